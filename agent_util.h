@@ -0,0 +1,186 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Helpers shared by the JVMTI agents (startup_agent.c, perf_agent.c
+ * and cpu_agent.c), all static inline so that each agent library
+ * still depends only on libc: an open addressing hash table keyed by
+ * pointer or string, a growing string buffer, and agent option
+ * parsing.
+ */
+
+#ifndef _AGENT_UTIL_H
+#define _AGENT_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#define AGENT_EXPORT __attribute__((visibility("default")))
+
+typedef struct {
+    const void *key;        // Pointer or string, per table
+    long value;
+} entry_t;
+
+typedef struct {
+    entry_t *entries;
+    long size;              // Power of 2
+    long count;
+} table_t;
+
+typedef struct {
+    char *s;
+    size_t len;
+    size_t cap;
+} buf_t;
+
+static inline unsigned long
+hash_key( const void *key, int is_string )
+{
+    unsigned long h = 14695981039346656037UL;
+    if( is_string ) {
+        const char *c;
+        for( c = key; *c != '\0'; c++ ) {
+            h = ( h ^ (unsigned char) *c ) * 1099511628211UL;
+        }
+    }
+    else {
+        h = ( (unsigned long) key ) * 0x9E3779B97F4A7C15UL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// Find the entry for key, or the empty slot for it.
+static inline entry_t *
+table_slot( table_t *t, const void *key, int is_string )
+{
+    unsigned long i = hash_key( key, is_string ) & ( t->size - 1 );
+    while( t->entries[i].key != NULL ) {
+        if( is_string ? ( strcmp( t->entries[i].key, key ) == 0 ) :
+            ( t->entries[i].key == key ) ) break;
+        i = ( i + 1 ) & ( t->size - 1 );
+    }
+    return &t->entries[i];
+}
+
+static inline void
+table_grow( table_t *t, int is_string )
+{
+    table_t old = *t;
+    t->size = ( old.size == 0 ) ? 1024 : old.size * 2;
+    t->entries = calloc( t->size, sizeof( entry_t ) );
+    t->count = 0;
+    long i;
+    for( i = 0; i < old.size; i++ ) {
+        if( old.entries[i].key != NULL ) {
+            *table_slot( t, old.entries[i].key, is_string ) = old.entries[i];
+            t->count++;
+        }
+    }
+    free( old.entries );
+}
+
+// The value for key, or -1 if not found.
+static inline long
+table_get( table_t *t, const void *key, int is_string )
+{
+    if( t->size == 0 ) return -1;
+    entry_t *e = table_slot( t, key, is_string );
+    return ( e->key != NULL ) ? e->value : -1;
+}
+
+// Set the value for key, which is kept (not copied) if new.
+static inline void
+table_put( table_t *t, const void *key, int is_string, long value )
+{
+    if( ( t->count + 1 ) * 2 > t->size ) table_grow( t, is_string );
+    entry_t *e = table_slot( t, key, is_string );
+    if( e->key == NULL ) t->count++;
+    e->key = key;
+    e->value = value;
+}
+
+// Append n chars of s, keeping b->s '\0' terminated.
+static inline void
+append( buf_t *b, const char *s, size_t n )
+{
+    if( b->len + n + 1 > b->cap ) {
+        b->cap = ( b->len + n + 1 ) * 2;
+        b->s = realloc( b->s, b->cap );
+    }
+    memcpy( b->s + b->len, s, n );
+    b->len += n;
+    b->s[ b->len ] = '\0';
+}
+
+static inline void
+appendf( buf_t *b, const char *format, ... )
+{
+    va_list ap;
+    va_start( ap, format );
+    int n = vsnprintf( NULL, 0, format, ap );
+    va_end( ap );
+
+    if( b->len + n + 1 > b->cap ) {
+        b->cap = ( b->len + n + 1 ) * 2;
+        b->s = realloc( b->s, b->cap );
+    }
+    va_start( ap, format );
+    vsnprintf( b->s + b->len, n + 1, format, ap );
+    va_end( ap );
+    b->len += n;
+}
+
+// Parse name=value of comma separated options, returning the rest of
+// the options from the value (so a value with commas must be last).
+static inline const char *
+option( const char *options, const char *name )
+{
+    size_t nlen = strlen( name );
+    const char *p = options;
+    while( ( p != NULL ) && ( *p != '\0' ) ) {
+        if( ( strncmp( p, name, nlen ) == 0 ) && ( p[nlen] == '=' ) ) {
+            return p + nlen + 1;
+        }
+        p = strchr( p, ',' );
+        if( p != NULL ) p++;
+    }
+    return NULL;
+}
+
+#endif
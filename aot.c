@@ -0,0 +1,388 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "history.h"
+#include "jvm.h"
+#include "aot.h"
+#include "cachebuild.h"
+
+// Marker file of complete compiled classes, containing their key
+#define MARKER "hashdot.aot"
+
+typedef struct {
+    const char *script;   // {script}: absolute script path
+    const char *file;     // {file}: script file name
+    const char *cname;    // {class}: file name as a class name
+    const char *output;   // {output}: class output directory
+} aot_vars_t;
+
+static apr_status_t
+aot_key( const char *script, apr_array_header_t *class_path,
+         const char **key );
+
+static const char *
+aot_dir( const char *key, const char *file );
+
+static apr_array_header_t *
+substitute( apr_array_header_t *vals, const aot_vars_t *vars );
+
+static int
+compile_classes( const char *tmp, void *data );
+
+/**
+ * With hashdot.aot, run the script (argv[file_offset]) from classes
+ * compiled by the language's own compiler (hashdot.aot.compile.*),
+ * cached in hashdot.aot.cache. The cache is keyed by the script
+ * content, the aot properties, hashdot.vm.options and the class path
+ * entries (with modification times and sizes). If complete, the class
+ * directory is prepended to java.class.path, hashdot.main and
+ * hashdot.args.pre are replaced by hashdot.aot.main and
+ * hashdot.aot.args.pre, and the script is removed from argv.
+ * Otherwise the script is compiled by a detached background process
+ * while this launch runs it from source.
+ */
+apr_status_t select_aot_class( int file_offset, int *argc, const char ***argv )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *aot = NULL;
+    const char *compile_main = NULL;
+
+    rv = get_property_value( "hashdot.aot", 0, 0, &aot );
+    if( ( rv != APR_SUCCESS ) || ( aot == NULL ) ||
+        ( strcmp( aot, "false" ) == 0 ) ) return rv;
+
+    if( strcmp( aot, "true" ) != 0 ) {
+        rv = 45;
+        ERROR( "[%d]: Invalid hashdot.aot [%s] (true or false).", rv, aot );
+        return rv;
+    }
+
+    rv = get_property_value( "hashdot.aot.compile.main", 0, 0,
+                             &compile_main );
+    if( rv != APR_SUCCESS ) return rv;
+    if( compile_main == NULL ) {
+        rv = 45;
+        ERROR( "[%d]: hashdot.aot requires hashdot.aot.compile.main.", rv );
+        return rv;
+    }
+
+    // Only a script given directly, since interpreter flags preceding
+    // it have no equivalent for a compiled class.
+    if( file_offset != 1 ) {
+        DEBUG( "Flags precede the script, no hashdot.aot." );
+        return rv;
+    }
+
+    aot_vars_t vars;
+    rv = get_property_value( "hashdot.script", 0, 1, &vars.script );
+    if( rv != APR_SUCCESS ) return rv;
+    vars.file = apr_filepath_name_get( vars.script );
+    vars.output = NULL;
+
+    char *cname = apr_pstrdup( _mp, vars.file );
+    char *ext = strrchr( cname, '.' );
+    if( ( ext != NULL ) && ( ext != cname ) ) *ext = '\0';
+    char *c;
+    for( c = cname; *c != '\0'; c++ ) {
+        if( !( ( ( *c >= 'a' ) && ( *c <= 'z' ) ) ||
+               ( ( *c >= 'A' ) && ( *c <= 'Z' ) ) ||
+               ( ( *c >= '0' ) && ( *c <= '9' ) ) ||
+               ( *c == '_' ) || ( *c == '$' ) ) ) *c = '_';
+    }
+    if( ( cname[0] >= '0' ) && ( cname[0] <= '9' ) ) {
+        cname = apr_pstrcat( _mp, "_", cname, NULL );
+    }
+    vars.cname = cname;
+
+    apr_array_header_t *class_path = NULL;
+    apr_array_header_t *vals = get_property_array( "java.class.path" );
+    if( vals != NULL ) {
+        rv = glob_values( vals, &class_path );
+        if( rv != APR_SUCCESS ) return rv;
+    }
+
+    const char *key = NULL;
+    rv = aot_key( vars.script, class_path, &key );
+    if( rv != APR_SUCCESS ) return rv;
+
+    const char *dir = aot_dir( key, vars.file );
+
+    if( !cache_complete( dir, MARKER, key ) ) {
+        if( cache_failed( dir ) ) {
+            DEBUG( "Previous compile of [%s] failed, see %s.log",
+                   vars.script, dir );
+        }
+        else {
+            DEBUG( "Compiling [%s] to [%s] in background.", vars.script, dir );
+            cache_build( dir, MARKER, key, compile_classes, &vars );
+        }
+        return rv;
+    }
+
+    DEBUG( "Using compiled classes [%s].", dir );
+    vars.output = dir;
+
+    apr_array_header_t *cp = apr_array_make( _mp, 8, sizeof( const char * ) );
+    *(const char **) apr_array_push( cp ) = dir;
+    if( vals != NULL ) apr_array_cat( cp, vals );
+    set_property_array( "java.class.path", cp );
+
+    const char *main_name = "{class}";
+    get_property_value( "hashdot.aot.main", 0, 0, &main_name );
+    apr_array_header_t *mvals = apr_array_make( _mp, 1, sizeof( const char * ) );
+    *(const char **) apr_array_push( mvals ) = main_name;
+    set_property_array( "hashdot.main", substitute( mvals, &vars ) );
+
+    apr_array_header_t *pre = get_property_array( "hashdot.aot.args.pre" );
+    if( pre != NULL ) {
+        set_property_array( "hashdot.args.pre", substitute( pre, &vars ) );
+    }
+    else {
+        clear_property( "hashdot.args.pre" );
+    }
+
+    // Drop the script argument
+    const char **nargv = apr_palloc( _mp, *argc * sizeof( const char * ) );
+    nargv[0] = (*argv)[0];
+    int i;
+    for( i = 2; i <= *argc; i++ ) nargv[i - 1] = (*argv)[i];
+    *argv = nargv;
+    (*argc)--;
+
+    return rv;
+}
+
+/**
+ * Key of the script content, the aot and VM options and the class
+ * path and boot class path entries, one per line.
+ */
+static apr_status_t
+aot_key( const char *script, apr_array_header_t *class_path,
+         const char **key )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_file_t *in = NULL;
+    struct stat st;
+
+    if( stat( script, &st ) != 0 ) {
+        rv = APR_FROM_OS_ERROR( errno );
+        print_error( rv, script );
+        return rv;
+    }
+
+    char *content = apr_palloc( _mp, st.st_size + 1 );
+    apr_size_t len = st.st_size;
+    rv = apr_file_open( &in, script, APR_FOPEN_READ, APR_OS_DEFAULT, _mp );
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_read_full( in, content, len, &len );
+        apr_file_close( in );
+    }
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, script );
+        return rv;
+    }
+    content[len] = '\0';
+
+    static const char *PROPS[] = {
+        "hashdot.aot.compile.main",
+        "hashdot.aot.compile.args",
+        "hashdot.aot.main",
+        "hashdot.aot.args.pre",
+        "hashdot.vm.options",
+        NULL
+    };
+
+    char *k = apr_psprintf( _mp, "S %s %016llx %ld\n", script,
+                            (unsigned long long) hash_string( content ),
+                            (long) len );
+    const char **p;
+    for( p = PROPS; *p != NULL; p++ ) {
+        const char *val = NULL;
+        get_property_value( *p, ' ', 0, &val );
+        if( val != NULL ) k = apr_psprintf( _mp, "%sP %s=%s\n", k, *p, val );
+    }
+
+    // Class path entries, and those of any -Xbootclasspath (i.e. jruby.jar)
+    apr_array_header_t *entries =
+        apr_array_make( _mp, 16, sizeof( const char * ) );
+    if( class_path != NULL ) apr_array_cat( entries, class_path );
+
+    apr_array_header_t *options = get_property_array( "hashdot.vm.options" );
+    int i;
+    for( i = 0; ( options != NULL ) && ( i < options->nelts ); i++ ) {
+        const char *opt = ((const char **) options->elts )[i];
+        if( strncmp( opt, "-Xbootclasspath", 15 ) == 0 ) {
+            const char *paths = strchr( opt, ':' );
+            char *last = NULL;
+            char *e = ( paths != NULL ) ?
+                apr_strtok( apr_pstrdup( _mp, paths + 1 ), ":", &last ) : NULL;
+            for( ; e != NULL; e = apr_strtok( NULL, ":", &last ) ) {
+                *(const char **) apr_array_push( entries ) = e;
+            }
+        }
+    }
+
+    for( i = 0; i < entries->nelts; i++ ) {
+        const char *entry = ((const char **) entries->elts )[i];
+        if( stat( entry, &st ) == 0 ) {
+            k = apr_psprintf( _mp, "%sC %s %ld %ld\n", k, entry,
+                              (long) st.st_mtime, (long) st.st_size );
+        }
+    }
+
+    *key = k;
+    return rv;
+}
+
+/**
+ * Class directory in hashdot.aot.cache (default: ~/.hashdot/aot),
+ * named for the script file and a hash of the key.
+ */
+static const char *
+aot_dir( const char *key, const char *file )
+{
+    const char *dir = NULL;
+    get_property_value( "hashdot.aot.cache", '/', 0, &dir );
+    if( dir == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        dir = apr_pstrcat( _mp, home, "/.hashdot/aot", NULL );
+    }
+
+    return apr_psprintf( _mp, "%s/%s-%016llx", dir, file,
+                         (unsigned long long) hash_string( key ) );
+}
+
+/**
+ * Copy of vals with {script}, {file}, {class} and {output} replaced.
+ */
+static apr_array_header_t *
+substitute( apr_array_header_t *vals, const aot_vars_t *vars )
+{
+    const char *names[] = { "{script}", "{file}", "{class}", "{output}" };
+    const char *values[] = { vars->script, vars->file, vars->cname,
+                             vars->output };
+
+    apr_array_header_t *svals =
+        apr_array_make( _mp, vals->nelts, sizeof( const char * ) );
+    int i, v;
+    for( i = 0; i < vals->nelts; i++ ) {
+        const char *val = ((const char **) vals->elts )[i];
+        for( v = 0; v < 4; v++ ) {
+            const char *s;
+            while( ( s = strstr( val, names[v] ) ) != NULL ) {
+                val = apr_pstrcat( _mp, apr_pstrndup( _mp, val, s - val ),
+                                   values[v], s + strlen( names[v] ), NULL );
+            }
+        }
+        *(const char **) apr_array_push( svals ) = val;
+    }
+    return svals;
+}
+
+/**
+ * Compile to tmp with a JVM of hashdot.aot.compile.main (data, the
+ * aot_vars_t), run in the script's directory. Succeeds only with
+ * {class}.class written.
+ */
+static int
+compile_classes( const char *tmp, void *data )
+{
+    aot_vars_t *vars = data;
+    vars->output = tmp;
+    if( mkdir( tmp, 0755 ) != 0 ) return 1;
+
+    pid_t pid = fork();
+    if( pid == 0 ) {
+        // The compiler JVM: no history, readiness, pid file or control
+        // socket of the script, and no agents or JFR recording.
+        discard_run();
+        unsetenv( "NOTIFY_SOCKET" );
+        clear_property( "hashdot.pid_file" );
+        clear_property( "hashdot.control" );
+        clear_property( "hashdot.watchdog" );
+        clear_property( "hashdot.profile.startup" );
+        clear_property( "hashdot.profile.cpu" );
+        clear_property( "hashdot.perf_map" );
+        clear_property( "hashdot.jfr" );
+
+        const char *compile_main = NULL;
+        get_property_value( "hashdot.aot.compile.main", 0, 1, &compile_main );
+        set_property_value( "hashdot.main", compile_main );
+
+        apr_array_header_t *args =
+            get_property_array( "hashdot.aot.compile.args" );
+        if( args != NULL ) {
+            set_property_array( "hashdot.args.pre", substitute( args, vars ) );
+        }
+        else {
+            clear_property( "hashdot.args.pre" );
+        }
+
+        char *sdir = apr_pstrndup( _mp, vars->script,
+                                   vars->file - vars->script );
+        if( ( sdir[0] != '\0' ) && ( chdir( sdir ) != 0 ) ) _exit( 1 );
+
+        printf( "Compiling %s with %s\n", vars->script, compile_main );
+        fflush( stdout );
+        _exit( init_jvm( 0, NULL ) );
+    }
+
+    int status = -1;
+    if( pid > 0 ) {
+        while( ( waitpid( pid, &status, 0 ) < 0 ) && ( errno == EINTR ) );
+    }
+
+    const char *cfile = apr_psprintf( _mp, "%s/%s.class", tmp, vars->cname );
+    if( ( pid > 0 ) && WIFEXITED( status ) && ( WEXITSTATUS( status ) == 0 ) &&
+        ( access( cfile, F_OK ) == 0 ) ) return 0;
+
+    printf( "Compile failed (status %d) or %s missing.\n", status, cfile );
+    return 1;
+}
@@ -0,0 +1,614 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_time.h>
+
+#include <jni.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "daemon.h"
+#include "jvm.h"
+#include "classgen.h"
+#include "history.h"
+#include "jfr.h"
+#include "batch.h"
+
+#define OUT 0
+#define ERR 1
+
+// Most threads hashdot.batch.threads may ask for
+#define MAX_THREADS 1024
+
+struct batch_job_t {
+    int index;
+    int argc;
+    const char **argv;
+    apr_status_t status;
+    apr_time_t elapsed;
+
+    // Per job output, either files (with hashdot.batch.output) or
+    // memory buffers written in one block when the job completes.
+    apr_file_t *files[2];
+    char *buf[2];
+    apr_size_t len[2];
+    apr_size_t cap[2];
+    apr_pool_t *pool;
+};
+
+typedef struct {
+    int index;
+    JavaVM *vm;
+    apr_pool_t *pool;
+
+    // This worker's remaining range of jobs [next, end), which may
+    // be stolen from the tail by idle workers.
+    apr_thread_mutex_t *lock;
+    int next;
+    int end;
+} batch_worker_t;
+
+static apr_array_header_t *_jobs = NULL;
+static batch_worker_t *_workers = NULL;
+static int _worker_count = 0;
+static const char *_output_dir = NULL;
+
+static apr_threadkey_t *_current_job = NULL;
+static apr_thread_mutex_t *_out_lock = NULL;
+static apr_file_t *_std_files[2] = { NULL, NULL };
+static jobject _streams[2] = { NULL, NULL };
+
+static void * APR_THREAD_FUNC
+batch_worker( apr_thread_t *thread, void *data );
+
+static batch_job_t *
+take_job( batch_worker_t *worker );
+
+static apr_status_t
+run_job( batch_worker_t *worker, JNIEnv *env, batch_job_t *job );
+
+static apr_status_t
+install_output_demux( JNIEnv *env );
+
+static apr_status_t
+write_status_file( const char *fname );
+
+static void
+job_output( JNIEnv *env, jobject stream, const char *buf, apr_size_t len );
+
+static void JNICALL
+batch_write_byte( JNIEnv *env, jobject stream, jint b );
+
+static void JNICALL
+batch_write_bytes( JNIEnv *env, jobject stream,
+                   jbyteArray bytes, jint off, jint len );
+
+static void JNICALL
+batch_flush( JNIEnv *env, jobject stream );
+
+/**
+ * Read argument vectors, one per line, from fname (or "-" for
+ * stdin). Lines are tokenized as per a shell command line (with
+ * quoting) and blank lines or those beginning with '#' are
+ * ignored. Each job receives argv0 as its first argument, like a
+ * normal hashdot invocation.
+ */
+apr_status_t read_batch( const char *fname,
+                         const char *argv0,
+                         apr_array_header_t **jobs )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_file_t *in = NULL;
+    char line[4096];
+
+    if( strcmp( fname, "-" ) == 0 ) {
+        rv = apr_file_open_stdin( &in, _mp );
+    }
+    else {
+        rv = apr_file_open( &in, fname, APR_FOPEN_READ, APR_OS_DEFAULT, _mp );
+    }
+
+    if( rv != APR_SUCCESS ) {
+        ERROR( "Could not open batch file [%s].", fname );
+        return rv;
+    }
+
+    *jobs = apr_array_make( _mp, 64, sizeof( batch_job_t * ) );
+
+    while( rv == APR_SUCCESS ) {
+
+        rv = apr_file_gets( line, sizeof( line ) - 1, in );
+
+        if( rv == APR_EOF ) {
+            rv = APR_SUCCESS;
+            break;
+        }
+
+        if( rv != APR_SUCCESS ) break;
+
+        char *p = line;
+        while( apr_isspace( *p ) ) p++;
+        if( ( *p == '\0' ) || ( *p == '#' ) ) continue;
+
+        char **tokens = NULL;
+        rv = apr_tokenize_to_argv( p, &tokens, _mp );
+        if( rv != APR_SUCCESS ) break;
+
+        int ntok = 0;
+        while( tokens[ntok] != NULL ) ntok++;
+
+        batch_job_t *job = apr_pcalloc( _mp, sizeof( batch_job_t ) );
+        job->index = (*jobs)->nelts;
+        job->argc = ntok + 1;
+        job->argv = apr_palloc( _mp, sizeof( const char * ) * ( ntok + 2 ) );
+        job->argv[0] = argv0;
+        memcpy( job->argv + 1, tokens, sizeof( const char * ) * ( ntok + 1 ) );
+
+        *(batch_job_t **) apr_array_push( *jobs ) = job;
+    }
+
+    apr_file_close( in );
+
+    if( ( rv == APR_SUCCESS ) && apr_is_empty_array( *jobs ) ) {
+        ERROR( "No jobs found in batch file [%s].", fname );
+        rv = 1;
+    }
+
+    DEBUG( "Read %d batch jobs from %s",
+           ( rv == APR_SUCCESS ) ? (*jobs)->nelts : 0, fname );
+
+    return rv;
+}
+
+void batch_job_args( apr_array_header_t *jobs,
+                     int index,
+                     int *argc,
+                     const char ***argv )
+{
+    batch_job_t *job = ((batch_job_t **) jobs->elts )[index];
+    *argc = job->argc;
+    *argv = job->argv;
+}
+
+/**
+ * Create the JVM once and run the hashdot.main main method for each
+ * job, on hashdot.batch.threads worker threads.
+ */
+apr_status_t run_batch( apr_array_header_t *jobs )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    _jobs = jobs;
+
+    const char *threads = NULL;
+    rv = get_property_value( "hashdot.batch.threads", 0, 0, &threads );
+    if( rv != APR_SUCCESS ) return rv;
+
+    _worker_count = 1;
+    if( threads != NULL ) {
+        if( strcmp( threads, "auto" ) == 0 ) {
+            _worker_count = (int) sysconf( _SC_NPROCESSORS_ONLN );
+        }
+        else {
+            char *end = NULL;
+            long count = strtol( threads, &end, 10 );
+            if( ( end == threads ) || ( *end != '\0' ) ||
+                ( count < 1 ) || ( count > MAX_THREADS ) ) {
+                rv = 30;
+                ERROR( "[%d]: Invalid hashdot.batch.threads [%s]"
+                       " (1-%d or auto).", rv, threads, MAX_THREADS );
+                return rv;
+            }
+            _worker_count = (int) count;
+        }
+    }
+    if( _worker_count < 1 ) _worker_count = 1;
+    if( _worker_count > jobs->nelts ) _worker_count = jobs->nelts;
+
+    rv = get_property_value( "hashdot.batch.output", '/', 0, &_output_dir );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( _output_dir != NULL ) {
+        rv = apr_dir_make_recursive( _output_dir, APR_OS_DEFAULT, _mp );
+        if( rv != APR_SUCCESS ) {
+            print_error( rv, _output_dir );
+            return rv;
+        }
+    }
+
+    JavaVM * vm = NULL;
+    JNIEnv * env = NULL;
+
+    rv = create_jvm( &vm, &env );
+
+    if( rv == APR_SUCCESS ) {
+        rv = install_hup_handler();
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = install_output_demux( env );
+    }
+
+    // Assign each worker an initial contiguous share of the jobs.
+    if( rv == APR_SUCCESS ) {
+        _workers = apr_pcalloc( _mp, sizeof( batch_worker_t ) * _worker_count );
+        for( i = 0; ( i < _worker_count ) && ( rv == APR_SUCCESS ); i++ ) {
+            batch_worker_t *w = &_workers[i];
+            w->index = i;
+            w->vm = vm;
+            w->next = (int) ( (apr_int64_t) jobs->nelts * i / _worker_count );
+            w->end  = (int) ( (apr_int64_t) jobs->nelts * ( i + 1 ) /
+                              _worker_count );
+            rv = apr_pool_create( &w->pool, _mp );
+            if( rv == APR_SUCCESS ) {
+                rv = apr_thread_mutex_create( &w->lock,
+                                              APR_THREAD_MUTEX_DEFAULT, _mp );
+            }
+        }
+    }
+
+    DEBUG( "Running %d batch jobs on %d worker threads",
+           jobs->nelts, _worker_count );
+
+    if( rv == APR_SUCCESS ) {
+        apr_thread_t *threads[ _worker_count ];
+        int started = 0;
+        for( i = 0; i < _worker_count; i++ ) {
+            rv = apr_thread_create( &threads[i], NULL, batch_worker,
+                                    &_workers[i], _mp );
+            if( rv != APR_SUCCESS ) {
+                print_error( rv, "batch worker thread" );
+                break;
+            }
+            ++started;
+        }
+        for( i = 0; i < started; i++ ) {
+            apr_status_t trv;
+            apr_thread_join( &trv, threads[i] );
+        }
+    }
+
+    int failed = 0;
+    if( rv == APR_SUCCESS ) {
+        for( i = 0; i < jobs->nelts; i++ ) {
+            batch_job_t *job = ((batch_job_t **) jobs->elts )[i];
+            if( job->status != APR_SUCCESS ) ++failed;
+        }
+
+        const char *status_file = NULL;
+        rv = get_property_value( "hashdot.batch.status", '/', 0, &status_file );
+        if( ( rv == APR_SUCCESS ) && ( status_file != NULL ) ) {
+            rv = write_status_file( status_file );
+        }
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( failed > 0 ) ) {
+        WARN( "%d of %d batch jobs failed.", failed, jobs->nelts );
+        rv = 30;
+    }
+
+    if( vm != NULL ) {
+        // The exit hook doesn't run on DestroyJavaVM.
+        (*vm)->DestroyJavaVM(vm);
+        record_run();
+        jfr_exit();
+    }
+
+    return rv;
+}
+
+static void * APR_THREAD_FUNC
+batch_worker( apr_thread_t *thread, void *data )
+{
+    batch_worker_t *worker = data;
+    JNIEnv *env = NULL;
+
+    JavaVMAttachArgs attach_args;
+    attach_args.version = JNI_VERSION_1_2;
+    attach_args.name = apr_psprintf( worker->pool, "hashdot-batch-%d",
+                                     worker->index );
+    attach_args.group = NULL;
+
+    apr_status_t rv = (*worker->vm)->AttachCurrentThread( worker->vm,
+                                                          (void **) &env,
+                                                          &attach_args );
+    if( rv != JNI_OK ) {
+        ERROR( "Worker %d could not attach to JVM [%d]", worker->index, rv );
+    }
+
+    batch_job_t *job;
+    while( ( rv == APR_SUCCESS ) && ( ( job = take_job( worker ) ) != NULL ) ) {
+        job->status = run_job( worker, env, job );
+        apr_pool_clear( worker->pool );
+    }
+
+    // On failure, still mark any remaining jobs of this worker.
+    while( ( rv != APR_SUCCESS ) && ( ( job = take_job( worker ) ) != NULL ) ) {
+        job->status = rv;
+    }
+
+    if( env != NULL ) {
+        (*worker->vm)->DetachCurrentThread( worker->vm );
+    }
+
+    apr_thread_exit( thread, rv );
+    return NULL;
+}
+
+/**
+ * Take the next job from this worker's own range, or steal the back
+ * half of the largest remaining range of another worker.
+ */
+static batch_job_t *
+take_job( batch_worker_t *worker )
+{
+    int index = -1;
+
+    apr_thread_mutex_lock( worker->lock );
+    if( worker->next < worker->end ) index = worker->next++;
+    apr_thread_mutex_unlock( worker->lock );
+
+    while( index < 0 ) {
+        batch_worker_t *victim = NULL;
+        int most = 0;
+        int i;
+        for( i = 0; i < _worker_count; i++ ) {
+            // Unlocked read is only a hint; re-checked below.
+            int remaining = _workers[i].end - _workers[i].next;
+            if( ( &_workers[i] != worker ) && ( remaining > most ) ) {
+                most = remaining;
+                victim = &_workers[i];
+            }
+        }
+        if( victim == NULL ) break;
+
+        int start = 0, end = 0;
+        apr_thread_mutex_lock( victim->lock );
+        if( victim->next < victim->end ) {
+            end = victim->end;
+            start = victim->end - ( ( victim->end - victim->next + 1 ) / 2 );
+            victim->end = start;
+        }
+        apr_thread_mutex_unlock( victim->lock );
+
+        if( start < end ) {
+            DEBUG( "Worker %d stole jobs [%d, %d) from worker %d",
+                   worker->index, start, end, victim->index );
+            apr_thread_mutex_lock( worker->lock );
+            worker->next = start + 1;
+            worker->end = end;
+            apr_thread_mutex_unlock( worker->lock );
+            index = start;
+        }
+    }
+
+    return ( index < 0 ) ? NULL : ((batch_job_t **) _jobs->elts )[index];
+}
+
+static apr_status_t
+run_job( batch_worker_t *worker, JNIEnv *env, batch_job_t *job )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    job->pool = worker->pool;
+
+    if( _output_dir != NULL ) {
+        static const char *SUFFIX[] = { "out", "err" };
+        for( i = OUT; ( i <= ERR ) && ( rv == APR_SUCCESS ); i++ ) {
+            const char *fname = apr_psprintf( job->pool, "%s/job-%d.%s",
+                                              _output_dir, job->index,
+                                              SUFFIX[i] );
+            rv = apr_file_open( &job->files[i], fname,
+                                ( APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                                  APR_FOPEN_TRUNCATE ),
+                                APR_OS_DEFAULT, job->pool );
+            if( rv != APR_SUCCESS ) {
+                ERROR( "Could not open batch output file [%s].", fname );
+            }
+        }
+    }
+
+    if( rv != APR_SUCCESS ) return rv;
+
+    DEBUG( "Worker %d starting job %d", worker->index, job->index );
+
+    apr_threadkey_private_set( job, _current_job );
+
+    apr_time_t start = apr_time_now();
+    int thrown = 0;
+    rv = call_main( env, job->argc - 1, job->argv + 1, &thrown );
+    job->elapsed = apr_time_now() - start;
+
+    apr_threadkey_private_set( NULL, _current_job );
+
+    if( ( rv == APR_SUCCESS ) && thrown ) rv = 1;
+
+    for( i = OUT; i <= ERR; i++ ) {
+        if( job->files[i] != NULL ) {
+            apr_file_close( job->files[i] );
+            job->files[i] = NULL;
+        }
+    }
+
+    // Write any buffered output as a single block per stream.
+    if( ( job->len[OUT] > 0 ) || ( job->len[ERR] > 0 ) ) {
+        apr_thread_mutex_lock( _out_lock );
+        for( i = OUT; i <= ERR; i++ ) {
+            if( job->len[i] > 0 ) {
+                apr_file_write_full( _std_files[i], job->buf[i], job->len[i],
+                                     NULL );
+            }
+        }
+        apr_thread_mutex_unlock( _out_lock );
+    }
+
+    DEBUG( "Worker %d finished job %d: status %d (%d ms)",
+           worker->index, job->index, rv,
+           (int) apr_time_as_msec( job->elapsed ) );
+
+    return rv;
+}
+
+/**
+ * Replace System.out/err with streams routing output by the job of
+ * the current thread. Output from other threads (including any
+ * started by a job) passes through to the original stdout/stderr.
+ */
+static apr_status_t
+install_output_demux( JNIEnv *env )
+{
+    static JNINativeMethod METHODS[] = {
+        { "write", "(I)V",    (void *) &batch_write_byte },
+        { "write", "([BII)V", (void *) &batch_write_bytes },
+        { "flush", "()V",     (void *) &batch_flush }
+    };
+
+    apr_status_t rv = APR_SUCCESS;
+
+    rv = apr_threadkey_private_create( &_current_job, NULL, _mp );
+    if( rv == APR_SUCCESS ) {
+        rv = apr_thread_mutex_create( &_out_lock, APR_THREAD_MUTEX_DEFAULT, _mp );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open_stdout( &_std_files[OUT], _mp );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open_stderr( &_std_files[ERR], _mp );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = replace_system_streams( env, "hashdot/BatchOutput",
+                                     METHODS, _streams );
+    }
+
+    return rv;
+}
+
+static apr_status_t
+write_status_file( const char *fname )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_file_t *out = NULL;
+
+    rv = apr_file_open( &out, fname,
+                        ( APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                          APR_FOPEN_TRUNCATE ),
+                        APR_OS_DEFAULT, _mp );
+    if( rv != APR_SUCCESS ) {
+        ERROR( "Could not open batch status file [%s].", fname );
+        return rv;
+    }
+
+    int i;
+    for( i = 0; i < _jobs->nelts; i++ ) {
+        batch_job_t *job = ((batch_job_t **) _jobs->elts )[i];
+        apr_file_printf( out, "%d %d %d",
+                         job->index, job->status,
+                         (int) apr_time_as_msec( job->elapsed ) );
+        int a;
+        for( a = 1; a < job->argc; a++ ) {
+            apr_file_printf( out, " %s", job->argv[a] );
+        }
+        apr_file_printf( out, "\n" );
+    }
+
+    return apr_file_close( out );
+}
+
+static void
+job_output( JNIEnv *env, jobject stream, const char *buf, apr_size_t len )
+{
+    int s = ( (*env)->IsSameObject( env, stream, _streams[ERR] ) ) ? ERR : OUT;
+
+    batch_job_t *job = NULL;
+    apr_threadkey_private_get( (void **) &job, _current_job );
+
+    if( job == NULL ) {
+        apr_file_write_full( _std_files[s], buf, len, NULL );
+    }
+    else if( job->files[s] != NULL ) {
+        apr_file_write_full( job->files[s], buf, len, NULL );
+    }
+    else {
+        if( job->len[s] + len > job->cap[s] ) {
+            apr_size_t cap = ( job->cap[s] > 0 ) ? job->cap[s] * 2 : 4096;
+            while( cap < job->len[s] + len ) cap *= 2;
+            char *nbuf = apr_palloc( job->pool, cap );
+            if( job->len[s] > 0 ) memcpy( nbuf, job->buf[s], job->len[s] );
+            job->buf[s] = nbuf;
+            job->cap[s] = cap;
+        }
+        memcpy( job->buf[s] + job->len[s], buf, len );
+        job->len[s] += len;
+    }
+}
+
+static void JNICALL
+batch_write_byte( JNIEnv *env, jobject stream, jint b )
+{
+    char c = (char) b;
+    job_output( env, stream, &c, 1 );
+}
+
+static void JNICALL
+batch_write_bytes( JNIEnv *env, jobject stream,
+                   jbyteArray bytes, jint off, jint len )
+{
+    char buf[4096];
+    while( len > 0 ) {
+        jint chunk = ( len < sizeof( buf ) ) ? len : sizeof( buf );
+        (*env)->GetByteArrayRegion( env, bytes, off, chunk, (jbyte *) buf );
+        if( (*env)->ExceptionCheck( env ) ) break;
+        job_output( env, stream, buf, chunk );
+        off += chunk;
+        len -= chunk;
+    }
+}
+
+static void JNICALL
+batch_flush( JNIEnv *env, jobject stream )
+{
+    // Output is unbuffered: nothing to flush.
+}
@@ -0,0 +1,205 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Cached directories built in the background (jlink images, compiled
+ * script classes). A complete directory <path> holds a marker file
+ * containing its key, and is built beside it:
+ *
+ *   <path>.lock        flock held by the one build in progress
+ *   <path>.log         output of the last build
+ *   <path>.failed      created when a build fails, to not retry it
+ *   <path>.tmp.<pid>   the directory being built, renamed into place
+ *                      once marked, so a partial build is never used
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE // nftw
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+
+#include "runtime.h"
+#include "cachebuild.h"
+
+static int
+mark_complete( const char *dir, const char *marker, const char *key );
+
+/**
+ * True if path has a marker file matching key.
+ */
+int cache_complete( const char *path, const char *marker, const char *key )
+{
+    const char *fname = apr_pstrcat( _mp, path, "/", marker, NULL );
+    FILE *in = fopen( fname, "r" );
+    if( in == NULL ) return 0;
+
+    apr_size_t len = strlen( key );
+    char *buf = apr_palloc( _mp, len + 1 );
+    apr_size_t n = fread( buf, 1, len + 1, in );
+    fclose( in );
+
+    return ( n == len ) && ( memcmp( buf, key, len ) == 0 );
+}
+
+/**
+ * True if a previous build of path failed.
+ */
+int cache_failed( const char *path )
+{
+    return ( access( apr_pstrcat( _mp, path, ".failed", NULL ), F_OK ) == 0 );
+}
+
+/**
+ * Build path with build, in a detached grandchild, which returns at
+ * once. Concurrent launches build it only once, by flock of
+ * <path>.lock, held until the build completes.
+ */
+void cache_build( const char *path,
+                  const char *marker,
+                  const char *key,
+                  cache_build_f build,
+                  void *data )
+{
+    const char *parent = apr_pstrndup( _mp, path,
+                                       strrchr( path, '/' ) - path );
+    apr_status_t rv = apr_dir_make_recursive( parent, APR_FPROT_OS_DEFAULT,
+                                              _mp );
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, parent );
+        return;
+    }
+
+    const char *lock = apr_pstrcat( _mp, path, ".lock", NULL );
+    const char *log = apr_pstrcat( _mp, path, ".log", NULL );
+    const char *failed = apr_pstrcat( _mp, path, ".failed", NULL );
+
+    fflush( stdout );
+    fflush( stderr );
+
+    pid_t pid = fork();
+    if( pid < 0 ) {
+        ERROR( "Could not fork build of %s: %s", path, strerror( errno ) );
+        return;
+    }
+
+    if( pid > 0 ) {
+        while( ( waitpid( pid, NULL, 0 ) < 0 ) && ( errno == EINTR ) );
+        return;
+    }
+
+    setsid();
+    if( fork() != 0 ) _exit( 0 );
+
+    int lfd = open( lock, O_WRONLY | O_CREAT, 0644 );
+    if( ( lfd < 0 ) || ( flock( lfd, LOCK_EX | LOCK_NB ) != 0 ) ) {
+        _exit( 0 ); // Already building
+    }
+    if( cache_complete( path, marker, key ) ) _exit( 0 );
+
+    int in = open( "/dev/null", O_RDONLY );
+    int out = open( log, O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    if( ( in < 0 ) || ( out < 0 ) ) _exit( 1 );
+    dup2( in, 0 );
+    dup2( out, 1 );
+    dup2( out, 2 );
+
+    // Don't hold the launcher's descriptors (pid file locks, slots)
+    int fd;
+    for( fd = 3; fd < 1024; fd++ ) {
+        if( fd != lfd ) close( fd );
+    }
+
+    const char *tmp = apr_psprintf( _mp, "%s.tmp.%d", path, (int) getpid() );
+    remove_tree( tmp );
+
+    int ok = ( (*build)( tmp, data ) == 0 ) &&
+             mark_complete( tmp, marker, key );
+    if( ok ) {
+        remove_tree( path );
+        ok = ( rename( tmp, path ) == 0 );
+    }
+
+    if( ok ) {
+        printf( "Built %s\n", path );
+    }
+    else {
+        printf( "Build of %s failed.\n", path );
+        remove_tree( tmp );
+        close( open( failed, O_WRONLY | O_CREAT, 0644 ) );
+    }
+    fflush( stdout );
+    _exit( ok ? 0 : 1 );
+}
+
+/**
+ * Write the marker file of key in dir.
+ */
+static int
+mark_complete( const char *dir, const char *marker, const char *key )
+{
+    const char *fname = apr_pstrcat( _mp, dir, "/", marker, NULL );
+    FILE *m = fopen( fname, "w" );
+    int ok = ( m != NULL ) && ( fputs( key, m ) >= 0 );
+    if( m != NULL ) ok = ( fclose( m ) == 0 ) && ok;
+    return ok;
+}
+
+static int
+remove_entry( const char *path, const struct stat *st, int flag,
+              struct FTW *ftw )
+{
+    remove( path );
+    return 0;
+}
+
+/**
+ * Remove dir and everything under it, if it exists.
+ */
+void remove_tree( const char *dir )
+{
+    nftw( dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS );
+}
@@ -0,0 +1,60 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifndef _CACHEBUILD_H
+#define _CACHEBUILD_H
+
+#include <apr_general.h>
+
+/**
+ * Builds the content of a cached directory into tmp (which does not
+ * yet exist), in the detached build process with output to the log.
+ * Returns 0 on success.
+ */
+typedef int (*cache_build_f)( const char *tmp, void *data );
+
+int cache_complete( const char *path, const char *marker, const char *key );
+
+int cache_failed( const char *path );
+
+void cache_build( const char *path,
+                  const char *marker,
+                  const char *key,
+                  cache_build_f build,
+                  void *data );
+
+void remove_tree( const char *dir );
+
+#endif
@@ -0,0 +1,248 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include "classgen.h"
+
+#include "runtime.h"
+
+#include <apr_strings.h>
+
+// Class file access flags
+#define ACC_PUBLIC 0x0001
+#define ACC_STATIC 0x0008
+#define ACC_FINAL  0x0010
+#define ACC_SUPER  0x0020
+#define ACC_NATIVE 0x0100
+
+// Constant pool tags
+#define CONSTANT_Utf8  1
+#define CONSTANT_Class 7
+
+// Java 5 class format: requires no StackMapTable, and is still
+// accepted by current JVMs.
+#define CLASS_MAJOR_VERSION 49
+
+typedef struct {
+    unsigned char *buf;
+    int len;
+} class_buf_t;
+
+static void put_u1( class_buf_t *cb, int v );
+static void put_u2( class_buf_t *cb, int v );
+static void put_u4( class_buf_t *cb, unsigned long v );
+static void put_utf8( class_buf_t *cb, const char *s );
+
+/**
+ * Generate and define a class containing only the specified native
+ * methods, and register the provided function pointers as their
+ * implementations. Since native methods have no Code attribute, no
+ * java compiler is needed at build time and no extra jar at runtime.
+ * The class is defined in the bootstrap loader so it is visible to
+ * all application classes.
+ */
+apr_status_t define_native_class( JNIEnv *env,
+                                  const char *cname,
+                                  const char *super_cname,
+                                  const JNINativeMethod *methods,
+                                  int count,
+                                  int is_static,
+                                  jclass *cls )
+{
+    apr_status_t rv = APR_SUCCESS;
+    class_buf_t cb;
+    int i;
+
+    // Upper bound: fixed header and constant pool overhead plus names.
+    apr_size_t size = 64 + strlen( cname ) + strlen( super_cname );
+    for( i = 0; i < count; i++ ) {
+        size += 16 + strlen( methods[i].name ) + strlen( methods[i].signature );
+    }
+    cb.buf = apr_palloc( _mp, size );
+    cb.len = 0;
+
+    put_u4( &cb, 0xCAFEBABEUL );
+    put_u2( &cb, 0 );
+    put_u2( &cb, CLASS_MAJOR_VERSION );
+
+    // Constant pool: [1] this name, [2] this class, [3] super name,
+    // [4] super class, then name/descriptor pairs for each method.
+    put_u2( &cb, 5 + ( 2 * count ) );
+    put_u1( &cb, CONSTANT_Utf8 );
+    put_utf8( &cb, cname );
+    put_u1( &cb, CONSTANT_Class );
+    put_u2( &cb, 1 );
+    put_u1( &cb, CONSTANT_Utf8 );
+    put_utf8( &cb, super_cname );
+    put_u1( &cb, CONSTANT_Class );
+    put_u2( &cb, 3 );
+    for( i = 0; i < count; i++ ) {
+        put_u1( &cb, CONSTANT_Utf8 );
+        put_utf8( &cb, methods[i].name );
+        put_u1( &cb, CONSTANT_Utf8 );
+        put_utf8( &cb, methods[i].signature );
+    }
+
+    put_u2( &cb, ACC_PUBLIC | ACC_FINAL | ACC_SUPER );
+    put_u2( &cb, 2 ); // this_class
+    put_u2( &cb, 4 ); // super_class
+    put_u2( &cb, 0 ); // interfaces_count
+    put_u2( &cb, 0 ); // fields_count
+
+    put_u2( &cb, count );
+    for( i = 0; i < count; i++ ) {
+        put_u2( &cb, ACC_PUBLIC | ACC_NATIVE | ( is_static ? ACC_STATIC : 0 ) );
+        put_u2( &cb, 5 + ( 2 * i ) );
+        put_u2( &cb, 6 + ( 2 * i ) );
+        put_u2( &cb, 0 ); // attributes_count
+    }
+
+    put_u2( &cb, 0 ); // attributes_count
+
+    DEBUG( "Defining native class %s (%d bytes, %d methods)",
+           cname, cb.len, count );
+
+    *cls = (*env)->DefineClass( env, cname, NULL,
+                                (const jbyte *) cb.buf, cb.len );
+    if( *cls == NULL ) {
+        (*env)->ExceptionDescribe( env );
+        ERROR( "Could not define class %s", cname );
+        rv = 23;
+    }
+
+    if( rv == APR_SUCCESS ) {
+        if( (*env)->RegisterNatives( env, *cls, methods, count ) != JNI_OK ) {
+            (*env)->ExceptionDescribe( env );
+            ERROR( "Could not register natives for class %s", cname );
+            rv = 23;
+        }
+    }
+
+    return rv;
+}
+
+/**
+ * Replace System.out and System.err with PrintStreams over instances
+ * of a generated java.io.OutputStream subclass implemented by the
+ * three given natives: write(I)V, write([BII)V and flush()V. Global
+ * references to the out and err OutputStream instances are returned
+ * in streams, allowing the natives to distinguish them.
+ */
+apr_status_t replace_system_streams( JNIEnv *env,
+                                     const char *cname,
+                                     const JNINativeMethod *methods,
+                                     jobject streams[2] )
+{
+    static const char *SETTERS[] = { "setOut", "setErr" };
+
+    apr_status_t rv = APR_SUCCESS;
+
+    jclass cls = NULL;
+    rv = define_native_class( env, cname, "java/io/OutputStream",
+                              methods, 3, 0, &cls );
+
+    jclass ps_cls = NULL;
+    jmethodID ps_init = NULL;
+    jclass sys_cls = NULL;
+    if( rv == APR_SUCCESS ) {
+        ps_cls = (*env)->FindClass( env, "java/io/PrintStream" );
+        sys_cls = (*env)->FindClass( env, "java/lang/System" );
+        if( ps_cls && sys_cls ) {
+            ps_init = (*env)->GetMethodID( env, ps_cls, "<init>",
+                                           "(Ljava/io/OutputStream;Z)V" );
+        }
+        if( !ps_init ) {
+            (*env)->ExceptionDescribe( env );
+            rv = 24;
+        }
+    }
+
+    int i;
+    for( i = 0; ( i < 2 ) && ( rv == APR_SUCCESS ); i++ ) {
+        jmethodID setter =
+            (*env)->GetStaticMethodID( env, sys_cls, SETTERS[i],
+                                       "(Ljava/io/PrintStream;)V" );
+        // OutputStream has a no-op constructor, so skip it.
+        jobject stream = NULL;
+        if( setter ) stream = (*env)->AllocObject( env, cls );
+        jobject print = NULL;
+        if( stream ) {
+            print = (*env)->NewObject( env, ps_cls, ps_init, stream, JNI_TRUE );
+        }
+        if( print ) {
+            (*env)->CallStaticVoidMethod( env, sys_cls, setter, print );
+        }
+        if( !print || (*env)->ExceptionCheck( env ) ) {
+            (*env)->ExceptionDescribe( env );
+            rv = 24;
+        }
+        if( rv == APR_SUCCESS ) {
+            streams[i] = (*env)->NewGlobalRef( env, stream );
+        }
+        if( print ) (*env)->DeleteLocalRef( env, print );
+        if( stream ) (*env)->DeleteLocalRef( env, stream );
+    }
+
+    if( rv == 24 ) {
+        ERROR( "Could not replace System.out/err with %s.", cname );
+    }
+
+    return rv;
+}
+
+static void put_u1( class_buf_t *cb, int v )
+{
+    cb->buf[ cb->len++ ] = (unsigned char) ( v & 0xff );
+}
+
+static void put_u2( class_buf_t *cb, int v )
+{
+    put_u1( cb, v >> 8 );
+    put_u1( cb, v );
+}
+
+static void put_u4( class_buf_t *cb, unsigned long v )
+{
+    put_u2( cb, (int) ( ( v >> 16 ) & 0xffff ) );
+    put_u2( cb, (int) ( v & 0xffff ) );
+}
+
+// Names are expected to be ASCII, where modified UTF-8 is identical.
+static void put_utf8( class_buf_t *cb, const char *s )
+{
+    int len = strlen( s );
+    put_u2( cb, len );
+    memcpy( cb->buf + cb->len, s, len );
+    cb->len += len;
+}
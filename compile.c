@@ -0,0 +1,405 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_thread_proc.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "jvm.h"
+#include "compile.h"
+
+#ifdef __MacOS_X__
+#  define JNI_MD_INCLUDE "darwin"
+#else
+#  define JNI_MD_INCLUDE "linux"
+#endif
+
+// Contents of launcher.c, as generated by Makefile
+static const char *LAUNCHER_SOURCE =
+#include "launcher_src.h"
+    ;
+
+static void write_string( apr_file_t *f, const char *str );
+
+static void write_string_decl( apr_file_t *f,
+                               const char *name,
+                               const char *str );
+
+static void write_string_array( apr_file_t *f,
+                                const char *name,
+                                apr_array_header_t *vals );
+
+static apr_status_t write_launcher( const char *src );
+
+static apr_status_t build_launcher( const char *src,
+                                    const char *out );
+
+/**
+ * Write a standalone launcher C translation unit to <out>.c, with all
+ * properties of the current script fully resolved to static data, and
+ * compile it to <out>.
+ */
+apr_status_t compile_launcher( const char *out )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if( get_property_array( "hashdot.vm.libpath" ) != NULL ) {
+        ERROR( "hashdot.vm.libpath is not supported with --compile-launcher." );
+        rv = 1;
+    }
+    if( get_property_array( "hashdot.services" ) != NULL ) {
+        ERROR( "hashdot.services is not supported with --compile-launcher." );
+        rv = 1;
+    }
+
+    // Its launch time and default report name would be those of the
+    // compile, not of each run.
+    const char *profile = NULL;
+    get_property_value( "hashdot.profile.startup", 0, 0, &profile );
+    if( ( profile != NULL ) && ( strcmp( profile, "true" ) == 0 ) ) {
+        ERROR( "hashdot.profile.startup is not supported with "
+               "--compile-launcher." );
+        rv = 1;
+    }
+
+    // Its repository would be created and pruned, and its path fixed,
+    // at compile time.
+    const char *jfr = NULL;
+    get_property_value( "hashdot.jfr", 0, 0, &jfr );
+    if( ( jfr != NULL ) && ( strcmp( jfr, "off" ) != 0 ) ) {
+        ERROR( "hashdot.jfr is not supported with --compile-launcher." );
+        rv = 1;
+    }
+
+    // Its class is defined by the full launcher only.
+    const char *native = NULL;
+    get_property_value( "hashdot.native", 0, 0, &native );
+    if( ( native != NULL ) && ( strcmp( native, "false" ) != 0 ) ) {
+        ERROR( "hashdot.native is not supported with --compile-launcher." );
+        rv = 1;
+    }
+
+    // Its socket is served by the full launcher only.
+    const char *control = NULL;
+    get_property_value( "hashdot.control", 0, 0, &control );
+    if( ( control != NULL ) && ( strcmp( control, "false" ) != 0 ) ) {
+        ERROR( "hashdot.control is not supported with --compile-launcher." );
+        rv = 1;
+    }
+
+    // Its thread is run by the full launcher only.
+    const char *watchdog = NULL;
+    get_property_value( "hashdot.watchdog", 0, 0, &watchdog );
+    if( watchdog != NULL ) {
+        ERROR( "hashdot.watchdog is not supported with --compile-launcher." );
+        rv = 1;
+    }
+
+    // Slots are taken by the full launcher only, so a compiled
+    // launcher would bypass the limit.
+    const char *max_concurrent = NULL;
+    get_property_value( "hashdot.launch.max_concurrent", 0, 0,
+                        &max_concurrent );
+    if( max_concurrent != NULL ) {
+        ERROR( "hashdot.launch.max_concurrent is not supported with "
+               "--compile-launcher." );
+        rv = 1;
+    }
+
+    // The launcher's parent exits right after the fork, without
+    // waiting for readiness or defining hashdot.Daemon.
+    const char *daemonize = NULL;
+    const char *ready = "main";
+    get_property_value( "hashdot.daemonize", 0, 0, &daemonize );
+    get_property_value( "hashdot.daemonize.ready", 0, 0, &ready );
+    if( ( daemonize != NULL ) && ( strcmp( daemonize, "false" ) != 0 ) &&
+        ( strcmp( ready, "none" ) != 0 ) ) {
+        ERROR( "hashdot.daemonize.ready [%s] is not supported with "
+               "--compile-launcher (use none).", ready );
+        rv = 1;
+    }
+
+    const char *src = apr_pstrcat( _mp, out, ".c", NULL );
+
+    if( rv == APR_SUCCESS ) {
+        rv = write_launcher( src );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = build_launcher( src, out );
+    }
+
+    return rv;
+}
+
+static apr_status_t write_launcher( const char *src )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *lib_name = NULL;
+    const char *main_name = NULL;
+    const char *script = NULL;
+    const char *wd = NULL;
+    const char *daemonize = NULL;
+    const char *redirect = NULL;
+    const char *append = NULL;
+    const char *pid_file = NULL;
+
+    rv = get_property_value( "hashdot.main", 0, 1, &main_name );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.script", 0, 1, &script );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.chdir", '/', 0, &wd );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.daemonize", 0, 0, &daemonize );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.io_redirect.file", '/', 0,
+                                 &redirect );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.io_redirect.append", 0, 0, &append );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.pid_file", 0, 0, &pid_file );
+    }
+
+    // Absolute chdir, since the launcher may be run from anywhere. This
+    // is called after check_hashdot_cwd(), so it is the current directory.
+    char *abs_chdir = NULL;
+    if( ( rv == APR_SUCCESS ) && ( wd != NULL ) ) {
+        rv = apr_filepath_get( &abs_chdir, 0, _mp );
+    }
+
+    apr_array_header_t *options = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = build_jvm_options( &options );
+    }
+
+    // After options, which may select a jlink image
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.vm.lib", 0, 1, &lib_name );
+    }
+
+    apr_file_t *f = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open( &f, src,
+                            APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                            APR_FOPEN_TRUNCATE | APR_FOPEN_BUFFERED,
+                            APR_OS_DEFAULT, _mp );
+        if( rv != APR_SUCCESS ) print_error( rv, src );
+    }
+
+    if( rv != APR_SUCCESS ) return rv;
+
+    DEBUG( "Writing launcher source %s", src );
+
+    apr_file_printf( f, "/* Generated by hashdot %s from %s */\n\n"
+                     "#include <stddef.h>\n\n", HASHDOT_VERSION, script );
+
+    write_string_decl( f, "VM_LIB", lib_name );
+
+    char *cname = apr_pstrdup( _mp, main_name );
+    char *c;
+    for( c = cname; *c != '\0'; c++ ) {
+        if( *c == '.' ) *c = '/';
+    }
+    write_string_decl( f, "MAIN_CLASS", cname );
+
+    write_string_array( f, "OPTIONS", options );
+
+    // Environment as name, value pairs
+    static const char *HASHDOT_ENV_PRE = "hashdot.env.";
+    int plen = strlen( HASHDOT_ENV_PRE );
+    apr_array_header_t *env = apr_array_make( _mp, 8, sizeof( const char* ) );
+    apr_array_header_t *vals;
+    const char *name = NULL;
+    apr_hash_index_t *p;
+    for( p = apr_hash_first( _mp, _props ); p; p = apr_hash_next( p ) ) {
+        apr_hash_this( p, (const void **) &name, NULL, (void **) &vals );
+        if( ( (int) strlen( name ) > plen ) &&
+            ( strncmp( HASHDOT_ENV_PRE, name, plen ) == 0 ) ) {
+            *(const char **) apr_array_push( env ) = name + plen;
+            *(const char **) apr_array_push( env ) =
+                apr_array_pstrcat( _mp, vals, ' ' );
+        }
+    }
+    write_string_array( f, "ENV", env );
+
+    apr_array_header_t *args = apr_array_make( _mp, 8, sizeof( const char* ) );
+    vals = get_property_array( "hashdot.args.pre" );
+    if( vals != NULL ) apr_array_cat( args, vals );
+    *(const char **) apr_array_push( args ) = script;
+    write_string_array( f, "ARGS", args );
+
+    write_string_decl( f, "PROCESS_NAME", apr_filepath_name_get( script ) );
+
+    write_string_decl( f, "CHDIR", abs_chdir );
+
+    apr_file_printf( f, "static const int DAEMONIZE = %d;\n",
+                     ( daemonize != NULL ) &&
+                     ( strcmp( daemonize, "false" ) != 0 ) );
+
+    write_string_decl( f, "REDIRECT_FILE", redirect );
+
+    apr_file_printf( f, "static const int REDIRECT_APPEND = %d;\n",
+                     ( append == NULL ) || ( strcmp( append, "false" ) != 0 ) );
+
+    write_string_decl( f, "PID_FILE", pid_file );
+
+    apr_file_puts( "\n", f );
+    apr_file_puts( LAUNCHER_SOURCE, f );
+
+    rv = apr_file_close( f );
+    if( rv != APR_SUCCESS ) print_error( rv, src );
+
+    return rv;
+}
+
+/**
+ * Write str as a C string literal, or NULL.
+ */
+static void write_string( apr_file_t *f, const char *str )
+{
+    if( str == NULL ) {
+        apr_file_puts( "NULL", f );
+        return;
+    }
+    apr_file_putc( '"', f );
+    for( ; *str != '\0'; str++ ) {
+        unsigned char c = *str;
+        if( ( c == '"' ) || ( c == '\\' ) ) {
+            apr_file_putc( '\\', f );
+            apr_file_putc( c, f );
+        }
+        else if( ( c < 0x20 ) || ( c >= 0x7f ) || ( c == '?' ) ) {
+            // Octal escapes; '?' to avoid any trigraphs.
+            apr_file_printf( f, "\\%03o", c );
+        }
+        else {
+            apr_file_putc( c, f );
+        }
+    }
+    apr_file_putc( '"', f );
+}
+
+static void write_string_decl( apr_file_t *f,
+                               const char *name,
+                               const char *str )
+{
+    apr_file_printf( f, "static const char *%s = ", name );
+    write_string( f, str );
+    apr_file_puts( ";\n", f );
+}
+
+/**
+ * Write vals as a NULL terminated static array of C strings.
+ */
+static void write_string_array( apr_file_t *f,
+                                const char *name,
+                                apr_array_header_t *vals )
+{
+    apr_file_printf( f, "static const char *%s[] = {\n", name );
+    int i;
+    for( i = 0; i < vals->nelts; i++ ) {
+        apr_file_puts( "    ", f );
+        write_string( f, ((const char **) vals->elts )[i] );
+        apr_file_puts( ",\n", f );
+    }
+    apr_file_puts( "    NULL\n};\n", f );
+}
+
+/**
+ * Compile src to out with hashdot.compile.cc (default: cc -O2)
+ */
+static apr_status_t build_launcher( const char *src, const char *out )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_array_header_t *cmd = apr_array_make( _mp, 16, sizeof( const char* ) );
+    apr_array_header_t *cc = get_property_array( "hashdot.compile.cc" );
+    if( cc != NULL ) {
+        apr_array_cat( cmd, cc );
+    }
+    else {
+        *(const char **) apr_array_push( cmd ) = "cc";
+        *(const char **) apr_array_push( cmd ) = "-O2";
+    }
+
+    *(const char **) apr_array_push( cmd ) = "-I" HASHDOT_JNI_INCLUDE;
+    *(const char **) apr_array_push( cmd ) =
+        "-I" HASHDOT_JNI_INCLUDE "/" JNI_MD_INCLUDE;
+    *(const char **) apr_array_push( cmd ) = "-o";
+    *(const char **) apr_array_push( cmd ) = out;
+    *(const char **) apr_array_push( cmd ) = src;
+    *(const char **) apr_array_push( cmd ) = "-ldl";
+    *(const char **) apr_array_push( cmd ) = NULL;
+
+    const char **argv = (const char **) cmd->elts;
+    if( _debug ) {
+        DEBUG( "Compiling: %s",
+               apr_array_pstrcat( _mp, cmd, ' ' ) );
+    }
+
+    apr_procattr_t *attr = NULL;
+    apr_proc_t proc;
+    rv = apr_procattr_create( &attr, _mp );
+    if( rv == APR_SUCCESS ) {
+        rv = apr_procattr_cmdtype_set( attr, APR_PROGRAM_PATH );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_proc_create( &proc, argv[0], argv, NULL, attr, _mp );
+        if( rv != APR_SUCCESS ) print_error( rv, argv[0] );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        int status = 0;
+        apr_exit_why_e why;
+        apr_proc_wait( &proc, &status, &why, APR_WAIT );
+        if( !APR_PROC_CHECK_EXIT( why ) || ( status != 0 ) ) {
+            ERROR( "Compile of %s failed (status %d).", src, status );
+            rv = 32;
+        }
+    }
+
+    return rv;
+}
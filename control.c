@@ -0,0 +1,636 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <apr_strings.h>
+#include <apr_hash.h>
+#include <apr_env.h>
+#include <apr_thread_proc.h>
+
+#include <jni.h>
+
+#include "runtime.h"
+#include "control.h"
+#include "property.h"
+#include "daemon.h"
+#include "jfr.h"
+
+// Seconds to wait for a client to send its command
+#define CLIENT_TIMEOUT 5
+
+// Launch inputs re-read by reload, in order, beyond the default
+// profile and script header: "p" profile names and "=" property lines
+static apr_array_header_t *_inputs = NULL;
+
+static const char *_script = NULL;
+static const char *_control_path = NULL;
+static const char *_socket_path = NULL;
+static int _listen_fd = -1;
+static JavaVM *_vm = NULL;
+
+// Properties (name to space joined value) as in effect in the JVM
+static apr_pool_t *_base_pool = NULL;
+static apr_hash_t *_base = NULL;
+
+static int _reloads = 0;
+
+static apr_status_t
+resolve_props( apr_pool_t *pool, apr_hash_t *out );
+
+static apr_status_t
+resolve_props_child( apr_pool_t *pool, apr_hash_t *out );
+
+static void * APR_THREAD_FUNC
+control_thread( apr_thread_t *thread, void *data );
+
+static void
+add_input( char kind, const char *value )
+{
+    if( _inputs == NULL ) {
+        _inputs = apr_array_make( _mp, 4, sizeof( const char * ) );
+    }
+    *(const char **) apr_array_push( _inputs ) =
+        apr_psprintf( _mp, "%c%s", kind, value );
+}
+
+/**
+ * Record a profile read at launch, after the default profile, to be
+ * re-read by the reload command.
+ */
+void control_add_profile( const char *pname )
+{
+    add_input( 'p', pname );
+}
+
+/**
+ * Record a property line given at launch (i.e. via hashdot_resolve),
+ * to be re-applied by the reload command.
+ */
+void control_add_property( const char *line )
+{
+    add_input( '=', line );
+}
+
+/**
+ * Check the hashdot.control settings, before the JVM is created, and
+ * resolve the socket path: hashdot.pid_file + ".ctl" with "true", else
+ * the given path.
+ */
+apr_status_t check_control_options()
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    _control_path = NULL;
+
+    const char *control = NULL;
+    rv = get_property_value( "hashdot.control", 0, 0, &control );
+    if( ( rv != APR_SUCCESS ) || ( control == NULL ) ||
+        ( strcmp( control, "false" ) == 0 ) ) return rv;
+
+    const char *path = control;
+    if( strcmp( control, "true" ) == 0 ) {
+        const char *pid_file = NULL;
+        rv = get_property_value( "hashdot.pid_file", 0, 0, &pid_file );
+        if( rv != APR_SUCCESS ) return rv;
+        if( pid_file == NULL ) {
+            rv = 40;
+            ERROR( "[%d]: hashdot.control = true requires hashdot.pid_file.",
+                   rv );
+            return rv;
+        }
+        path = apr_pstrcat( _mp, pid_file, ".ctl", NULL );
+    }
+
+    struct sockaddr_un addr;
+    if( strlen( path ) >= sizeof( addr.sun_path ) ) {
+        rv = 40;
+        ERROR( "[%d]: hashdot.control socket path too long [%s].", rv, path );
+        return rv;
+    }
+
+    _control_path = path;
+
+    return rv;
+}
+
+/**
+ * With hashdot.control set (as checked by check_control_options),
+ * listen on a unix socket for control commands. Commands are served
+ * by a launcher thread, see doc/reference.html#control.
+ */
+apr_status_t start_control( JNIEnv *env )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *path = _control_path;
+    if( path == NULL ) return rv;
+
+    struct sockaddr_un addr;
+    memset( &addr, 0, sizeof( addr ) );
+    addr.sun_family = AF_UNIX;
+    strcpy( addr.sun_path, path );
+
+    rv = get_property_value( "hashdot.script", 0, 0, &_script );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( (*env)->GetJavaVM( env, &_vm ) != JNI_OK ) ) {
+        rv = 40;
+        ERROR( "[%d]: hashdot.control: no JavaVM.", rv );
+        return rv;
+    }
+
+    // The baseline is resolved the same way as on reload, rather than
+    // taken from the launch, which has run time additions.
+    rv = apr_pool_create( &_base_pool, NULL );
+    if( rv == APR_SUCCESS ) {
+        _base = apr_hash_make( _base_pool );
+        rv = resolve_props( _base_pool, _base );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    _listen_fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( _listen_fd < 0 ) rv = APR_FROM_OS_ERROR( errno );
+
+    if( rv == APR_SUCCESS ) {
+        fcntl( _listen_fd, F_SETFD, FD_CLOEXEC );
+        unlink( path ); // Any stale socket; the pid file lock is held
+        mode_t mask = umask( 077 );
+        if( ( bind( _listen_fd, (struct sockaddr *) &addr,
+                    sizeof( addr ) ) != 0 ) ||
+            ( listen( _listen_fd, 4 ) != 0 ) ) {
+            rv = APR_FROM_OS_ERROR( errno );
+        }
+        umask( mask );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        _socket_path = path;
+        apr_thread_t *thread = NULL;
+        rv = apr_thread_create( &thread, NULL, control_thread, NULL, _mp );
+    }
+
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, path );
+        return rv;
+    }
+
+    DEBUG( "Control socket %s", path );
+
+    return rv;
+}
+
+/**
+ * Remove the control socket, if any, and forget the launch inputs.
+ */
+void stop_control()
+{
+    if( _socket_path != NULL ) {
+        unlink( _socket_path );
+        _socket_path = NULL;
+    }
+    _inputs = NULL;
+}
+
+/**
+ * Resolve the default profile, launch profiles, script header and
+ * launch properties as at launch into out (name to space joined
+ * value), in a fresh property table.
+ */
+static apr_status_t
+resolve_props( apr_pool_t *pool, apr_hash_t *out )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_hash_t *saved = _props;
+    _props = apr_hash_make( _mp );
+    apr_hash_t *rprops = apr_hash_make( _mp );
+
+    rv = set_user_prop();
+
+    if( rv == APR_SUCCESS ) {
+        rv = parse_profile( "default", rprops );
+    }
+
+    int i;
+    for( i = 0; ( _inputs != NULL ) && ( i < _inputs->nelts ) &&
+             ( rv == APR_SUCCESS ); i++ ) {
+        const char *input = ((const char **) _inputs->elts )[i];
+        if( input[0] == 'p' ) {
+            rv = parse_profile( input + 1, rprops );
+        }
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( _script != NULL ) ) {
+        rv = set_script_props( _script );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( _script != NULL ) ) {
+        rv = parse_hashdot_header( _script, rprops );
+    }
+
+    // Launch property lines come after the header
+    for( i = 0; ( _inputs != NULL ) && ( i < _inputs->nelts ) &&
+             ( rv == APR_SUCCESS ); i++ ) {
+        const char *input = ((const char **) _inputs->elts )[i];
+        if( input[0] == '=' ) {
+            rv = parse_property_line( input + 1, rprops );
+        }
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = expand_recursive_props( rprops );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        apr_hash_index_t *p;
+        for( p = apr_hash_first( _mp, _props ); p; p = apr_hash_next( p ) ) {
+            const char *name = NULL;
+            apr_array_header_t *vals = NULL;
+            apr_hash_this( p, (const void **) &name, NULL, (void **) &vals );
+            apr_hash_set( out, apr_pstrdup( pool, name ), APR_HASH_KEY_STRING,
+                          apr_array_pstrcat( pool, vals, ' ' ) );
+        }
+    }
+
+    _props = saved;
+    return rv;
+}
+
+/**
+ * As resolve_props, but in a forked child process, leaving the
+ * launcher state (which other threads may be reading) untouched.
+ * Any profile errors are written by the child to stderr.
+ */
+static apr_status_t
+resolve_props_child( apr_pool_t *pool, apr_hash_t *out )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int fds[2];
+
+    if( pipe( fds ) != 0 ) return APR_FROM_OS_ERROR( errno );
+
+    pid_t pid = fork();
+    if( pid < 0 ) {
+        rv = APR_FROM_OS_ERROR( errno );
+        close( fds[0] );
+        close( fds[1] );
+        return rv;
+    }
+
+    if( pid == 0 ) {
+        close( fds[0] );
+        apr_hash_t *props = apr_hash_make( _mp );
+        rv = resolve_props( _mp, props );
+        if( rv == APR_SUCCESS ) {
+            FILE *cout = fdopen( fds[1], "w" );
+            apr_hash_index_t *p;
+            for( p = apr_hash_first( _mp, props ); p; p = apr_hash_next( p ) ) {
+                const char *name = NULL;
+                const char *value = NULL;
+                apr_hash_this( p, (const void **) &name, NULL,
+                               (void **) &value );
+                fprintf( cout, "%s=%s\n", name, value );
+            }
+            fclose( cout );
+        }
+        fflush( stderr );
+        _exit( ( rv == APR_SUCCESS ) ? 0 : 1 );
+    }
+
+    close( fds[1] );
+
+    // Read all name=value lines, then wait for the child's status
+    apr_size_t len = 0;
+    apr_size_t cap = 4096;
+    char *buf = apr_palloc( pool, cap );
+    ssize_t n;
+    for(;;) {
+        if( len + 1 == cap ) {
+            char *nbuf = apr_palloc( pool, cap * 2 );
+            memcpy( nbuf, buf, len );
+            buf = nbuf;
+            cap *= 2;
+        }
+        n = read( fds[0], buf + len, cap - len - 1 );
+        if( n > 0 ) len += n;
+        else if( ( n < 0 ) && ( errno == EINTR ) ) continue;
+        else break;
+    }
+    buf[len] = '\0';
+    close( fds[0] );
+
+    int status = 0;
+    while( ( waitpid( pid, &status, 0 ) < 0 ) && ( errno == EINTR ) );
+    if( !WIFEXITED( status ) || ( WEXITSTATUS( status ) != 0 ) ) return 1;
+
+    char *line = buf;
+    char *next = NULL;
+    for( ; *line != '\0'; line = next ) {
+        next = strchr( line, '\n' );
+        if( next == NULL ) break;
+        *next++ = '\0';
+        char *eq = strchr( line, '=' );
+        if( eq != NULL ) {
+            *eq = '\0';
+            apr_hash_set( out, line, APR_HASH_KEY_STRING, eq + 1 );
+        }
+    }
+
+    return rv;
+}
+
+/**
+ * True for properties read by the launcher or the JVM only at start,
+ * which System.setProperty can not change.
+ */
+static int
+requires_restart( const char *name )
+{
+    return ( ( strncmp( name, "hashdot.", 8 ) == 0 ) ||
+             ( strncmp( name, "java.", 5 ) == 0 ) ||
+             ( strncmp( name, "jdk.", 4 ) == 0 ) ||
+             ( strncmp( name, "sun.", 4 ) == 0 ) );
+}
+
+/**
+ * Set (value non-NULL) or clear a system property in the JVM.
+ */
+static int
+push_property( JNIEnv *env, const char *name, const char *value )
+{
+    static jclass system_cls = NULL;
+    static jmethodID set_property = NULL;
+    static jmethodID clear_property = NULL;
+
+    if( system_cls == NULL ) {
+        jclass cls = (*env)->FindClass( env, "java/lang/System" );
+        if( cls != NULL ) {
+            set_property = (*env)->GetStaticMethodID(
+                env, cls, "setProperty",
+                "(Ljava/lang/String;Ljava/lang/String;)Ljava/lang/String;" );
+            clear_property = (*env)->GetStaticMethodID(
+                env, cls, "clearProperty",
+                "(Ljava/lang/String;)Ljava/lang/String;" );
+            system_cls = (*env)->NewGlobalRef( env, cls );
+        }
+        if( ( system_cls == NULL ) || ( set_property == NULL ) ||
+            ( clear_property == NULL ) ) {
+            (*env)->ExceptionClear( env );
+            system_cls = NULL;
+            return 0;
+        }
+    }
+
+    jstring jname = (*env)->NewStringUTF( env, name );
+    jstring jvalue = ( value != NULL ) ?
+        (*env)->NewStringUTF( env, value ) : NULL;
+    jobject old = NULL;
+    if( value != NULL ) {
+        old = (*env)->CallStaticObjectMethod( env, system_cls, set_property,
+                                              jname, jvalue );
+    }
+    else {
+        old = (*env)->CallStaticObjectMethod( env, system_cls, clear_property,
+                                              jname );
+    }
+
+    int ok = !(*env)->ExceptionCheck( env );
+    if( !ok ) {
+        (*env)->ExceptionDescribe( env );
+    }
+    if( old != NULL ) (*env)->DeleteLocalRef( env, old );
+    if( jvalue != NULL ) (*env)->DeleteLocalRef( env, jvalue );
+    (*env)->DeleteLocalRef( env, jname );
+    return ok;
+}
+
+/**
+ * Re-read the launch profiles and script header and apply the
+ * differences to the baseline: other than requires_restart properties
+ * are pushed into the JVM, the rest reported.
+ */
+static void
+control_reload( FILE *out )
+{
+    apr_pool_t *pool = NULL;
+    apr_hash_t *props = NULL;
+    JNIEnv *env = NULL;
+
+    apr_status_t rv = apr_pool_create( &pool, NULL );
+    if( rv == APR_SUCCESS ) {
+        props = apr_hash_make( pool );
+        rv = resolve_props_child( pool, props );
+    }
+    if( rv != APR_SUCCESS ) {
+        fprintf( out, "error profiles or script header not resolved,"
+                 " see the daemon's stderr\n" );
+        if( pool != NULL ) apr_pool_destroy( pool );
+        return;
+    }
+
+    JavaVMAttachArgs attach_args;
+    attach_args.version = JNI_VERSION_1_2;
+    attach_args.name = "hashdot-control";
+    attach_args.group = NULL;
+    if( (*_vm)->AttachCurrentThread( _vm, (void **) &env,
+                                     &attach_args ) != JNI_OK ) {
+        fprintf( out, "error could not attach to JVM\n" );
+        apr_pool_destroy( pool );
+        return;
+    }
+
+    int restarts = 0;
+    int failed = 0;
+    apr_hash_index_t *p;
+    for( p = apr_hash_first( pool, props ); p; p = apr_hash_next( p ) ) {
+        const char *name = NULL;
+        const char *value = NULL;
+        apr_hash_this( p, (const void **) &name, NULL, (void **) &value );
+        const char *old = apr_hash_get( _base, name, APR_HASH_KEY_STRING );
+        if( ( old != NULL ) && ( strcmp( old, value ) == 0 ) ) continue;
+
+        if( requires_restart( name ) ) {
+            fprintf( out, "restart %s=%s\n", name, value );
+            restarts++;
+        }
+        else if( push_property( env, name, value ) ) {
+            fprintf( out, "set %s=%s\n", name, value );
+            apr_hash_set( _base, apr_pstrdup( _base_pool, name ),
+                          APR_HASH_KEY_STRING,
+                          apr_pstrdup( _base_pool, value ) );
+        }
+        else {
+            fprintf( out, "failed %s=%s\n", name, value );
+            failed++;
+        }
+    }
+
+    for( p = apr_hash_first( pool, _base ); p; p = apr_hash_next( p ) ) {
+        const char *name = NULL;
+        apr_hash_this( p, (const void **) &name, NULL, NULL );
+        if( apr_hash_get( props, name, APR_HASH_KEY_STRING ) != NULL ) continue;
+
+        if( requires_restart( name ) ) {
+            fprintf( out, "restart %s (removed)\n", name );
+            restarts++;
+        }
+        else if( push_property( env, name, NULL ) ) {
+            fprintf( out, "clear %s\n", name );
+            apr_hash_set( _base, name, APR_HASH_KEY_STRING, NULL );
+        }
+        else {
+            fprintf( out, "failed %s (removed)\n", name );
+            failed++;
+        }
+    }
+
+    (*_vm)->DetachCurrentThread( _vm );
+    apr_pool_destroy( pool );
+
+    _reloads++;
+    if( failed > 0 ) {
+        fprintf( out, "error %d properties not set\n", failed );
+    }
+    else if( restarts > 0 ) {
+        fprintf( out, "ok restart required for %d changes\n", restarts );
+    }
+    else {
+        fprintf( out, "ok\n" );
+    }
+}
+
+static void
+control_status( FILE *out )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    apr_int64_t now_ns = (apr_int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
+    const char *main_name = apr_hash_get( _base, "hashdot.main",
+                                          APR_HASH_KEY_STRING );
+    const char *profiles = apr_hash_get( _base, "hashdot.profile",
+                                         APR_HASH_KEY_STRING );
+
+    fprintf( out, "pid %d\n", (int) getpid() );
+    fprintf( out, "uptime %.1f\n", ( now_ns - _launch_ns ) / 1e9 );
+    fprintf( out, "version %s\n", HASHDOT_VERSION );
+    if( _script != NULL ) fprintf( out, "script %s\n", _script );
+    if( main_name != NULL ) fprintf( out, "main %s\n", main_name );
+    if( profiles != NULL ) fprintf( out, "profiles %s\n", profiles );
+    fprintf( out, "properties %u\n", apr_hash_count( _base ) );
+    fprintf( out, "reloads %d\n", _reloads );
+    fprintf( out, "ok\n" );
+}
+
+static void
+control_command( const char *cmd, FILE *out )
+{
+    DEBUG( "Control command [%s]", cmd );
+
+    if( strcmp( cmd, "status" ) == 0 ) {
+        control_status( out );
+    }
+    else if( strcmp( cmd, "reload" ) == 0 ) {
+        control_reload( out );
+    }
+    else if( strcmp( cmd, "reopen-logs" ) == 0 ) {
+        apr_status_t rv = reopen_redirect();
+        if( rv == APR_SUCCESS ) {
+            fprintf( out, "ok\n" );
+        }
+        else if( rv == APR_ENOENT ) {
+            fprintf( out, "error no hashdot.io_redirect.file\n" );
+        }
+        else {
+            char buf[ 256 ];
+            fprintf( out, "error %s\n", apr_strerror( rv, buf, sizeof( buf ) ) );
+        }
+    }
+    else if( strcmp( cmd, "jfr-dump" ) == 0 ) {
+        jfr_dump_command( _vm, out );
+    }
+    else {
+        fprintf( out, "error unknown command [%s]"
+                 " (status, reload, reopen-logs or jfr-dump)\n", cmd );
+    }
+}
+
+static void * APR_THREAD_FUNC
+control_thread( apr_thread_t *thread, void *data )
+{
+    for(;;) {
+        int fd = accept( _listen_fd, NULL, NULL );
+        if( fd >= 0 ) fcntl( fd, F_SETFD, FD_CLOEXEC );
+        if( fd < 0 ) {
+            if( ( errno == EINTR ) || ( errno == ECONNABORTED ) ) continue;
+            break;
+        }
+
+        struct timeval tv = { CLIENT_TIMEOUT, 0 };
+        setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof( tv ) );
+
+        int ofd = dup( fd );
+        FILE *in = fdopen( fd, "r" );
+        FILE *out = ( ofd >= 0 ) ? fdopen( ofd, "w" ) : NULL;
+        if( ( in == NULL ) || ( out == NULL ) ) {
+            if( in != NULL ) fclose( in ); else close( fd );
+            if( out != NULL ) fclose( out ); else if( ofd >= 0 ) close( ofd );
+            continue;
+        }
+
+        char cmd[ 256 ];
+        if( fgets( cmd, sizeof( cmd ), in ) != NULL ) {
+            cmd[ strcspn( cmd, "\r\n" ) ] = '\0';
+            control_command( cmd, out );
+        }
+        fclose( out );
+        fclose( in );
+    }
+
+    print_error( APR_FROM_OS_ERROR( errno ), "control socket" );
+    return NULL;
+}
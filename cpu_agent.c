@@ -0,0 +1,519 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * CPU profiler, a JVMTI agent loaded with -agentpath when
+ * hashdot.profile.cpu is set (see jvm.c). Samples the thread using
+ * CPU hz times a second of CPU time (SIGPROF of ITIMER_PROF), taking
+ * its Java stack with HotSpot's AsyncGetCallTrace, or for threads
+ * without Java frames (i.e. GC, JIT compiler) the native function
+ * interrupted. The signal handler only copies each sample to a
+ * lock-free ring, drained every DRAIN_MS by a profiler thread which
+ * folds samples by stack. At VM death, and on SIGUSR1 (i.e. for
+ * daemons), all samples so far are written to <out> as collapsed
+ * stacks for flamegraph.pl. Depends only on libc and libdl.
+ *
+ * Options: hz=<samples per CPU second>,out=<output file>
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/time.h>
+
+#include <jni.h>
+#include <jvmti.h>
+
+#include "agent_util.h"
+
+// Deepest Java stack sampled
+#define MAX_FRAMES 128
+
+// Samples buffered between drains, a power of 2
+#define RING_SIZE 1024
+
+// Milliseconds between drains of the ring
+#define DRAIN_MS 100
+
+// AsyncGetCallTrace, as exported (but not declared) by HotSpot
+typedef struct {
+    jint lineno;            // Or -3 for a native method
+    jmethodID method_id;
+} asgct_frame_t;
+
+typedef struct {
+    JNIEnv *env_id;
+    jint num_frames;        // Or an error (< 1), see sample_name()
+    asgct_frame_t *frames;
+} asgct_trace_t;
+
+typedef void (*asgct_f)( asgct_trace_t *trace, jint depth, void *ucontext );
+
+typedef struct {
+    volatile int ready;     // Written, not yet drained
+    jint num_frames;        // As from AsyncGetCallTrace, or 1 if detached
+    const void *pc;         // Interrupted PC
+    asgct_frame_t frames[ MAX_FRAMES ];
+} sample_t;
+
+static JavaVM *_vm = NULL;
+static jvmtiEnv *_jvmti = NULL;
+static asgct_f _asgct = NULL;
+
+static long _hz = 100;
+static char *_out = NULL;
+
+static sample_t _ring[ RING_SIZE ];
+static volatile unsigned long _head = 0;  // Next slot to sample into
+static volatile unsigned long _tail = 0;  // Next slot to drain
+static volatile unsigned long _lost = 0;  // Samples dropped, ring full
+
+static volatile sig_atomic_t _dump = 0;
+static volatile int _stopping = 0;
+static pthread_t _drainer;
+static int _draining = 0;
+
+// Drainer only, after start
+static table_t _names = { NULL, 0, 0 };   // jmethodID -> char *
+static table_t _stacks = { NULL, 0, 0 };  // stack -> count
+static long _samples = 0;
+
+// The entry for key, added with value 0 and a copy of a string key
+// if new.
+static entry_t *
+table_entry( table_t *t, const void *key, int is_string )
+{
+    if( ( t->count + 1 ) * 2 > t->size ) table_grow( t, is_string );
+    entry_t *e = table_slot( t, key, is_string );
+    if( e->key == NULL ) {
+        e->key = is_string ? strdup( key ) : key;
+        e->value = 0;
+        t->count++;
+    }
+    return e;
+}
+
+static const void *
+context_pc( void *ucontext )
+{
+    ucontext_t *uc = ucontext;
+#if defined(__x86_64__)
+    return (const void *) uc->uc_mcontext.gregs[ REG_RIP ];
+#elif defined(__i386__)
+    return (const void *) uc->uc_mcontext.gregs[ REG_EIP ];
+#elif defined(__aarch64__)
+    return (const void *) uc->uc_mcontext.pc;
+#else
+    return NULL;
+#endif
+}
+
+/**
+ * SIGPROF handler: copy the stack of the interrupted thread to the
+ * next free slot of the ring. Only async-signal-safe calls, and no
+ * locks (the interrupted thread may be holding any).
+ */
+static void
+on_prof( int signo, siginfo_t *info, void *ucontext )
+{
+    int saved_errno = errno;
+
+    unsigned long h;
+    do {
+        h = _head;
+        if( h - _tail >= RING_SIZE ) {
+            __sync_fetch_and_add( &_lost, 1 );
+            errno = saved_errno;
+            return;
+        }
+    } while( !__sync_bool_compare_and_swap( &_head, h, h + 1 ) );
+
+    sample_t *s = &_ring[ h & ( RING_SIZE - 1 ) ];
+    s->pc = context_pc( ucontext );
+    s->num_frames = 1;
+
+    JNIEnv *jni = NULL;
+    if( (*_vm)->GetEnv( _vm, (void **) &jni, JNI_VERSION_1_2 ) == JNI_OK ) {
+        asgct_trace_t trace;
+        trace.env_id = jni;
+        trace.num_frames = 0;
+        trace.frames = s->frames;
+        _asgct( &trace, MAX_FRAMES, ucontext );
+        s->num_frames = trace.num_frames;
+    }
+    else {
+        s->frames[0].method_id = NULL;  // Native only
+    }
+
+    __sync_synchronize();
+    s->ready = 1;
+
+    errno = saved_errno;
+}
+
+static void
+on_usr1( int signo )
+{
+    _dump = 1;
+}
+
+// Name of a sample without Java frames, by AsyncGetCallTrace error.
+static const char *
+sample_name( jint num_frames )
+{
+    switch( num_frames ) {
+    case 0:   return "[no_frames]";
+    case -1:  return "[no_Java_frame]";
+    case -2:  return "[no_class_load]";
+    case -3:  return "[gc_active]";
+    case -4:  return "[unknown_not_Java]";
+    case -5:  return "[not_walkable_not_Java]";
+    case -6:  return "[unknown_Java]";
+    case -7:  return "[not_walkable_Java]";
+    case -8:  return "[unknown_state]";
+    case -9:  return "[thread_exit]";
+    case -10: return "[deopt]";
+    case -11: return "[safepoint]";
+    default:  return "[unknown]";
+    }
+}
+
+// The java name of method (i.e. foo.Bar.baz), cached.
+static const char *
+method_name( jmethodID method )
+{
+    entry_t *e = table_entry( &_names, method, 0 );
+    if( e->value != 0 ) return (const char *) e->value;
+
+    jvmtiEnv *jvmti = _jvmti;
+    jclass cls = NULL;
+    char *sig = NULL;
+    char *name = NULL;
+    if( (*jvmti)->GetMethodDeclaringClass( jvmti, method, &cls ) ==
+        JVMTI_ERROR_NONE ) {
+        (*jvmti)->GetClassSignature( jvmti, cls, &sig, NULL );
+    }
+    (*jvmti)->GetMethodName( jvmti, method, &name, NULL, NULL );
+
+    buf_t b = { NULL, 0, 0 };
+    if( sig != NULL ) {
+        size_t len = strlen( sig );
+        if( ( len > 2 ) && ( sig[0] == 'L' ) && ( sig[len - 1] == ';' ) ) {
+            append( &b, sig + 1, len - 2 );
+        }
+        else {
+            append( &b, sig, len );
+        }
+        append( &b, ".", 1 );
+        char *c;
+        for( c = b.s; *c != '\0'; c++ ) {
+            if( ( *c == '/' ) || ( *c == ';' ) ) *c = '.';
+        }
+    }
+    const char *n = ( name != NULL ) ? name : "[unknown]";
+    append( &b, n, strlen( n ) );
+
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) sig );
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) name );
+
+    e->value = (long) b.s;
+    return b.s;
+}
+
+// Append the native function at pc, as lib`function, or the library
+// alone if its symbols aren't exported.
+static void
+append_native( buf_t *b, const void *pc )
+{
+    Dl_info info;
+    if( ( pc == NULL ) || ( dladdr( pc, &info ) == 0 ) ||
+        ( info.dli_fname == NULL ) ) {
+        append( b, "[unknown_native]", 16 );
+        return;
+    }
+    const char *lib = strrchr( info.dli_fname, '/' );
+    lib = ( lib != NULL ) ? lib + 1 : info.dli_fname;
+    append( b, lib, strlen( lib ) );
+    if( info.dli_sname != NULL ) {
+        append( b, "`", 1 );
+        append( b, info.dli_sname, strlen( info.dli_sname ) );
+    }
+}
+
+// Fold the samples in the ring into _stacks.
+static void
+drain()
+{
+    buf_t b = { NULL, 0, 0 };
+    for( ;; ) {
+        sample_t *s = &_ring[ _tail & ( RING_SIZE - 1 ) ];
+        if( !s->ready ) break;
+        __sync_synchronize();
+
+        b.len = 0;
+        if( ( s->num_frames == 1 ) && ( s->frames[0].method_id == NULL ) ) {
+            append( &b, "[native];", 9 );
+            append_native( &b, s->pc );
+        }
+        else if( s->num_frames < 1 ) {
+            const char *n = sample_name( s->num_frames );
+            append( &b, n, strlen( n ) );
+            append( &b, ";", 1 );
+            append_native( &b, s->pc );
+        }
+        else {
+            // Root first
+            int i;
+            for( i = s->num_frames - 1; i >= 0; i-- ) {
+                const char *n = method_name( s->frames[i].method_id );
+                append( &b, n, strlen( n ) );
+                if( i > 0 ) append( &b, ";", 1 );
+            }
+        }
+
+        table_entry( &_stacks, b.s, 1 )->value++;
+        _samples++;
+
+        s->ready = 0;
+        __sync_synchronize();
+        _tail++;
+    }
+    free( b.s );
+}
+
+// Write all stacks so far, replacing out.
+static void
+write_profile()
+{
+    size_t len = strlen( _out );
+    char tmp[ len + 5 ];
+    snprintf( tmp, sizeof( tmp ), "%s.tmp", _out );
+
+    FILE *out = fopen( tmp, "w" );
+    if( out == NULL ) {
+        fprintf( stderr, "HASHDOT WARN: Can't write CPU profile %s.\n", tmp );
+        return;
+    }
+    long i;
+    for( i = 0; i < _stacks.size; i++ ) {
+        if( _stacks.entries[i].key != NULL ) {
+            fprintf( out, "%s %ld\n", (const char *) _stacks.entries[i].key,
+                     _stacks.entries[i].value );
+        }
+    }
+    if( ( fclose( out ) != 0 ) || ( rename( tmp, _out ) != 0 ) ) {
+        fprintf( stderr, "HASHDOT WARN: Can't write CPU profile %s.\n", _out );
+        unlink( tmp );
+        return;
+    }
+    fprintf( stderr, "HASHDOT: CPU profile written to %s"
+             " (%ld samples, %lu lost).\n", _out, _samples, _lost );
+}
+
+static void *
+drainer( void *arg )
+{
+    JNIEnv *jni = NULL;
+    (*_vm)->AttachCurrentThreadAsDaemon( _vm, (void **) &jni, NULL );
+
+    struct timespec delay = { 0, DRAIN_MS * 1000000L };
+    while( !_stopping ) {
+        nanosleep( &delay, NULL );
+        drain();
+        if( _dump ) {
+            _dump = 0;
+            write_profile();
+        }
+    }
+
+    (*_vm)->DetachCurrentThread( _vm );
+    return NULL;
+}
+
+static void
+set_timer( long hz )
+{
+    struct itimerval t;
+    memset( &t, 0, sizeof( t ) );
+    if( hz > 0 ) {
+        t.it_interval.tv_usec = 1000000 / hz;
+        t.it_value = t.it_interval;
+    }
+    setitimer( ITIMER_PROF, &t, NULL );
+}
+
+// Create the jmethodIDs of klass, as AsyncGetCallTrace can't.
+static void
+prepare_methods( jvmtiEnv *jvmti, jclass klass )
+{
+    jint count = 0;
+    jmethodID *methods = NULL;
+    if( (*jvmti)->GetClassMethods( jvmti, klass, &count, &methods ) ==
+        JVMTI_ERROR_NONE ) {
+        (*jvmti)->Deallocate( jvmti, (unsigned char *) methods );
+    }
+}
+
+static void JNICALL
+on_class_prepare( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass klass )
+{
+    prepare_methods( jvmti, klass );
+}
+
+static void JNICALL
+on_vm_init( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread )
+{
+    jint count = 0;
+    jclass *classes = NULL;
+    if( (*jvmti)->GetLoadedClasses( jvmti, &count, &classes ) ==
+        JVMTI_ERROR_NONE ) {
+        jint i;
+        for( i = 0; i < count; i++ ) prepare_methods( jvmti, classes[i] );
+        (*jvmti)->Deallocate( jvmti, (unsigned char *) classes );
+    }
+
+    if( pthread_create( &_drainer, NULL, &drainer, NULL ) != 0 ) {
+        fprintf( stderr, "HASHDOT WARN: Can't start CPU profiler.\n" );
+        return;
+    }
+    _draining = 1;
+    set_timer( _hz );
+}
+
+static void JNICALL
+on_vm_death( jvmtiEnv *jvmti, JNIEnv *jni )
+{
+    if( !_draining ) return;
+    set_timer( 0 );
+
+    _stopping = 1;
+    pthread_join( _drainer, NULL );
+    _draining = 0;
+
+    drain();
+    write_profile();
+}
+
+// Find AsyncGetCallTrace in the (already loaded) libjvm of jvmti.
+static asgct_f
+find_asgct( jvmtiEnv *jvmti )
+{
+    Dl_info info;
+    if( ( dladdr( (void *) (*jvmti)->GetMethodName, &info ) == 0 ) ||
+        ( info.dli_fname == NULL ) ) return NULL;
+
+    void *lib = dlopen( info.dli_fname, RTLD_NOW | RTLD_NOLOAD );
+    if( lib == NULL ) return NULL;
+
+    asgct_f f = (asgct_f) dlsym( lib, "AsyncGetCallTrace" );
+    dlclose( lib );
+    return f;
+}
+
+AGENT_EXPORT JNIEXPORT jint JNICALL
+Agent_OnLoad( JavaVM *vm, char *options, void *reserved )
+{
+    const char *val;
+
+    if( ( val = option( options, "hz" ) ) != NULL ) _hz = atol( val );
+    if( ( _hz < 1 ) || ( _hz > 1000 ) ) _hz = 100;
+
+    val = option( options, "out" );
+    _out = strdup( ( val != NULL ) ? val : "hashdot-cpu.folded" );
+
+    _vm = vm;
+    if( (*vm)->GetEnv( vm, (void **) &_jvmti, JVMTI_VERSION_1_0 ) != JNI_OK ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI unavailable, "
+                 "CPU not profiled.\n" );
+        return JNI_OK;
+    }
+    jvmtiEnv *jvmti = _jvmti;
+
+    _asgct = find_asgct( jvmti );
+    if( _asgct == NULL ) {
+        fprintf( stderr, "HASHDOT WARN: No AsyncGetCallTrace (not HotSpot?), "
+                 "CPU not profiled.\n" );
+        return JNI_OK;
+    }
+
+    jvmtiEventCallbacks callbacks;
+    memset( &callbacks, 0, sizeof( callbacks ) );
+    callbacks.VMInit       = &on_vm_init;
+    callbacks.VMDeath      = &on_vm_death;
+    callbacks.ClassPrepare = &on_class_prepare;
+
+    static const jvmtiEvent events[] = {
+        JVMTI_EVENT_VM_INIT, JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_CLASS_PREPARE };
+
+    int failed =
+        ( (*jvmti)->SetEventCallbacks( jvmti, &callbacks,
+                                       sizeof( callbacks ) ) != JVMTI_ERROR_NONE );
+    int i;
+    for( i = 0; !failed && ( i < sizeof( events ) / sizeof( events[0] ) ); i++ ) {
+        failed = ( (*jvmti)->SetEventNotificationMode(
+                       jvmti, JVMTI_ENABLE, events[i], NULL ) != JVMTI_ERROR_NONE );
+    }
+
+    if( !failed ) {
+        struct sigaction sa;
+        memset( &sa, 0, sizeof( sa ) );
+        sigemptyset( &sa.sa_mask );
+        sa.sa_sigaction = &on_prof;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        failed = ( sigaction( SIGPROF, &sa, NULL ) != 0 );
+
+        memset( &sa, 0, sizeof( sa ) );
+        sigemptyset( &sa.sa_mask );
+        sa.sa_handler = &on_usr1;
+        sa.sa_flags = SA_RESTART;
+        failed = failed || ( sigaction( SIGUSR1, &sa, NULL ) != 0 );
+    }
+
+    if( failed ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI events unavailable, "
+                 "CPU not profiled.\n" );
+    }
+
+    return JNI_OK;
+}
@@ -36,17 +36,54 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <apr_signal.h>
+#include <apr_time.h>
+
+#include <jni.h>
 
 #include "runtime.h"
 #include "daemon.h"
 #include "property.h"
+#include "classgen.h"
+#include "launch.h"
+
+// Default seconds the launching parent waits for the daemon to be ready
+#define READY_TIMEOUT 60
 
 static const char * _redirect_fname = NULL;
 
+typedef enum { READY_NONE, READY_MAIN, READY_NOTIFY } ready_mode_t;
+
+static ready_mode_t _ready_mode = READY_MAIN;
+
+// Daemon side of the readiness socket to the launching parent, or -1
+static int _ready_fd = -1;
+
 static void reopen_streams( int signo );
 
+static apr_status_t
+read_ready_mode();
+
+static void
+wait_ready( int fd, pid_t pid );
+
+static void
+send_ready();
+
+static void JNICALL
+daemon_ready( JNIEnv *env, jclass cls );
+
 apr_status_t check_daemonize()
 {
     apr_status_t rv = APR_SUCCESS;
@@ -54,18 +91,38 @@ apr_status_t check_daemonize()
     const char * flag = NULL;
     rv = get_property_value( "hashdot.daemonize", 0, 0, &flag );
 
+    if( rv == APR_SUCCESS ) {
+        rv = read_ready_mode();
+    }
+
     int daemon = 0;
     if( ( rv == APR_SUCCESS ) && ( flag != NULL ) &&
         ( strcmp( flag, "false" ) != 0 ) ) {
 
         DEBUG( "Forking daemon." );
 
-        pid_t pid = fork();
-        if( pid < 0 ) {
+        int sv[2] = { -1, -1 };
+        if( ( _ready_mode != READY_NONE ) &&
+            ( socketpair( AF_UNIX, SOCK_STREAM, 0, sv ) != 0 ) ) {
             rv = APR_FROM_OS_ERROR( errno );
         }
-        if( pid > 0 ) { // Parent exit normally.
-            exit( 0 );
+
+        pid_t pid = -1;
+        if( rv == APR_SUCCESS ) {
+            pid = fork();
+            if( pid < 0 ) {
+                rv = APR_FROM_OS_ERROR( errno );
+            }
+        }
+        if( pid > 0 ) {
+            if( sv[0] < 0 ) exit( 0 ); // Parent exit normally.
+            close( sv[1] );
+            wait_ready( sv[0], pid ); // Exits
+        }
+        if( sv[1] >= 0 ) {
+            close( sv[0] );
+            _ready_fd = sv[1];
+            fcntl( _ready_fd, F_SETFD, FD_CLOEXEC );
         }
         if( rv == APR_SUCCESS ) {
             pid_t sid = setsid();
@@ -111,14 +168,228 @@ apr_status_t install_hup_handler()
     return APR_SUCCESS;
 }
 
-static void reopen_streams( int signo )
+/**
+ * Reopen stdout and stderr on the hashdot.io_redirect.file of a daemon,
+ * i.e. after log rotation. Returns APR_ENOENT if not redirected.
+ */
+apr_status_t reopen_redirect()
 {
-    if( _redirect_fname != NULL ) {
-        if( freopen( _redirect_fname, "a", stdout ) == NULL ) {
-            print_error( APR_FROM_OS_ERROR( errno ), "freopen stdout" );
+    if( _redirect_fname == NULL ) return APR_ENOENT;
+
+    if( ( freopen( _redirect_fname, "a", stdout ) == NULL ) ||
+        ( freopen( _redirect_fname, "a", stderr ) == NULL ) ) {
+        return APR_FROM_OS_ERROR( errno );
+    }
+    return APR_SUCCESS;
+}
+
+/**
+ * Called just before the main method(s) are invoked: the daemon is
+ * ready unless it is to notify explicitly via hashdot.Daemon.ready().
+ */
+void main_ready()
+{
+    if( _ready_mode == READY_MAIN ) send_ready();
+    if( _ready_mode != READY_NOTIFY ) launch_ready();
+}
+
+/**
+ * Explicit readiness from the application (i.e. via hashdot.Native),
+ * sent only when hashdot.daemonize.ready = notify.
+ */
+void notify_ready()
+{
+    if( _ready_mode == READY_NOTIFY ) {
+        send_ready();
+        launch_ready();
+    }
+}
+
+/**
+ * Define the hashdot.Daemon class, with a static native ready() method
+ * for the application to signal readiness with hashdot.daemonize.ready
+ * = notify. Calls are ignored when there is no one to notify.
+ */
+apr_status_t define_daemon_class( JNIEnv *env )
+{
+    static JNINativeMethod METHODS[] = {
+        { "ready", "()V", (void *) &daemon_ready }
+    };
+
+    if( _ready_mode != READY_NOTIFY ) return APR_SUCCESS;
+
+    jclass cls = NULL;
+    return define_native_class( env, "hashdot/Daemon", "java/lang/Object",
+                                METHODS, 1, 1, &cls );
+}
+
+static apr_status_t
+read_ready_mode()
+{
+    const char *mode = NULL;
+    apr_status_t rv = get_property_value( "hashdot.daemonize.ready",
+                                          0, 0, &mode );
+    if( ( rv == APR_SUCCESS ) && ( mode != NULL ) ) {
+        if( strcmp( mode, "main" ) == 0 ) {
+            _ready_mode = READY_MAIN;
         }
-        if( freopen( _redirect_fname, "a", stderr ) == NULL ) {
-            print_error( APR_FROM_OS_ERROR( errno ), "freopen stderr" );
+        else if( strcmp( mode, "notify" ) == 0 ) {
+            _ready_mode = READY_NOTIFY;
+        }
+        else if( strcmp( mode, "none" ) == 0 ) {
+            _ready_mode = READY_NONE;
+        }
+        else {
+            ERROR( "Invalid hashdot.daemonize.ready value [%s].", mode );
+            rv = 34;
         }
     }
+    return rv;
+}
+
+/**
+ * In the launching parent, wait for the daemon to report ready and
+ * exit 0, or exit with the daemon's own status if it exits first, or
+ * with 35 if not ready within hashdot.daemonize.timeout seconds.
+ */
+static void
+wait_ready( int fd, pid_t pid )
+{
+    apr_time_t start = apr_time_now();
+
+    int timeout = READY_TIMEOUT;
+    const char *val = NULL;
+    get_property_value( "hashdot.daemonize.timeout", 0, 0, &val );
+    if( val != NULL ) timeout = atoi( val );
+
+    apr_time_t deadline = start + apr_time_from_sec( timeout );
+
+    char buf[64];
+    int len = 0;
+    int ready = 0;
+    int eof = 0;
+
+    while( !ready && !eof ) {
+        apr_time_t now = apr_time_now();
+        if( ( timeout > 0 ) && ( now >= deadline ) ) break;
+
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int wait_ms = ( timeout > 0 ) ?
+            (int) apr_time_as_msec( deadline - now ) + 1 : -1;
+        int n = poll( &pfd, 1, wait_ms );
+        if( n < 0 ) {
+            if( errno == EINTR ) continue;
+            break;
+        }
+        if( n == 0 ) continue;
+
+        ssize_t r = read( fd, buf + len, sizeof( buf ) - 1 - len );
+        if( r < 0 ) {
+            if( errno == EINTR ) continue;
+            eof = 1;
+        }
+        else if( r == 0 ) {
+            eof = 1;
+        }
+        else {
+            len += r;
+            buf[len] = '\0';
+            ready = ( strstr( buf, "READY=1\n" ) != NULL );
+            if( len >= sizeof( buf ) - 1 ) len = 0;
+        }
+    }
+
+    double secs = ( apr_time_now() - start ) / 1000000.0;
+
+    if( ready ) {
+        fprintf( stderr, "HASHDOT: Daemon (pid %d) ready in %.3fs\n",
+                 (int) pid, secs );
+        exit( 0 );
+    }
+
+    if( eof ) {
+        int status = 0;
+        int code = 1;
+        while( waitpid( pid, &status, 0 ) < 0 ) {
+            if( errno != EINTR ) break;
+        }
+        if( WIFEXITED( status ) ) {
+            code = WEXITSTATUS( status );
+        }
+        else if( WIFSIGNALED( status ) ) {
+            code = 128 + WTERMSIG( status );
+        }
+        if( code != 0 ) {
+            ERROR( "Daemon (pid %d) exited with status %d before ready.",
+                   (int) pid, code );
+        }
+        exit( code );
+    }
+
+    ERROR( "Daemon (pid %d) not ready after %ds, terminating.",
+           (int) pid, timeout );
+    kill( pid, SIGTERM );
+    exit( 35 );
+}
+
+/**
+ * Report ready to the launching parent, if any, and to a service
+ * manager via $NOTIFY_SOCKET (as sd_notify), once only.
+ */
+static void
+send_ready()
+{
+    static int sent = 0;
+    if( sent ) return;
+    sent = 1;
+
+    if( _ready_fd >= 0 ) {
+        const char *msg = "READY=1\n";
+        if( send( _ready_fd, msg, strlen( msg ), MSG_NOSIGNAL ) < 0 ) {
+            DEBUG( "Ready not sent to parent: %s", strerror( errno ) );
+        }
+        close( _ready_fd );
+        _ready_fd = -1;
+    }
+
+    const char *path = getenv( "NOTIFY_SOCKET" );
+    if( ( path != NULL ) &&
+        ( ( path[0] == '/' ) || ( path[0] == '@' ) ) &&
+        ( strlen( path ) < sizeof( ((struct sockaddr_un *) 0)->sun_path ) ) ) {
+
+        struct sockaddr_un addr;
+        memset( &addr, 0, sizeof( addr ) );
+        addr.sun_family = AF_UNIX;
+        strcpy( addr.sun_path, path );
+        if( path[0] == '@' ) addr.sun_path[0] = '\0'; // Abstract namespace
+
+        socklen_t alen = offsetof( struct sockaddr_un, sun_path ) +
+            strlen( path );
+        char msg[64];
+        snprintf( msg, sizeof( msg ), "READY=1\nMAINPID=%d\n",
+                  (int) getpid() );
+
+        int sock = socket( AF_UNIX, SOCK_DGRAM, 0 );
+        if( ( sock < 0 ) ||
+            ( sendto( sock, msg, strlen( msg ), MSG_NOSIGNAL,
+                      (struct sockaddr *) &addr, alen ) < 0 ) ) {
+            DEBUG( "Ready not sent to %s: %s", path, strerror( errno ) );
+        }
+        if( sock >= 0 ) close( sock );
+    }
+
+    DEBUG( "Daemon ready." );
+}
+
+static void JNICALL
+daemon_ready( JNIEnv *env, jclass cls )
+{
+    send_ready();
+    launch_ready();
+}
+
+static void reopen_streams( int signo )
+{
+    apr_status_t rv = reopen_redirect();
+    if( rv != APR_SUCCESS ) print_error( rv, "reopen stdout/stderr" );
 }
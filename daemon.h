@@ -38,7 +38,13 @@
 
 #include <apr_general.h>
 
+#include <jni.h>
+
 apr_status_t install_hup_handler();
+apr_status_t reopen_redirect();
 apr_status_t check_daemonize();
+apr_status_t define_daemon_class( JNIEnv *env );
+void main_ready();
+void notify_ready();
 
 #endif
@@ -0,0 +1,616 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <apr_strings.h>
+#include <apr_fnmatch.h>
+#include <apr_hash.h>
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "dirscan.h"
+
+// Pending directories before scanning continues on multiple threads
+#define PARALLEL_THRESHOLD 16
+
+// Default limit of scan threads (hashdot.glob.threads = auto)
+#define MAX_THREADS 8
+
+// Directory entry buffer, per scanning thread
+#define DENTS_SIZE 32768
+
+typedef enum { ENT_FILE, ENT_DIR, ENT_OTHER } ent_type_t;
+
+// A directory to be read, matching segment seg of the pattern.
+typedef struct {
+    const char *dir;
+    int seg;
+} scan_t;
+
+typedef struct {
+    const char **segs;
+    int nsegs;
+    apr_pool_t *pool;           // Of queue
+    apr_array_header_t *queue;  // scan_t
+    int head;
+    int busy;                   // Scans in progress
+    apr_thread_mutex_t *lock;   // Guards the above, once threaded
+    apr_thread_cond_t *cond;
+} scanner_t;
+
+typedef struct {
+    scanner_t *sc;
+    apr_pool_t *pool;
+    apr_array_header_t *matches;
+    char *dents;
+} scan_worker_t;
+
+#ifdef __linux__
+// As returned by getdents64(2)
+typedef struct {
+    apr_uint64_t d_ino;
+    apr_int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} dirent64_t;
+#endif
+
+static int _threads = 0;
+
+static void
+expand_braces( const char *pattern, apr_pool_t *pool,
+               apr_array_header_t *alts );
+
+static int
+split_path( const char *path, apr_pool_t *pool, const char ***segs );
+
+static apr_status_t
+scan_pattern( const char *pattern, apr_array_header_t *matches );
+
+static void
+scan_dir( scan_worker_t *w, scan_t *scan );
+
+static void * APR_THREAD_FUNC
+scan_thread( apr_thread_t *thread, void *data );
+
+static void
+scan_loop( scan_worker_t *w );
+
+static int
+compare_paths( const void *a, const void *b );
+
+/**
+ * True if pattern has wildcards (including **) or {a,b} alternatives.
+ */
+int dirscan_test( const char *pattern )
+{
+    if( apr_fnmatch_test( pattern ) ) return 1;
+
+    const char *open = strchr( pattern, '{' );
+    return ( open != NULL ) && ( strchr( open, ',' ) != NULL ) &&
+        ( strchr( open, '}' ) != NULL );
+}
+
+/**
+ * Return the paths matching pattern, which may use *, ? and [...] in
+ * any path segment, ** for zero or more directories, and {a,b}
+ * alternatives. Matches of each alternative are sorted by path,
+ * alternatives in the order given, without duplicates.
+ */
+apr_status_t dirscan_glob( const char *pattern,
+                           apr_array_header_t **matches )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i, j;
+
+    if( _threads == 0 ) {
+        const char *val = NULL;
+        rv = get_property_value( "hashdot.glob.threads", 0, 0, &val );
+        if( rv != APR_SUCCESS ) return rv;
+        if( ( val == NULL ) || ( strcmp( val, "auto" ) == 0 ) ) {
+            _threads = (int) sysconf( _SC_NPROCESSORS_ONLN );
+            if( _threads > MAX_THREADS ) _threads = MAX_THREADS;
+        }
+        else {
+            _threads = atoi( val );
+        }
+        if( _threads < 1 ) _threads = 1;
+    }
+
+    apr_array_header_t *alts = apr_array_make( _mp, 4, sizeof( const char * ) );
+    expand_braces( pattern, _mp, alts );
+
+    *matches = apr_array_make( _mp, 16, sizeof( const char * ) );
+    apr_hash_t *seen = ( alts->nelts > 1 ) ? apr_hash_make( _mp ) : NULL;
+
+    for( i = 0; ( i < alts->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+        apr_array_header_t *found =
+            apr_array_make( _mp, 16, sizeof( const char * ) );
+        rv = scan_pattern( ((const char **) alts->elts )[i], found );
+
+        qsort( found->elts, found->nelts, sizeof( const char * ),
+               compare_paths );
+
+        for( j = 0; j < found->nelts; j++ ) {
+            const char *path = ((const char **) found->elts )[j];
+            if( seen != NULL ) {
+                if( apr_hash_get( seen, path, APR_HASH_KEY_STRING ) ) continue;
+                apr_hash_set( seen, path, APR_HASH_KEY_STRING, path );
+            }
+            *(const char **) apr_array_push( *matches ) = path;
+        }
+    }
+
+    return rv;
+}
+
+static int
+match_segs( const char **pats, int npats, const char **segs, int nsegs )
+{
+    if( npats == 0 ) return ( nsegs == 0 );
+
+    if( strcmp( pats[0], "**" ) == 0 ) {
+        int k;
+        for( k = 0; k <= nsegs; k++ ) {
+            if( match_segs( pats + 1, npats - 1, segs + k, nsegs - k ) ) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    return ( nsegs > 0 ) &&
+        ( apr_fnmatch( pats[0], segs[0], 0 ) == APR_SUCCESS ) &&
+        match_segs( pats + 1, npats - 1, segs + 1, nsegs - 1 );
+}
+
+/**
+ * True if path matches pattern, with the same syntax as dirscan_glob,
+ * without reference to the file system.
+ */
+int dirscan_match( const char *pattern, const char *path )
+{
+    apr_pool_t *pool = NULL;
+    int i;
+    int matched = 0;
+
+    if( apr_pool_create( &pool, _mp ) != APR_SUCCESS ) return 0;
+
+    apr_array_header_t *alts = apr_array_make( pool, 4, sizeof( const char * ) );
+    expand_braces( pattern, pool, alts );
+
+    const char **segs = NULL;
+    int nsegs = split_path( path, pool, &segs );
+
+    for( i = 0; ( i < alts->nelts ) && !matched; i++ ) {
+        const char *alt = ((const char **) alts->elts )[i];
+        const char **pats = NULL;
+        int npats = split_path( alt, pool, &pats );
+        // A relative pattern starting with ** matches anywhere, so
+        // also absolute paths.
+        int anywhere = ( alt[0] != '/' ) && ( npats > 0 ) &&
+            ( strcmp( pats[0], "**" ) == 0 );
+        matched = ( anywhere ||
+                    ( ( alt[0] == '/' ) == ( path[0] == '/' ) ) ) &&
+            match_segs( pats, npats, segs, nsegs );
+    }
+
+    apr_pool_destroy( pool );
+    return matched;
+}
+
+/**
+ * Expand the first {a,b} group of pattern (recursively, for any
+ * others) into alts.
+ */
+static void
+expand_braces( const char *pattern, apr_pool_t *pool,
+               apr_array_header_t *alts )
+{
+    const char *open = NULL;
+    const char *close = NULL;
+    const char *p;
+    int depth = 0;
+
+    for( p = pattern; ( *p != '\0' ) && ( close == NULL ); p++ ) {
+        if( ( *p == '\\' ) && ( p[1] != '\0' ) ) {
+            p++;
+        }
+        else if( *p == '{' ) {
+            if( depth++ == 0 ) open = p;
+        }
+        else if( ( *p == '}' ) && ( depth > 0 ) ) {
+            if( --depth == 0 ) close = p;
+        }
+    }
+
+    if( close == NULL ) {
+        *(const char **) apr_array_push( alts ) = pattern;
+        return;
+    }
+
+    const char *prefix = apr_pstrndup( pool, pattern, open - pattern );
+    const char *alt = open + 1;
+    depth = 0;
+    for( p = alt; p <= close; p++ ) {
+        if( ( *p == '\\' ) && ( p < close ) ) {
+            p++;
+        }
+        else if( *p == '{' ) {
+            depth++;
+        }
+        else if( ( *p == '}' ) && ( p < close ) ) {
+            depth--;
+        }
+        else if( ( ( *p == ',' ) && ( depth == 0 ) ) || ( p == close ) ) {
+            expand_braces( apr_pstrcat( pool, prefix,
+                                        apr_pstrndup( pool, alt, p - alt ),
+                                        close + 1, NULL ),
+                           pool, alts );
+            alt = p + 1;
+        }
+    }
+}
+
+// Split path into its non-empty segments, returning the count.
+static int
+split_path( const char *path, apr_pool_t *pool, const char ***segs )
+{
+    char *buf = apr_pstrdup( pool, path );
+    apr_array_header_t *arr = apr_array_make( pool, 8, sizeof( const char * ) );
+    char *last = NULL;
+    char *seg = apr_strtok( buf, "/", &last );
+    while( seg != NULL ) {
+        *(const char **) apr_array_push( arr ) = seg;
+        seg = apr_strtok( NULL, "/", &last );
+    }
+    *segs = (const char **) arr->elts;
+    return arr->nelts;
+}
+
+static const char *
+join_path( apr_pool_t *pool, const char *dir, const char *name )
+{
+    apr_size_t len = strlen( dir );
+    if( len == 0 ) return apr_pstrdup( pool, name );
+    if( dir[len - 1] == '/' ) return apr_pstrcat( pool, dir, name, NULL );
+    return apr_pstrcat( pool, dir, "/", name, NULL );
+}
+
+static apr_status_t
+scan_pattern( const char *pattern, apr_array_header_t *matches )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    scanner_t sc;
+    memset( &sc, 0, sizeof( sc ) );
+
+    rv = apr_pool_create( &sc.pool, _mp );
+    if( rv != APR_SUCCESS ) return rv;
+
+    sc.nsegs = split_path( pattern, _mp, &sc.segs );
+
+    // Leading segments without wildcards are the base directory.
+    const char *base = ( pattern[0] == '/' ) ? "/" : "";
+    while( ( sc.nsegs > 0 ) && !apr_fnmatch_test( sc.segs[0] ) ) {
+        if( sc.nsegs == 1 ) {
+            // Literal pattern (an alternative without wildcards)
+            const char *path = join_path( _mp, base, sc.segs[0] );
+            if( access( path, F_OK ) == 0 ) {
+                *(const char **) apr_array_push( matches ) = path;
+            }
+            apr_pool_destroy( sc.pool );
+            return rv;
+        }
+        base = join_path( _mp, base, sc.segs[0] );
+        sc.segs++;
+        sc.nsegs--;
+    }
+
+    sc.queue = apr_array_make( sc.pool, 64, sizeof( scan_t ) );
+    scan_t *first = apr_array_push( sc.queue );
+    first->dir = base;
+    first->seg = 0;
+
+    scan_worker_t main_worker = { &sc, _mp, matches,
+                                  apr_palloc( _mp, DENTS_SIZE ) };
+
+    // Scan on this thread alone until there is enough to share.
+    while( sc.head < sc.queue->nelts ) {
+        if( ( _threads > 1 ) &&
+            ( sc.queue->nelts - sc.head >= PARALLEL_THRESHOLD ) ) break;
+        scan_t scan = ((scan_t *) sc.queue->elts )[ sc.head++ ];
+        scan_dir( &main_worker, &scan );
+    }
+
+    if( sc.head < sc.queue->nelts ) {
+        int count = _threads - 1;
+        scan_worker_t workers[ count ];
+        apr_thread_t *threads[ count ];
+        int started = 0;
+
+        rv = apr_thread_mutex_create( &sc.lock, APR_THREAD_MUTEX_DEFAULT,
+                                      sc.pool );
+        if( rv == APR_SUCCESS ) {
+            rv = apr_thread_cond_create( &sc.cond, sc.pool );
+        }
+
+        for( i = 0; ( i < count ) && ( rv == APR_SUCCESS ); i++ ) {
+            workers[i].sc = &sc;
+            rv = apr_pool_create( &workers[i].pool, _mp );
+            if( rv != APR_SUCCESS ) break;
+            workers[i].matches = apr_array_make( workers[i].pool, 64,
+                                                 sizeof( const char * ) );
+            workers[i].dents = apr_palloc( workers[i].pool, DENTS_SIZE );
+            rv = apr_thread_create( &threads[i], NULL, scan_thread,
+                                    &workers[i], sc.pool );
+            if( rv != APR_SUCCESS ) {
+                print_error( rv, "glob scan thread" );
+                break;
+            }
+            ++started;
+        }
+
+        DEBUG( "Scanning %s on %d threads", pattern, started + 1 );
+
+        // Also completes the scan, if threads could not be started.
+        if( sc.lock == NULL ) {
+            while( sc.head < sc.queue->nelts ) {
+                scan_t scan = ((scan_t *) sc.queue->elts )[ sc.head++ ];
+                scan_dir( &main_worker, &scan );
+            }
+        }
+        else {
+            scan_loop( &main_worker );
+        }
+
+        for( i = 0; i < started; i++ ) {
+            apr_status_t trv;
+            apr_thread_join( &trv, threads[i] );
+            apr_array_cat( matches, workers[i].matches );
+        }
+        rv = APR_SUCCESS;
+    }
+
+    apr_pool_destroy( sc.pool );
+
+    return rv;
+}
+
+static void * APR_THREAD_FUNC
+scan_thread( apr_thread_t *thread, void *data )
+{
+    scan_loop( data );
+    return NULL;
+}
+
+// Take and scan queued directories until none remain in progress.
+static void
+scan_loop( scan_worker_t *w )
+{
+    scanner_t *sc = w->sc;
+
+    apr_thread_mutex_lock( sc->lock );
+    while( 1 ) {
+        if( sc->head < sc->queue->nelts ) {
+            scan_t scan = ((scan_t *) sc->queue->elts )[ sc->head++ ];
+            sc->busy++;
+            apr_thread_mutex_unlock( sc->lock );
+
+            scan_dir( w, &scan );
+
+            apr_thread_mutex_lock( sc->lock );
+            sc->busy--;
+            if( ( sc->busy == 0 ) && ( sc->head == sc->queue->nelts ) ) {
+                apr_thread_cond_broadcast( sc->cond );
+            }
+        }
+        else if( sc->busy == 0 ) {
+            break;
+        }
+        else {
+            apr_thread_cond_wait( sc->cond, sc->lock );
+        }
+    }
+    apr_thread_mutex_unlock( sc->lock );
+}
+
+static void
+add_scan( scan_worker_t *w, const char *dir, int seg )
+{
+    scanner_t *sc = w->sc;
+
+    if( sc->lock != NULL ) apr_thread_mutex_lock( sc->lock );
+
+    scan_t *scan = apr_array_push( sc->queue );
+    scan->dir = dir;
+    scan->seg = seg;
+
+    if( sc->lock != NULL ) {
+        apr_thread_cond_signal( sc->cond );
+        apr_thread_mutex_unlock( sc->lock );
+    }
+}
+
+static int
+is_dir( const char *path, ent_type_t type, int follow )
+{
+    if( type != ENT_OTHER ) return ( type == ENT_DIR );
+
+    struct stat st;
+    int rc = follow ? stat( path, &st ) : lstat( path, &st );
+    return ( rc == 0 ) && S_ISDIR( st.st_mode );
+}
+
+// Match an entry name of scan->dir against pattern segment seg.
+static void
+match_entry( scan_worker_t *w, scan_t *scan, int seg,
+             const char *name, ent_type_t type )
+{
+    scanner_t *sc = w->sc;
+
+    if( ( strcmp( name, "." ) == 0 ) || ( strcmp( name, ".." ) == 0 ) ) {
+        return;
+    }
+
+    if( seg == sc->nsegs ) {
+        // Trailing **: all files below
+        const char *path = join_path( w->pool, scan->dir, name );
+        if( !is_dir( path, type, 1 ) ) {
+            *(const char **) apr_array_push( w->matches ) = path;
+        }
+        return;
+    }
+
+    if( apr_fnmatch( sc->segs[seg], name, 0 ) != APR_SUCCESS ) return;
+
+    const char *path = join_path( w->pool, scan->dir, name );
+    if( seg == sc->nsegs - 1 ) {
+        *(const char **) apr_array_push( w->matches ) = path;
+    }
+    else if( is_dir( path, type, 1 ) ) {
+        add_scan( w, path, seg + 1 );
+    }
+}
+
+static void
+scan_entry( scan_worker_t *w, scan_t *scan,
+            const char *name, ent_type_t type )
+{
+    scanner_t *sc = w->sc;
+
+    if( strcmp( sc->segs[ scan->seg ], "**" ) != 0 ) {
+        match_entry( w, scan, scan->seg, name, type );
+        return;
+    }
+
+    // Descend into (not hidden, not linked) directories for the same
+    // **, and match the segment after it here.
+    if( ( name[0] != '.' ) && ( type != ENT_FILE ) ) {
+        const char *path = join_path( w->pool, scan->dir, name );
+        if( is_dir( path, type, 0 ) ) {
+            add_scan( w, path, scan->seg );
+        }
+    }
+
+    int next = scan->seg + 1;
+    while( ( next < sc->nsegs ) && ( strcmp( sc->segs[next], "**" ) == 0 ) ) {
+        next++;
+    }
+    match_entry( w, scan, next, name, type );
+}
+
+static ent_type_t
+entry_type( unsigned char d_type )
+{
+    switch( d_type ) {
+    case DT_DIR:     return ENT_DIR;
+    case DT_LNK:
+    case DT_UNKNOWN: return ENT_OTHER;
+    default:         return ENT_FILE;
+    }
+}
+
+// Read the entries of scan->dir (types from the directory, without a
+// stat per entry where the file system provides them).
+static void
+scan_dir( scan_worker_t *w, scan_t *scan )
+{
+    scanner_t *sc = w->sc;
+    const char *seg = sc->segs[ scan->seg ];
+
+    // A literal segment needs no directory read.
+    if( !apr_fnmatch_test( seg ) ) {
+        const char *path = join_path( w->pool, scan->dir, seg );
+        if( scan->seg == sc->nsegs - 1 ) {
+            if( access( path, F_OK ) == 0 ) {
+                *(const char **) apr_array_push( w->matches ) = path;
+            }
+        }
+        else {
+            add_scan( w, path, scan->seg + 1 );
+        }
+        return;
+    }
+
+    const char *dname = ( scan->dir[0] != '\0' ) ? scan->dir : ".";
+
+#ifdef __linux__
+    int fd = open( dname, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if( fd < 0 ) return;
+
+    long n;
+    while( ( n = syscall( SYS_getdents64, fd, w->dents, DENTS_SIZE ) ) > 0 ) {
+        long off = 0;
+        while( off < n ) {
+            dirent64_t *d = (dirent64_t *) ( w->dents + off );
+            off += d->d_reclen;
+            scan_entry( w, scan, d->d_name, entry_type( d->d_type ) );
+        }
+    }
+    close( fd );
+#else
+    DIR *dir = opendir( dname );
+    if( dir == NULL ) return;
+
+    struct dirent *d;
+    while( ( d = readdir( dir ) ) != NULL ) {
+        scan_entry( w, scan, d->d_name, entry_type( d->d_type ) );
+    }
+    closedir( dir );
+#endif
+}
+
+static int
+compare_paths( const void *a, const void *b )
+{
+    return strcmp( *(const char **) a, *(const char **) b );
+}
@@ -0,0 +1,137 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * libhashdot: Embedding API
+ *
+ * Resolves profiles, a script header and property expressions into
+ * JVM options exactly as the hashdot launcher does, and creates the
+ * JVM in the calling process. Functions return 0 on success or a
+ * hashdot error code (as the launcher exit status), with messages
+ * written to standard error.
+ *
+ * Profiles are read from the compiled in profile directory. The
+ * library uses process wide state: calls must be made from one thread,
+ * and a JVM may only be created once per process. Any
+ * hashdot.vm.libpath must already be in the embedding process
+ * LD_LIBRARY_PATH, since it can not be re-executed.
+ */
+
+#ifndef _HASHDOT_H
+#define _HASHDOT_H
+
+#include <jni.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HASHDOT_API_VERSION 1
+
+#if defined(__GNUC__)
+#  define HASHDOT_API __attribute__((visibility("default")))
+#else
+#  define HASHDOT_API
+#endif
+
+typedef struct hashdot_options hashdot_options_t;
+
+/**
+ * Initialize the library. Must be called first.
+ */
+HASHDOT_API int hashdot_initialize( void );
+
+/**
+ * Resolve the "default" profile, then each of the NULL terminated
+ * profiles, then the header of script (if not NULL), then each of the
+ * NULL terminated property expressions (as in a profile, for example
+ * "hashdot.main = org.example.Main") into options. Either list may be
+ * NULL.
+ */
+HASHDOT_API int hashdot_resolve( const char * const *profiles,
+                                 const char *script,
+                                 const char * const *props,
+                                 hashdot_options_t **options );
+
+/**
+ * The number of resolved JVM option strings.
+ */
+HASHDOT_API int hashdot_option_count( const hashdot_options_t *options );
+
+/**
+ * The resolved JVM option string at index.
+ */
+HASHDOT_API const char *hashdot_option( const hashdot_options_t *options,
+                                        int index );
+
+/**
+ * The resolved value of property name (multiple values joined with a
+ * space) or NULL if not set.
+ */
+HASHDOT_API const char *hashdot_property( const hashdot_options_t *options,
+                                          const char *name );
+
+/**
+ * Set any hashdot.env.* variables and create the JVM from options
+ * with the resolved hashdot.vm.lib.
+ */
+HASHDOT_API int hashdot_create_vm( const hashdot_options_t *options,
+                                   JavaVM **vm,
+                                   JNIEnv **env );
+
+/**
+ * Call the static main( String[] ) of the resolved hashdot.main class
+ * with any hashdot.args.pre and then argv. Returns non-zero if an
+ * exception was thrown.
+ */
+HASHDOT_API int hashdot_call_main( JNIEnv *env,
+                                   int argc,
+                                   const char *argv[] );
+
+/**
+ * Release all library resources. Any options are invalid after.
+ */
+HASHDOT_API void hashdot_terminate( void );
+
+/**
+ * Run the complete hashdot launcher, as for the hashdot binary.
+ */
+HASHDOT_API int hashdot_main( int argc, const char *argv[] );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
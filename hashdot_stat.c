@@ -0,0 +1,520 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * hashdot-stat: Monitor hashdot launched JVMs by reading their
+ * HotSpot perf data (hsperfdata) files, which the JVM keeps updated
+ * in shared memory. Reading these needs no attach, so has no cost in
+ * the target JVM. Depends only on libc.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "perfdata.h"
+
+#define MAX_TARGETS 1024
+
+typedef struct {
+    long long frequency;          // Ticks per second
+    long long vm_begin;           // Epoch ms
+    long long eden_used, eden_cap;
+    long long s0_used, s0_cap, s1_used, s1_cap;
+    long long old_used, old_cap;
+    long long meta_used, meta_cap;
+    long long ygc, ygc_time;      // Ticks
+    long long fgc, fgc_time;
+    long long cls_loaded, cls_unloaded, cls_time;
+    long long jit_compiles, jit_time;
+    long long safepoints, safepoint_time, safepoint_sync_time;
+    long long threads;
+} counters_t;
+
+static const struct {
+    const char *name;
+    size_t offset;
+} COUNTERS[] = {
+    { "sun.os.hrt.frequency",                  offsetof( counters_t, frequency ) },
+    { "sun.rt.createVmBeginTime",              offsetof( counters_t, vm_begin ) },
+    { "sun.gc.generation.0.space.0.used",      offsetof( counters_t, eden_used ) },
+    { "sun.gc.generation.0.space.0.capacity",  offsetof( counters_t, eden_cap ) },
+    { "sun.gc.generation.0.space.1.used",      offsetof( counters_t, s0_used ) },
+    { "sun.gc.generation.0.space.1.capacity",  offsetof( counters_t, s0_cap ) },
+    { "sun.gc.generation.0.space.2.used",      offsetof( counters_t, s1_used ) },
+    { "sun.gc.generation.0.space.2.capacity",  offsetof( counters_t, s1_cap ) },
+    { "sun.gc.generation.1.space.0.used",      offsetof( counters_t, old_used ) },
+    { "sun.gc.generation.1.space.0.capacity",  offsetof( counters_t, old_cap ) },
+    { "sun.gc.metaspace.used",                 offsetof( counters_t, meta_used ) },
+    { "sun.gc.metaspace.capacity",             offsetof( counters_t, meta_cap ) },
+    { "sun.gc.collector.0.invocations",        offsetof( counters_t, ygc ) },
+    { "sun.gc.collector.0.time",               offsetof( counters_t, ygc_time ) },
+    { "sun.gc.collector.1.invocations",        offsetof( counters_t, fgc ) },
+    { "sun.gc.collector.1.time",               offsetof( counters_t, fgc_time ) },
+    { "java.cls.loadedClasses",                offsetof( counters_t, cls_loaded ) },
+    { "java.cls.unloadedClasses",              offsetof( counters_t, cls_unloaded ) },
+    { "sun.cls.time",                          offsetof( counters_t, cls_time ) },
+    { "sun.ci.totalCompiles",                  offsetof( counters_t, jit_compiles ) },
+    { "java.ci.totalTime",                     offsetof( counters_t, jit_time ) },
+    { "sun.rt.safepoints",                     offsetof( counters_t, safepoints ) },
+    { "sun.rt.safepointTime",                  offsetof( counters_t, safepoint_time ) },
+    { "sun.rt.safepointSyncTime",              offsetof( counters_t, safepoint_sync_time ) },
+    { "java.threads.live",                     offsetof( counters_t, threads ) },
+    { NULL, 0 }
+};
+
+typedef struct {
+    int pid;
+    char name[ 64 ];
+    char path[ PATH_MAX ];
+    int seen;                 // In the current scan
+    int have_prev;
+    double prev_time;
+    counters_t prev;
+    counters_t cur;
+    const char *status;       // Why there are no counters, or NULL
+} target_t;
+
+static target_t _targets[ MAX_TARGETS ];
+static int _ntargets = 0;
+
+static int _all = 0;
+static int _json = 0;
+
+static double
+monotonic()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+usage( const char *prog )
+{
+    fprintf( stderr,
+             "Usage: %s [-j] [-a] [-i seconds] [-n count] "
+             "[-p pid-file]... [pid]...\n"
+             "  -j  JSON output, one object per JVM per sample\n"
+             "  -a  all JVMs with perf data, not only hashdot launched\n"
+             "  -i  seconds between samples (default 1)\n"
+             "  -n  number of samples (default: until interrupted)\n"
+             "  -p  monitor the pid in a hashdot.pid_file\n",
+             prog );
+}
+
+static target_t *
+add_target( int pid )
+{
+    int i;
+    for( i = 0; i < _ntargets; i++ ) {
+        if( _targets[i].pid == pid ) {
+            _targets[i].seen = 1;
+            return &_targets[i];
+        }
+    }
+    if( _ntargets == MAX_TARGETS ) return NULL;
+
+    target_t *t = &_targets[ _ntargets++ ];
+    memset( t, 0, sizeof( *t ) );
+    t->pid = pid;
+    t->seen = 1;
+
+    // Process name, as set by hashdot to the script name
+    char fname[ 64 ];
+    snprintf( fname, sizeof( fname ), "/proc/%d/comm", pid );
+    FILE *in = fopen( fname, "r" );
+    if( in != NULL ) {
+        if( fgets( t->name, sizeof( t->name ), in ) != NULL ) {
+            t->name[ strcspn( t->name, "\n" ) ] = '\0';
+        }
+        fclose( in );
+    }
+
+    perfdata_path( pid, t->path, sizeof( t->path ) );
+
+    return t;
+}
+
+static int
+is_hashdot( int pid )
+{
+    char fname[ 64 ];
+    char exe[ PATH_MAX ];
+    snprintf( fname, sizeof( fname ), "/proc/%d/exe", pid );
+    ssize_t len = readlink( fname, exe, sizeof( exe ) - 1 );
+    if( len <= 0 ) return 0;
+    exe[len] = '\0';
+
+    const char *base = strrchr( exe, '/' );
+    base = ( base != NULL ) ? base + 1 : exe;
+    return ( strcmp( base, "hashdot" ) == 0 );
+}
+
+// Find hashdot (or with -a, all) JVM processes.
+static void
+scan_processes()
+{
+    DIR *dir = opendir( "/proc" );
+    if( dir == NULL ) return;
+
+    struct dirent *d;
+    while( ( d = readdir( dir ) ) != NULL ) {
+        char *end = NULL;
+        long pid = strtol( d->d_name, &end, 10 );
+        if( ( *end != '\0' ) || ( pid <= 0 ) ) continue;
+        if( _all ) {
+            char path[ PATH_MAX ];
+            if( ( perfdata_path( (int) pid, path, sizeof( path ) ) !=
+                  PERFDATA_OK ) || ( access( path, R_OK ) != 0 ) ) continue;
+        }
+        else if( !is_hashdot( (int) pid ) ) {
+            continue;
+        }
+        add_target( (int) pid );
+    }
+    closedir( dir );
+}
+
+static int
+read_pid_file( const char *fname )
+{
+    int pid = 0;
+    FILE *in = fopen( fname, "r" );
+    if( in != NULL ) {
+        if( fscanf( in, "%d", &pid ) != 1 ) pid = 0;
+        fclose( in );
+    }
+    if( pid <= 0 ) {
+        fprintf( stderr, "HASHDOT WARN: No pid in %s\n", fname );
+    }
+    return pid;
+}
+
+// Read the counters of t from its perf data file.
+static int
+read_counters( target_t *t )
+{
+    perfdata_t pd;
+    int prv = perfdata_open( t->path, &pd );
+
+    t->status = NULL;
+    if( prv == PERFDATA_NOFILE ) {
+        int alive = ( kill( t->pid, 0 ) == 0 ) || ( errno == EPERM );
+        t->status = alive ? "no perf data (-XX:-UsePerfData?)" : "exited";
+        return 0;
+    }
+    if( prv != PERFDATA_OK ) {
+        t->status = "unsupported perf data";
+        return 0;
+    }
+
+    if( !perfdata_accessible( &pd ) ) {
+        t->status = "starting";
+    }
+    else {
+        int c;
+        for( c = 0; COUNTERS[c].name != NULL; c++ ) {
+            const volatile long long *v = perfdata_long( &pd, COUNTERS[c].name );
+            *(long long *) ( (char *) &t->cur + COUNTERS[c].offset ) =
+                ( v != NULL ) ? *v : 0;
+        }
+        if( t->cur.frequency <= 0 ) t->cur.frequency = 1000000000LL;
+    }
+
+    perfdata_close( &pd );
+    return ( t->status == NULL );
+}
+
+static double
+ms( const counters_t *c, long long ticks )
+{
+    return ticks * 1000.0 / c->frequency;
+}
+
+static double
+mb( long long bytes )
+{
+    return bytes / ( 1024.0 * 1024.0 );
+}
+
+static void
+print_json_string( const char *s )
+{
+    putchar( '"' );
+    for( ; *s != '\0'; s++ ) {
+        if( ( *s == '"' ) || ( *s == '\\' ) ) printf( "\\%c", *s );
+        else if( (unsigned char) *s < 0x20 ) printf( "\\u%04x", *s );
+        else putchar( *s );
+    }
+    putchar( '"' );
+}
+
+static void
+print_json_rate( const char *key, int have, double value )
+{
+    if( have ) printf( ",\"%s\":%.3f", key, value );
+    else printf( ",\"%s\":null", key );
+}
+
+static void
+print_json( target_t *t, double now, long long epoch_ms )
+{
+    const counters_t *c = &t->cur;
+    const counters_t *p = &t->prev;
+    double dt = now - t->prev_time;
+    int rates = t->have_prev && ( dt > 0 );
+
+    printf( "{\"time\":%lld,\"pid\":%d,\"name\":", epoch_ms, t->pid );
+    print_json_string( t->name );
+    if( t->status != NULL ) {
+        printf( ",\"status\":" );
+        print_json_string( t->status );
+        printf( "}\n" );
+        return;
+    }
+    printf( ",\"uptime_s\":%.3f,\"threads\":%lld",
+            ( c->vm_begin > 0 ) ? ( epoch_ms - c->vm_begin ) / 1000.0 : 0.0,
+            c->threads );
+    printf( ",\"heap\":{"
+            "\"eden\":{\"used\":%lld,\"capacity\":%lld},"
+            "\"survivor\":{\"used\":%lld,\"capacity\":%lld},"
+            "\"old\":{\"used\":%lld,\"capacity\":%lld},"
+            "\"metaspace\":{\"used\":%lld,\"capacity\":%lld}}",
+            c->eden_used, c->eden_cap,
+            c->s0_used + c->s1_used, c->s0_cap + c->s1_cap,
+            c->old_used, c->old_cap,
+            c->meta_used, c->meta_cap );
+    printf( ",\"gc\":{\"young\":{\"count\":%lld,\"time_ms\":%.3f},"
+            "\"full\":{\"count\":%lld,\"time_ms\":%.3f}",
+            c->ygc, ms( c, c->ygc_time ), c->fgc, ms( c, c->fgc_time ) );
+    print_json_rate( "per_s", rates, ( c->ygc + c->fgc - p->ygc - p->fgc ) / dt );
+    print_json_rate( "time_pct", rates,
+                     ms( c, c->ygc_time + c->fgc_time -
+                            p->ygc_time - p->fgc_time ) / ( dt * 10.0 ) );
+    printf( "},\"classes\":{\"loaded\":%lld,\"unloaded\":%lld,\"time_ms\":%.3f",
+            c->cls_loaded, c->cls_unloaded, ms( c, c->cls_time ) );
+    print_json_rate( "per_s", rates, ( c->cls_loaded - p->cls_loaded ) / dt );
+    printf( "},\"jit\":{\"compiles\":%lld,\"time_ms\":%.3f",
+            c->jit_compiles, ms( c, c->jit_time ) );
+    print_json_rate( "per_s", rates, ( c->jit_compiles - p->jit_compiles ) / dt );
+    print_json_rate( "time_pct", rates,
+                     ms( c, c->jit_time - p->jit_time ) / ( dt * 10.0 ) );
+    printf( "},\"safepoints\":{\"count\":%lld,\"time_ms\":%.3f,\"sync_ms\":%.3f",
+            c->safepoints, ms( c, c->safepoint_time ),
+            ms( c, c->safepoint_sync_time ) );
+    print_json_rate( "per_s", rates, ( c->safepoints - p->safepoints ) / dt );
+    print_json_rate( "time_pct", rates,
+                     ms( c, c->safepoint_time - p->safepoint_time ) /
+                     ( dt * 10.0 ) );
+    printf( "}}\n" );
+}
+
+static void
+print_uptime( char *buf, size_t len, long long seconds )
+{
+    if( seconds >= 86400 ) {
+        snprintf( buf, len, "%lldd%02lldh", seconds / 86400,
+                  ( seconds % 86400 ) / 3600 );
+    }
+    else if( seconds >= 3600 ) {
+        snprintf( buf, len, "%lldh%02lldm", seconds / 3600,
+                  ( seconds % 3600 ) / 60 );
+    }
+    else {
+        snprintf( buf, len, "%lldm%02llds", seconds / 60, seconds % 60 );
+    }
+}
+
+static void
+print_row( target_t *t, double now, long long epoch_ms )
+{
+    const counters_t *c = &t->cur;
+    const counters_t *p = &t->prev;
+
+    printf( "%7d %-16.16s ", t->pid, t->name );
+    if( t->status != NULL ) {
+        printf( "%s\n", t->status );
+        return;
+    }
+
+    char up[ 32 ];
+    print_uptime( up, sizeof( up ),
+                  ( c->vm_begin > 0 ) ? ( epoch_ms - c->vm_begin ) / 1000 : 0 );
+
+    long long heap_cap = c->eden_cap + c->s0_cap + c->s1_cap + c->old_cap;
+    long long heap_used = c->eden_used + c->s0_used + c->s1_used + c->old_used;
+
+    printf( "%8s %8.1f %8.1f %5.1f %7.1f %6lld %5lld %8.0f ",
+            up, mb( heap_used ), mb( heap_cap ),
+            ( c->old_cap > 0 ) ? c->old_used * 100.0 / c->old_cap : 0.0,
+            mb( c->meta_used ), c->ygc, c->fgc,
+            ms( c, c->ygc_time + c->fgc_time ) );
+
+    double dt = now - t->prev_time;
+    if( t->have_prev && ( dt > 0 ) ) {
+        printf( "%5.1f ", ms( c, c->ygc_time + c->fgc_time -
+                                 p->ygc_time - p->fgc_time ) / ( dt * 10.0 ) );
+    }
+    else printf( "%5s ", "-" );
+
+    printf( "%7lld ", c->cls_loaded );
+    if( t->have_prev && ( dt > 0 ) ) {
+        printf( "%7.1f ", ( c->cls_loaded - p->cls_loaded ) / dt );
+    }
+    else printf( "%7s ", "-" );
+
+    printf( "%8.0f ", ms( c, c->jit_time ) );
+    if( t->have_prev && ( dt > 0 ) ) {
+        printf( "%5.1f ", ms( c, c->jit_time - p->jit_time ) / ( dt * 10.0 ) );
+    }
+    else printf( "%5s ", "-" );
+
+    printf( "%7lld %7.0f\n", c->safepoints, ms( c, c->safepoint_time ) );
+}
+
+static void
+print_header( int count, double interval )
+{
+    time_t now = time( NULL );
+    char when[ 16 ];
+    strftime( when, sizeof( when ), "%H:%M:%S", localtime( &now ) );
+
+    // Clear and home, top-style
+    printf( "\033[H\033[2J" );
+    printf( "hashdot-stat  %s  %d JVM%s  interval %.1fs\n\n",
+            when, count, ( count == 1 ) ? "" : "s", interval );
+    printf( "%7s %-16s %8s %8s %8s %5s %7s %6s %5s %8s %5s "
+            "%7s %7s %8s %5s %7s %7s\n",
+            "PID", "NAME", "UPTIME", "HEAP MB", "CAP MB", "OLD%", "META MB",
+            "YGC", "FGC", "GC ms", "GC%", "CLASSES", "CLS/s",
+            "JIT ms", "JIT%", "SAFEPTS", "SP ms" );
+}
+
+int
+main( int argc, char *argv[] )
+{
+    double interval = 1.0;
+    long samples = 0;
+    int explicit = 0;
+    int opt;
+
+    while( ( opt = getopt( argc, argv, "jai:n:p:h" ) ) != -1 ) {
+        switch( opt ) {
+        case 'j': _json = 1; break;
+        case 'a': _all = 1; break;
+        case 'i':
+            interval = atof( optarg );
+            if( interval <= 0 ) {
+                fprintf( stderr, "HASHDOT ERROR: Invalid interval %s\n",
+                         optarg );
+                return 1;
+            }
+            break;
+        case 'n': samples = atol( optarg ); break;
+        case 'p': {
+            int pid = read_pid_file( optarg );
+            if( pid > 0 ) add_target( pid );
+            explicit = 1;
+            break;
+        }
+        default:
+            usage( argv[0] );
+            return ( opt == 'h' ) ? 0 : 1;
+        }
+    }
+    for( ; optind < argc; optind++ ) {
+        int pid = atoi( argv[optind] );
+        if( pid <= 0 ) {
+            usage( argv[0] );
+            return 1;
+        }
+        add_target( pid );
+        explicit = 1;
+    }
+    if( explicit && ( _ntargets == 0 ) ) return 1;
+
+    long n;
+    for( n = 0; ( samples == 0 ) || ( n < samples ); n++ ) {
+        if( n > 0 ) {
+            struct timespec ts;
+            ts.tv_sec = (time_t) interval;
+            ts.tv_nsec = (long) ( ( interval - ts.tv_sec ) * 1e9 );
+            nanosleep( &ts, NULL );
+        }
+
+        // Rescan so newly launched JVMs show up and exited ones drop
+        int i;
+        if( !explicit ) {
+            for( i = 0; i < _ntargets; i++ ) _targets[i].seen = 0;
+            scan_processes();
+            int kept = 0;
+            for( i = 0; i < _ntargets; i++ ) {
+                if( _targets[i].seen ) _targets[ kept++ ] = _targets[i];
+            }
+            _ntargets = kept;
+        }
+
+        struct timespec wall;
+        clock_gettime( CLOCK_REALTIME, &wall );
+        long long epoch_ms = wall.tv_sec * 1000LL + wall.tv_nsec / 1000000;
+        double now = monotonic();
+
+        if( !_json ) print_header( _ntargets, interval );
+
+        for( i = 0; i < _ntargets; i++ ) {
+            target_t *t = &_targets[i];
+            int ok = read_counters( t );
+            if( _json ) print_json( t, now, epoch_ms );
+            else print_row( t, now, epoch_ms );
+            if( ok ) {
+                t->prev = t->cur;
+                t->prev_time = now;
+                t->have_prev = 1;
+            }
+            else t->have_prev = 0;
+        }
+        fflush( stdout );
+    }
+    return 0;
+}
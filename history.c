@@ -0,0 +1,387 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_time.h>
+
+#include <jvmti.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "history.h"
+
+// Runs kept per script
+#define MAX_RUNS 10
+
+typedef struct {
+    apr_int64_t time;      // End of run, seconds since the epoch
+    apr_int64_t duration;  // Wall time, ms
+    apr_int64_t cpu;       // User and system time, ms
+    apr_int64_t max_rss;   // Peak resident set size, KB
+    apr_int64_t gc;        // Time in GC pauses, ms
+} run_t;
+
+// Set when this run is to be recorded
+static const char *_history_file = NULL;
+
+static apr_time_t _start = 0;
+
+static apr_int64_t _gc_nanos = 0;
+static apr_int64_t _gc_start = 0;
+
+static const char *history_file_name( const char *script );
+
+static int read_history( const char *fname, run_t *runs );
+
+static apr_int64_t long_property( const char *name, apr_int64_t def );
+
+static int compare_int64( const void *a, const void *b );
+
+/**
+ * Select the short or long run overlay profile for hashdot.script, as
+ * given by hashdot.adaptive (auto: learned from the run history of the
+ * script; short; long; off) and enable recording of this run. Sets
+ * class and profile, or leaves them NULL when neither applies.
+ */
+apr_status_t select_adaptive_profile( const char **class,
+                                      const char **profile )
+{
+    apr_status_t rv = APR_SUCCESS;
+    *class = NULL;
+    *profile = NULL;
+
+    const char *mode = NULL;
+    const char *script = NULL;
+    rv = get_property_value( "hashdot.adaptive", 0, 0, &mode );
+
+    if( ( rv == APR_SUCCESS ) && ( mode != NULL ) &&
+        ( strcmp( mode, "off" ) != 0 ) ) {
+        rv = get_property_value( "hashdot.script", 0, 0, &script );
+    }
+
+    if( ( rv != APR_SUCCESS ) || ( script == NULL ) ) return rv;
+
+    if( strcmp( mode, "short" ) == 0 ) {
+        *class = "short";
+    }
+    else if( strcmp( mode, "long" ) == 0 ) {
+        *class = "long";
+    }
+    else if( strcmp( mode, "auto" ) != 0 ) {
+        ERROR( "Unknown hashdot.adaptive mode [%s] (auto|short|long|off).",
+               mode );
+        return 1;
+    }
+
+    _history_file = history_file_name( script );
+    _start = apr_time_now();
+
+    if( *class != NULL ) {
+        DEBUG( "Adaptive %s run set by hashdot.adaptive.", *class );
+    }
+    else {
+        run_t runs[ MAX_RUNS ];
+        int n = read_history( _history_file, runs );
+
+        run_t mean = { 0, 0, 0, 0, 0 };
+        int i;
+        for( i = 0; i < n; i++ ) {
+            mean.duration += runs[i].duration;
+            mean.cpu      += runs[i].cpu;
+            mean.max_rss  += runs[i].max_rss;
+            mean.gc       += runs[i].gc;
+        }
+        if( n > 0 ) {
+            mean.duration /= n;
+            mean.cpu      /= n;
+            mean.max_rss  /= n;
+            mean.gc       /= n;
+        }
+
+        // Classify by median duration, robust to the odd outlier run.
+        apr_int64_t median = 0;
+        if( n > 0 ) {
+            apr_int64_t durations[ MAX_RUNS ];
+            for( i = 0; i < n; i++ ) durations[i] = runs[i].duration;
+            qsort( durations, n, sizeof( apr_int64_t ), &compare_int64 );
+            median = durations[ n / 2 ];
+        }
+
+        if( n >= long_property( "hashdot.adaptive.min_runs", 2 ) ) {
+            if( median <=
+                long_property( "hashdot.adaptive.short_secs", 10 ) * 1000 ) {
+                *class = "short";
+            }
+            else if( median >=
+                     long_property( "hashdot.adaptive.long_secs", 600 ) * 1000 ) {
+                *class = "long";
+            }
+        }
+
+        DEBUG( "Adaptive history: %d runs, median %.1fs wall, mean %.1fs cpu, "
+               "%ldMB rss, %.0f%% gc: %s",
+               n, median / 1000.0, mean.cpu / 1000.0,
+               (long) ( mean.max_rss / 1024 ),
+               ( mean.duration > 0 ) ? 100.0 * mean.gc / mean.duration : 0.0,
+               ( *class != NULL ) ? *class : "neither" );
+    }
+
+    if( *class != NULL ) {
+        const char *name = apr_psprintf( _mp, "hashdot.adaptive.%s_profile",
+                                         *class );
+        rv = get_property_value( name, 0, 0, profile );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( *profile != NULL ) ) {
+        DEBUG( "Adaptive %s run profile: %s", *class, *profile );
+    }
+
+    return rv;
+}
+
+static void JNICALL gc_start( jvmtiEnv *jvmti )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    _gc_start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void JNICALL gc_finish( jvmtiEnv *jvmti )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    if( _gc_start > 0 ) {
+        _gc_nanos += ( ts.tv_sec * 1000000000LL + ts.tv_nsec ) - _gc_start;
+        _gc_start = 0;
+    }
+}
+
+/**
+ * Track GC pause time via JVMTI, if this run is to be recorded.
+ */
+void history_attach_vm( JavaVM *vm )
+{
+    if( _history_file == NULL ) return;
+
+    jvmtiEnv *jvmti = NULL;
+    if( (*vm)->GetEnv( vm, (void **) &jvmti, JVMTI_VERSION_1_0 ) != JNI_OK ) {
+        DEBUG( "JVMTI unavailable, GC time not recorded." );
+        return;
+    }
+
+    jvmtiCapabilities caps;
+    memset( &caps, 0, sizeof( caps ) );
+    caps.can_generate_garbage_collection_events = 1;
+
+    jvmtiEventCallbacks callbacks;
+    memset( &callbacks, 0, sizeof( callbacks ) );
+    callbacks.GarbageCollectionStart  = &gc_start;
+    callbacks.GarbageCollectionFinish = &gc_finish;
+
+    if( ( (*jvmti)->AddCapabilities( jvmti, &caps ) != JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->SetEventCallbacks( jvmti, &callbacks,
+                                       sizeof( callbacks ) ) != JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->SetEventNotificationMode(
+            jvmti, JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START,
+            NULL ) != JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->SetEventNotificationMode(
+            jvmti, JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH,
+            NULL ) != JVMTI_ERROR_NONE ) ) {
+        DEBUG( "JVMTI GC events unavailable, GC time not recorded." );
+    }
+}
+
+/**
+ * Don't record the run of this process, i.e. of a forked helper JVM.
+ */
+void discard_run()
+{
+    _history_file = NULL;
+}
+
+/**
+ * Append this run to the script history, keeping the last MAX_RUNS.
+ * Called once, on JVM exit or after DestroyJavaVM.
+ */
+void record_run()
+{
+    const char *fname = _history_file;
+    if( fname == NULL ) return;
+    _history_file = NULL;
+
+    apr_pool_t *pool = NULL;
+    if( apr_pool_create( &pool, NULL ) != APR_SUCCESS ) return;
+
+    run_t runs[ MAX_RUNS + 1 ];
+    int n = read_history( fname, runs );
+    if( n == MAX_RUNS ) {
+        memmove( runs, runs + 1, ( MAX_RUNS - 1 ) * sizeof( run_t ) );
+        n--;
+    }
+
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+
+    apr_time_t now = apr_time_now();
+    run_t *run = &runs[ n++ ];
+    run->time     = apr_time_sec( now );
+    run->duration = apr_time_as_msec( now - _start );
+    run->cpu      = ( usage.ru_utime.tv_sec + usage.ru_stime.tv_sec ) * 1000 +
+                    ( usage.ru_utime.tv_usec + usage.ru_stime.tv_usec ) / 1000;
+#ifdef __MacOS_X__
+    run->max_rss  = usage.ru_maxrss / 1024; // bytes
+#else
+    run->max_rss  = usage.ru_maxrss;
+#endif
+    run->gc       = _gc_nanos / 1000000;
+
+    DEBUG( "Recording run: %ldms wall, %ldms cpu, %ldKB rss, %ldms gc",
+           (long) run->duration, (long) run->cpu, (long) run->max_rss,
+           (long) run->gc );
+
+    // Write a new file and rename, so concurrent runs never see a
+    // partial history.
+    apr_status_t rv = APR_SUCCESS;
+    char *dir = apr_pstrdup( pool, fname );
+    *strrchr( dir, '/' ) = '\0';
+    rv = apr_dir_make_recursive( dir, APR_FPROT_OS_DEFAULT, pool );
+
+    const char *tmp = apr_psprintf( pool, "%s.%d", fname, (int) getpid() );
+    apr_file_t *out = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open( &out, tmp,
+                            APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                            APR_FOPEN_TRUNCATE,
+                            APR_OS_DEFAULT, pool );
+    }
+    if( rv == APR_SUCCESS ) {
+        const char *script = NULL;
+        get_property_value( "hashdot.script", 0, 0, &script );
+        apr_file_printf( out, "# hashdot run history: %s\n"
+                         "# time duration_ms cpu_ms max_rss_kb gc_ms\n",
+                         script );
+        int i;
+        for( i = 0; i < n; i++ ) {
+            apr_file_printf( out, "%ld %ld %ld %ld %ld\n",
+                             (long) runs[i].time, (long) runs[i].duration,
+                             (long) runs[i].cpu, (long) runs[i].max_rss,
+                             (long) runs[i].gc );
+        }
+        rv = apr_file_close( out );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_rename( tmp, fname, pool );
+    }
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, fname );
+        apr_file_remove( tmp, pool );
+    }
+
+    apr_pool_destroy( pool );
+}
+
+/**
+ * History file for script in hashdot.adaptive.history (default:
+ * ~/.hashdot/history), named for the script and a hash of its
+ * absolute path.
+ */
+static const char *history_file_name( const char *script )
+{
+    const char *dir = NULL;
+    get_property_value( "hashdot.adaptive.history", '/', 0, &dir );
+    if( dir == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        dir = apr_pstrcat( _mp, home, "/.hashdot/history", NULL );
+    }
+
+    return apr_psprintf( _mp, "%s/%s-%016llx.hist", dir,
+                         apr_filepath_name_get( script ),
+                         (unsigned long long) hash_string( script ) );
+}
+
+static int read_history( const char *fname, run_t *runs )
+{
+    apr_pool_t *pool = NULL;
+    apr_file_t *in = NULL;
+    char line[256];
+    int n = 0;
+
+    if( apr_pool_create( &pool, NULL ) != APR_SUCCESS ) return 0;
+
+    if( apr_file_open( &in, fname, APR_FOPEN_READ, APR_OS_DEFAULT,
+                       pool ) == APR_SUCCESS ) {
+        while( apr_file_gets( line, sizeof( line ), in ) == APR_SUCCESS ) {
+            run_t r;
+            long t, d, c, m, g;
+            if( ( line[0] != '#' ) &&
+                ( sscanf( line, "%ld %ld %ld %ld %ld", &t, &d, &c, &m, &g ) == 5 ) ) {
+                r.time = t; r.duration = d; r.cpu = c; r.max_rss = m; r.gc = g;
+                if( n == MAX_RUNS ) {
+                    memmove( runs, runs + 1, ( MAX_RUNS - 1 ) * sizeof( run_t ) );
+                    n--;
+                }
+                runs[ n++ ] = r;
+            }
+        }
+        apr_file_close( in );
+    }
+
+    apr_pool_destroy( pool );
+    return n;
+}
+
+static apr_int64_t long_property( const char *name, apr_int64_t def )
+{
+    const char *value = NULL;
+    get_property_value( name, 0, 0, &value );
+    return ( value != NULL ) ? atol( value ) : def;
+}
+
+static int compare_int64( const void *a, const void *b )
+{
+    apr_int64_t x = *(const apr_int64_t *) a;
+    apr_int64_t y = *(const apr_int64_t *) b;
+    return ( x > y ) - ( x < y );
+}
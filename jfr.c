@@ -0,0 +1,525 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Managed continuous Java Flight Recorder (hashdot.jfr). The recording
+ * options are generated for the detected JDK, and each process keeps
+ * its recording repository (chunk files) and dumps in hashdot.jfr.dir,
+ * named <prefix>-<start time>-<pid>:
+ *
+ *   .repo   The repository of a running JVM.
+ *   .jfr    The final dump at exit (or dumps of the jfr-dump control
+ *           command, named for their time).
+ *   .abort  The repository of a JVM which aborted, was killed or was
+ *           exited by the watchdog, kept as is.
+ *
+ * At launch, the repositories of JVMs no longer running are kept as
+ * .abort (or removed if empty), and all but the newest hashdot.jfr.keep
+ * dumps of the same prefix are removed.
+ */
+
+#define _GNU_SOURCE // nftw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "vminfo.h"
+#include "jfr.h"
+#include "cachebuild.h"
+
+#define RECORDING_NAME "hashdot"
+
+typedef struct {
+    const char *path;
+    time_t mtime;
+} kept_t;
+
+// Set at launch, read only after (including from hooks)
+static char *_dir = NULL;
+static char *_prefix = NULL;
+static char *_repo = NULL;
+static char *_abort_repo = NULL;
+
+static apr_status_t
+check_size( const char *name, const char *value, const char *units,
+            const char *description );
+
+static const char *
+recording_prefix();
+
+static void
+time_stamp( time_t t, char *buf, size_t size );
+
+static void
+prune( const char *dir, const char *prefix, int keep );
+
+/**
+ * With hashdot.jfr = continuous, prepend the options for a continuous
+ * recording, bounded by hashdot.jfr.max_size and max_age, to options.
+ * No recording is added if options already start one. Requires a
+ * HotSpot JDK 11 or later, whose options are the same (the JDK 8
+ * options depend on the vendor and update).
+ */
+apr_status_t add_jfr_options( apr_array_header_t **options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *mode = NULL;
+    rv = get_property_value( "hashdot.jfr", 0, 0, &mode );
+    if( ( rv != APR_SUCCESS ) || ( mode == NULL ) ||
+        ( strcmp( mode, "off" ) == 0 ) ) return rv;
+
+    if( strcmp( mode, "continuous" ) != 0 ) {
+        rv = 48;
+        ERROR( "[%d]: Invalid hashdot.jfr [%s] (continuous or off).",
+               rv, mode );
+        return rv;
+    }
+
+    const char *max_size = "250m";
+    const char *max_age = "1h";
+    const char *settings = "default";
+    const char *keep_value = "5";
+    const char *dir = NULL;
+
+    rv = get_property_value( "hashdot.jfr.max_size", 0, 0, &max_size );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.jfr.max_age", 0, 0, &max_age );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.jfr.settings", 0, 0, &settings );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.jfr.keep", 0, 0, &keep_value );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.jfr.dir", '/', 0, &dir );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = check_size( "hashdot.jfr.max_size", max_size, "kmg",
+                         "k, m or g" );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = check_size( "hashdot.jfr.max_age", max_age, "smhd",
+                         "s, m, h or d" );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    char *end = NULL;
+    long keep = strtol( keep_value, &end, 10 );
+    if( ( end == keep_value ) || ( *end != '\0' ) || ( keep < 1 ) ) {
+        rv = 48;
+        ERROR( "[%d]: Invalid hashdot.jfr.keep [%s].", rv, keep_value );
+        return rv;
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( info->impl != VM_IMPL_HOTSPOT ) || ( info->version < 11 ) ) {
+        WARN( "hashdot.jfr requires a HotSpot JDK 11 or later;"
+              " not recording." );
+        return rv;
+    }
+
+    int i;
+    for( i = 0; ( *options != NULL ) && ( i < (*options)->nelts ); i++ ) {
+        const char *val = ((const char **) (*options)->elts )[i];
+        if( strncmp( val, "-XX:StartFlightRecording", 24 ) == 0 ) {
+            DEBUG( "JFR recording started by options, not hashdot.jfr." );
+            return rv;
+        }
+    }
+
+    if( dir == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        dir = apr_pstrcat( _mp, home, "/.hashdot/jfr", NULL );
+    }
+
+    rv = apr_dir_make_recursive( dir, APR_FPROT_OS_DEFAULT, _mp );
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, dir );
+        return rv;
+    }
+
+    const char *prefix = recording_prefix();
+    prune( dir, prefix, (int) keep );
+
+    char stamp[32];
+    time_stamp( time( NULL ), stamp, sizeof( stamp ) );
+    const char *base = apr_psprintf( _mp, "%s/%s-%s-%d", dir, prefix, stamp,
+                                     (int) getpid() );
+    const char *repo = apr_pstrcat( _mp, base, ".repo", NULL );
+
+    if( mkdir( repo, 0755 ) != 0 ) {
+        rv = APR_FROM_OS_ERROR( errno );
+        print_error( rv, repo );
+        return rv;
+    }
+
+    // Crash (emergency) dumps of JDK 17+ go in the repository too.
+    apr_array_header_t *vals =
+        apr_array_make( _mp, 4, sizeof( const char* ) );
+    *(const char **) apr_array_push( vals ) =
+        apr_psprintf( _mp, "-XX:FlightRecorderOptions=repository=%s%s%s",
+                      repo, ( info->version >= 17 ) ? ",dumppath=" : "",
+                      ( info->version >= 17 ) ? repo : "" );
+    *(const char **) apr_array_push( vals ) =
+        apr_psprintf( _mp, "-XX:StartFlightRecording=name=" RECORDING_NAME
+                      ",settings=%s,disk=true,maxsize=%s,maxage=%s"
+                      ",dumponexit=true,filename=%s.jfr",
+                      settings, max_size, max_age, base );
+
+    for( i = 0; i < vals->nelts; i++ ) {
+        DEBUG( "JFR option: %s", ((const char **) vals->elts )[i] );
+    }
+
+    if( *options != NULL ) apr_array_cat( vals, *options );
+    *options = vals;
+
+    // Copies, as read from other threads and hooks
+    _dir = strdup( dir );
+    _prefix = strdup( prefix );
+    _repo = strdup( repo );
+    _abort_repo = strdup( apr_pstrcat( _mp, base, ".abort", NULL ) );
+
+    return rv;
+}
+
+/**
+ * Control command jfr-dump: dump the recording so far to a new file in
+ * hashdot.jfr.dir, via the jdk.jfr API.
+ */
+void jfr_dump_command( JavaVM *vm, FILE *out )
+{
+    if( _repo == NULL ) {
+        fprintf( out, "error not recording (hashdot.jfr)\n" );
+        return;
+    }
+
+    char stamp[32];
+    time_stamp( time( NULL ), stamp, sizeof( stamp ) );
+    size_t size = strlen( _dir ) + strlen( _prefix ) + 64;
+    char fname[ size ];
+    snprintf( fname, size, "%s/%s-%s-%d.jfr", _dir, _prefix, stamp,
+              (int) getpid() );
+
+    JNIEnv *env = NULL;
+    JavaVMAttachArgs attach_args;
+    attach_args.version = JNI_VERSION_1_2;
+    attach_args.name = "hashdot-control";
+    attach_args.group = NULL;
+    if( (*vm)->AttachCurrentThread( vm, (void **) &env,
+                                    &attach_args ) != JNI_OK ) {
+        fprintf( out, "error could not attach to JVM\n" );
+        return;
+    }
+
+    const char *error = NULL;
+    if( (*env)->PushLocalFrame( env, 16 ) != JNI_OK ) {
+        error = "out of memory";
+    }
+
+    jclass recorder_cls = NULL;
+    jclass list_cls = NULL;
+    jclass recording_cls = NULL;
+    jclass paths_cls = NULL;
+    jclass string_cls = NULL;
+    if( error == NULL ) {
+        recorder_cls = (*env)->FindClass( env, "jdk/jfr/FlightRecorder" );
+        list_cls = recorder_cls ?
+            (*env)->FindClass( env, "java/util/List" ) : NULL;
+        recording_cls = list_cls ?
+            (*env)->FindClass( env, "jdk/jfr/Recording" ) : NULL;
+        paths_cls = recording_cls ?
+            (*env)->FindClass( env, "java/nio/file/Paths" ) : NULL;
+        string_cls = paths_cls ?
+            (*env)->FindClass( env, "java/lang/String" ) : NULL;
+        if( string_cls == NULL ) error = "no jdk.jfr classes";
+    }
+
+    jmethodID get_recorder = NULL, get_recordings = NULL, size_m = NULL,
+        get_m = NULL, get_name = NULL, dump = NULL, get_path = NULL;
+    if( error == NULL ) {
+        get_recorder = (*env)->GetStaticMethodID(
+            env, recorder_cls, "getFlightRecorder",
+            "()Ljdk/jfr/FlightRecorder;" );
+        get_recordings = (*env)->GetMethodID(
+            env, recorder_cls, "getRecordings", "()Ljava/util/List;" );
+        size_m = (*env)->GetMethodID( env, list_cls, "size", "()I" );
+        get_m = (*env)->GetMethodID( env, list_cls, "get",
+                                     "(I)Ljava/lang/Object;" );
+        get_name = (*env)->GetMethodID(
+            env, recording_cls, "getName", "()Ljava/lang/String;" );
+        dump = (*env)->GetMethodID(
+            env, recording_cls, "dump", "(Ljava/nio/file/Path;)V" );
+        get_path = (*env)->GetStaticMethodID(
+            env, paths_cls, "get",
+            "(Ljava/lang/String;[Ljava/lang/String;)Ljava/nio/file/Path;" );
+        if( !get_recorder || !get_recordings || !size_m || !get_m ||
+            !get_name || !dump || !get_path ) error = "no jdk.jfr methods";
+    }
+
+    jobject recording = NULL;
+    if( error == NULL ) {
+        jobject recorder =
+            (*env)->CallStaticObjectMethod( env, recorder_cls, get_recorder );
+        jobject list = recorder ?
+            (*env)->CallObjectMethod( env, recorder, get_recordings ) : NULL;
+        jint n = list ? (*env)->CallIntMethod( env, list, size_m ) : 0;
+        jint i;
+        for( i = 0; ( i < n ) && !(*env)->ExceptionCheck( env ); i++ ) {
+            jobject r = (*env)->CallObjectMethod( env, list, get_m, i );
+            jstring name = r ?
+                (*env)->CallObjectMethod( env, r, get_name ) : NULL;
+            const char *cname =
+                name ? (*env)->GetStringUTFChars( env, name, NULL ) : NULL;
+            if( cname != NULL ) {
+                if( strcmp( cname, RECORDING_NAME ) == 0 ) recording = r;
+                (*env)->ReleaseStringUTFChars( env, name, cname );
+            }
+            if( recording != NULL ) break;
+        }
+        if( (*env)->ExceptionCheck( env ) ) error = "recordings not listed";
+        else if( recording == NULL ) error = "no " RECORDING_NAME " recording";
+    }
+
+    if( error == NULL ) {
+        jstring jname = (*env)->NewStringUTF( env, fname );
+        jobjectArray more = jname ?
+            (*env)->NewObjectArray( env, 0, string_cls, NULL ) : NULL;
+        jobject path = more ?
+            (*env)->CallStaticObjectMethod( env, paths_cls, get_path,
+                                            jname, more ) : NULL;
+        if( path != NULL ) {
+            (*env)->CallVoidMethod( env, recording, dump, path );
+        }
+        if( ( path == NULL ) || (*env)->ExceptionCheck( env ) ) {
+            error = "dump failed";
+        }
+    }
+
+    if( (*env)->ExceptionCheck( env ) ) {
+        (*env)->ExceptionDescribe( env );
+    }
+    (*env)->PopLocalFrame( env, NULL );
+    (*vm)->DetachCurrentThread( vm );
+
+    if( error != NULL ) {
+        fprintf( out, "error %s\n", error );
+    }
+    else {
+        fprintf( out, "ok %s\n", fname );
+    }
+}
+
+/**
+ * At exit, after the final dump: remove the (then empty) repository.
+ */
+void jfr_exit()
+{
+    if( _repo != NULL ) remove_tree( _repo );
+}
+
+/**
+ * On abnormal exit (JVM abort, watchdog exit): keep the repository,
+ * with the recording up to then, as .abort.
+ */
+void jfr_abort()
+{
+    if( ( _repo != NULL ) && ( rename( _repo, _abort_repo ) == 0 ) ) {
+        WARN( "JFR recording kept in %s", _abort_repo );
+    }
+}
+
+/**
+ * Check value is a number with an optional unit, one of units.
+ */
+static apr_status_t
+check_size( const char *name, const char *value, const char *units,
+            const char *description )
+{
+    size_t digits = strspn( value, "0123456789" );
+    if( ( digits == 0 ) ||
+        ( ( value[digits] != '\0' ) &&
+          ( ( strchr( units, value[digits] ) == NULL ) ||
+            ( value[digits + 1] != '\0' ) ) ) ) {
+        apr_status_t rv = 48;
+        ERROR( "[%d]: Invalid %s [%s] (a number, with unit %s).",
+               rv, name, value, description );
+        return rv;
+    }
+    return APR_SUCCESS;
+}
+
+/**
+ * The file name prefix of this script's recordings: the script file
+ * name, or the main class.
+ */
+static const char *
+recording_prefix()
+{
+    const char *name = NULL;
+    get_property_value( "hashdot.script", 0, 0, &name );
+    if( name != NULL ) {
+        const char *base = strrchr( name, '/' );
+        return ( base != NULL ) ? base + 1 : name;
+    }
+    name = "hashdot";
+    get_property_value( "hashdot.main", 0, 0, &name );
+    return name;
+}
+
+static void
+time_stamp( time_t t, char *buf, size_t size )
+{
+    struct tm tm;
+    localtime_r( &t, &tm );
+    strftime( buf, size, "%Y%m%d-%H%M%S", &tm );
+}
+
+/**
+ * If name is <prefix>-<yyyymmdd>-<hhmmss>-<pid><suffix>, return the
+ * pid and suffix, else 0.
+ */
+static int
+parse_name( const char *name, const char *prefix, const char **suffix )
+{
+    size_t plen = strlen( prefix );
+    if( ( strncmp( name, prefix, plen ) != 0 ) || ( name[plen] != '-' ) ) {
+        return 0;
+    }
+    const char *p = name + plen + 1;
+    if( ( strspn( p, "0123456789" ) != 8 ) || ( p[8] != '-' ) ||
+        ( strspn( p + 9, "0123456789" ) != 6 ) || ( p[15] != '-' ) ) {
+        return 0;
+    }
+    p += 16;
+    size_t digits = strspn( p, "0123456789" );
+    if( digits == 0 ) return 0;
+    *suffix = p + digits;
+    return atoi( p );
+}
+
+static int
+count_chunk( const char *path, const struct stat *st, int flag,
+             struct FTW *ftw )
+{
+    size_t len = strlen( path );
+    return ( ( flag == FTW_F ) && ( len > 4 ) &&
+             ( strcmp( path + len - 4, ".jfr" ) == 0 ) );
+}
+
+static int
+compare_mtime( const void *a, const void *b )
+{
+    time_t ta = ((const kept_t *) a)->mtime;
+    time_t tb = ((const kept_t *) b)->mtime;
+    return ( ta < tb ) ? 1 : ( ( ta > tb ) ? -1 : 0 );
+}
+
+/**
+ * Keep the repositories of JVMs of prefix no longer running with any
+ * chunks as .abort (removing the others), then remove all but the
+ * newest keep .jfr dumps and .abort repositories.
+ */
+static void
+prune( const char *dir, const char *prefix, int keep )
+{
+    DIR *d = opendir( dir );
+    if( d == NULL ) return;
+
+    apr_array_header_t *kept = apr_array_make( _mp, 16, sizeof( kept_t ) );
+    struct dirent *e;
+    while( ( e = readdir( d ) ) != NULL ) {
+        const char *suffix = NULL;
+        int pid = parse_name( e->d_name, prefix, &suffix );
+        if( pid <= 0 ) continue;
+
+        const char *path = apr_pstrcat( _mp, dir, "/", e->d_name, NULL );
+
+        if( strcmp( suffix, ".repo" ) == 0 ) {
+            if( ( kill( pid, 0 ) == 0 ) || ( errno == EPERM ) ) continue;
+
+            if( nftw( path, count_chunk, 16, FTW_PHYS ) > 0 ) {
+                char *to = apr_pstrndup( _mp, path, strlen( path ) - 5 );
+                to = apr_pstrcat( _mp, to, ".abort", NULL );
+                if( rename( path, to ) != 0 ) continue;
+                WARN( "JFR recording of pid %d (not exited normally)"
+                      " kept in %s", pid, to );
+                path = to;
+                suffix = ".abort";
+            }
+            else {
+                remove_tree( path );
+                continue;
+            }
+        }
+
+        if( ( strcmp( suffix, ".jfr" ) == 0 ) ||
+            ( strcmp( suffix, ".abort" ) == 0 ) ) {
+            struct stat st;
+            if( stat( path, &st ) != 0 ) continue;
+            kept_t *k = (kept_t *) apr_array_push( kept );
+            k->path = path;
+            k->mtime = st.st_mtime;
+        }
+    }
+    closedir( d );
+
+    qsort( kept->elts, kept->nelts, sizeof( kept_t ), compare_mtime );
+
+    int i;
+    for( i = keep; i < kept->nelts; i++ ) {
+        const char *path = ((kept_t *) kept->elts )[i].path;
+        DEBUG( "Removing old JFR recording %s", path );
+        remove_tree( path );
+    }
+}
@@ -0,0 +1,304 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "vminfo.h"
+#include "jlink.h"
+#include "cachebuild.h"
+
+// Marker file of a complete image, containing its key
+#define MARKER "hashdot.jlink"
+
+// Run by sh with arguments: base home, output image, mode
+// (auto|manual), JDK version, extra modules, class path entries.
+static const char *BUILD_SCRIPT =
+    "base=$1 out=$2 mode=$3 ver=$4 extra=$5; shift 5\n"
+    "mods=\n"
+    "if [ \"$mode\" = auto ] && [ $# -gt 0 ]; then\n"
+    "  mods=$(\"$base/bin/jdeps\" -q --ignore-missing-deps"
+    " --multi-release \"$ver\" --print-module-deps \"$@\") ||"
+    " { echo \"jdeps failed.\"; exit 1; }\n"
+    "fi\n"
+    "mods=java.base${mods:+,$mods}${extra:+,$extra}\n"
+    "echo \"Modules: $mods\"\n"
+    "exec \"$base/bin/jlink\" --add-modules \"$mods\" --strip-debug"
+    " --no-header-files --no-man-pages --output \"$out\"\n";
+
+// BUILD_SCRIPT argument of the output image
+#define OUTPUT_ARG 5
+
+static apr_status_t
+image_key( const char *home,
+           const char *mode,
+           const char *extra,
+           apr_array_header_t *class_path,
+           const char **key );
+
+static const char *
+image_dir( const char *key );
+
+static const char **
+build_args( const char *home,
+            const char *mode,
+            int version,
+            const char *extra,
+            apr_array_header_t *class_path );
+
+static int
+build_image( const char *tmp, void *data );
+
+/**
+ * With hashdot.vm.jlink, point hashdot.vm.home and hashdot.vm.lib at a
+ * trimmed runtime image of only the modules required by class_path
+ * (the expanded java.class.path), as cached in hashdot.vm.jlink.cache.
+ * An image is keyed by the base JDK, the class path entries (with
+ * their modification times and sizes) and the module settings. If no
+ * complete image exists, it is built in a detached background process
+ * while this launch proceeds with the base JDK.
+ */
+apr_status_t select_jlink_image( apr_array_header_t *class_path )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *mode = NULL;
+    const char *extra = NULL;
+    const char *home = NULL;
+    const char *lib = NULL;
+
+    rv = get_property_value( "hashdot.vm.jlink", 0, 0, &mode );
+    if( ( rv != APR_SUCCESS ) || ( mode == NULL ) ||
+        ( strcmp( mode, "off" ) == 0 ) ) return rv;
+
+    if( ( strcmp( mode, "auto" ) != 0 ) && ( strcmp( mode, "manual" ) != 0 ) ) {
+        rv = 43;
+        ERROR( "[%d]: Invalid hashdot.vm.jlink [%s] (auto, manual or off).",
+               rv, mode );
+        return rv;
+    }
+
+    rv = get_property_value( "hashdot.vm.jlink.modules", ',', 0, &extra );
+    if( rv != APR_SUCCESS ) return rv;
+    if( extra == NULL ) extra = "";
+
+    if( strspn( extra, "abcdefghijklmnopqrstuvwxyz"
+                       "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._," ) !=
+        strlen( extra ) ) {
+        rv = 43;
+        ERROR( "[%d]: Invalid hashdot.vm.jlink.modules [%s].", rv, extra );
+        return rv;
+    }
+
+    // The recording of hashdot.jfr needs jdk.jfr, which jdeps won't
+    // find in the class path.
+    const char *jfr = NULL;
+    get_property_value( "hashdot.jfr", 0, 0, &jfr );
+    if( ( jfr != NULL ) && ( strcmp( jfr, "off" ) != 0 ) ) {
+        extra = ( extra[0] != '\0' ) ?
+            apr_pstrcat( _mp, extra, ",jdk.jfr", NULL ) : "jdk.jfr";
+    }
+
+    rv = get_property_value( "hashdot.vm.home", 0, 1, &home );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.vm.lib", 0, 1, &lib );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    apr_size_t hlen = strlen( home );
+    if( ( strncmp( lib, home, hlen ) != 0 ) || ( lib[hlen] != '/' ) ) {
+        DEBUG( "hashdot.vm.lib [%s] not under hashdot.vm.home, no jlink image.",
+               lib );
+        return rv;
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    // jdeps --print-module-deps and --ignore-missing-deps need 11+
+    if( ( info->version < 11 ) || ( info->impl != VM_IMPL_HOTSPOT ) ) {
+        DEBUG( "JVM version %d is not supported by hashdot.vm.jlink.",
+               info->version );
+        return rv;
+    }
+
+    const char *key = NULL;
+    rv = image_key( home, mode, extra, class_path, &key );
+    if( rv != APR_SUCCESS ) return rv;
+
+    const char *image = image_dir( key );
+    const char *image_lib = apr_pstrcat( _mp, image, lib + hlen, NULL );
+
+    if( cache_complete( image, MARKER, key ) &&
+        ( access( image_lib, R_OK ) == 0 ) ) {
+        DEBUG( "Using jlink image [%s].", image );
+        set_property_value( "hashdot.vm.home", image );
+        set_property_value( "hashdot.vm.lib", image_lib );
+        return rv;
+    }
+
+    if( cache_failed( image ) ) {
+        DEBUG( "Previous build of jlink image [%s] failed, see %s.log",
+               image, image );
+        return rv;
+    }
+
+    DEBUG( "Building jlink image [%s] in background.", image );
+    cache_build( image, MARKER, key, build_image,
+                 build_args( home, mode, info->version, extra, class_path ) );
+
+    return rv;
+}
+
+/**
+ * Key of the base JDK (by its modules file), module settings and
+ * class path entries, one per line.
+ */
+static apr_status_t
+image_key( const char *home,
+           const char *mode,
+           const char *extra,
+           apr_array_header_t *class_path,
+           const char **key )
+{
+    struct stat st;
+    const char *modules = apr_pstrcat( _mp, home, "/lib/modules", NULL );
+
+    if( stat( modules, &st ) != 0 ) {
+        apr_status_t rv = APR_FROM_OS_ERROR( errno );
+        print_error( rv, modules );
+        return rv;
+    }
+
+    char *k = apr_psprintf( _mp, "B %s %ld %ld\nM %s %s\n", home,
+                            (long) st.st_mtime, (long) st.st_size,
+                            mode, extra );
+
+    int i;
+    for( i = 0; ( class_path != NULL ) && ( i < class_path->nelts ); i++ ) {
+        const char *entry = ((const char **) class_path->elts )[i];
+        if( stat( entry, &st ) == 0 ) {
+            k = apr_psprintf( _mp, "%sC %s %ld %ld\n", k, entry,
+                              (long) st.st_mtime, (long) st.st_size );
+        }
+    }
+
+    *key = k;
+    return APR_SUCCESS;
+}
+
+/**
+ * Image directory in hashdot.vm.jlink.cache (default:
+ * ~/.hashdot/jlink), named for a hash of its key.
+ */
+static const char *
+image_dir( const char *key )
+{
+    const char *dir = NULL;
+    get_property_value( "hashdot.vm.jlink.cache", '/', 0, &dir );
+    if( dir == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        dir = apr_pstrcat( _mp, home, "/.hashdot/jlink", NULL );
+    }
+
+    return apr_psprintf( _mp, "%s/%016llx", dir,
+                         (unsigned long long) hash_string( key ) );
+}
+
+/**
+ * BUILD_SCRIPT command line, prepared before the build process is
+ * forked.
+ */
+static const char **
+build_args( const char *home,
+            const char *mode,
+            int version,
+            const char *extra,
+            apr_array_header_t *class_path )
+{
+    int n = ( class_path != NULL ) ? class_path->nelts : 0;
+    const char **argv = apr_palloc( _mp, ( 10 + n ) * sizeof( const char * ) );
+    int a = 0;
+    argv[a++] = "/bin/sh";
+    argv[a++] = "-c";
+    argv[a++] = BUILD_SCRIPT;
+    argv[a++] = "hashdot-jlink";
+    argv[a++] = home;
+    argv[a++] = NULL; // OUTPUT_ARG
+    argv[a++] = mode;
+    argv[a++] = apr_psprintf( _mp, "%d", version );
+    argv[a++] = extra;
+    int i;
+    for( i = 0; i < n; i++ ) {
+        const char *entry = ((const char **) class_path->elts )[i];
+        if( access( entry, R_OK ) == 0 ) argv[a++] = entry;
+    }
+    argv[a] = NULL;
+    return argv;
+}
+
+/**
+ * Run BUILD_SCRIPT (data, from build_args) to build the image in tmp.
+ */
+static int
+build_image( const char *tmp, void *data )
+{
+    const char **argv = data;
+    argv[ OUTPUT_ARG ] = tmp;
+
+    pid_t pid = fork();
+    if( pid == 0 ) {
+        execv( argv[0], (char * const *) argv );
+        _exit( 127 );
+    }
+
+    int status = -1;
+    if( pid > 0 ) {
+        while( ( waitpid( pid, &status, 0 ) < 0 ) && ( errno == EINTR ) );
+    }
+    return ( pid > 0 ) && WIFEXITED( status ) ? WEXITSTATUS( status ) : 1;
+}
@@ -39,6 +39,17 @@
 #include "property.h"
 #include "daemon.h"
 #include "pidfile.h"
+#include "vminfo.h"
+#include "history.h"
+#include "watchdog.h"
+#include "control.h"
+#include "native.h"
+#include "launch.h"
+#include "jlink.h"
+#include "jfr.h"
+
+#include <stdlib.h>
+#include <unistd.h>
 
 #include <apr_strings.h>
 #include <apr_hash.h>
@@ -54,6 +65,194 @@
 
 typedef jint (*create_java_vm_f)(JavaVM **, JNIEnv **, JavaVMInitArgs *);
 
+/**
+ * With hashdot.profile.startup = true, add the -agentpath option for
+ * the startup profiler agent (startup_agent.c).
+ */
+static apr_status_t
+add_profiler_option( apr_array_header_t *options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    int enabled = 0;
+    rv = get_boolean( "hashdot.profile.startup", 37, &enabled );
+    if( ( rv != APR_SUCCESS ) || !enabled ) return rv;
+
+    const char *agent = HASHDOT_AGENT_PATH;
+    const char *window = "5";
+    const char *out = NULL;
+    const char *main_name = "";
+    rv = get_property_value( "hashdot.profile.startup.agent", 0, 0, &agent );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.profile.startup.window", 0, 0,
+                                 &window );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.profile.startup.output", 0, 0, &out );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.main", 0, 0, &main_name );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    char *end = NULL;
+    double secs = strtod( window, &end );
+    if( ( end == window ) || ( *end != '\0' ) || ( secs < 0 ) ) {
+        rv = 37;
+        ERROR( "[%d]: Invalid hashdot.profile.startup.window [%s]"
+               " (seconds, 0 for until exit).", rv, window );
+        return rv;
+    }
+
+    if( out == NULL ) {
+        out = apr_psprintf( _mp, "hashdot-startup.%d", (int) getpid() );
+    }
+
+    *(const char **) apr_array_push( options ) =
+        apr_psprintf( _mp, "-agentpath:%s=t0=%" APR_INT64_T_FMT
+                      ",window=%s,main=%s,out=%s",
+                      agent, _launch_ns, window, main_name, out );
+
+    DEBUG( "Startup profiler enabled, report to %s.txt", out );
+
+    return rv;
+}
+
+/**
+ * With hashdot.perf_map = true, add the -agentpath option for the
+ * perf map agent (perf_agent.c) to options, and prepend the HotSpot
+ * flags perf needs to vm_options, so that explicit options still take
+ * precedence on compaction: frame pointers for whole JIT stacks (JDK
+ * 8u60 and later, only added for 9+ as the update isn't known) and,
+ * to unfold inlined frames, debug info at all PCs.
+ */
+static apr_status_t
+add_perf_map_options( apr_array_header_t **vm_options,
+                      apr_array_header_t *options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    int enabled = 0;
+    rv = get_boolean( "hashdot.perf_map", 46, &enabled );
+    if( ( rv != APR_SUCCESS ) || !enabled ) return rv;
+
+    const char *agent = HASHDOT_PERF_AGENT_PATH;
+    const char *compact = "60";
+    int unfold = 0;
+    int jitdump = 0;
+    rv = get_property_value( "hashdot.perf_map.agent", 0, 0, &agent );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.perf_map.compact", 0, 0, &compact );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_boolean( "hashdot.perf_map.unfold", 46, &unfold );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_boolean( "hashdot.perf_map.jitdump", 46, &jitdump );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    char *end = NULL;
+    double secs = strtod( compact, &end );
+    if( ( end == compact ) || ( *end != '\0' ) || ( secs < 0 ) ) {
+        rv = 46;
+        ERROR( "[%d]: Invalid hashdot.perf_map.compact [%s]"
+               " (seconds, 0 for never).", rv, compact );
+        return rv;
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( info->impl == VM_IMPL_HOTSPOT ) {
+        apr_array_header_t *vals =
+            apr_array_make( _mp, 4, sizeof( const char* ) );
+        if( info->version >= 9 ) {
+            *(const char **) apr_array_push( vals ) =
+                "-XX:+PreserveFramePointer";
+        }
+        if( unfold ) {
+            *(const char **) apr_array_push( vals ) =
+                "-XX:+UnlockDiagnosticVMOptions";
+            *(const char **) apr_array_push( vals ) =
+                "-XX:+DebugNonSafepoints";
+        }
+        if( *vm_options != NULL ) apr_array_cat( vals, *vm_options );
+        *vm_options = vals;
+    }
+    else {
+        DEBUG( "Not a known HotSpot JVM, no perf map VM options." );
+    }
+
+    *(const char **) apr_array_push( options ) =
+        apr_psprintf( _mp, "-agentpath:%s=unfold=%d,jitdump=%d,compact=%s",
+                      agent, unfold, jitdump, compact );
+
+    DEBUG( "Perf map agent enabled, writing /tmp/perf-%d.map",
+           (int) getpid() );
+
+    return rv;
+}
+
+/**
+ * With hashdot.profile.cpu set to an output file, add the -agentpath
+ * option for the CPU profiler agent (cpu_agent.c) to options, and
+ * prepend HotSpot flags for debug info at all PCs, so that samples
+ * aren't biased to safepoints, to vm_options.
+ */
+static apr_status_t
+add_cpu_profiler_options( apr_array_header_t **vm_options,
+                          apr_array_header_t *options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *out = NULL;
+    rv = get_property_value( "hashdot.profile.cpu", 0, 0, &out );
+    if( ( rv != APR_SUCCESS ) || ( out == NULL ) ||
+        ( strcmp( out, "false" ) == 0 ) ) return rv;
+
+    const char *agent = HASHDOT_CPU_AGENT_PATH;
+    const char *hz_value = "100";
+    rv = get_property_value( "hashdot.profile.cpu.agent", 0, 0, &agent );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.profile.cpu.hz", 0, 0, &hz_value );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    char *end = NULL;
+    long hz = strtol( hz_value, &end, 10 );
+    if( ( end == hz_value ) || ( *end != '\0' ) ||
+        ( hz < 1 ) || ( hz > 1000 ) ) {
+        rv = 47;
+        ERROR( "[%d]: Invalid hashdot.profile.cpu.hz [%s] (1 to 1000).",
+               rv, hz_value );
+        return rv;
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( info->impl == VM_IMPL_HOTSPOT ) {
+        apr_array_header_t *vals =
+            apr_array_make( _mp, 2, sizeof( const char* ) );
+        *(const char **) apr_array_push( vals ) =
+            "-XX:+UnlockDiagnosticVMOptions";
+        *(const char **) apr_array_push( vals ) =
+            "-XX:+DebugNonSafepoints";
+        if( *vm_options != NULL ) apr_array_cat( vals, *vm_options );
+        *vm_options = vals;
+    }
+
+    *(const char **) apr_array_push( options ) =
+        apr_psprintf( _mp, "-agentpath:%s=hz=%ld,out=%s", agent, hz, out );
+
+    DEBUG( "CPU profiler enabled at %ld Hz, writing %s", hz, out );
+
+    return rv;
+}
+
 static char *
 property_to_option( const char *name,
                     apr_array_header_t *vals,
@@ -63,8 +262,8 @@ static apr_status_t
 get_create_jvm_function( const char *lib_name,
                          create_java_vm_f *symbol );
 
-static char *
-convert_class_name( const char *cname );
+static void
+convert_class_name( const char *cname, char *nname );
 
 static apr_status_t
 compact_option_flags( apr_array_header_t **values );
@@ -73,10 +272,55 @@ static void jvm_abort_hook();
 static void jvm_exit_hook( int status );
 
 apr_status_t init_jvm( int argc, const char *argv[] )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    JavaVM * vm = NULL;
+    JNIEnv * env = NULL;
+
+    rv = create_jvm( &vm, &env );
+
+    if( rv == APR_SUCCESS ) {
+        history_attach_vm( vm );
+        rv = install_hup_handler();
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = call_main( env, argc, argv, NULL );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        (*vm)->DestroyJavaVM(vm);
+        record_run();
+        jfr_exit();
+    }
+
+    return rv;
+}
+
+apr_status_t create_jvm( JavaVM **vm, JNIEnv **env )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_array_header_t *vals = NULL;
+
+    // Options first, since these may select a jlink image
+    rv = build_jvm_options( &vals );
+
+    if( rv != APR_SUCCESS ) return rv;
+
+    return start_jvm( vals, vm, env );
+}
+
+/**
+ * Create the JVM from hashdot.vm.lib with previously built options
+ * (as from build_jvm_options).
+ */
+apr_status_t start_jvm( apr_array_header_t *vals,
+                        JavaVM **vm,
+                        JNIEnv **env )
 {
     apr_status_t rv = APR_SUCCESS;
     JavaVMInitArgs vm_args;
-    apr_array_header_t *vals;
     int opt = 0;
 
     const char *lib_name = NULL;
@@ -84,51 +328,126 @@ apr_status_t init_jvm( int argc, const char *argv[] )
 
     create_java_vm_f create_jvm_func = NULL;
 
-    rv = get_create_jvm_function( lib_name, &create_jvm_func );
+    if( rv == APR_SUCCESS ) {
+        rv = get_create_jvm_function( lib_name, &create_jvm_func );
+    }
 
     if( rv != APR_SUCCESS ) return rv;
 
-    int options_len = 2 + apr_hash_count( _props );
+    JavaVMOption options[ 2 + vals->nelts ];
+
+    // Install exit and abort hooks (first 2)
+    options[opt  ].optionString = "exit";
+    options[opt++].extraInfo    = &jvm_exit_hook;
+    options[opt  ].optionString = "abort";
+    options[opt++].extraInfo    = &jvm_abort_hook;
+
+    int i;
+    for( i = 0; i < vals->nelts; i++ ) {
+        const char *val = ((const char **) vals->elts )[i];
+        options[opt  ].optionString = (char *) val;
+        options[opt++].extraInfo = NULL;
+    }
+
+    vm_args.version = JNI_VERSION_1_2; /* 1.2 is minimal for our purposes */
+    vm_args.options = options;
+    vm_args.nOptions = opt;
+    vm_args.ignoreUnrecognized = JNI_FALSE;
+
+    if( rv == APR_SUCCESS ) {
+        rv = acquire_launch_slot();
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = (*create_jvm_func)(vm, env, &vm_args);
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = define_daemon_class( *env );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = define_native_api( *env );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = start_watchdog( *env );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = start_control( *env );
+    }
+
+    return rv;
+}
+
+/**
+ * Build the final JVM option strings (excluding hooks) from
+ * hashdot.vm.options and all properties.
+ */
+apr_status_t build_jvm_options( apr_array_header_t **options )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_array_header_t *vals;
+
+    *options = apr_array_make( _mp, 16 + apr_hash_count( _props ),
+                               sizeof( const char* ) );
 
     vals = get_property_array( "hashdot.vm.options" );
 
+    // GC goal first, so that a collector it selects isn't overridden
+    // by a startup preset.
+    rv = add_gc_options( &vals );
+    if( rv != APR_SUCCESS ) return rv;
+
+    rv = add_startup_options( &vals );
+    if( rv != APR_SUCCESS ) return rv;
+
+    rv = add_perf_map_options( &vals, *options );
+    if( rv != APR_SUCCESS ) return rv;
+
+    rv = add_cpu_profiler_options( &vals, *options );
+    if( rv != APR_SUCCESS ) return rv;
+
+    rv = add_jfr_options( &vals );
+    if( rv != APR_SUCCESS ) return rv;
+
     if( vals ) {
         rv = compact_option_flags( &vals );
         set_property_array( "hashdot.vm.options", vals );
 
         if( rv != APR_SUCCESS) return rv;
-        options_len += vals->nelts;
+        apr_array_cat( *options, vals );
     }
 
-    JavaVMOption options[ options_len ];
+    rv = add_profiler_option( *options );
+    if( rv != APR_SUCCESS ) return rv;
 
-    // Install exit and abort hooks (first 2)
-    options[opt  ].optionString = "exit";
-    options[opt++].extraInfo    = &jvm_exit_hook;
-    options[opt  ].optionString = "abort";
-    options[opt++].extraInfo    = &jvm_abort_hook;
+    rv = add_watchdog_options( *options );
+    if( rv != APR_SUCCESS ) return rv;
 
-    if( vals ) {
-        int i;
-        for( i = 0; i < vals->nelts; i++ ) {
-            const char *val = ((const char **) vals->elts )[i];
-            options[opt  ].optionString = (char *) val;
-            options[opt++].extraInfo = NULL;
-        }
-    }
+    rv = check_control_options();
+    if( rv != APR_SUCCESS ) return rv;
+
+    rv = check_launch_options();
+    if( rv != APR_SUCCESS ) return rv;
 
     // Add java.class.path first (required by JVM)
+    apr_array_header_t *tvals = NULL;
     vals = get_property_array( "java.class.path" );
     if( vals ) {
-        apr_array_header_t *tvals = NULL;
         rv = glob_values( vals, &tvals );
         if( rv == APR_SUCCESS ) {
-            options[opt].optionString =
+            *(const char **) apr_array_push( *options ) =
                 property_to_option( "java.class.path", tvals, ':' );
-            options[opt++].extraInfo = NULL;
         }
     }
 
+    // Before other properties, as this may set hashdot.vm.home and lib
+    if( rv == APR_SUCCESS ) {
+        rv = select_jlink_image( tvals );
+    }
+
     if( rv != APR_SUCCESS ) return rv;
 
     // Add all other properties.
@@ -137,36 +456,33 @@ apr_status_t init_jvm( int argc, const char *argv[] )
     for( p = apr_hash_first( _mp, _props ); p; p = apr_hash_next( p ) ) {
         apr_hash_this( p, (const void **) &name, NULL, (void **) &vals );
         if( strcmp( name, "java.class.path" ) != 0 ) {
-            options[opt].optionString =
+            *(const char **) apr_array_push( *options ) =
                 property_to_option( name, vals, ' ' );
-            options[opt++].extraInfo = NULL;
         }
-        if( rv != APR_SUCCESS ) break;
     }
 
-    vm_args.version = JNI_VERSION_1_2; /* 1.2 is minimal for our purposes */
-    vm_args.options = options;
-    vm_args.nOptions = opt;
-    vm_args.ignoreUnrecognized = JNI_FALSE;
-
-    JavaVM * vm = NULL;
-    JNIEnv * env = NULL;
-
-    if( rv == APR_SUCCESS ) {
-        rv = (*create_jvm_func)(&vm, &env, &vm_args);
-    }
+    return rv;
+}
 
-    if( rv == APR_SUCCESS ) {
-        rv = install_hup_handler();
-    }
+apr_status_t call_main( JNIEnv *env,
+                        int argc,
+                        const char *argv[],
+                        int *thrown )
+{
+    apr_status_t rv = APR_SUCCESS;
 
     const char *main_name = NULL;
     rv = get_property_value( "hashdot.main", 0, 1, &main_name );
-    main_name = convert_class_name( main_name );
+    if( rv != APR_SUCCESS ) return rv;
+
+    // Converted on the stack, since this may be called concurrently
+    // (see batch.c) and _mp isn't thread safe.
+    char cname[ strlen( main_name ) + 1 ];
+    convert_class_name( main_name, cname );
 
     jclass cls = NULL;
     if( rv == APR_SUCCESS ) {
-        cls = (*env)->FindClass( env, main_name );
+        cls = (*env)->FindClass( env, cname );
 
         if( !cls ) {
             (*env)->ExceptionDescribe(env);
@@ -184,34 +500,63 @@ apr_status_t init_jvm( int argc, const char *argv[] )
         }
     }
 
-    jclass string_cls = NULL;
+    jobjectArray args = NULL;
     if( rv == APR_SUCCESS ) {
-        string_cls = (*env)->FindClass( env, "java/lang/String" ); // . -> / ?
-        if( !string_cls ) {
-            (*env)->ExceptionDescribe(env);
-            rv = 5;
-        }
+        rv = new_string_array( env, get_property_array( "hashdot.args.pre" ),
+                               argc, argv, &args );
     }
 
-    jobjectArray args = NULL;
     if( rv == APR_SUCCESS ) {
-        vals = get_property_array( "hashdot.args.pre" );
+        main_ready();
+        (*env)->CallStaticVoidMethod( env, cls, main_method, args );
+        DEBUG( "EXIT: returned from main." );
+        if( thrown != NULL ) {
+            *thrown = (*env)->ExceptionCheck( env ) ? 1 : 0;
+        }
+        (*env)->ExceptionDescribe(env);
+    }
+
+    if( args ) (*env)->DeleteLocalRef( env, args );
+    if( cls ) (*env)->DeleteLocalRef( env, cls );
 
+    return rv;
+}
+
+/**
+ * Create a new java String[] from the pre values (may be NULL)
+ * followed by argv.
+ */
+apr_status_t new_string_array( JNIEnv *env,
+                               apr_array_header_t *pre,
+                               int argc,
+                               const char *argv[],
+                               jobjectArray *args )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    jclass string_cls = NULL;
+    string_cls = (*env)->FindClass( env, "java/lang/String" ); // . -> / ?
+    if( !string_cls ) {
+        (*env)->ExceptionDescribe(env);
+        rv = 5;
+    }
+
+    if( rv == APR_SUCCESS ) {
         jsize args_total = argc;
         int argp = 0;
-        if( vals ) {
-            args_total += vals->nelts;
+        if( pre ) {
+            args_total += pre->nelts;
         }
 
-        args = (*env)->NewObjectArray( env, args_total, string_cls, NULL );
+        *args = (*env)->NewObjectArray( env, args_total, string_cls, NULL );
 
-        if( args && vals ) {
+        if( *args && pre ) {
             int i;
-            for( i = 0; i < vals->nelts; i++ ) {
+            for( i = 0; i < pre->nelts; i++ ) {
                 jstring arg = (*env)->NewStringUTF( env,
-                                  ((const char **) vals->elts )[i] );
+                                  ((const char **) pre->elts )[i] );
                 if( arg ) {
-                    (*env)->SetObjectArrayElement( env, args, argp++, arg );
+                    (*env)->SetObjectArrayElement( env, *args, argp++, arg );
                     (*env)->DeleteLocalRef( env, arg );
                 }
                 else {
@@ -222,13 +567,13 @@ apr_status_t init_jvm( int argc, const char *argv[] )
             }
         }
 
-        if( args ) {
+        if( *args ) {
             int i;
             for( i = 0; i < argc; i++ ) {  //start at arg 0 (post adjusted)
                 jstring arg = (*env)->NewStringUTF( env, argv[i] );
                 DEBUG( "Argument: %s", argv[i] );
                 if( arg ) {
-                    (*env)->SetObjectArrayElement( env, args, argp++, arg );
+                    (*env)->SetObjectArrayElement( env, *args, argp++, arg );
                     (*env)->DeleteLocalRef( env, arg );
                 }
                 else {
@@ -244,17 +589,7 @@ apr_status_t init_jvm( int argc, const char *argv[] )
         }
     }
 
-    if( rv == APR_SUCCESS ) {
-        (*env)->CallStaticVoidMethod( env, cls, main_method, args );
-        DEBUG( "EXIT: returned from main." );
-        (*env)->ExceptionDescribe(env);
-    }
-
-    if( args ) (*env)->DeleteLocalRef( env, args );
-
-    if( rv == APR_SUCCESS ) {
-        (*vm)->DestroyJavaVM(vm);
-    }
+    if( string_cls ) (*env)->DeleteLocalRef( env, string_cls );
 
     return rv;
 }
@@ -292,6 +627,14 @@ compact_option_flags( apr_array_header_t **values )
         int equal_pos = 0;
         if( found != NULL ) equal_pos = found - val;
 
+        //Boolean -XX:+Name and -XX:-Name are the same
+        const char *key = val;
+        if( ( equal_pos == 0 ) && ( strncmp( val, "-XX:", 4 ) == 0 ) &&
+            ( ( val[4] == '+' ) || ( val[4] == '-' ) ) ) {
+            key = val + 5;
+            equal_pos = strlen( key );
+        }
+
         //Otherwise any of the prefixes are the same
         if( equal_pos == 0 ) {
             int p;
@@ -310,8 +653,8 @@ compact_option_flags( apr_array_header_t **values )
         if( equal_pos == 0 ) equal_pos = strlen( val );
 
         //Add to tmp if its the first (from the back) of its type.
-        if( apr_hash_get( occurred, val, equal_pos ) == NULL ) {
-            apr_hash_set( occurred, val, equal_pos, val );
+        if( apr_hash_get( occurred, key, equal_pos ) == NULL ) {
+            apr_hash_set( occurred, key, equal_pos, val );
             *(const char **) apr_array_push( tmp ) = val;
         }
     }
@@ -361,28 +704,27 @@ get_create_jvm_function( const char *lib_name,
     return rv;
 }
 
-static char *
-convert_class_name( const char *cname )
+static void
+convert_class_name( const char *cname, char *nname )
 {
-    char * nname = apr_pstrdup( _mp, cname );
-
-    char * p = nname;
-    while( *p != '\0' ) {
-        if( *p == '.' ) *p = '/';
-        ++p;
-    }
-
-    return nname;
+    do {
+        *nname++ = ( *cname == '.' ) ? '/' : *cname;
+    } while( *cname++ != '\0' );
 }
 
 static void jvm_abort_hook()
 {
     WARN( "abort hook: abnormal exit." );
+    jfr_abort();
+    stop_control();
     unlock_pid_file();
 }
 
 static void jvm_exit_hook( int status )
 {
     DEBUG( "exit hook: status %d.", status );
+    record_run();
+    jfr_exit();
+    stop_control();
     unlock_pid_file();
 }
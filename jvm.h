@@ -37,7 +37,29 @@
 #define _JVM_H
 
 #include <apr_general.h>
+#include <apr_tables.h>
+
+#include <jni.h>
 
 apr_status_t init_jvm( int argc, const char *argv[] );
 
+apr_status_t create_jvm( JavaVM **vm, JNIEnv **env );
+
+apr_status_t start_jvm( apr_array_header_t *options,
+                        JavaVM **vm,
+                        JNIEnv **env );
+
+apr_status_t build_jvm_options( apr_array_header_t **options );
+
+apr_status_t call_main( JNIEnv *env,
+                        int argc,
+                        const char *argv[],
+                        int *thrown );
+
+apr_status_t new_string_array( JNIEnv *env,
+                               apr_array_header_t *pre,
+                               int argc,
+                               const char *argv[],
+                               jobjectArray *args );
+
 #endif
@@ -0,0 +1,248 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include <apr_strings.h>
+
+#include "runtime.h"
+#include "launch.h"
+#include "property.h"
+
+#define MAX_SLOTS 1024
+
+// Seconds between attempts for a slot, at minimum (plus random 0-50ms)
+#define RETRY_SECS 0.02
+
+// Descriptor of the locked slot file, or -1
+static int _slot_fd = -1;
+
+// Release the slot once ready (scope = startup), or hold until exit
+static int _release_on_ready = 1;
+
+// Settings, as checked by check_launch_options (0 slots when disabled)
+static long _max = 0;
+static const char *_group = "host";
+static double _jitter = 0;
+static double _timeout = 0;
+
+static void
+sleep_secs( double secs )
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t) secs;
+    ts.tv_nsec = (long) ( ( secs - ts.tv_sec ) * 1e9 );
+    while( ( nanosleep( &ts, &ts ) != 0 ) && ( errno == EINTR ) );
+}
+
+/**
+ * Read and check the hashdot.launch.* settings, before the JVM library
+ * is loaded, for acquire_launch_slot().
+ */
+apr_status_t check_launch_options()
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *max_value = NULL;
+    const char *scope = NULL;
+
+    _max = 0;
+    _group = "host";
+    _jitter = 0;
+    _timeout = 0;
+
+    rv = get_property_value( "hashdot.launch.max_concurrent", 0, 0,
+                             &max_value );
+    if( ( rv != APR_SUCCESS ) || ( max_value == NULL ) ) return rv;
+
+    rv = get_property_value( "hashdot.launch.group", 0, 0, &_group );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.launch.scope", 0, 0, &scope );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = read_seconds( "hashdot.launch.jitter", 41, &_jitter );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = read_seconds( "hashdot.launch.timeout", 41, &_timeout );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    char *end = NULL;
+    long max = strtol( max_value, &end, 10 );
+    if( ( end == max_value ) || ( *end != '\0' ) ||
+        ( max < 1 ) || ( max > MAX_SLOTS ) ) {
+        rv = 41;
+        ERROR( "[%d]: Invalid hashdot.launch.max_concurrent [%s] (1-%d).",
+               rv, max_value, MAX_SLOTS );
+        return rv;
+    }
+
+    if( ( _group[0] == '\0' ) ||
+        ( strspn( _group, "abcdefghijklmnopqrstuvwxyz"
+                          "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-" ) !=
+          strlen( _group ) ) ) {
+        rv = 41;
+        ERROR( "[%d]: Invalid hashdot.launch.group [%s]"
+               " (letters, digits, '.', '_' and '-').", rv, _group );
+        return rv;
+    }
+
+    if( ( scope == NULL ) || ( strcmp( scope, "startup" ) == 0 ) ) {
+        _release_on_ready = 1;
+    }
+    else if( strcmp( scope, "alive" ) == 0 ) {
+        _release_on_ready = 0;
+    }
+    else {
+        rv = 41;
+        ERROR( "[%d]: Invalid hashdot.launch.scope [%s] (startup or alive).",
+               rv, scope );
+        return rv;
+    }
+
+    _max = max;
+
+    return rv;
+}
+
+/**
+ * With hashdot.launch.max_concurrent (see check_launch_options), wait
+ * for one of that many launch slots of hashdot.launch.group, shared by
+ * all hashdot processes of the host, before the JVM is created. Slots
+ * are lock files in /dev/shm held with flock, so a slot is freed by the
+ * kernel when its process exits, however it exits.
+ */
+apr_status_t acquire_launch_slot()
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if( ( _max == 0 ) || ( _slot_fd >= 0 ) ) return rv;
+
+    struct timespec now;
+    clock_gettime( CLOCK_REALTIME, &now );
+    unsigned int seed = (unsigned int) getpid() ^ (unsigned int) now.tv_nsec;
+
+    double start = monotonic();
+
+    // Spread out launches started together (i.e. by cron)
+    if( _jitter > 0 ) {
+        sleep_secs( _jitter * rand_r( &seed ) / RAND_MAX );
+    }
+
+    const char *dir = ( access( "/dev/shm", W_OK ) == 0 ) ? "/dev/shm" : "/tmp";
+
+    int fds[ _max ];
+    int i;
+    for( i = 0; i < _max; i++ ) fds[i] = -1;
+
+    for( i = 0; ( i < _max ) && ( rv == APR_SUCCESS ); i++ ) {
+        const char *fname = apr_psprintf( _mp, "%s/hashdot-launch.%s.%d",
+                                          dir, _group, i );
+        fds[i] = open( fname, O_RDONLY | O_CREAT, 0666 );
+        if( fds[i] < 0 ) {
+            rv = APR_FROM_OS_ERROR( errno );
+            print_error( rv, fname );
+        }
+        else {
+            // Shared with other users' launches, where we created it
+            fchmod( fds[i], 0666 );
+            fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+        }
+    }
+
+    int slot = -1;
+    int attempts = 0;
+    while( rv == APR_SUCCESS ) {
+        int first = rand_r( &seed ) % _max;
+        for( i = 0; i < _max; i++ ) {
+            int s = ( first + i ) % _max;
+            if( flock( fds[s], LOCK_EX | LOCK_NB ) == 0 ) {
+                slot = s;
+                break;
+            }
+        }
+        if( slot >= 0 ) break;
+
+        if( attempts++ == 0 ) {
+            DEBUG( "All %ld launch slots of %s in use, waiting.",
+                   _max, _group );
+        }
+
+        if( ( _timeout > 0 ) && ( monotonic() - start >= _timeout ) ) {
+            rv = 42;
+            ERROR( "[%d]: No hashdot launch slot of %s free after %.1fs.",
+                   rv, _group, _timeout );
+        }
+        else {
+            sleep_secs( RETRY_SECS + 0.05 * rand_r( &seed ) / RAND_MAX );
+        }
+    }
+
+    for( i = 0; i < _max; i++ ) {
+        if( ( i != slot ) && ( fds[i] >= 0 ) ) close( fds[i] );
+    }
+
+    if( slot >= 0 ) {
+        _slot_fd = fds[slot];
+        DEBUG( "Launch slot %d of %ld (%s) after %.3fs queued.",
+               slot, _max, _group, monotonic() - start );
+    }
+
+    return rv;
+}
+
+/**
+ * Called when the application is ready (see main_ready): release the
+ * launch slot unless hashdot.launch.scope = alive. May be called
+ * repeatedly and concurrently.
+ */
+void launch_ready()
+{
+    if( !_release_on_ready ) return;
+
+    int fd = __atomic_exchange_n( &_slot_fd, -1, __ATOMIC_SEQ_CST );
+    if( fd >= 0 ) {
+        close( fd );
+        DEBUG( "Released launch slot." );
+    }
+}
@@ -0,0 +1,254 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/*
+ * Body of a launcher generated by "hashdot --compile-launcher". This
+ * file is not compiled into hashdot itself, but embedded as a string
+ * (see launcher_src.h in Makefile) and appended to the generated,
+ * fully resolved configuration:
+ *
+ *   VM_LIB, MAIN_CLASS, OPTIONS[], ENV[], ARGS[], PROCESS_NAME,
+ *   CHDIR, DAEMONIZE, REDIRECT_FILE, REDIRECT_APPEND, PID_FILE
+ *
+ * It depends only on libc, libdl and jni.h, and thus goes straight
+ * to dlopen and JNI_CreateJavaVM without reading any profiles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <dlfcn.h>
+#include <sys/file.h>
+
+#ifdef __linux__
+#  include <sys/prctl.h>
+#endif
+
+#include <jni.h>
+
+#ifdef __APPLE__
+#  define CREATE_JVM_FUNCTION_NAME "JNI_CreateJavaVM_Impl"
+#else
+#  define CREATE_JVM_FUNCTION_NAME "JNI_CreateJavaVM"
+#endif
+
+#define ERROR(format, args...) \
+    fprintf( stderr, "HASHDOT ERROR: " ); \
+    fprintf( stderr, format , ## args); \
+    fprintf( stderr, "\n" );
+
+typedef jint (*create_java_vm_f)(JavaVM **, JNIEnv **, JavaVMInitArgs *);
+
+static int _pid_fd = -1;
+
+static int count( const char **values )
+{
+    int n = 0;
+    while( values[n] != NULL ) n++;
+    return n;
+}
+
+static void unlock_pid_file()
+{
+    if( _pid_fd >= 0 ) {
+        unlink( PID_FILE );
+        close( _pid_fd );
+        _pid_fd = -1;
+    }
+}
+
+static void jvm_abort_hook()
+{
+    fprintf( stderr, "HASHDOT WARN: abort hook: abnormal exit.\n" );
+    unlock_pid_file();
+}
+
+static void jvm_exit_hook( int status )
+{
+    unlock_pid_file();
+}
+
+static void reopen_streams( int signo )
+{
+    if( ( freopen( REDIRECT_FILE, "a", stdout ) == NULL ) ||
+        ( freopen( REDIRECT_FILE, "a", stderr ) == NULL ) ) {
+        ERROR( "freopen %s: %s", REDIRECT_FILE, strerror( errno ) );
+    }
+}
+
+static int lock_pid_file()
+{
+    _pid_fd = open( PID_FILE, O_RDWR | O_CREAT, 0644 );
+    if( _pid_fd < 0 ) {
+        ERROR( "Could not open pid file [%s] for write.", PID_FILE );
+        return 1;
+    }
+    if( flock( _pid_fd, LOCK_EX | LOCK_NB ) != 0 ) {
+        fprintf( stderr, "HASHDOT WARN: pid_file [%s] already locked. "
+                 "Exiting.\n", PID_FILE );
+        close( _pid_fd );
+        _pid_fd = -1;
+        return 1;
+    }
+    char buf[32];
+    int len = snprintf( buf, sizeof( buf ), "%d\n", (int) getpid() );
+    if( ( ftruncate( _pid_fd, 0 ) != 0 ) ||
+        ( write( _pid_fd, buf, len ) != len ) ) {
+        ERROR( "Could not write pid file [%s].", PID_FILE );
+        return 1;
+    }
+    return 0;
+}
+
+int main( int argc, const char *argv[] )
+{
+    int i;
+
+    for( i = 0; ENV[i] != NULL; i += 2 ) {
+        setenv( ENV[i], ENV[i+1], 1 );
+    }
+
+#ifdef __linux__
+    prctl( PR_SET_NAME, PROCESS_NAME, 0, 0, 0 );
+#endif
+
+    if( ( CHDIR != NULL ) && ( chdir( CHDIR ) != 0 ) ) {
+        ERROR( "chdir %s: %s", CHDIR, strerror( errno ) );
+        return 1;
+    }
+
+    if( DAEMONIZE ) {
+        pid_t pid = fork();
+        if( pid < 0 ) {
+            ERROR( "fork: %s", strerror( errno ) );
+            return 1;
+        }
+        if( pid > 0 ) exit( 0 );
+        setsid();
+    }
+
+    if( REDIRECT_FILE != NULL ) {
+        const char *mode = REDIRECT_APPEND ? "a" : "w";
+        if( ( freopen( "/dev/null", "r", stdin ) == NULL ) ||
+            ( freopen( REDIRECT_FILE, mode, stdout ) == NULL ) ||
+            ( freopen( REDIRECT_FILE, mode, stderr ) == NULL ) ) {
+            return 1;
+        }
+    }
+
+    if( ( PID_FILE != NULL ) && ( lock_pid_file() != 0 ) ) {
+        return 1;
+    }
+
+    void *lib = dlopen( VM_LIB, RTLD_NOW | RTLD_GLOBAL );
+    create_java_vm_f create_jvm_func = NULL;
+    if( lib != NULL ) {
+        create_jvm_func = (create_java_vm_f)
+            dlsym( lib, CREATE_JVM_FUNCTION_NAME );
+    }
+    if( create_jvm_func == NULL ) {
+        ERROR( "Loading jvm: %s", dlerror() );
+        return 1;
+    }
+
+    int nopts = count( OPTIONS );
+    JavaVMOption options[ 2 + nopts ];
+    options[0].optionString = "exit";
+    options[0].extraInfo    = &jvm_exit_hook;
+    options[1].optionString = "abort";
+    options[1].extraInfo    = &jvm_abort_hook;
+    for( i = 0; i < nopts; i++ ) {
+        options[ 2 + i ].optionString = (char *) OPTIONS[i];
+        options[ 2 + i ].extraInfo    = NULL;
+    }
+
+    JavaVMInitArgs vm_args;
+    vm_args.version = JNI_VERSION_1_2;
+    vm_args.options = options;
+    vm_args.nOptions = 2 + nopts;
+    vm_args.ignoreUnrecognized = JNI_FALSE;
+
+    JavaVM *vm = NULL;
+    JNIEnv *env = NULL;
+    int rv = (*create_jvm_func)( &vm, &env, &vm_args );
+    if( rv != 0 ) {
+        ERROR( "[%d]: JNI_CreateJavaVM failed", rv );
+        unlock_pid_file();
+        return rv;
+    }
+
+    if( DAEMONIZE && ( REDIRECT_FILE != NULL ) ) {
+        signal( SIGHUP, &reopen_streams );
+    }
+
+    jclass cls = (*env)->FindClass( env, MAIN_CLASS );
+    jmethodID main_method = NULL;
+    if( cls ) {
+        main_method = (*env)->GetStaticMethodID( env, cls, "main",
+                                                 "([Ljava/lang/String;)V" );
+    }
+    jclass string_cls = (*env)->FindClass( env, "java/lang/String" );
+    jobjectArray args = NULL;
+    int nargs = count( ARGS );
+    if( main_method && string_cls ) {
+        args = (*env)->NewObjectArray( env, nargs + argc - 1,
+                                       string_cls, NULL );
+    }
+    for( i = 0; args && ( i < nargs + argc - 1 ); i++ ) {
+        const char *val = ( i < nargs ) ? ARGS[i] : argv[ i - nargs + 1 ];
+        jstring arg = (*env)->NewStringUTF( env, val );
+        if( arg == NULL ) break;
+        (*env)->SetObjectArrayElement( env, args, i, arg );
+        (*env)->DeleteLocalRef( env, arg );
+    }
+
+    if( (*env)->ExceptionCheck( env ) || ( args == NULL ) ) {
+        (*env)->ExceptionDescribe( env );
+        rv = 3;
+    }
+    else {
+        (*env)->CallStaticVoidMethod( env, cls, main_method, args );
+        (*env)->ExceptionDescribe( env );
+        (*vm)->DestroyJavaVM( vm );
+    }
+
+    unlock_pid_file();
+
+    return rv;
+}
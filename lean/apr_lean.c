@@ -0,0 +1,1010 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/time.h>
+
+#include "apr_lean.h"
+
+/* Pools */
+
+#define BLOCK_SIZE 8192
+
+typedef struct block_t {
+    struct block_t *next;
+    apr_size_t size;
+    apr_size_t used;
+    // Aligned for any use, as with malloc
+    double data[];
+} block_t;
+
+struct apr_pool_t {
+    block_t *blocks;
+};
+
+apr_status_t apr_initialize( void )
+{
+    return APR_SUCCESS;
+}
+
+void apr_terminate( void )
+{
+}
+
+apr_status_t apr_pool_create( apr_pool_t **pool, apr_pool_t *parent )
+{
+    *pool = calloc( 1, sizeof( apr_pool_t ) );
+    return ( *pool == NULL ) ? ENOMEM : APR_SUCCESS;
+}
+
+void apr_pool_clear( apr_pool_t *pool )
+{
+    while( pool->blocks != NULL ) {
+        block_t *next = pool->blocks->next;
+        free( pool->blocks );
+        pool->blocks = next;
+    }
+}
+
+void apr_pool_destroy( apr_pool_t *pool )
+{
+    apr_pool_clear( pool );
+    free( pool );
+}
+
+void *apr_palloc( apr_pool_t *pool, apr_size_t size )
+{
+    size = ( size + sizeof( double ) - 1 ) & ~( sizeof( double ) - 1 );
+
+    block_t *b = pool->blocks;
+    if( ( b == NULL ) || ( b->size - b->used < size ) ) {
+        apr_size_t bsize = ( size > BLOCK_SIZE / 4 ) ? size : BLOCK_SIZE;
+        b = malloc( sizeof( block_t ) + bsize );
+        if( b == NULL ) abort(); // As APR, without an abort function
+        b->size = bsize;
+        b->used = 0;
+        // Keep a partially used block current when adding a large one.
+        if( ( bsize != BLOCK_SIZE ) && ( pool->blocks != NULL ) ) {
+            b->next = pool->blocks->next;
+            pool->blocks->next = b;
+        }
+        else {
+            b->next = pool->blocks;
+            pool->blocks = b;
+        }
+    }
+    void *mem = (char *) b->data + b->used;
+    b->used += size;
+    return mem;
+}
+
+void *apr_pcalloc( apr_pool_t *pool, apr_size_t size )
+{
+    return memset( apr_palloc( pool, size ), 0, size );
+}
+
+void *apr_pmemdup( apr_pool_t *pool, const void *m, apr_size_t n )
+{
+    return memcpy( apr_palloc( pool, n ), m, n );
+}
+
+char *apr_strerror( apr_status_t rv, char *buf, apr_size_t size )
+{
+    if( rv < APR_OS_START_ERROR ) {
+        snprintf( buf, size, "%s", strerror( rv ) );
+    }
+    else if( rv == APR_EOF ) {
+        snprintf( buf, size, "End of file found" );
+    }
+    else if( rv == APR_EDSOOPEN ) {
+        snprintf( buf, size, "DSO load failed" );
+    }
+    else if( rv == APR_ESYMNOTFOUND ) {
+        snprintf( buf, size, "Could not find the requested symbol" );
+    }
+    else {
+        snprintf( buf, size, "APR does not understand this error code" );
+    }
+    return buf;
+}
+
+/* Strings */
+
+char *apr_pstrdup( apr_pool_t *pool, const char *s )
+{
+    if( s == NULL ) return NULL;
+    apr_size_t len = strlen( s ) + 1;
+    return memcpy( apr_palloc( pool, len ), s, len );
+}
+
+char *apr_pstrndup( apr_pool_t *pool, const char *s, apr_size_t n )
+{
+    if( s == NULL ) return NULL;
+    const char *end = memchr( s, '\0', n );
+    if( end != NULL ) n = end - s;
+    char *res = apr_palloc( pool, n + 1 );
+    memcpy( res, s, n );
+    res[n] = '\0';
+    return res;
+}
+
+char *apr_strtok( char *str, const char *sep, char **last )
+{
+    return strtok_r( str, sep, last );
+}
+
+apr_int64_t apr_atoi64( const char *buf )
+{
+    return strtoll( buf, NULL, 10 );
+}
+
+char *apr_pstrcat( apr_pool_t *pool, ... )
+{
+    va_list ap;
+    const char *s;
+    apr_size_t len = 0;
+
+    va_start( ap, pool );
+    while( ( s = va_arg( ap, const char * ) ) != NULL ) {
+        len += strlen( s );
+    }
+    va_end( ap );
+
+    char *res = apr_palloc( pool, len + 1 );
+    char *end = res;
+
+    va_start( ap, pool );
+    while( ( s = va_arg( ap, const char * ) ) != NULL ) {
+        apr_size_t slen = strlen( s );
+        memcpy( end, s, slen );
+        end += slen;
+    }
+    va_end( ap );
+
+    *end = '\0';
+    return res;
+}
+
+static char *pvsprintf( apr_pool_t *pool, const char *fmt, va_list ap )
+{
+    va_list cp;
+    va_copy( cp, ap );
+    int len = vsnprintf( NULL, 0, fmt, cp );
+    va_end( cp );
+
+    char *res = apr_palloc( pool, len + 1 );
+    vsnprintf( res, len + 1, fmt, ap );
+    return res;
+}
+
+char *apr_psprintf( apr_pool_t *pool, const char *fmt, ... )
+{
+    va_list ap;
+    va_start( ap, fmt );
+    char *res = pvsprintf( pool, fmt, ap );
+    va_end( ap );
+    return res;
+}
+
+/* Arrays */
+
+apr_array_header_t *apr_array_make( apr_pool_t *pool, int nelts, int elt_size )
+{
+    if( nelts < 1 ) nelts = 1;
+    apr_array_header_t *arr = apr_palloc( pool, sizeof( apr_array_header_t ) );
+    arr->pool = pool;
+    arr->elt_size = elt_size;
+    arr->nelts = 0;
+    arr->nalloc = nelts;
+    arr->elts = apr_pcalloc( pool, nelts * elt_size );
+    return arr;
+}
+
+static void array_grow( apr_array_header_t *arr, int nalloc )
+{
+    if( nalloc > arr->nalloc ) {
+        char *elts = apr_pcalloc( arr->pool, nalloc * arr->elt_size );
+        memcpy( elts, arr->elts, arr->nelts * arr->elt_size );
+        arr->elts = elts;
+        arr->nalloc = nalloc;
+    }
+}
+
+void *apr_array_push( apr_array_header_t *arr )
+{
+    if( arr->nelts == arr->nalloc ) {
+        array_grow( arr, arr->nalloc * 2 );
+    }
+    return arr->elts + ( arr->elt_size * arr->nelts++ );
+}
+
+void *apr_array_pop( apr_array_header_t *arr )
+{
+    if( arr->nelts <= 0 ) return NULL;
+    return arr->elts + ( arr->elt_size * --arr->nelts );
+}
+
+void apr_array_cat( apr_array_header_t *dst, const apr_array_header_t *src )
+{
+    if( dst->nelts + src->nelts > dst->nalloc ) {
+        int nalloc = dst->nalloc * 2;
+        while( dst->nelts + src->nelts > nalloc ) nalloc *= 2;
+        array_grow( dst, nalloc );
+    }
+    memcpy( dst->elts + dst->nelts * dst->elt_size, src->elts,
+            src->nelts * src->elt_size );
+    dst->nelts += src->nelts;
+}
+
+apr_array_header_t *apr_array_append( apr_pool_t *pool,
+                                      const apr_array_header_t *first,
+                                      const apr_array_header_t *second )
+{
+    apr_array_header_t *res =
+        apr_array_make( pool, first->nelts + second->nelts + 1,
+                        first->elt_size );
+    apr_array_cat( res, first );
+    apr_array_cat( res, second );
+    return res;
+}
+
+char *apr_array_pstrcat( apr_pool_t *pool,
+                         const apr_array_header_t *arr,
+                         const char sep )
+{
+    const char **strs = (const char **) arr->elts;
+    apr_size_t len = 0;
+    int i;
+    for( i = 0; i < arr->nelts; i++ ) {
+        if( strs[i] != NULL ) len += strlen( strs[i] );
+        if( sep && ( i > 0 ) ) len++;
+    }
+
+    char *res = apr_palloc( pool, len + 1 );
+    char *end = res;
+    for( i = 0; i < arr->nelts; i++ ) {
+        if( sep && ( i > 0 ) ) *end++ = sep;
+        if( strs[i] != NULL ) {
+            apr_size_t slen = strlen( strs[i] );
+            memcpy( end, strs[i], slen );
+            end += slen;
+        }
+    }
+    *end = '\0';
+    return res;
+}
+
+/* Hash tables: chained, doubling at a load factor of 1. */
+
+typedef struct entry_t {
+    struct entry_t *next;
+    unsigned int hash;
+    const void *key;
+    apr_ssize_t klen;
+    const void *val;
+} entry_t;
+
+struct apr_hash_index_t {
+    apr_hash_t *ht;
+    entry_t *this;
+    entry_t *next;
+    unsigned int bucket;
+};
+
+struct apr_hash_t {
+    apr_pool_t *pool;
+    entry_t **buckets;
+    entry_t *free;
+    unsigned int max;
+    unsigned int count;
+    apr_hash_index_t iterator;
+};
+
+apr_hash_t *apr_hash_make( apr_pool_t *pool )
+{
+    apr_hash_t *ht = apr_pcalloc( pool, sizeof( apr_hash_t ) );
+    ht->pool = pool;
+    ht->max = 15;
+    ht->buckets = apr_pcalloc( pool, ( ht->max + 1 ) * sizeof( entry_t* ) );
+    return ht;
+}
+
+static unsigned int hash_key( const void *key, apr_ssize_t *klen )
+{
+    // Same "times 33" function as APR
+    const unsigned char *k = key;
+    unsigned int hash = 0;
+    if( *klen == APR_HASH_KEY_STRING ) {
+        const unsigned char *p;
+        for( p = k; *p; p++ ) hash = hash * 33 + *p;
+        *klen = p - k;
+    }
+    else {
+        apr_ssize_t i;
+        for( i = 0; i < *klen; i++ ) hash = hash * 33 + k[i];
+    }
+    return hash;
+}
+
+static entry_t **find_entry( apr_hash_t *ht, const void *key,
+                             apr_ssize_t klen, unsigned int *hash )
+{
+    *hash = hash_key( key, &klen );
+    entry_t **ep = &ht->buckets[ *hash & ht->max ];
+    for( ; *ep != NULL; ep = &(*ep)->next ) {
+        if( ( (*ep)->hash == *hash ) && ( (*ep)->klen == klen ) &&
+            ( memcmp( (*ep)->key, key, klen ) == 0 ) ) {
+            break;
+        }
+    }
+    return ep;
+}
+
+static void expand_hash( apr_hash_t *ht )
+{
+    unsigned int max = ht->max * 2 + 1;
+    entry_t **buckets = apr_pcalloc( ht->pool, ( max + 1 ) * sizeof( entry_t* ) );
+    unsigned int i;
+    for( i = 0; i <= ht->max; i++ ) {
+        entry_t *e = ht->buckets[i];
+        while( e != NULL ) {
+            entry_t *next = e->next;
+            e->next = buckets[ e->hash & max ];
+            buckets[ e->hash & max ] = e;
+            e = next;
+        }
+    }
+    ht->buckets = buckets;
+    ht->max = max;
+}
+
+void *apr_hash_get( apr_hash_t *ht, const void *key, apr_ssize_t klen )
+{
+    unsigned int hash;
+    entry_t *e = *find_entry( ht, key, klen, &hash );
+    return ( e != NULL ) ? (void *) e->val : NULL;
+}
+
+void apr_hash_set( apr_hash_t *ht, const void *key, apr_ssize_t klen,
+                   const void *val )
+{
+    unsigned int hash;
+    entry_t **ep = find_entry( ht, key, klen, &hash );
+    if( *ep != NULL ) {
+        if( val == NULL ) { // Remove, and keep the entry for reuse
+            entry_t *e = *ep;
+            *ep = e->next;
+            e->next = ht->free;
+            ht->free = e;
+            --ht->count;
+        }
+        else {
+            (*ep)->val = val;
+        }
+    }
+    else if( val != NULL ) {
+        entry_t *e = ht->free;
+        if( e != NULL ) {
+            ht->free = e->next;
+        }
+        else {
+            e = apr_palloc( ht->pool, sizeof( entry_t ) );
+        }
+        if( klen == APR_HASH_KEY_STRING ) klen = strlen( key );
+        e->next = NULL;
+        e->hash = hash;
+        e->key = key;
+        e->klen = klen;
+        e->val = val;
+        *ep = e;
+        if( ++ht->count > ht->max ) {
+            expand_hash( ht );
+        }
+    }
+}
+
+unsigned int apr_hash_count( apr_hash_t *ht )
+{
+    return ht->count;
+}
+
+apr_hash_index_t *apr_hash_next( apr_hash_index_t *hi )
+{
+    // The next entry is fetched in advance, so that the current entry
+    // may be removed while iterating, as with APR.
+    hi->this = hi->next;
+    while( hi->this == NULL ) {
+        if( hi->bucket > hi->ht->max ) return NULL;
+        hi->this = hi->ht->buckets[ hi->bucket++ ];
+    }
+    hi->next = hi->this->next;
+    return hi;
+}
+
+apr_hash_index_t *apr_hash_first( apr_pool_t *pool, apr_hash_t *ht )
+{
+    apr_hash_index_t *hi = ( pool != NULL ) ?
+        apr_palloc( pool, sizeof( apr_hash_index_t ) ) : &ht->iterator;
+    hi->ht = ht;
+    hi->this = NULL;
+    hi->next = NULL;
+    hi->bucket = 0;
+    return apr_hash_next( hi );
+}
+
+void apr_hash_this( apr_hash_index_t *hi, const void **key, apr_ssize_t *klen,
+                    void **val )
+{
+    if( key )  *key  = hi->this->key;
+    if( klen ) *klen = hi->this->klen;
+    if( val )  *val  = (void *) hi->this->val;
+}
+
+/* Files: unbuffered writes and buffered reads over a descriptor. */
+
+static mode_t unix_mode( apr_fileperms_t perm, mode_t os_default );
+
+struct apr_file_t {
+    int fd;
+    char *buf;
+    apr_size_t pos;
+    apr_size_t len;
+    int eof;
+};
+
+apr_status_t apr_file_open( apr_file_t **file, const char *fname,
+                            apr_int32_t flags, apr_fileperms_t perm,
+                            apr_pool_t *pool )
+{
+    int oflags = 0;
+    if( ( flags & APR_FOPEN_READ ) && ( flags & APR_FOPEN_WRITE ) ) {
+        oflags = O_RDWR;
+    }
+    else if( flags & APR_FOPEN_WRITE ) {
+        oflags = O_WRONLY;
+    }
+    else {
+        oflags = O_RDONLY;
+    }
+    if( flags & APR_FOPEN_CREATE )   oflags |= O_CREAT;
+    if( flags & APR_FOPEN_APPEND )   oflags |= O_APPEND;
+    if( flags & APR_FOPEN_TRUNCATE ) oflags |= O_TRUNC;
+
+    int fd = open( fname, oflags | O_CLOEXEC, unix_mode( perm, 0666 ) );
+    if( fd < 0 ) return errno;
+
+    *file = apr_pcalloc( pool, sizeof( apr_file_t ) );
+    (*file)->fd = fd;
+    if( flags & APR_FOPEN_READ ) {
+        (*file)->buf = apr_palloc( pool, BLOCK_SIZE );
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_file_close( apr_file_t *file )
+{
+    if( ( file->fd >= 0 ) && ( close( file->fd ) != 0 ) ) return errno;
+    file->fd = -1;
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_file_read_full( apr_file_t *file, void *buf,
+                                 apr_size_t nbytes, apr_size_t *bytes_read )
+{
+    apr_size_t done = 0;
+    if( file->pos < file->len ) {
+        done = file->len - file->pos;
+        if( done > nbytes ) done = nbytes;
+        memcpy( buf, file->buf + file->pos, done );
+        file->pos += done;
+    }
+    while( ( done < nbytes ) && !file->eof ) {
+        ssize_t n = read( file->fd, (char *) buf + done, nbytes - done );
+        if( n < 0 ) {
+            if( errno == EINTR ) continue;
+            if( bytes_read != NULL ) *bytes_read = done;
+            return errno;
+        }
+        if( n == 0 ) file->eof = 1;
+        done += n;
+    }
+    if( bytes_read != NULL ) *bytes_read = done;
+    return ( done < nbytes ) ? APR_EOF : APR_SUCCESS;
+}
+
+apr_status_t apr_file_gets( char *str, int len, apr_file_t *file )
+{
+    int i = 0;
+    while( i < len - 1 ) {
+        if( file->pos == file->len ) {
+            if( file->eof ) break;
+            ssize_t n = read( file->fd, file->buf, BLOCK_SIZE );
+            if( n < 0 ) {
+                if( errno == EINTR ) continue;
+                str[i] = '\0';
+                return errno;
+            }
+            if( n == 0 ) {
+                file->eof = 1;
+                break;
+            }
+            file->pos = 0;
+            file->len = n;
+        }
+        char c = file->buf[ file->pos++ ];
+        str[i++] = c;
+        if( c == '\n' ) break;
+    }
+    str[i] = '\0';
+    return ( ( i == 0 ) && file->eof ) ? APR_EOF : APR_SUCCESS;
+}
+
+static apr_status_t write_full( apr_file_t *file, const char *str,
+                                apr_size_t len )
+{
+    while( len > 0 ) {
+        ssize_t n = write( file->fd, str, len );
+        if( n < 0 ) {
+            if( errno == EINTR ) continue;
+            return errno;
+        }
+        str += n;
+        len -= n;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_file_puts( const char *str, apr_file_t *file )
+{
+    return write_full( file, str, strlen( str ) );
+}
+
+int apr_file_printf( apr_file_t *file, const char *fmt, ... )
+{
+    char buf[ 4096 ];
+    va_list ap;
+    va_start( ap, fmt );
+    int len = vsnprintf( buf, sizeof( buf ), fmt, ap );
+    va_end( ap );
+    if( len >= (int) sizeof( buf ) ) len = sizeof( buf ) - 1;
+    return ( write_full( file, buf, len ) == APR_SUCCESS ) ? len : -1;
+}
+
+apr_status_t apr_file_lock( apr_file_t *file, int type )
+{
+    int op = ( ( type & 0x0f ) == APR_FLOCK_SHARED ) ? LOCK_SH : LOCK_EX;
+    if( type & APR_FLOCK_NONBLOCK ) op |= LOCK_NB;
+    while( flock( file->fd, op ) != 0 ) {
+        if( errno != EINTR ) return errno;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_file_trunc( apr_file_t *file, apr_off_t offset )
+{
+    if( ftruncate( file->fd, offset ) != 0 ) return errno;
+    if( lseek( file->fd, offset, SEEK_SET ) < 0 ) return errno;
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_file_remove( const char *path, apr_pool_t *pool )
+{
+    return ( unlink( path ) == 0 ) ? APR_SUCCESS : errno;
+}
+
+apr_status_t apr_file_rename( const char *from_path, const char *to_path,
+                              apr_pool_t *pool )
+{
+    return ( rename( from_path, to_path ) == 0 ) ? APR_SUCCESS : errno;
+}
+
+static mode_t unix_mode( apr_fileperms_t perm, mode_t os_default )
+{
+    if( perm == APR_OS_DEFAULT ) return os_default; // subject to umask
+
+    // One hex digit per user, group, world triple
+    return ( ( ( perm >> 8 ) & 7 ) << 6 ) | ( ( ( perm >> 4 ) & 7 ) << 3 ) |
+           ( perm & 7 );
+}
+
+apr_status_t apr_dir_make_recursive( const char *path, apr_fileperms_t perm,
+                                     apr_pool_t *pool )
+{
+    if( mkdir( path, unix_mode( perm, 0777 ) ) == 0 ) return APR_SUCCESS;
+    if( errno == EEXIST ) return APR_SUCCESS;
+    if( errno != ENOENT ) return errno;
+
+    // Make the parent first
+    const char *s = strrchr( path, '/' );
+    if( ( s == NULL ) || ( s == path ) ) return ENOENT;
+    apr_status_t rv = apr_dir_make_recursive( apr_pstrndup( pool, path, s - path ),
+                                              perm, pool );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( mkdir( path, unix_mode( perm, 0777 ) ) != 0 ) && ( errno != EEXIST ) ) {
+        return errno;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_stat( apr_finfo_t *finfo, const char *fname,
+                       apr_int32_t wanted, apr_pool_t *pool )
+{
+    struct stat st;
+    if( stat( fname, &st ) != 0 ) return errno;
+
+    switch( st.st_mode & S_IFMT ) {
+    case S_IFREG:  finfo->filetype = APR_REG;  break;
+    case S_IFDIR:  finfo->filetype = APR_DIR;  break;
+    case S_IFCHR:  finfo->filetype = APR_CHR;  break;
+    case S_IFBLK:  finfo->filetype = APR_BLK;  break;
+    case S_IFIFO:  finfo->filetype = APR_PIPE; break;
+    case S_IFLNK:  finfo->filetype = APR_LNK;  break;
+    case S_IFSOCK: finfo->filetype = APR_SOCK; break;
+    default:       finfo->filetype = APR_UNKFILE;
+    }
+    finfo->size = st.st_size;
+#ifdef __APPLE__
+    finfo->mtime = (apr_int64_t) st.st_mtime * 1000000 +
+        st.st_mtimespec.tv_nsec / 1000;
+#else
+    finfo->mtime = (apr_int64_t) st.st_mtime * 1000000 +
+        st.st_mtim.tv_nsec / 1000;
+#endif
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_filepath_get( char **path, apr_int32_t flags,
+                               apr_pool_t *pool )
+{
+    char buf[ 4096 ];
+    if( getcwd( buf, sizeof( buf ) ) == NULL ) return errno;
+    *path = apr_pstrdup( pool, buf );
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_filepath_set( const char *path, apr_pool_t *pool )
+{
+    return ( chdir( path ) == 0 ) ? APR_SUCCESS : errno;
+}
+
+/**
+ * Merge addpath to rootpath (or the current directory), eliminating
+ * "." and ".." segments lexically, as APR does.
+ */
+apr_status_t apr_filepath_merge( char **newpath, const char *rootpath,
+                                 const char *addpath, apr_int32_t flags,
+                                 apr_pool_t *pool )
+{
+    apr_status_t rv = APR_SUCCESS;
+    char *root = (char *) rootpath;
+
+    if( addpath == NULL ) addpath = "";
+    if( addpath[0] == '/' ) {
+        root = "/";
+    }
+    else if( root == NULL ) {
+        rv = apr_filepath_get( &root, 0, pool );
+        if( rv != APR_SUCCESS ) return rv;
+    }
+
+    apr_size_t rlen = strlen( root );
+    char *path = apr_palloc( pool, rlen + strlen( addpath ) + 3 );
+    memcpy( path, root, rlen );
+    apr_size_t len = rlen;
+
+    // Ensure separator between root and added segments
+    if( ( len > 0 ) && ( path[ len - 1 ] != '/' ) && ( addpath[0] != '\0' ) ) {
+        path[ len++ ] = '/';
+    }
+    apr_size_t base = ( path[0] == '/' ) ? 1 : 0;
+
+    const char *seg = addpath;
+    while( *seg != '\0' ) {
+        const char *end = strchr( seg, '/' );
+        apr_size_t slen = ( end != NULL ) ? (apr_size_t) ( end - seg ) : strlen( seg );
+
+        if( ( slen == 0 ) || ( ( slen == 1 ) && ( seg[0] == '.' ) ) ) {
+            // skip
+        }
+        else if( ( slen == 2 ) && ( seg[0] == '.' ) && ( seg[1] == '.' ) ) {
+            // Back up over the last segment, leaving the trailing '/'
+            if( len > base ) {
+                len--;
+                while( ( len > base ) && ( path[ len - 1 ] != '/' ) ) len--;
+            }
+        }
+        else {
+            memcpy( path + len, seg, slen );
+            len += slen;
+            if( end != NULL ) path[ len++ ] = '/';
+        }
+        if( end == NULL ) break;
+        seg = end + 1;
+    }
+
+    // Drop any trailing '/' not given in addpath
+    apr_size_t alen = strlen( addpath );
+    if( ( alen > 0 ) && ( addpath[ alen - 1 ] != '/' ) &&
+        ( len > base ) && ( path[ len - 1 ] == '/' ) ) {
+        len--;
+    }
+    path[ len ] = '\0';
+    *newpath = path;
+    return rv;
+}
+
+const char *apr_filepath_name_get( const char *pathname )
+{
+    const char *s = strrchr( pathname, '/' );
+    return ( s != NULL ) ? s + 1 : pathname;
+}
+
+/* Time */
+
+apr_time_t apr_time_now( void )
+{
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec * APR_USEC_PER_SEC + tv.tv_usec;
+}
+
+/* Globs */
+
+apr_status_t apr_fnmatch( const char *pattern, const char *string,
+                          int flags )
+{
+    return ( fnmatch( pattern, string, flags ) == 0 ) ?
+        APR_SUCCESS : APR_FNM_NOMATCH;
+}
+
+int apr_fnmatch_test( const char *pattern )
+{
+    int nesting = 0;
+    for( ; *pattern != '\0'; pattern++ ) {
+        switch( *pattern ) {
+        case '?':
+        case '*':
+            return 1;
+        case '\\':
+            if( *++pattern == '\0' ) return 0;
+            break;
+        case '[':
+            ++nesting;
+            break;
+        case ']':
+            if( nesting ) return 1;
+            break;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Match the file name pattern against entries of its directory,
+ * returning the matching names (without directory) in directory order.
+ */
+apr_status_t apr_match_glob( const char *pattern,
+                             apr_array_header_t **result,
+                             apr_pool_t *pool )
+{
+    const char *path = ".";
+    const char *idx = strrchr( pattern, '/' );
+    if( idx != NULL ) {
+        path = apr_pstrndup( pool, pattern, idx - pattern );
+        pattern = idx + 1;
+    }
+
+    *result = apr_array_make( pool, 0, sizeof( char * ) );
+
+    DIR *dir = opendir( path );
+    if( dir == NULL ) return errno;
+
+    struct dirent *ent;
+    while( ( ent = readdir( dir ) ) != NULL ) {
+        if( fnmatch( pattern, ent->d_name, 0 ) == 0 ) {
+            *(const char **) apr_array_push( *result ) =
+                apr_pstrdup( pool, ent->d_name );
+        }
+    }
+    closedir( dir );
+    return APR_SUCCESS;
+}
+
+/* Environment */
+
+apr_status_t apr_env_get( char **value, const char *envvar,
+                          apr_pool_t *pool )
+{
+    *value = getenv( envvar );
+    return ( *value != NULL ) ? APR_SUCCESS : APR_ENOENT;
+}
+
+apr_status_t apr_env_set( const char *envvar, const char *value,
+                          apr_pool_t *pool )
+{
+    return ( setenv( envvar, value, 1 ) == 0 ) ? APR_SUCCESS : errno;
+}
+
+/* Signals */
+
+apr_sigfunc_t *apr_signal( int signo, apr_sigfunc_t *func )
+{
+    struct sigaction act, oact;
+    act.sa_handler = func;
+    sigemptyset( &act.sa_mask );
+    act.sa_flags = SA_RESTART;
+    if( sigaction( signo, &act, &oact ) < 0 ) return SIG_ERR;
+    return oact.sa_handler;
+}
+
+/* Dynamic loading */
+
+struct apr_dso_handle_t {
+    void *handle;
+    const char *errormsg;
+    apr_pool_t *pool;
+};
+
+apr_status_t apr_dso_load( apr_dso_handle_t **res, const char *path,
+                           apr_pool_t *pool )
+{
+    // As APR, a handle is returned even on failure, for apr_dso_error
+    *res = apr_pcalloc( pool, sizeof( apr_dso_handle_t ) );
+    (*res)->pool = pool;
+    (*res)->handle = dlopen( path, RTLD_NOW | RTLD_GLOBAL );
+    if( (*res)->handle == NULL ) {
+        (*res)->errormsg = apr_pstrdup( pool, dlerror() );
+        return APR_EDSOOPEN;
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t apr_dso_sym( apr_dso_handle_sym_t *sym,
+                          apr_dso_handle_t *handle,
+                          const char *name )
+{
+    dlerror();
+    *sym = dlsym( handle->handle, name );
+    if( *sym == NULL ) {
+        const char *msg = dlerror();
+        handle->errormsg = apr_pstrdup( handle->pool,
+                                        msg ? msg : "symbol not found" );
+        return APR_ESYMNOTFOUND;
+    }
+    return APR_SUCCESS;
+}
+
+const char *apr_dso_error( apr_dso_handle_t *handle, char *buf,
+                           apr_size_t bufsize )
+{
+    snprintf( buf, bufsize, "%s",
+              handle->errormsg ? handle->errormsg : "No Error" );
+    return buf;
+}
+
+/* Threads */
+
+struct apr_thread_t {
+    pthread_t thread;
+    apr_thread_start_t func;
+    void *data;
+};
+
+struct apr_thread_mutex_t {
+    pthread_mutex_t mutex;
+};
+
+struct apr_thread_cond_t {
+    pthread_cond_t cond;
+};
+
+static void *thread_start( void *arg )
+{
+    apr_thread_t *thread = arg;
+    return thread->func( thread, thread->data );
+}
+
+apr_status_t apr_thread_create( apr_thread_t **thread,
+                                apr_threadattr_t *attr,
+                                apr_thread_start_t func,
+                                void *data, apr_pool_t *pool )
+{
+    *thread = apr_pcalloc( pool, sizeof( apr_thread_t ) );
+    (*thread)->func = func;
+    (*thread)->data = data;
+    return pthread_create( &(*thread)->thread, NULL, thread_start, *thread );
+}
+
+apr_status_t apr_thread_join( apr_status_t *retval, apr_thread_t *thread )
+{
+    void *res = NULL;
+    apr_status_t rv = pthread_join( thread->thread, &res );
+    if( retval != NULL ) *retval = (apr_status_t) (intptr_t) res;
+    return rv;
+}
+
+apr_status_t apr_thread_mutex_create( apr_thread_mutex_t **mutex,
+                                      unsigned int flags,
+                                      apr_pool_t *pool )
+{
+    *mutex = apr_pcalloc( pool, sizeof( apr_thread_mutex_t ) );
+    return pthread_mutex_init( &(*mutex)->mutex, NULL );
+}
+
+apr_status_t apr_thread_mutex_lock( apr_thread_mutex_t *mutex )
+{
+    return pthread_mutex_lock( &mutex->mutex );
+}
+
+apr_status_t apr_thread_mutex_unlock( apr_thread_mutex_t *mutex )
+{
+    return pthread_mutex_unlock( &mutex->mutex );
+}
+
+apr_status_t apr_thread_cond_create( apr_thread_cond_t **cond,
+                                     apr_pool_t *pool )
+{
+    *cond = apr_pcalloc( pool, sizeof( apr_thread_cond_t ) );
+    return pthread_cond_init( &(*cond)->cond, NULL );
+}
+
+apr_status_t apr_thread_cond_wait( apr_thread_cond_t *cond,
+                                   apr_thread_mutex_t *mutex )
+{
+    return pthread_cond_wait( &cond->cond, &mutex->mutex );
+}
+
+apr_status_t apr_thread_cond_signal( apr_thread_cond_t *cond )
+{
+    return pthread_cond_signal( &cond->cond );
+}
+
+apr_status_t apr_thread_cond_broadcast( apr_thread_cond_t *cond )
+{
+    return pthread_cond_broadcast( &cond->cond );
+}
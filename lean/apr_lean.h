@@ -0,0 +1,312 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/*
+ * Minimal, APR compatible portability layer for the lean (APR free)
+ * build of hashdot. Only the subset of APR used by the launcher core
+ * (runtime.c, property.c, jvm.c, daemon.c, pidfile.c, libpath.c and
+ * main.c) is provided, with the same semantics, so these sources
+ * build unchanged against the apr_*.h headers in this directory.
+ *
+ * POSIX (Linux/Mac) only. Not thread safe, like an APR pool; threads
+ * must allocate from pools of their own.
+ */
+
+#ifndef _APR_LEAN_H
+#define _APR_LEAN_H
+
+// System headers otherwise included by the APR headers
+#include <stddef.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+typedef int          apr_status_t;
+typedef size_t       apr_size_t;
+typedef ssize_t      apr_ssize_t;
+typedef off_t        apr_off_t;
+typedef int32_t      apr_int32_t;
+typedef int64_t      apr_int64_t;
+typedef uint64_t     apr_uint64_t;
+typedef int32_t      apr_fileperms_t;
+
+#define APR_INT64_T_FMT      PRId64
+
+#define APR_SUCCESS          0
+#define APR_OS_START_ERROR   20000
+#define APR_OS_START_STATUS  70000
+#define APR_OS_START_USERERR 120000
+#define APR_EDSOOPEN         ( APR_OS_START_ERROR + 25 )
+#define APR_ESYMNOTFOUND     ( APR_OS_START_STATUS + 15 )
+#define APR_EOF              ( APR_OS_START_STATUS + 14 )
+#define APR_ENOENT           ENOENT
+
+#define APR_FROM_OS_ERROR(e) (e)
+#define APR_TO_OS_ERROR(e)   (e)
+
+/* Pools: arena allocation, freed all at once. */
+
+typedef struct apr_pool_t apr_pool_t;
+
+apr_status_t apr_initialize( void );
+void apr_terminate( void );
+
+apr_status_t apr_pool_create( apr_pool_t **pool, apr_pool_t *parent );
+void apr_pool_clear( apr_pool_t *pool );
+void apr_pool_destroy( apr_pool_t *pool );
+
+void *apr_palloc( apr_pool_t *pool, apr_size_t size );
+void *apr_pcalloc( apr_pool_t *pool, apr_size_t size );
+void *apr_pmemdup( apr_pool_t *pool, const void *m, apr_size_t n );
+
+char *apr_strerror( apr_status_t rv, char *buf, apr_size_t size );
+
+/* Strings */
+
+char *apr_pstrdup( apr_pool_t *pool, const char *s );
+char *apr_pstrndup( apr_pool_t *pool, const char *s, apr_size_t n );
+char *apr_pstrcat( apr_pool_t *pool, ... );
+char *apr_psprintf( apr_pool_t *pool, const char *fmt, ... )
+    __attribute__(( format( printf, 2, 3 ) ));
+char *apr_strtok( char *str, const char *sep, char **last );
+apr_int64_t apr_atoi64( const char *buf );
+
+#define apr_isspace(c) ( isspace( ( (unsigned char)(c) ) ) )
+
+/* Arrays */
+
+typedef struct apr_array_header_t {
+    apr_pool_t *pool;
+    int elt_size;
+    int nelts;
+    int nalloc;
+    char *elts;
+} apr_array_header_t;
+
+#define apr_is_empty_array(a) ( ( (a) == NULL ) || ( (a)->nelts == 0 ) )
+
+apr_array_header_t *apr_array_make( apr_pool_t *pool, int nelts, int elt_size );
+void *apr_array_push( apr_array_header_t *arr );
+void *apr_array_pop( apr_array_header_t *arr );
+void apr_array_cat( apr_array_header_t *dst, const apr_array_header_t *src );
+apr_array_header_t *apr_array_append( apr_pool_t *pool,
+                                      const apr_array_header_t *first,
+                                      const apr_array_header_t *second );
+char *apr_array_pstrcat( apr_pool_t *pool,
+                         const apr_array_header_t *arr,
+                         const char sep );
+
+/* Hash tables */
+
+#define APR_HASH_KEY_STRING (-1)
+
+typedef struct apr_hash_t apr_hash_t;
+typedef struct apr_hash_index_t apr_hash_index_t;
+
+apr_hash_t *apr_hash_make( apr_pool_t *pool );
+void *apr_hash_get( apr_hash_t *ht, const void *key, apr_ssize_t klen );
+void apr_hash_set( apr_hash_t *ht, const void *key, apr_ssize_t klen,
+                   const void *val );
+unsigned int apr_hash_count( apr_hash_t *ht );
+apr_hash_index_t *apr_hash_first( apr_pool_t *pool, apr_hash_t *ht );
+apr_hash_index_t *apr_hash_next( apr_hash_index_t *hi );
+void apr_hash_this( apr_hash_index_t *hi, const void **key, apr_ssize_t *klen,
+                    void **val );
+
+/* Files */
+
+typedef struct apr_file_t apr_file_t;
+
+#define APR_FOPEN_READ       0x00001
+#define APR_FOPEN_WRITE      0x00002
+#define APR_FOPEN_CREATE     0x00004
+#define APR_FOPEN_APPEND     0x00008
+#define APR_FOPEN_TRUNCATE   0x00010
+#define APR_FOPEN_BUFFERED   0x00080
+
+#define APR_READ             APR_FOPEN_READ
+#define APR_WRITE            APR_FOPEN_WRITE
+#define APR_CREATE           APR_FOPEN_CREATE
+#define APR_APPEND           APR_FOPEN_APPEND
+#define APR_TRUNCATE         APR_FOPEN_TRUNCATE
+
+#define APR_FPROT_UREAD      0x0400
+#define APR_FPROT_UWRITE     0x0200
+#define APR_FPROT_GREAD      0x0040
+#define APR_FPROT_WREAD      0x0004
+#define APR_OS_DEFAULT       0x0FFF
+
+#define APR_FLOCK_SHARED     1
+#define APR_FLOCK_EXCLUSIVE  2
+#define APR_FLOCK_NONBLOCK   0x0010
+
+apr_status_t apr_file_open( apr_file_t **file, const char *fname,
+                            apr_int32_t flags, apr_fileperms_t perm,
+                            apr_pool_t *pool );
+apr_status_t apr_file_close( apr_file_t *file );
+apr_status_t apr_file_gets( char *str, int len, apr_file_t *file );
+apr_status_t apr_file_read_full( apr_file_t *file, void *buf,
+                                 apr_size_t nbytes, apr_size_t *bytes_read );
+apr_status_t apr_file_puts( const char *str, apr_file_t *file );
+int apr_file_printf( apr_file_t *file, const char *fmt, ... )
+    __attribute__(( format( printf, 2, 3 ) ));
+apr_status_t apr_file_lock( apr_file_t *file, int type );
+apr_status_t apr_file_trunc( apr_file_t *file, apr_off_t offset );
+apr_status_t apr_file_remove( const char *path, apr_pool_t *pool );
+apr_status_t apr_file_rename( const char *from_path, const char *to_path,
+                              apr_pool_t *pool );
+
+#define APR_FPROT_OS_DEFAULT 0x0FFF
+
+apr_status_t apr_dir_make_recursive( const char *path, apr_fileperms_t perm,
+                                     apr_pool_t *pool );
+
+typedef enum {
+    APR_NOFILE = 0, APR_REG, APR_DIR, APR_CHR, APR_BLK, APR_PIPE,
+    APR_LNK, APR_SOCK, APR_UNKFILE = 127
+} apr_filetype_e;
+
+#define APR_FINFO_MTIME 0x00000010
+#define APR_FINFO_SIZE  0x00000100
+#define APR_FINFO_TYPE  0x00008000
+
+typedef struct apr_finfo_t {
+    apr_filetype_e filetype;
+    apr_off_t size;
+    apr_int64_t mtime; // apr_time_t
+} apr_finfo_t;
+
+apr_status_t apr_stat( apr_finfo_t *finfo, const char *fname,
+                       apr_int32_t wanted, apr_pool_t *pool );
+
+apr_status_t apr_filepath_get( char **path, apr_int32_t flags,
+                               apr_pool_t *pool );
+apr_status_t apr_filepath_set( const char *path, apr_pool_t *pool );
+apr_status_t apr_filepath_merge( char **newpath, const char *rootpath,
+                                 const char *addpath, apr_int32_t flags,
+                                 apr_pool_t *pool );
+const char *apr_filepath_name_get( const char *pathname );
+
+/* Time */
+
+typedef apr_int64_t apr_time_t;
+typedef apr_int64_t apr_interval_time_t;
+
+#define APR_USEC_PER_SEC         ( (apr_time_t) 1000000 )
+#define apr_time_sec(t)          ( (t) / APR_USEC_PER_SEC )
+#define apr_time_usec(t)         ( (t) % APR_USEC_PER_SEC )
+#define apr_time_as_msec(t)      ( (t) / 1000 )
+#define apr_time_from_sec(s)     ( (apr_time_t)(s) * APR_USEC_PER_SEC )
+
+apr_time_t apr_time_now( void );
+
+/* Globs */
+
+#define APR_FNM_NOMATCH 1
+
+apr_status_t apr_fnmatch( const char *pattern, const char *string,
+                          int flags );
+int apr_fnmatch_test( const char *pattern );
+apr_status_t apr_match_glob( const char *pattern,
+                             apr_array_header_t **result,
+                             apr_pool_t *pool );
+
+/* Environment */
+
+apr_status_t apr_env_get( char **value, const char *envvar,
+                          apr_pool_t *pool );
+apr_status_t apr_env_set( const char *envvar, const char *value,
+                          apr_pool_t *pool );
+
+/* Signals */
+
+typedef void apr_sigfunc_t( int );
+
+apr_sigfunc_t *apr_signal( int signo, apr_sigfunc_t *func );
+
+/* Dynamic loading */
+
+typedef struct apr_dso_handle_t apr_dso_handle_t;
+typedef void *apr_dso_handle_sym_t;
+
+apr_status_t apr_dso_load( apr_dso_handle_t **handle, const char *path,
+                           apr_pool_t *pool );
+apr_status_t apr_dso_sym( apr_dso_handle_sym_t *sym,
+                          apr_dso_handle_t *handle,
+                          const char *name );
+const char *apr_dso_error( apr_dso_handle_t *handle, char *buf,
+                           apr_size_t bufsize );
+
+/* Threads (pthreads) */
+
+#define APR_THREAD_FUNC
+
+typedef struct apr_thread_t apr_thread_t;
+typedef struct apr_threadattr_t apr_threadattr_t;
+typedef struct apr_thread_mutex_t apr_thread_mutex_t;
+typedef struct apr_thread_cond_t apr_thread_cond_t;
+
+typedef void *( APR_THREAD_FUNC *apr_thread_start_t )( apr_thread_t *,
+                                                       void * );
+
+#define APR_THREAD_MUTEX_DEFAULT 0
+
+apr_status_t apr_thread_create( apr_thread_t **thread,
+                                apr_threadattr_t *attr,
+                                apr_thread_start_t func,
+                                void *data, apr_pool_t *pool );
+apr_status_t apr_thread_join( apr_status_t *retval, apr_thread_t *thread );
+
+apr_status_t apr_thread_mutex_create( apr_thread_mutex_t **mutex,
+                                      unsigned int flags,
+                                      apr_pool_t *pool );
+apr_status_t apr_thread_mutex_lock( apr_thread_mutex_t *mutex );
+apr_status_t apr_thread_mutex_unlock( apr_thread_mutex_t *mutex );
+
+apr_status_t apr_thread_cond_create( apr_thread_cond_t **cond,
+                                     apr_pool_t *pool );
+apr_status_t apr_thread_cond_wait( apr_thread_cond_t *cond,
+                                   apr_thread_mutex_t *mutex );
+apr_status_t apr_thread_cond_signal( apr_thread_cond_t *cond );
+apr_status_t apr_thread_cond_broadcast( apr_thread_cond_t *cond );
+
+#endif
@@ -0,0 +1,2 @@
+/* Lean build, see apr_lean.h */
+#include "apr_lean.h"
@@ -0,0 +1,199 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <string.h>
+
+#include <apr_strings.h>
+#include <apr_env.h>
+#include <apr_hash.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "jvm.h"
+#include "control.h"
+#include "hashdot.h"
+
+struct hashdot_options {
+    apr_hash_t *props;
+    apr_array_header_t *vm_options;
+};
+
+int hashdot_initialize( void )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if( _mp == NULL ) {
+        rv = rt_initialize();
+    }
+
+    char * value;
+    if( ( rv == APR_SUCCESS ) &&
+        ( apr_env_get( &value, "HASHDOT_DEBUG", _mp ) == APR_SUCCESS ) ) {
+        _debug = 1;
+    }
+
+    return rv;
+}
+
+int hashdot_resolve( const char * const *profiles,
+                     const char *script,
+                     const char * const *props,
+                     hashdot_options_t **options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    if( _mp == NULL ) {
+        ERROR( "hashdot_initialize() not called." );
+        return 1;
+    }
+
+    _props = apr_hash_make( _mp );
+    apr_hash_t *rprops = apr_hash_make( _mp );
+
+    rv = set_user_prop();
+
+    if( rv == APR_SUCCESS ) {
+        rv = parse_profile( "default", rprops );
+    }
+
+    const char * const *p;
+    for( p = profiles; ( p != NULL ) && ( *p != NULL ) &&
+             ( rv == APR_SUCCESS ); p++ ) {
+        rv = parse_profile( *p, rprops );
+        control_add_profile( *p );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( script != NULL ) ) {
+        rv = set_script_props( script );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( script != NULL ) ) {
+        rv = parse_hashdot_header( script, rprops );
+    }
+
+    for( p = props; ( p != NULL ) && ( *p != NULL ) &&
+             ( rv == APR_SUCCESS ); p++ ) {
+        rv = parse_property_line( *p, rprops );
+        control_add_property( *p );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = expand_recursive_props( rprops );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        set_property_value( "hashdot.version", HASHDOT_VERSION );
+    }
+
+    // Note: java.class.path is expanded/globed/resolved here
+    apr_array_header_t *vm_options = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = build_jvm_options( &vm_options );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        *options = apr_pcalloc( _mp, sizeof( hashdot_options_t ) );
+        (*options)->props = _props;
+        (*options)->vm_options = vm_options;
+    }
+
+    if( rv > APR_OS_START_ERROR ) {
+        print_error( rv, "" );
+    }
+
+    return rv;
+}
+
+int hashdot_option_count( const hashdot_options_t *options )
+{
+    return options->vm_options->nelts;
+}
+
+const char *hashdot_option( const hashdot_options_t *options, int index )
+{
+    if( ( index < 0 ) || ( index >= options->vm_options->nelts ) ) {
+        return NULL;
+    }
+    return ((const char **) options->vm_options->elts )[index];
+}
+
+const char *hashdot_property( const hashdot_options_t *options,
+                              const char *name )
+{
+    apr_array_header_t *vals =
+        apr_hash_get( options->props, name, strlen( name ) + 1 );
+    return ( vals != NULL ) ? apr_array_pstrcat( _mp, vals, ' ' ) : NULL;
+}
+
+int hashdot_create_vm( const hashdot_options_t *options,
+                       JavaVM **vm,
+                       JNIEnv **env )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    // The properties of these options apply from here on.
+    _props = options->props;
+
+    rv = set_hashdot_env();
+
+    if( rv == APR_SUCCESS ) {
+        rv = start_jvm( options->vm_options, vm, env );
+    }
+
+    if( rv > APR_OS_START_ERROR ) {
+        print_error( rv, "" );
+    }
+
+    return rv;
+}
+
+int hashdot_call_main( JNIEnv *env, int argc, const char *argv[] )
+{
+    int thrown = 0;
+    apr_status_t rv = call_main( env, argc, argv, &thrown );
+    if( ( rv == APR_SUCCESS ) && thrown ) rv = 1;
+    return rv;
+}
+
+void hashdot_terminate( void )
+{
+    if( _mp != NULL ) {
+        stop_control();
+        rt_shutdown();
+        _mp = NULL;
+        _props = NULL;
+    }
+}
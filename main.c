@@ -36,7 +36,6 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <pwd.h>
 
 #include <apr_strings.h>
 #include <apr_env.h>
@@ -49,6 +48,14 @@
 #include "pidfile.h"
 #include "jvm.h"
 #include "libpath.h"
+#include "batch.h"
+#include "services.h"
+#include "compile.h"
+#include "history.h"
+#include "workers.h"
+#include "control.h"
+#include "aot.h"
+#include "hashdot.h"
 
 #ifndef __MacOS_X__
 #  include <sys/prctl.h>
@@ -59,15 +66,6 @@ skip_flags( int argc,
             const char *argv[],
             int *file_offset );
 
-static apr_status_t
-set_user_prop();
-
-static apr_status_t
-set_script_props( const char *script );
-
-static apr_status_t
-set_hashdot_env();
-
 static apr_status_t
 set_process_name( int argc,
                   const char *argv[],
@@ -76,7 +74,7 @@ set_process_name( int argc,
 static apr_status_t
 check_hashdot_cwd( const char **script );
 
-int main( int argc, const char *argv[] )
+int hashdot_main( int argc, const char *argv[] )
 {
     apr_status_t rv = rt_initialize();
 
@@ -87,6 +85,51 @@ int main( int argc, const char *argv[] )
         DEBUG( "DEBUG output enabled." );
     }
 
+    // Original arguments, for any exec_self
+    int main_argc = argc;
+    const char **main_argv = argv;
+
+    // Batch mode: read all argument vectors and then proceed with the
+    // first as if it were the command line.
+    apr_array_header_t *batch = NULL;
+    if( ( rv == APR_SUCCESS ) && ( argc > 1 ) &&
+        ( strcmp( argv[1], "--batch" ) == 0 ) ) {
+        if( argc != 3 ) {
+            ERROR( "Usage: %s --batch <batch-file|->", argv[0] );
+            rv = 1;
+        }
+        if( rv == APR_SUCCESS ) {
+            rv = read_batch( argv[2], argv[0], &batch );
+        }
+        if( rv == APR_SUCCESS ) {
+            batch_job_args( batch, 0, &argc, &argv );
+        }
+    }
+
+    // Compile a standalone launcher for the given script instead of
+    // running it.
+    const char *compile_out = NULL;
+    if( ( rv == APR_SUCCESS ) && ( argc > 1 ) &&
+        ( strcmp( argv[1], "--compile-launcher" ) == 0 ) ) {
+        if( ( argc != 5 ) || ( strcmp( argv[3], "-o" ) != 0 ) ) {
+            ERROR( "Usage: %s --compile-launcher <script-file> -o <output>",
+                   argv[0] );
+            rv = 1;
+        }
+        if( rv == APR_SUCCESS ) {
+            rv = apr_filepath_merge( (char **) &compile_out, NULL, argv[4],
+                                     0, _mp );
+        }
+        if( rv == APR_SUCCESS ) {
+            static const char *cargv[3];
+            cargv[0] = argv[0];
+            cargv[1] = argv[2];
+            cargv[2] = NULL;
+            argc = 2;
+            argv = cargv;
+        }
+    }
+
     int file_offset = 0;
     char * called_as = NULL;
     if( rv == APR_SUCCESS ) {
@@ -124,10 +167,12 @@ int main( int argc, const char *argv[] )
     if( ( rv == APR_SUCCESS ) &&
         ( apr_env_get( &value, "HASHDOT_PROFILE", _mp ) == APR_SUCCESS ) ) {
         rv = parse_profile( value, rprops );
+        control_add_profile( value );
     }
 
     if( ( rv == APR_SUCCESS ) && ( called_as != NULL ) ) {
         rv = parse_profile( called_as, rprops );
+        control_add_profile( called_as );
     }
 
     if( ( rv == APR_SUCCESS ) && ( called_as != NULL ) ) {
@@ -138,17 +183,53 @@ int main( int argc, const char *argv[] )
         rv = set_script_props( argv[ file_offset ] );
     }
 
+    // Properties before the script header, for any adaptive overlay
+    apr_hash_t *base_props = NULL;
+    apr_hash_t *base_rprops = NULL;
+    if( ( rv == APR_SUCCESS ) && ( file_offset > 0 ) && ( batch == NULL ) ) {
+        copy_properties( rprops, &base_props, &base_rprops );
+    }
+
     if( ( rv == APR_SUCCESS ) && ( file_offset > 0 ) ) {
         rv = parse_hashdot_header( argv[ file_offset ], rprops );
     }
 
+    // Overlay a short or long run profile, as learned from history. The
+    // overlay goes under the script header, which is parsed again on top
+    // of it, so explicit header settings still win.
+    const char *adaptive_class = NULL;
+    const char *adaptive_profile = NULL;
+    if( ( rv == APR_SUCCESS ) && ( base_props != NULL ) ) {
+        rv = select_adaptive_profile( &adaptive_class, &adaptive_profile );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( adaptive_profile != NULL ) ) {
+        _props = base_props;
+        rprops = base_rprops;
+        rv = parse_profile( adaptive_profile, rprops );
+        if( rv == APR_SUCCESS ) {
+            rv = parse_hashdot_header( argv[ file_offset ], rprops );
+        }
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( adaptive_class != NULL ) ) {
+        set_property_value( "hashdot.adaptive.class", adaptive_class );
+    }
+
     // Late expand any "recursive" rprops and fold in to props
     if( rv == APR_SUCCESS ) {
         rv = expand_recursive_props( rprops );
     }
 
+    if( ( rv == APR_SUCCESS ) && ( batch != NULL ) &&
+        ( strcmp( main_argv[2], "-" ) == 0 ) &&
+        ( get_property_array( "hashdot.vm.libpath" ) != NULL ) ) {
+        ERROR( "A batch from stdin can not be used with hashdot.vm.libpath." );
+        rv = 1;
+    }
+
     if( rv == APR_SUCCESS ) {
-        rv = exec_self( argc, argv ); //if needed
+        rv = exec_self( main_argc, main_argv ); //if needed
     }
 
     if( rv == APR_SUCCESS ) {
@@ -180,6 +261,20 @@ int main( int argc, const char *argv[] )
         rv = check_hashdot_cwd( (file_offset > 0) ? argv + file_offset : NULL );
     }
 
+    // After any chdir, so relative class path entries are expanded from
+    // the same directory the launcher will run in.
+    if( ( rv == APR_SUCCESS ) && ( compile_out != NULL ) ) {
+        rv = compile_launcher( compile_out );
+        goto END;
+    }
+
+    // Run from compiled classes of the script (hashdot.aot), or start
+    // compiling them, before any daemon or pid file lock.
+    if( ( rv == APR_SUCCESS ) && ( batch == NULL ) &&
+        ( get_property_array( "hashdot.services" ) == NULL ) ) {
+        rv = select_aot_class( file_offset, &argc, &argv );
+    }
+
     if( rv == APR_SUCCESS ) {
         rv = check_daemonize();
     }
@@ -190,13 +285,27 @@ int main( int argc, const char *argv[] )
 
     if( rv == APR_SUCCESS ) {
         // Note: java.class.path is expanded/globed/resolved here
-        rv = init_jvm( argc-1, argv+1 );
+        if( batch != NULL ) {
+            rv = run_batch( batch );
+        }
+        else if( get_property_array( "hashdot.services" ) != NULL ) {
+            rv = run_services();
+        }
+        else if( get_property_array( "hashdot.workers" ) != NULL ) {
+            rv = run_workers( argc-1, argv+1 );
+        }
+        else {
+            rv = init_jvm( argc-1, argv+1 );
+        }
     }
 
+    stop_control();
+
     if( rv == APR_SUCCESS ) {
         rv = unlock_pid_file();
     }
 
+ END:
     if( rv > APR_OS_START_ERROR ) {
         print_error( rv, "" );
     }
@@ -253,54 +362,6 @@ skip_flags( int argc,
     return rv;
 }
 
-static apr_status_t
-set_user_prop()
-{
-    struct passwd *pentry = getpwuid( getuid() );
-    return set_property_value( "hashdot.user.home", pentry->pw_dir );
-}
-
-static apr_status_t
-set_script_props( const char *script )
-{
-    apr_status_t rv = APR_SUCCESS;
-
-    char *absolute_script = NULL;
-    apr_filepath_merge( &absolute_script, NULL, script, 0, _mp );
-
-    rv = set_property_value( "hashdot.script", absolute_script );
-
-    char *lpath = strrchr( absolute_script, '/' );
-    char *dir = ( lpath == NULL ) ? "." :
-        apr_pstrndup( _mp, absolute_script, lpath - absolute_script );
-
-    rv = set_property_value( "hashdot.script.dir", dir );
-
-    return rv;
-}
-
-static apr_status_t set_hashdot_env()
-{
-    static const char *HASHDOT_ENV_PRE = "hashdot.env.";
-    int plen = strlen( HASHDOT_ENV_PRE );
-    apr_status_t rv = APR_SUCCESS;
-
-    apr_array_header_t *vals;
-    const char *name = NULL;
-    apr_hash_index_t *p;
-    for( p = apr_hash_first( _mp, _props ); p && (rv == APR_SUCCESS);
-         p = apr_hash_next( p ) ) {
-
-        apr_hash_this( p, (const void **) &name, NULL, (void **) &vals );
-        int nlen = strlen( name );
-        if( ( nlen > plen ) && strncmp( HASHDOT_ENV_PRE, name, plen ) == 0 ) {
-            const char *val = apr_array_pstrcat( _mp, vals, ' ' );
-            rv = apr_env_set( name + plen, val, _mp );
-        }
-    }
-    return rv;
-}
-
 static apr_status_t
 set_process_name( int argc,
                   const char *argv[],
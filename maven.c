@@ -0,0 +1,1006 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_file_info.h>
+#include <apr_hash.h>
+#include <apr_time.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "maven.h"
+
+#define MVN_PREFIX "mvn:"
+
+// Limit of parent and import POM nesting
+#define MAX_POM_DEPTH 32
+
+// Limit of nested ${property} references
+#define MAX_INTERPOLATE_DEPTH 8
+
+typedef struct xml_node_t xml_node_t;
+
+// Element of a parsed POM. Attributes are ignored; text is only kept
+// for elements without child elements.
+struct xml_node_t {
+    const char *name;
+    const char *text;
+    xml_node_t *parent;
+    xml_node_t *child;
+    xml_node_t *last;
+    xml_node_t *next;
+};
+
+typedef struct {
+    const char *group;
+    const char *artifact;
+    const char *version;
+    const char *type;
+    const char *classifier;
+    const char *scope;
+    int optional;
+    apr_array_header_t *exclusions; // "group:artifact", either may be "*"
+} dep_t;
+
+// Effective POM: inherited from parents, with properties interpolated.
+typedef struct {
+    const char *group;
+    const char *artifact;
+    const char *version;
+    const char *parent_version;
+    apr_hash_t *props;
+    apr_array_header_t *raw_managed; // dep_t *, as written, parents first
+    apr_array_header_t *raw_deps;    // dep_t *, as written, parents first
+    apr_hash_t *managed;             // "group:artifact" -> dep_t *
+    apr_array_header_t *deps;        // dep_t *
+} pom_t;
+
+typedef struct {
+    const char *path;
+    apr_time_t mtime; // 0 if not found
+} pom_file_t;
+
+typedef struct {
+    apr_pool_t *pool;
+    const char *repo;
+    apr_hash_t *poms;             // "group:artifact:version" -> pom_t *
+    apr_array_header_t *pom_files; // pom_file_t, every POM looked for
+} maven_t;
+
+typedef struct {
+    dep_t *dep;
+    apr_array_header_t *exclusions; // Inherited from dependents
+} pending_t;
+
+// Marks a POM which could not be loaded (or is being loaded).
+static pom_t MISSING_POM;
+
+static apr_status_t
+parse_coordinate( const char *coord, apr_pool_t *pool, dep_t **dep );
+
+static void
+resolve( maven_t *mvn, dep_t *root, apr_hash_t *seen,
+         apr_array_header_t *jars );
+
+static pom_t *
+load_pom( maven_t *mvn, const char *group, const char *artifact,
+          const char *version, int depth );
+
+static const char *
+artifact_path( maven_t *mvn, dep_t *dep, const char *version,
+               const char *ext );
+
+static const char *
+pick_version( const char *version );
+
+static const char *
+index_file_name( const char *key );
+
+static int
+read_index( const char *fname, const char *repo,
+            apr_array_header_t *coords, apr_array_header_t **jars );
+
+static void
+write_index( const char *fname, maven_t *mvn,
+             apr_array_header_t *coords, apr_array_header_t *jars );
+
+static xml_node_t *
+parse_xml( char *buf, apr_pool_t *pool );
+
+static xml_node_t *
+xml_child( xml_node_t *node, const char *name );
+
+static const char *
+xml_text( xml_node_t *node, const char *name );
+
+/**
+ * Replace each "mvn:group:artifact[:type[:classifier]]:version" value
+ * with the path of the artifact in the local repository
+ * (hashdot.maven.repository), followed by the paths of its transitive
+ * compile and runtime dependencies, nearest first. An artifact already
+ * resolved for an earlier value (by group and artifact) is not added
+ * again. The resolved paths are cached in an index file, used while
+ * none of the POMs read have changed.
+ */
+apr_status_t resolve_maven_values( apr_array_header_t *values,
+                                   apr_array_header_t **rvalues )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    apr_array_header_t *coords = NULL;
+    for( i = 0; i < values->nelts; i++ ) {
+        const char *val = ((const char **) values->elts )[i];
+        if( strncmp( val, MVN_PREFIX, strlen( MVN_PREFIX ) ) == 0 ) {
+            if( coords == NULL ) {
+                coords = apr_array_make( _mp, 8, sizeof( const char * ) );
+            }
+            *(const char **) apr_array_push( coords ) = val;
+        }
+    }
+
+    *rvalues = values;
+    if( coords == NULL ) return rv;
+
+    apr_time_t start = apr_time_now();
+
+    const char *repo = NULL;
+    rv = get_property_value( "hashdot.maven.repository", '/', 0, &repo );
+    if( rv != APR_SUCCESS ) return rv;
+    if( repo == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        repo = apr_pstrcat( _mp, home, "/.m2/repository", NULL );
+    }
+
+    const char *key = apr_pstrcat( _mp, repo, "\n",
+                                   apr_array_pstrcat( _mp, coords, '\n' ),
+                                   NULL );
+    const char *fname = index_file_name( key );
+
+    apr_array_header_t *jars = NULL;
+    int cached = read_index( fname, repo, coords, &jars );
+
+    if( !cached ) {
+        maven_t mvn;
+        rv = apr_pool_create( &mvn.pool, _mp );
+        if( rv != APR_SUCCESS ) return rv;
+        mvn.repo = repo;
+        mvn.poms = apr_hash_make( mvn.pool );
+        mvn.pom_files = apr_array_make( mvn.pool, 64, sizeof( pom_file_t ) );
+
+        apr_hash_t *seen = apr_hash_make( mvn.pool );
+        jars = apr_array_make( _mp, coords->nelts,
+                               sizeof( apr_array_header_t * ) );
+
+        for( i = 0; ( i < coords->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+            const char *coord = ((const char **) coords->elts )[i];
+            dep_t *root = NULL;
+            rv = parse_coordinate( coord, mvn.pool, &root );
+            if( rv == APR_SUCCESS ) {
+                apr_array_header_t *cjars =
+                    apr_array_make( _mp, 16, sizeof( const char * ) );
+                resolve( &mvn, root, seen, cjars );
+                *(apr_array_header_t **) apr_array_push( jars ) = cjars;
+            }
+        }
+
+        if( rv == APR_SUCCESS ) {
+            write_index( fname, &mvn, coords, jars );
+        }
+
+        apr_pool_destroy( mvn.pool );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        int count = 0;
+        int c = 0;
+        *rvalues = apr_array_make( _mp, values->nelts + 16,
+                                   sizeof( const char * ) );
+        for( i = 0; i < values->nelts; i++ ) {
+            const char *val = ((const char **) values->elts )[i];
+            if( strncmp( val, MVN_PREFIX, strlen( MVN_PREFIX ) ) == 0 ) {
+                apr_array_header_t *cjars =
+                    ((apr_array_header_t **) jars->elts )[c++];
+                apr_array_cat( *rvalues, cjars );
+                count += cjars->nelts;
+            }
+            else {
+                *(const char **) apr_array_push( *rvalues ) = val;
+            }
+        }
+
+        DEBUG( "Resolved %d maven coordinates to %d jars (%s) in %ldus",
+               coords->nelts, count, cached ? "index" : "POMs",
+               (long) ( apr_time_now() - start ) );
+    }
+
+    return rv;
+}
+
+static apr_status_t
+parse_coordinate( const char *coord, apr_pool_t *pool, dep_t **dep )
+{
+    char *parts[5];
+    int n = 0;
+    char *last = NULL;
+    char *buf = apr_pstrdup( pool, coord + strlen( MVN_PREFIX ) );
+    char *tok = apr_strtok( buf, ":", &last );
+
+    while( ( tok != NULL ) && ( n < 5 ) ) {
+        parts[n++] = tok;
+        tok = apr_strtok( NULL, ":", &last );
+    }
+
+    if( ( tok != NULL ) || ( n < 3 ) ) {
+        ERROR( "Invalid maven coordinate [%s], expected "
+               "mvn:group:artifact[:type[:classifier]]:version", coord );
+        return 36;
+    }
+
+    *dep = apr_pcalloc( pool, sizeof( dep_t ) );
+    (*dep)->group      = parts[0];
+    (*dep)->artifact   = parts[1];
+    (*dep)->type       = ( n > 3 ) ? parts[2] : "jar";
+    (*dep)->classifier = ( n > 4 ) ? parts[3] : NULL;
+    (*dep)->version    = parts[n - 1];
+    (*dep)->scope      = "compile";
+
+    return APR_SUCCESS;
+}
+
+static int
+is_excluded( apr_array_header_t *exclusions, dep_t *dep )
+{
+    int i;
+    if( exclusions == NULL ) return 0;
+
+    for( i = 0; i < exclusions->nelts; i++ ) {
+        const char *ex = ((const char **) exclusions->elts )[i];
+        const char *sep = strchr( ex, ':' );
+        if( sep == NULL ) continue;
+        apr_size_t glen = sep - ex;
+        int group = ( ( glen == 1 ) && ( ex[0] == '*' ) ) ||
+            ( ( strlen( dep->group ) == glen ) &&
+              ( strncmp( dep->group, ex, glen ) == 0 ) );
+        int artifact = ( strcmp( sep + 1, "*" ) == 0 ) ||
+            ( strcmp( sep + 1, dep->artifact ) == 0 );
+        if( group && artifact ) return 1;
+    }
+    return 0;
+}
+
+/**
+ * Breadth first walk of the dependency graph from root, so the
+ * version nearest to the root wins as with maven.
+ */
+static void
+resolve( maven_t *mvn, dep_t *root, apr_hash_t *seen,
+         apr_array_header_t *jars )
+{
+    apr_array_header_t *queue =
+        apr_array_make( mvn->pool, 32, sizeof( pending_t ) );
+    int head = 0;
+    int i;
+
+    pending_t first = { root, NULL };
+    *(pending_t *) apr_array_push( queue ) = first;
+
+    while( head < queue->nelts ) {
+        pending_t p = ((pending_t *) queue->elts )[head++];
+        dep_t *dep = p.dep;
+
+        const char *ga = apr_pstrcat( mvn->pool, dep->group, ":",
+                                      dep->artifact, NULL );
+        if( apr_hash_get( seen, ga, APR_HASH_KEY_STRING ) ) continue;
+        apr_hash_set( seen, ga, APR_HASH_KEY_STRING, ga );
+
+        const char *version = pick_version( dep->version );
+        if( version == NULL ) {
+            WARN( "No usable version [%s] for %s, skipped.",
+                  ( dep->version != NULL ) ? dep->version : "", ga );
+            continue;
+        }
+
+        const char *jar = NULL;
+        if( ( strcmp( dep->type, "jar" ) == 0 ) ||
+            ( strcmp( dep->type, "bundle" ) == 0 ) ||
+            ( strcmp( dep->type, "test-jar" ) == 0 ) ) {
+            jar = artifact_path( mvn, dep, version, "jar" );
+        }
+        else if( strcmp( dep->type, "pom" ) != 0 ) {
+            jar = artifact_path( mvn, dep, version, dep->type );
+        }
+        if( jar != NULL ) {
+            *(const char **) apr_array_push( jars ) = apr_pstrdup( _mp, jar );
+        }
+
+        pom_t *pom = load_pom( mvn, dep->group, dep->artifact, version, 0 );
+        if( pom == NULL ) {
+            DEBUG( "No POM for %s:%s, dependencies unknown.", ga, version );
+            continue;
+        }
+
+        for( i = 0; i < pom->deps->nelts; i++ ) {
+            dep_t *d = ((dep_t **) pom->deps->elts )[i];
+
+            if( ( strcmp( d->scope, "compile" ) != 0 ) &&
+                ( strcmp( d->scope, "runtime" ) != 0 ) ) continue;
+            if( d->optional ) continue;
+            if( is_excluded( p.exclusions, d ) ) continue;
+
+            pending_t next = { d, p.exclusions };
+            if( d->exclusions != NULL ) {
+                next.exclusions = ( p.exclusions != NULL ) ?
+                    apr_array_append( mvn->pool, p.exclusions,
+                                      d->exclusions ) :
+                    d->exclusions;
+            }
+            *(pending_t *) apr_array_push( queue ) = next;
+        }
+    }
+}
+
+/**
+ * Return the version to use: as given, the single version of a
+ * "[1.0]" range, or the lower bound of an inclusive "[1.0,2.0)"
+ * range. NULL if none.
+ */
+static const char *
+pick_version( const char *version )
+{
+    if( ( version == NULL ) || ( *version == '\0' ) ) return NULL;
+    if( ( version[0] != '[' ) && ( version[0] != '(' ) ) return version;
+    if( version[0] == '(' ) return NULL;
+
+    apr_size_t len = strcspn( version + 1, ",])" );
+    if( len == 0 ) return NULL;
+    return apr_pstrndup( _mp, version + 1, len );
+}
+
+static const char *
+artifact_path( maven_t *mvn, dep_t *dep, const char *version,
+               const char *ext )
+{
+    char *gpath = apr_pstrdup( mvn->pool, dep->group );
+    char *c;
+    for( c = gpath; *c != '\0'; c++ ) {
+        if( *c == '.' ) *c = '/';
+    }
+
+    const char *classifier = dep->classifier;
+    if( ( classifier == NULL ) && ( strcmp( dep->type, "test-jar" ) == 0 ) ) {
+        classifier = "tests";
+    }
+
+    return apr_pstrcat( mvn->pool, mvn->repo, "/", gpath, "/",
+                        dep->artifact, "/", version, "/",
+                        dep->artifact, "-", version,
+                        ( classifier != NULL ) ? "-" : "",
+                        ( classifier != NULL ) ? classifier : "",
+                        ".", ext, NULL );
+}
+
+/**
+ * Read a whole POM file, recording its modification time (0 if not
+ * found) for the index. Returns NULL if not found or unreadable.
+ */
+static char *
+read_pom_file( maven_t *mvn, const char *path )
+{
+    pom_file_t *pf = apr_array_push( mvn->pom_files );
+    pf->path = path;
+    pf->mtime = 0;
+
+    apr_finfo_t info;
+    if( apr_stat( &info, path, APR_FINFO_MTIME | APR_FINFO_SIZE,
+                  mvn->pool ) != APR_SUCCESS ) {
+        return NULL;
+    }
+    pf->mtime = info.mtime;
+
+    apr_file_t *in = NULL;
+    if( apr_file_open( &in, path, APR_FOPEN_READ, APR_OS_DEFAULT,
+                       mvn->pool ) != APR_SUCCESS ) {
+        return NULL;
+    }
+
+    char *buf = apr_palloc( mvn->pool, info.size + 1 );
+    apr_size_t len = 0;
+    apr_status_t rv = apr_file_read_full( in, buf, info.size, &len );
+    apr_file_close( in );
+    if( ( rv != APR_SUCCESS ) && ( rv != APR_EOF ) ) {
+        print_error( rv, path );
+        return NULL;
+    }
+    buf[len] = '\0';
+
+    return buf;
+}
+
+static const char *
+pom_value( pom_t *pom, const char *name )
+{
+    if( strncmp( name, "project.", 8 ) == 0 ) name += 8;
+    else if( strncmp( name, "pom.", 4 ) == 0 ) name += 4;
+
+    if( strcmp( name, "groupId" ) == 0 ) return pom->group;
+    if( strcmp( name, "artifactId" ) == 0 ) return pom->artifact;
+    if( strcmp( name, "version" ) == 0 ) return pom->version;
+    if( strcmp( name, "parent.version" ) == 0 ) return pom->parent_version;
+
+    return apr_hash_get( pom->props, name, APR_HASH_KEY_STRING );
+}
+
+/**
+ * Replace ${name} references in str with POM values. Unknown
+ * references are left as is.
+ */
+static const char *
+interpolate( maven_t *mvn, pom_t *pom, const char *str, int depth )
+{
+    if( ( str == NULL ) || ( strstr( str, "${" ) == NULL ) ) return str;
+
+    const char *res = "";
+    const char *s = str;
+    const char *ref;
+    while( ( ref = strstr( s, "${" ) ) != NULL ) {
+        const char *end = strchr( ref, '}' );
+        if( end == NULL ) break;
+
+        const char *name = apr_pstrndup( mvn->pool, ref + 2, end - ref - 2 );
+        const char *val = pom_value( pom, name );
+        if( ( val != NULL ) && ( depth < MAX_INTERPOLATE_DEPTH ) ) {
+            val = interpolate( mvn, pom, val, depth + 1 );
+        }
+        else {
+            val = apr_pstrndup( mvn->pool, ref, end - ref + 1 );
+        }
+        res = apr_pstrcat( mvn->pool, res,
+                           apr_pstrndup( mvn->pool, s, ref - s ), val, NULL );
+        s = end + 1;
+    }
+
+    return apr_pstrcat( mvn->pool, res, s, NULL );
+}
+
+static dep_t *
+read_dep( maven_t *mvn, xml_node_t *node )
+{
+    dep_t *dep = apr_pcalloc( mvn->pool, sizeof( dep_t ) );
+    dep->group      = xml_text( node, "groupId" );
+    dep->artifact   = xml_text( node, "artifactId" );
+    dep->version    = xml_text( node, "version" );
+    dep->type       = xml_text( node, "type" );
+    dep->classifier = xml_text( node, "classifier" );
+    dep->scope      = xml_text( node, "scope" );
+
+    const char *optional = xml_text( node, "optional" );
+    dep->optional = ( optional != NULL ) && ( strcmp( optional, "true" ) == 0 );
+
+    xml_node_t *ex = xml_child( xml_child( node, "exclusions" ), NULL );
+    for( ; ex != NULL; ex = ex->next ) {
+        const char *g = xml_text( ex, "groupId" );
+        const char *a = xml_text( ex, "artifactId" );
+        if( ( g == NULL ) || ( a == NULL ) ) continue;
+        if( dep->exclusions == NULL ) {
+            dep->exclusions = apr_array_make( mvn->pool, 4,
+                                              sizeof( const char * ) );
+        }
+        *(const char **) apr_array_push( dep->exclusions ) =
+            apr_pstrcat( mvn->pool, g, ":", a, NULL );
+    }
+
+    return dep;
+}
+
+static dep_t *
+interpolate_dep( maven_t *mvn, pom_t *pom, dep_t *raw )
+{
+    dep_t *dep = apr_pmemdup( mvn->pool, raw, sizeof( dep_t ) );
+    dep->group      = interpolate( mvn, pom, raw->group, 0 );
+    dep->artifact   = interpolate( mvn, pom, raw->artifact, 0 );
+    dep->version    = interpolate( mvn, pom, raw->version, 0 );
+    dep->type       = interpolate( mvn, pom, raw->type, 0 );
+    dep->classifier = interpolate( mvn, pom, raw->classifier, 0 );
+    dep->scope      = interpolate( mvn, pom, raw->scope, 0 );
+    if( dep->type == NULL ) dep->type = "jar";
+    return dep;
+}
+
+static const char *
+dep_key( maven_t *mvn, dep_t *dep )
+{
+    return apr_pstrcat( mvn->pool, dep->group, ":", dep->artifact, NULL );
+}
+
+/**
+ * Load the effective POM of group:artifact:version, or NULL if it (or
+ * a required part) is not in the repository.
+ */
+static pom_t *
+load_pom( maven_t *mvn, const char *group, const char *artifact,
+          const char *version, int depth )
+{
+    int i;
+
+    const char *key = apr_pstrcat( mvn->pool, group, ":", artifact, ":",
+                                   version, NULL );
+    pom_t *pom = apr_hash_get( mvn->poms, key, APR_HASH_KEY_STRING );
+    if( pom != NULL ) return ( pom == &MISSING_POM ) ? NULL : pom;
+
+    // Also guards against parent or import cycles.
+    apr_hash_set( mvn->poms, key, APR_HASH_KEY_STRING, &MISSING_POM );
+    if( depth > MAX_POM_DEPTH ) return NULL;
+
+    dep_t coord;
+    memset( &coord, 0, sizeof( coord ) );
+    coord.group = group;
+    coord.artifact = artifact;
+    coord.type = "pom";
+    const char *path = artifact_path( mvn, &coord, version, "pom" );
+
+    char *buf = read_pom_file( mvn, path );
+    if( buf == NULL ) return NULL;
+
+    xml_node_t *project = parse_xml( buf, mvn->pool );
+    while( ( project != NULL ) && ( strcmp( project->name, "project" ) != 0 ) ) {
+        project = project->next;
+    }
+    if( project == NULL ) {
+        WARN( "No project in POM %s, ignored.", path );
+        return NULL;
+    }
+
+    pom = apr_pcalloc( mvn->pool, sizeof( pom_t ) );
+    pom->props = apr_hash_make( mvn->pool );
+    pom->raw_managed = apr_array_make( mvn->pool, 16, sizeof( dep_t * ) );
+    pom->raw_deps = apr_array_make( mvn->pool, 16, sizeof( dep_t * ) );
+    pom->managed = apr_hash_make( mvn->pool );
+    pom->deps = apr_array_make( mvn->pool, 16, sizeof( dep_t * ) );
+
+    // Inherit properties, managed and declared dependencies as
+    // written; these are interpolated below with this POM's values.
+    xml_node_t *pnode = xml_child( project, "parent" );
+    if( pnode != NULL ) {
+        const char *pg = xml_text( pnode, "groupId" );
+        const char *pa = xml_text( pnode, "artifactId" );
+        pom->parent_version = xml_text( pnode, "version" );
+        pom_t *parent = NULL;
+        if( ( pg != NULL ) && ( pa != NULL ) &&
+            ( pom->parent_version != NULL ) ) {
+            parent = load_pom( mvn, pg, pa, pom->parent_version, depth + 1 );
+        }
+        if( parent != NULL ) {
+            apr_hash_index_t *hi;
+            for( hi = apr_hash_first( mvn->pool, parent->props ); hi;
+                 hi = apr_hash_next( hi ) ) {
+                const void *name;
+                void *val;
+                apr_hash_this( hi, &name, NULL, &val );
+                apr_hash_set( pom->props, name, APR_HASH_KEY_STRING, val );
+            }
+            apr_array_cat( pom->raw_managed, parent->raw_managed );
+            apr_array_cat( pom->raw_deps, parent->raw_deps );
+        }
+        else {
+            DEBUG( "Parent of POM %s not found.", path );
+        }
+    }
+
+    pom->group = xml_text( project, "groupId" );
+    if( ( pom->group == NULL ) && ( pnode != NULL ) ) {
+        pom->group = xml_text( pnode, "groupId" );
+    }
+    pom->artifact = xml_text( project, "artifactId" );
+    pom->version = xml_text( project, "version" );
+    if( pom->version == NULL ) pom->version = pom->parent_version;
+
+    xml_node_t *prop = xml_child( xml_child( project, "properties" ), NULL );
+    for( ; prop != NULL; prop = prop->next ) {
+        apr_hash_set( pom->props, prop->name, APR_HASH_KEY_STRING,
+                      ( prop->text != NULL ) ? prop->text : "" );
+    }
+
+    pom->group = interpolate( mvn, pom, pom->group, 0 );
+    pom->version = interpolate( mvn, pom, pom->version, 0 );
+
+    xml_node_t *dnode = xml_child( xml_child( xml_child(
+        project, "dependencyManagement" ), "dependencies" ), NULL );
+    for( ; dnode != NULL; dnode = dnode->next ) {
+        *(dep_t **) apr_array_push( pom->raw_managed ) = read_dep( mvn, dnode );
+    }
+
+    dnode = xml_child( xml_child( project, "dependencies" ), NULL );
+    for( ; dnode != NULL; dnode = dnode->next ) {
+        *(dep_t **) apr_array_push( pom->raw_deps ) = read_dep( mvn, dnode );
+    }
+
+    // Managed versions: later (child) entries override, imported BOMs
+    // only add.
+    for( i = 0; i < pom->raw_managed->nelts; i++ ) {
+        dep_t *dep = interpolate_dep( mvn, pom,
+                                      ((dep_t **) pom->raw_managed->elts )[i] );
+        if( ( dep->group == NULL ) || ( dep->artifact == NULL ) ) continue;
+
+        if( ( dep->scope != NULL ) && ( strcmp( dep->scope, "import" ) == 0 ) ) {
+            const char *bversion = pick_version( dep->version );
+            pom_t *bom = ( bversion == NULL ) ? NULL :
+                load_pom( mvn, dep->group, dep->artifact, bversion, depth + 1 );
+            if( bom != NULL ) {
+                apr_hash_index_t *hi;
+                for( hi = apr_hash_first( mvn->pool, bom->managed ); hi;
+                     hi = apr_hash_next( hi ) ) {
+                    const void *ga;
+                    void *bdep;
+                    apr_hash_this( hi, &ga, NULL, &bdep );
+                    if( !apr_hash_get( pom->managed, ga, APR_HASH_KEY_STRING ) ) {
+                        apr_hash_set( pom->managed, ga, APR_HASH_KEY_STRING,
+                                      bdep );
+                    }
+                }
+            }
+        }
+        else {
+            apr_hash_set( pom->managed, dep_key( mvn, dep ),
+                          APR_HASH_KEY_STRING, dep );
+        }
+    }
+
+    // Declared dependencies, with a child's redeclaration replacing
+    // the parent's.
+    apr_hash_t *positions = apr_hash_make( mvn->pool );
+    for( i = 0; i < pom->raw_deps->nelts; i++ ) {
+        dep_t *dep = interpolate_dep( mvn, pom,
+                                      ((dep_t **) pom->raw_deps->elts )[i] );
+        if( ( dep->group == NULL ) || ( dep->artifact == NULL ) ) continue;
+
+        const char *ga = dep_key( mvn, dep );
+        dep_t *managed = apr_hash_get( pom->managed, ga, APR_HASH_KEY_STRING );
+        if( managed != NULL ) {
+            if( dep->version == NULL ) dep->version = managed->version;
+            if( dep->scope == NULL ) dep->scope = managed->scope;
+            if( ( dep->exclusions == NULL ) && ( managed->exclusions != NULL ) ) {
+                dep->exclusions = managed->exclusions;
+            }
+        }
+        if( dep->scope == NULL ) dep->scope = "compile";
+
+        int *pos = apr_hash_get( positions, ga, APR_HASH_KEY_STRING );
+        if( pos != NULL ) {
+            ((dep_t **) pom->deps->elts )[*pos] = dep;
+        }
+        else {
+            pos = apr_palloc( mvn->pool, sizeof( int ) );
+            *pos = pom->deps->nelts;
+            apr_hash_set( positions, ga, APR_HASH_KEY_STRING, pos );
+            *(dep_t **) apr_array_push( pom->deps ) = dep;
+        }
+    }
+
+    apr_hash_set( mvn->poms, key, APR_HASH_KEY_STRING, pom );
+    return pom;
+}
+
+/**
+ * Index file in hashdot.maven.index (default: ~/.hashdot/maven),
+ * named for a hash of the repository and coordinates.
+ */
+static const char *
+index_file_name( const char *key )
+{
+    const char *dir = NULL;
+    get_property_value( "hashdot.maven.index", '/', 0, &dir );
+    if( dir == NULL ) {
+        const char *home = NULL;
+        get_property_value( "hashdot.user.home", 0, 0, &home );
+        dir = apr_pstrcat( _mp, home, "/.hashdot/maven", NULL );
+    }
+
+    return apr_psprintf( _mp, "%s/%016llx.idx", dir,
+                         (unsigned long long) hash_string( key ) );
+}
+
+static void
+chomp( char *line )
+{
+    apr_size_t len = strlen( line );
+    if( ( len > 0 ) && ( line[len - 1] == '\n' ) ) line[len - 1] = '\0';
+}
+
+/**
+ * Read the index in fname, returning true with the jars of each
+ * coordinate if it matches repo and coords and none of its POMs have
+ * changed (or appeared).
+ */
+static int
+read_index( const char *fname, const char *repo,
+            apr_array_header_t *coords, apr_array_header_t **jars )
+{
+    apr_file_t *in = NULL;
+    char line[4096];
+    int valid = 1;
+    int c = 0;
+
+    if( apr_file_open( &in, fname, APR_FOPEN_READ, APR_OS_DEFAULT,
+                       _mp ) != APR_SUCCESS ) {
+        return 0;
+    }
+
+    *jars = apr_array_make( _mp, coords->nelts,
+                            sizeof( apr_array_header_t * ) );
+    apr_array_header_t *cjars = NULL;
+
+    while( valid &&
+           ( apr_file_gets( line, sizeof( line ), in ) == APR_SUCCESS ) ) {
+        chomp( line );
+        if( ( line[0] == '\0' ) || ( line[0] == '#' ) ) continue;
+        if( line[1] != ' ' ) {
+            valid = 0;
+            break;
+        }
+        char *val = line + 2;
+
+        switch( line[0] ) {
+        case 'R':
+            valid = ( strcmp( val, repo ) == 0 );
+            break;
+        case 'C':
+            valid = ( c < coords->nelts ) &&
+                ( strcmp( val, ((const char **) coords->elts )[c] ) == 0 );
+            c++;
+            cjars = apr_array_make( _mp, 16, sizeof( const char * ) );
+            *(apr_array_header_t **) apr_array_push( *jars ) = cjars;
+            break;
+        case 'J':
+            valid = ( cjars != NULL );
+            if( valid ) {
+                *(const char **) apr_array_push( cjars ) =
+                    apr_pstrdup( _mp, val );
+            }
+            break;
+        case 'P': {
+            char *path = strchr( val, ' ' );
+            valid = ( path != NULL );
+            if( valid ) {
+                apr_time_t mtime = (apr_time_t) apr_atoi64( val );
+                apr_finfo_t info;
+                if( apr_stat( &info, path + 1, APR_FINFO_MTIME,
+                              _mp ) != APR_SUCCESS ) {
+                    info.mtime = 0;
+                }
+                valid = ( info.mtime == mtime );
+                if( !valid ) DEBUG( "Maven index stale: %s", path + 1 );
+            }
+            break;
+        }
+        default:
+            valid = 0;
+        }
+    }
+    apr_file_close( in );
+
+    return valid && ( c == coords->nelts );
+}
+
+static void
+write_index( const char *fname, maven_t *mvn,
+             apr_array_header_t *coords, apr_array_header_t *jars )
+{
+    apr_pool_t *pool = mvn->pool;
+    int i, j;
+
+    // Write a new file and rename, as with the run history.
+    apr_status_t rv = APR_SUCCESS;
+    char *dir = apr_pstrdup( pool, fname );
+    *strrchr( dir, '/' ) = '\0';
+    rv = apr_dir_make_recursive( dir, APR_FPROT_OS_DEFAULT, pool );
+
+    const char *tmp = apr_psprintf( pool, "%s.%d", fname, (int) getpid() );
+    apr_file_t *out = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open( &out, tmp,
+                            APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                            APR_FOPEN_TRUNCATE,
+                            APR_OS_DEFAULT, pool );
+    }
+    if( rv == APR_SUCCESS ) {
+        apr_file_printf( out, "# hashdot maven index\nR %s\n", mvn->repo );
+        for( i = 0; i < mvn->pom_files->nelts; i++ ) {
+            pom_file_t *pf = &((pom_file_t *) mvn->pom_files->elts )[i];
+            apr_file_printf( out, "P %" APR_INT64_T_FMT " %s\n",
+                             pf->mtime, pf->path );
+        }
+        for( i = 0; i < coords->nelts; i++ ) {
+            apr_file_printf( out, "C %s\n",
+                             ((const char **) coords->elts )[i] );
+            apr_array_header_t *cjars = ((apr_array_header_t **) jars->elts )[i];
+            for( j = 0; j < cjars->nelts; j++ ) {
+                apr_file_printf( out, "J %s\n",
+                                 ((const char **) cjars->elts )[j] );
+            }
+        }
+        rv = apr_file_close( out );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_rename( tmp, fname, pool );
+    }
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, fname );
+        apr_file_remove( tmp, pool );
+    }
+}
+
+static char *
+skip_past( char *p, const char *end )
+{
+    char *e = strstr( p, end );
+    return ( e != NULL ) ? e + strlen( end ) : p + strlen( p );
+}
+
+// Copy of [start,end) with surrounding white space removed and the
+// predefined entities replaced.
+static const char *
+xml_text_dup( const char *start, const char *end, apr_pool_t *pool )
+{
+    while( ( start < end ) && isspace( (unsigned char) *start ) ) start++;
+    while( ( end > start ) && isspace( (unsigned char) end[-1] ) ) end--;
+
+    char *text = apr_pstrndup( pool, start, end - start );
+    if( strchr( text, '&' ) == NULL ) return text;
+
+    static const char *ENTITIES[] = {
+        "&amp;", "&", "&lt;", "<", "&gt;", ">",
+        "&quot;", "\"", "&apos;", "'", NULL };
+
+    char *in = text, *out = text;
+    while( *in != '\0' ) {
+        int i;
+        for( i = 0; ENTITIES[i] != NULL; i += 2 ) {
+            apr_size_t len = strlen( ENTITIES[i] );
+            if( strncmp( in, ENTITIES[i], len ) == 0 ) {
+                *out++ = ENTITIES[i + 1][0];
+                in += len;
+                break;
+            }
+        }
+        if( ENTITIES[i] == NULL ) *out++ = *in++;
+    }
+    *out = '\0';
+
+    return text;
+}
+
+/**
+ * Minimal, non-validating XML element parser sufficient for POMs.
+ * Returns the first top level element.
+ */
+static xml_node_t *
+parse_xml( char *buf, apr_pool_t *pool )
+{
+    xml_node_t top;
+    memset( &top, 0, sizeof( top ) );
+    xml_node_t *cur = &top;
+    char *text = NULL;
+    char *p = buf;
+
+    while( *p != '\0' ) {
+        if( *p != '<' ) {
+            p++;
+        }
+        else if( strncmp( p, "<!--", 4 ) == 0 ) {
+            p = skip_past( p + 4, "-->" );
+        }
+        else if( ( p[1] == '?' ) || ( p[1] == '!' ) ) {
+            p = skip_past( p + 2, ">" );
+        }
+        else if( p[1] == '/' ) {
+            if( cur != &top ) {
+                if( ( cur->child == NULL ) && ( text != NULL ) ) {
+                    cur->text = xml_text_dup( text, p, pool );
+                }
+                cur = cur->parent;
+            }
+            text = NULL;
+            p = skip_past( p + 2, ">" );
+        }
+        else {
+            char *name = p + 1;
+            char *e = name;
+            while( ( *e != '\0' ) && !isspace( (unsigned char) *e ) &&
+                   ( *e != '>' ) && ( *e != '/' ) ) e++;
+
+            xml_node_t *node = apr_pcalloc( pool, sizeof( xml_node_t ) );
+            node->name = apr_pstrndup( pool, name, e - name );
+            node->parent = cur;
+            if( cur->last != NULL ) cur->last->next = node;
+            else cur->child = node;
+            cur->last = node;
+
+            char quote = 0;
+            while( ( *e != '\0' ) && ( quote || ( *e != '>' ) ) ) {
+                if( quote ) {
+                    if( *e == quote ) quote = 0;
+                }
+                else if( ( *e == '"' ) || ( *e == '\'' ) ) {
+                    quote = *e;
+                }
+                e++;
+            }
+            int empty = ( e > name ) && ( e[-1] == '/' );
+            p = ( *e != '\0' ) ? e + 1 : e;
+
+            if( empty ) {
+                node->text = "";
+            }
+            else {
+                cur = node;
+                text = p;
+            }
+        }
+    }
+
+    return top.child;
+}
+
+// Child element of node named name (or the first, if name is NULL).
+static xml_node_t *
+xml_child( xml_node_t *node, const char *name )
+{
+    if( node == NULL ) return NULL;
+
+    xml_node_t *child;
+    for( child = node->child; child != NULL; child = child->next ) {
+        if( ( name == NULL ) || ( strcmp( child->name, name ) == 0 ) ) {
+            return child;
+        }
+    }
+    return NULL;
+}
+
+static const char *
+xml_text( xml_node_t *node, const char *name )
+{
+    xml_node_t *child = xml_child( node, name );
+    return ( ( child != NULL ) && ( child->text != NULL ) &&
+             ( child->text[0] != '\0' ) ) ? child->text : NULL;
+}
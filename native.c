@@ -0,0 +1,266 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <sys/prctl.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <apr_tables.h>
+
+#include <jni.h>
+
+#include "runtime.h"
+#include "native.h"
+#include "property.h"
+#include "classgen.h"
+#include "daemon.h"
+
+static jboolean JNICALL
+native_set_affinity( JNIEnv *env, jclass cls, jintArray cpus );
+
+static jboolean JNICALL
+native_set_thread_name( JNIEnv *env, jclass cls, jstring name );
+
+static jboolean JNICALL
+native_lock( JNIEnv *env, jclass cls, jobject buffer );
+
+static jboolean JNICALL
+native_unlock( JNIEnv *env, jclass cls, jobject buffer );
+
+static jboolean JNICALL
+native_advise( JNIEnv *env, jclass cls, jobject buffer, jint advice );
+
+static jstring JNICALL
+native_property( JNIEnv *env, jclass cls, jstring name );
+
+static void JNICALL
+native_ready( JNIEnv *env, jclass cls );
+
+/**
+ * With hashdot.native = true, define the hashdot.Native class, whose
+ * static native methods give the application thread and memory
+ * controls of the launcher without a JNI library of its own.
+ */
+apr_status_t define_native_api( JNIEnv *env )
+{
+    static JNINativeMethod METHODS[] = {
+        { "setAffinity",   "([I)Z",
+          (void *) &native_set_affinity },
+        { "setThreadName", "(Ljava/lang/String;)Z",
+          (void *) &native_set_thread_name },
+        { "lock",          "(Ljava/nio/ByteBuffer;)Z",
+          (void *) &native_lock },
+        { "unlock",        "(Ljava/nio/ByteBuffer;)Z",
+          (void *) &native_unlock },
+        { "advise",        "(Ljava/nio/ByteBuffer;I)Z",
+          (void *) &native_advise },
+        { "property",      "(Ljava/lang/String;)Ljava/lang/String;",
+          (void *) &native_property },
+        { "ready",         "()V",
+          (void *) &native_ready }
+    };
+
+    int enabled = 0;
+    apr_status_t rv = get_boolean( "hashdot.native", 49, &enabled );
+    if( ( rv != APR_SUCCESS ) || !enabled ) return rv;
+
+    jclass cls = NULL;
+    return define_native_class( env, "hashdot/Native", "java/lang/Object",
+                                METHODS,
+                                sizeof( METHODS ) / sizeof( METHODS[0] ),
+                                1, &cls );
+}
+
+/**
+ * Bind the calling thread to the given CPUs.
+ */
+static jboolean JNICALL
+native_set_affinity( JNIEnv *env, jclass cls, jintArray cpus )
+{
+#ifdef __linux__
+    if( cpus == NULL ) return JNI_FALSE;
+
+    // Bounds the ids copied to the stack; more can't be distinct CPUs.
+    jsize count = (*env)->GetArrayLength( env, cpus );
+    if( ( count <= 0 ) || ( count > CPU_SETSIZE ) ) return JNI_FALSE;
+
+    jint ids[ count ];
+    (*env)->GetIntArrayRegion( env, cpus, 0, count, ids );
+    if( (*env)->ExceptionCheck( env ) ) return JNI_FALSE;
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    int i;
+    for( i = 0; i < count; i++ ) {
+        if( ( ids[i] < 0 ) || ( ids[i] >= CPU_SETSIZE ) ) return JNI_FALSE;
+        CPU_SET( ids[i], &set );
+    }
+    return ( sched_setaffinity( 0, sizeof( set ), &set ) == 0 ) ?
+        JNI_TRUE : JNI_FALSE;
+#else
+    return JNI_FALSE;
+#endif
+}
+
+/**
+ * Set the OS name of the calling thread (truncated to 15 bytes), as
+ * shown by top -H and in /proc, which Thread.setName does not.
+ */
+static jboolean JNICALL
+native_set_thread_name( JNIEnv *env, jclass cls, jstring name )
+{
+#ifdef __linux__
+    if( name == NULL ) return JNI_FALSE;
+
+    const char *cname = (*env)->GetStringUTFChars( env, name, NULL );
+    if( cname == NULL ) return JNI_FALSE;
+
+    char buf[16];
+    strncpy( buf, cname, sizeof( buf ) - 1 );
+    buf[ sizeof( buf ) - 1 ] = '\0';
+    (*env)->ReleaseStringUTFChars( env, name, cname );
+
+    return ( prctl( PR_SET_NAME, buf, 0, 0, 0 ) == 0 ) ? JNI_TRUE : JNI_FALSE;
+#else
+    return JNI_FALSE;
+#endif
+}
+
+/**
+ * Get the page aligned memory range of a direct buffer.
+ */
+static int
+buffer_range( JNIEnv *env, jobject buffer, void **start, size_t *len )
+{
+    if( buffer == NULL ) return 0;
+
+    char *addr = (*env)->GetDirectBufferAddress( env, buffer );
+    jlong cap = (*env)->GetDirectBufferCapacity( env, buffer );
+    if( ( addr == NULL ) || ( cap <= 0 ) ) return 0;
+
+    size_t page = (size_t) sysconf( _SC_PAGESIZE );
+    char *first = (char *) ( (size_t) addr & ~( page - 1 ) );
+    *start = first;
+    *len = ( ( addr + cap - first ) + page - 1 ) & ~( page - 1 );
+    return 1;
+}
+
+/**
+ * Lock the pages of a direct buffer in memory (mlock).
+ */
+static jboolean JNICALL
+native_lock( JNIEnv *env, jclass cls, jobject buffer )
+{
+    void *start;
+    size_t len;
+    return ( buffer_range( env, buffer, &start, &len ) &&
+             ( mlock( start, len ) == 0 ) ) ? JNI_TRUE : JNI_FALSE;
+}
+
+static jboolean JNICALL
+native_unlock( JNIEnv *env, jclass cls, jobject buffer )
+{
+    void *start;
+    size_t len;
+    return ( buffer_range( env, buffer, &start, &len ) &&
+             ( munlock( start, len ) == 0 ) ) ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * Advise the kernel of the use of the pages of a direct buffer, with
+ * an madvise(2) advice value.
+ */
+static jboolean JNICALL
+native_advise( JNIEnv *env, jclass cls, jobject buffer, jint advice )
+{
+    void *start;
+    size_t len;
+    return ( buffer_range( env, buffer, &start, &len ) &&
+             ( madvise( start, len, advice ) == 0 ) ) ? JNI_TRUE : JNI_FALSE;
+}
+
+/**
+ * The value of a launcher property (values space separated) or null,
+ * including hashdot.* properties as resolved by the launcher.
+ */
+static jstring JNICALL
+native_property( JNIEnv *env, jclass cls, jstring name )
+{
+    if( name == NULL ) return NULL;
+
+    const char *cname = (*env)->GetStringUTFChars( env, name, NULL );
+    if( cname == NULL ) return NULL;
+    apr_array_header_t *vals = get_property_array( cname );
+    (*env)->ReleaseStringUTFChars( env, name, cname );
+    if( vals == NULL ) return NULL;
+
+    // The launcher pool is not for use by application threads
+    size_t len = 1;
+    int i;
+    for( i = 0; i < vals->nelts; i++ ) {
+        len += strlen( ((const char **) vals->elts )[i] ) + 1;
+    }
+    char *value = malloc( len );
+    if( value == NULL ) return NULL;
+    value[0] = '\0';
+    for( i = 0; i < vals->nelts; i++ ) {
+        if( i > 0 ) strcat( value, " " );
+        strcat( value, ((const char **) vals->elts )[i] );
+    }
+
+    jstring jvalue = (*env)->NewStringUTF( env, value );
+    free( value );
+    return jvalue;
+}
+
+/**
+ * Signal readiness, as hashdot.Daemon.ready(), when
+ * hashdot.daemonize.ready = notify; otherwise ignored.
+ */
+static void JNICALL
+native_ready( JNIEnv *env, jclass cls )
+{
+    notify_ready();
+}
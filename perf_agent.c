@@ -0,0 +1,530 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Perf map agent, a JVMTI agent loaded with -agentpath when
+ * hashdot.perf_map is set (see jvm.c). Writes /tmp/perf-<pid>.map,
+ * the symbol map Linux perf reads for JIT compiled code, from the
+ * CompiledMethodLoad and DynamicCodeGenerated events. With unfold,
+ * ranges of inlined code are named by their inlining chain
+ * (outer->inner). Entries of unloaded methods are dropped when the map
+ * is rewritten, at most every compact seconds. With jitdump, also
+ * writes /tmp/jit-<pid>.dump (with code, for perf inject --jit).
+ * Depends only on libc.
+ *
+ * Options: unfold=<0|1>,jitdump=<0|1>,compact=<seconds, 0 for never>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <jni.h>
+#include <jvmti.h>
+#include <jvmticmlr.h>
+
+#include "agent_util.h"
+
+// jitdump format, see linux tools/perf/Documentation/jitdump-specification.txt
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD   0
+
+#if defined(__x86_64__)
+#define JITDUMP_MACH EM_X86_64
+#elif defined(__aarch64__)
+#define JITDUMP_MACH EM_AARCH64
+#elif defined(__i386__)
+#define JITDUMP_MACH EM_386
+#else
+#define JITDUMP_MACH EM_NONE
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size;
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} jitdump_header_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t total_size;
+    uint64_t timestamp;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+    // Followed by the name (with '\0') and the code
+} jitdump_load_t;
+
+typedef struct {
+    const void *addr;       // Start of the code blob, the table key
+    char *lines;            // Its map lines
+    int live;
+} code_rec_t;
+
+static jvmtiEnv *_jvmti = NULL;
+static jrawMonitorID _lock = NULL;
+
+static int _unfold = 0;
+static jlong _compact_ns = 0;
+static jlong _compacted_ns = 0;
+
+static char _map_name[64];
+static FILE *_map = NULL;
+
+static FILE *_dump = NULL;
+static void *_dump_marker = NULL;
+static uint64_t _code_index = 0;
+
+static code_rec_t *_recs = NULL;
+static long _nrecs = 0;
+static long _max_recs = 0;
+static long _dead = 0;
+static table_t _by_addr = { NULL, 0, 0 };
+
+static jlong
+monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (jlong) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Append the java name of method, i.e. foo.Bar.baz
+static void
+append_method( jvmtiEnv *jvmti, buf_t *b, jmethodID method )
+{
+    jclass cls = NULL;
+    char *sig = NULL;
+    char *name = NULL;
+
+    if( (*jvmti)->GetMethodDeclaringClass( jvmti, method, &cls ) ==
+        JVMTI_ERROR_NONE ) {
+        (*jvmti)->GetClassSignature( jvmti, cls, &sig, NULL );
+    }
+    (*jvmti)->GetMethodName( jvmti, method, &name, NULL, NULL );
+
+    if( sig != NULL ) {
+        size_t start = b->len;
+        size_t len = strlen( sig );
+        if( ( len > 2 ) && ( sig[0] == 'L' ) && ( sig[len - 1] == ';' ) ) {
+            appendf( b, "%.*s.", (int) ( len - 2 ), sig + 1 );
+        }
+        else {
+            appendf( b, "%s.", sig );
+        }
+        char *c;
+        for( c = b->s + start; *c != '\0'; c++ ) {
+            if( *c == '/' ) *c = '.';
+        }
+    }
+    appendf( b, "%s", ( name != NULL ) ? name : "<unknown>" );
+
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) sig );
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) name );
+}
+
+// Append the inlining chain of info, outermost first.
+static void
+append_chain( jvmtiEnv *jvmti, buf_t *b, const PCStackInfo *info )
+{
+    int i;
+    for( i = info->numstackframes - 1; i >= 0; i-- ) {
+        append_method( jvmti, b, info->methods[i] );
+        if( i > 0 ) appendf( b, "->" );
+    }
+}
+
+static int
+same_chain( const PCStackInfo *a, const PCStackInfo *b )
+{
+    return ( a->numstackframes == b->numstackframes ) &&
+        ( memcmp( a->methods, b->methods,
+                  a->numstackframes * sizeof( jmethodID ) ) == 0 );
+}
+
+static const jvmtiCompiledMethodLoadInlineRecord *
+inline_record( const void *compile_info )
+{
+    const jvmtiCompiledMethodLoadRecordHeader *h = compile_info;
+    for( ; h != NULL; h = h->next ) {
+        if( h->kind == JVMTI_CMLR_INLINE_INFO ) {
+            return (const jvmtiCompiledMethodLoadInlineRecord *) h;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Append map lines for the code of method from its inline record:
+ * one range per run of PCs with the same inlining chain. Returns 0,
+ * with nothing appended, if the PCs aren't ordered within the code.
+ */
+static int
+append_unfolded( jvmtiEnv *jvmti, buf_t *b, jmethodID method,
+                 const char *start, const char *end,
+                 const jvmtiCompiledMethodLoadInlineRecord *rec )
+{
+    const PCStackInfo *pcs = rec->pcinfo;
+    const char *last = start;
+    int i;
+    for( i = 0; i < rec->numpcs; i++ ) {
+        const char *pc = pcs[i].pc;
+        if( ( pc < last ) || ( pc > end ) ||
+            ( pcs[i].numstackframes < 1 ) ) return 0;
+        last = pc;
+    }
+
+    // Code before the first PC is of the method itself.
+    const char *from = start;
+    const PCStackInfo *chain = NULL;
+    for( i = 0; i <= rec->numpcs; i++ ) {
+        const char *to = ( i < rec->numpcs ) ? (const char *) pcs[i].pc : end;
+        if( ( i < rec->numpcs ) &&
+            ( ( chain != NULL ) ? same_chain( chain, &pcs[i] ) :
+              ( ( pcs[i].numstackframes == 1 ) &&
+                ( pcs[i].methods[0] == method ) ) ) ) continue;
+        if( to > from ) {
+            appendf( b, "%lx %lx ", (unsigned long) from,
+                    (unsigned long) ( to - from ) );
+            if( chain != NULL ) {
+                append_chain( jvmti, b, chain );
+            }
+            else {
+                append_method( jvmti, b, method );
+            }
+            appendf( b, "\n" );
+            from = to;
+        }
+        if( i < rec->numpcs ) chain = &pcs[i];
+    }
+    return 1;
+}
+
+static void
+write_jitdump( const char *name, const void *addr, jint size )
+{
+    size_t nlen = strlen( name ) + 1;
+    jitdump_load_t r;
+    memset( &r, 0, sizeof( r ) );
+    r.id = JIT_CODE_LOAD;
+    r.total_size = sizeof( r ) + nlen + size;
+    r.timestamp = monotonic_ns();
+    r.pid = getpid();
+    r.tid = syscall( SYS_gettid );
+    r.vma = (uint64_t) (uintptr_t) addr;
+    r.code_addr = r.vma;
+    r.code_size = size;
+    r.code_index = _code_index++;
+
+    fwrite( &r, sizeof( r ), 1, _dump );
+    fwrite( name, nlen, 1, _dump );
+    fwrite( addr, size, 1, _dump );
+    fflush( _dump );
+}
+
+// Rewrite the map with the live entries only.
+static void
+compact()
+{
+    char tmp_name[ sizeof( _map_name ) + 4 ];
+    snprintf( tmp_name, sizeof( tmp_name ), "%s.tmp", _map_name );
+    FILE *out = fopen( tmp_name, "w" );
+    if( out == NULL ) return;
+
+    free( _by_addr.entries );
+    memset( &_by_addr, 0, sizeof( _by_addr ) );
+
+    long i, n = 0;
+    for( i = 0; i < _nrecs; i++ ) {
+        if( _recs[i].live ) {
+            fputs( _recs[i].lines, out );
+            _recs[n] = _recs[i];
+            table_put( &_by_addr, _recs[n].addr, 0, n );
+            n++;
+        }
+    }
+    _nrecs = n;
+    _dead = 0;
+
+    if( ( fclose( out ) == 0 ) && ( rename( tmp_name, _map_name ) == 0 ) ) {
+        fclose( _map );
+        _map = fopen( _map_name, "a" );
+    }
+    else {
+        unlink( tmp_name );
+    }
+}
+
+static void
+mark_dead( const void *addr )
+{
+    long i = table_get( &_by_addr, addr, 0 );
+    if( ( i >= 0 ) && _recs[i].live ) {
+        _recs[i].live = 0;
+        free( _recs[i].lines );
+        _recs[i].lines = NULL;
+        _dead++;
+    }
+}
+
+// Record and write the map lines of a code blob (lock held).
+static void
+add_code( const void *addr, char *lines )
+{
+    // Replaces any entry not unloaded at the same address.
+    mark_dead( addr );
+
+    if( _nrecs == _max_recs ) {
+        _max_recs = ( _max_recs == 0 ) ? 1024 : _max_recs * 2;
+        _recs = realloc( _recs, _max_recs * sizeof( code_rec_t ) );
+    }
+    _recs[_nrecs].addr = addr;
+    _recs[_nrecs].lines = lines;
+    _recs[_nrecs].live = 1;
+    table_put( &_by_addr, addr, 0, _nrecs );
+    _nrecs++;
+
+    if( _map != NULL ) {
+        fputs( lines, _map );
+        fflush( _map );
+    }
+}
+
+static void
+check_compact()
+{
+    jlong now = monotonic_ns();
+    if( ( _dead > 0 ) && ( _compact_ns > 0 ) && ( _map != NULL ) &&
+        ( now - _compacted_ns >= _compact_ns ) ) {
+        compact();
+        _compacted_ns = now;
+    }
+}
+
+static void JNICALL
+on_compiled_method_load( jvmtiEnv *jvmti, jmethodID method, jint size,
+                         const void *addr, jint map_length,
+                         const jvmtiAddrLocationMap *map,
+                         const void *compile_info )
+{
+    const char *start = addr;
+    buf_t b = { NULL, 0, 0 };
+
+    const jvmtiCompiledMethodLoadInlineRecord *rec =
+        _unfold ? inline_record( compile_info ) : NULL;
+    if( ( rec == NULL ) || ( rec->numpcs == 0 ) ||
+        !append_unfolded( jvmti, &b, method, start, start + size, rec ) ) {
+        b.len = 0;
+        appendf( &b, "%lx %x ", (unsigned long) start, (unsigned int) size );
+        append_method( jvmti, &b, method );
+        appendf( &b, "\n" );
+    }
+
+    buf_t name = { NULL, 0, 0 };
+    if( _dump != NULL ) append_method( jvmti, &name, method );
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    if( _dump != NULL ) write_jitdump( name.s, addr, size );
+    add_code( addr, b.s );
+    check_compact();
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+
+    free( name.s );
+}
+
+static void JNICALL
+on_compiled_method_unload( jvmtiEnv *jvmti, jmethodID method,
+                           const void *addr )
+{
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    mark_dead( addr );
+    check_compact();
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+}
+
+static void JNICALL
+on_dynamic_code_generated( jvmtiEnv *jvmti, const char *name,
+                           const void *addr, jint size )
+{
+    buf_t b = { NULL, 0, 0 };
+    appendf( &b, "%lx %x %s\n", (unsigned long) addr, (unsigned int) size,
+            name );
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    if( _dump != NULL ) write_jitdump( name, addr, size );
+    add_code( addr, b.s );
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+}
+
+static void JNICALL
+on_vm_death( jvmtiEnv *jvmti, JNIEnv *jni )
+{
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    if( _map != NULL ) {
+        fclose( _map );
+        _map = NULL;
+    }
+    if( _dump != NULL ) {
+        fclose( _dump );
+        _dump = NULL;
+    }
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+}
+
+/**
+ * Create the jitdump file. It is kept mapped executable, as perf
+ * record finds it by that mmap.
+ */
+static void
+open_jitdump()
+{
+    char name[64];
+    snprintf( name, sizeof( name ), "/tmp/jit-%d.dump", (int) getpid() );
+
+    int fd = open( name, O_CREAT | O_TRUNC | O_RDWR, 0666 );
+    if( fd < 0 ) {
+        fprintf( stderr, "HASHDOT WARN: Can't create %s, no jitdump.\n",
+                 name );
+        return;
+    }
+
+    _dump_marker = mmap( NULL, sysconf( _SC_PAGESIZE ),
+                         PROT_READ | PROT_EXEC, MAP_PRIVATE, fd, 0 );
+    if( _dump_marker == MAP_FAILED ) {
+        fprintf( stderr, "HASHDOT WARN: Can't map %s, no jitdump.\n",
+                 name );
+        close( fd );
+        unlink( name );
+        return;
+    }
+
+    _dump = fdopen( fd, "w" );
+    jitdump_header_t h;
+    memset( &h, 0, sizeof( h ) );
+    h.magic = JITDUMP_MAGIC;
+    h.version = JITDUMP_VERSION;
+    h.total_size = sizeof( h );
+    h.elf_mach = JITDUMP_MACH;
+    h.pid = getpid();
+    h.timestamp = monotonic_ns();
+    fwrite( &h, sizeof( h ), 1, _dump );
+    fflush( _dump );
+}
+
+AGENT_EXPORT JNIEXPORT jint JNICALL
+Agent_OnLoad( JavaVM *vm, char *options, void *reserved )
+{
+    const char *val;
+
+    if( ( val = option( options, "unfold" ) ) != NULL ) {
+        _unfold = ( atoi( val ) != 0 );
+    }
+    if( ( val = option( options, "compact" ) ) != NULL ) {
+        _compact_ns = (jlong) ( atof( val ) * 1000000000.0 );
+    }
+    _compacted_ns = monotonic_ns();
+
+    if( (*vm)->GetEnv( vm, (void **) &_jvmti, JVMTI_VERSION_1_0 ) != JNI_OK ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI unavailable, no perf map.\n" );
+        return JNI_OK;
+    }
+    jvmtiEnv *jvmti = _jvmti;
+
+    snprintf( _map_name, sizeof( _map_name ), "/tmp/perf-%d.map",
+              (int) getpid() );
+    _map = fopen( _map_name, "w" );
+    if( _map == NULL ) {
+        fprintf( stderr, "HASHDOT WARN: Can't create %s, no perf map.\n",
+                 _map_name );
+        return JNI_OK;
+    }
+
+    if( ( ( val = option( options, "jitdump" ) ) != NULL ) &&
+        ( atoi( val ) != 0 ) ) {
+        open_jitdump();
+    }
+
+    jvmtiCapabilities caps;
+    memset( &caps, 0, sizeof( caps ) );
+    caps.can_generate_compiled_method_load_events = 1;
+
+    jvmtiEventCallbacks callbacks;
+    memset( &callbacks, 0, sizeof( callbacks ) );
+    callbacks.VMDeath              = &on_vm_death;
+    callbacks.CompiledMethodLoad   = &on_compiled_method_load;
+    callbacks.CompiledMethodUnload = &on_compiled_method_unload;
+    callbacks.DynamicCodeGenerated = &on_dynamic_code_generated;
+
+    static const jvmtiEvent events[] = {
+        JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_COMPILED_METHOD_LOAD,
+        JVMTI_EVENT_COMPILED_METHOD_UNLOAD,
+        JVMTI_EVENT_DYNAMIC_CODE_GENERATED };
+
+    int failed =
+        ( (*jvmti)->CreateRawMonitor( jvmti, "hashdot_perf_map", &_lock ) !=
+          JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->AddCapabilities( jvmti, &caps ) != JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->SetEventCallbacks( jvmti, &callbacks,
+                                       sizeof( callbacks ) ) != JVMTI_ERROR_NONE );
+    int i;
+    for( i = 0; !failed && ( i < sizeof( events ) / sizeof( events[0] ) ); i++ ) {
+        failed = ( (*jvmti)->SetEventNotificationMode(
+                       jvmti, JVMTI_ENABLE, events[i], NULL ) != JVMTI_ERROR_NONE );
+    }
+
+    if( failed ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI events unavailable, "
+                 "no perf map.\n" );
+    }
+
+    return JNI_OK;
+}
@@ -0,0 +1,163 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include "perfdata.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pwd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// hsperfdata prologue and entry layout (HotSpot perfMemory.hpp)
+typedef struct {
+    unsigned char magic[4];       // 0xcafec0c0, big endian
+    unsigned char byte_order;     // 0: big, 1: little
+    unsigned char major_version;
+    unsigned char minor_version;
+    unsigned char accessible;
+    int used;
+    int overflow;
+    long long mod_time_stamp;
+    int entry_offset;
+    int num_entries;
+} perf_prologue_t;
+
+typedef struct {
+    int entry_length;
+    int name_offset;
+    int vector_length;
+    unsigned char data_type;
+    unsigned char flags;
+    unsigned char data_units;
+    unsigned char data_variability;
+    int data_offset;
+} perf_entry_t;
+
+/**
+ * Set path to the perf data file of pid, which is kept in the
+ * hsperfdata directory of the process owner.
+ */
+int perfdata_path( int pid, char *path, size_t len )
+{
+    char proc[ 32 ];
+    struct stat st;
+    snprintf( proc, sizeof( proc ), "/proc/%d", pid );
+    struct passwd *pw = ( stat( proc, &st ) == 0 ) ?
+        getpwuid( st.st_uid ) : NULL;
+    if( pw == NULL ) return PERFDATA_NOFILE;
+
+    snprintf( path, len, "/tmp/hsperfdata_%s/%d", pw->pw_name, pid );
+    return PERFDATA_OK;
+}
+
+int perfdata_open( const char *path, perfdata_t *pd )
+{
+    pd->map = NULL;
+    pd->size = 0;
+
+    int fd = open( path, O_RDONLY );
+    if( fd < 0 ) return PERFDATA_NOFILE;
+
+    struct stat st;
+    void *map = MAP_FAILED;
+    if( ( fstat( fd, &st ) == 0 ) &&
+        ( st.st_size >= (off_t) sizeof( perf_prologue_t ) ) ) {
+        map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+    }
+    close( fd );
+    if( map == MAP_FAILED ) return PERFDATA_NOFILE;
+
+    const perf_prologue_t *p = map;
+    int host_little = ( *(const unsigned short *) "\1\0" == 1 );
+    if( ( p->magic[0] != 0xca ) || ( p->magic[1] != 0xfe ) ||
+        ( p->magic[2] != 0xc0 ) || ( p->magic[3] != 0xc0 ) ||
+        ( p->byte_order != host_little ) || ( p->major_version != 2 ) ) {
+        munmap( map, st.st_size );
+        return PERFDATA_INVALID;
+    }
+
+    pd->map = map;
+    pd->size = st.st_size;
+    return PERFDATA_OK;
+}
+
+void perfdata_close( perfdata_t *pd )
+{
+    if( pd->map != NULL ) munmap( pd->map, pd->size );
+    pd->map = NULL;
+    pd->size = 0;
+}
+
+/**
+ * True once the JVM has completed initializing the counters.
+ */
+int perfdata_accessible( const perfdata_t *pd )
+{
+    return ( (const volatile perf_prologue_t *) pd->map )->accessible;
+}
+
+/**
+ * Return the scalar long counter named name, or NULL if not found. The
+ * JVM updates counters in place, so the returned pointer remains valid
+ * for reading current values until perfdata_close.
+ */
+const volatile long long *perfdata_long( const perfdata_t *pd,
+                                         const char *name )
+{
+    const perf_prologue_t *p = pd->map;
+    const unsigned char *m = pd->map;
+    const unsigned char *end = m + pd->size;
+    const unsigned char *e = m + p->entry_offset;
+    int i;
+
+    for( i = 0; i < p->num_entries; i++ ) {
+        if( ( e < m ) || ( e + sizeof( perf_entry_t ) > end ) ) break;
+
+        const perf_entry_t *entry = (const perf_entry_t *) e;
+        if( ( entry->entry_length <= 0 ) ||
+            ( e + entry->entry_length > end ) ) break;
+
+        if( ( entry->data_type == 'J' ) && ( entry->vector_length == 0 ) &&
+            ( strncmp( (const char *) e + entry->name_offset, name,
+                       entry->entry_length - entry->name_offset ) == 0 ) ) {
+            return (const volatile long long *) ( e + entry->data_offset );
+        }
+        e += entry->entry_length;
+    }
+    return NULL;
+}
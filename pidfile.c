@@ -43,6 +43,17 @@
 
 static apr_file_t *_pid_file = NULL;
 
+// Additional (service) pid files, locked and removed with the above.
+static apr_array_header_t *_service_pid_files = NULL;
+
+typedef struct {
+    const char *name;
+    apr_file_t *file;
+} pid_file_t;
+
+static apr_status_t
+lock_file( const char *pfile_name, apr_file_t **file );
+
 apr_status_t lock_pid_file()
 {
     apr_status_t rv = APR_SUCCESS;
@@ -51,39 +62,82 @@ apr_status_t lock_pid_file()
     rv = get_property_value( "hashdot.pid_file", 0, 0, &pfile_name );
 
     if( ( rv == APR_SUCCESS ) && ( pfile_name != NULL ) ) {
+        rv = lock_file( pfile_name, &_pid_file );
+    }
 
-        rv = apr_file_open( &_pid_file, pfile_name,
-                            ( APR_READ | APR_WRITE | APR_CREATE ),
-                            ( APR_FPROT_UREAD | APR_FPROT_UWRITE |
-                              APR_FPROT_GREAD | APR_FPROT_WREAD ),
-                            _mp );
+    return rv;
+}
 
-        if( rv != APR_SUCCESS ) {
-            ERROR( "Could not open pid file [%s] for write.", pfile_name );
-        }
+apr_status_t lock_service_pid_file( const char *pfile_name )
+{
+    pid_file_t pf;
+    pf.name = pfile_name;
+    pf.file = NULL;
 
-        if( rv == APR_SUCCESS ) {
-            rv = apr_file_lock( _pid_file,
-                                APR_FLOCK_EXCLUSIVE | APR_FLOCK_NONBLOCK );
+    apr_status_t rv = lock_file( pfile_name, &pf.file );
 
-            if( rv != APR_SUCCESS ) {
-                WARN( "pid_file [%s] already locked. Exiting.", pfile_name );
-                apr_file_close( _pid_file );
-            }
+    if( rv == APR_SUCCESS ) {
+        if( _service_pid_files == NULL ) {
+            _service_pid_files = apr_array_make( _mp, 8, sizeof( pid_file_t ) );
         }
+        *(pid_file_t *) apr_array_push( _service_pid_files ) = pf;
+    }
+
+    return rv;
+}
+
+apr_status_t release_pid_file()
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    // Only closes this process's descriptor: the lock is shared with
+    // the parent which still holds it.
+    if( _pid_file != NULL ) {
+        rv = apr_file_close( _pid_file );
+        _pid_file = NULL;
+    }
+
+    return rv;
+}
+
+static apr_status_t
+lock_file( const char *pfile_name, apr_file_t **file )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    rv = apr_file_open( file, pfile_name,
+                        ( APR_READ | APR_WRITE | APR_CREATE ),
+                        ( APR_FPROT_UREAD | APR_FPROT_UWRITE |
+                          APR_FPROT_GREAD | APR_FPROT_WREAD ),
+                        _mp );
+
+    if( rv != APR_SUCCESS ) {
+        ERROR( "Could not open pid file [%s] for write.", pfile_name );
+    }
 
-        if( rv == APR_SUCCESS ) {
-            rv = apr_file_trunc( _pid_file, 0 );
-            if( rv != APR_SUCCESS ) {
-                ERROR( "Could not truncate pid file [%s].", pfile_name );
-                apr_file_close( _pid_file );
-            }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_lock( *file,
+                            APR_FLOCK_EXCLUSIVE | APR_FLOCK_NONBLOCK );
+
+        if( rv != APR_SUCCESS ) {
+            WARN( "pid_file [%s] already locked. Exiting.", pfile_name );
+            apr_file_close( *file );
         }
+    }
 
-        if( rv == APR_SUCCESS ) {
-            apr_file_printf( _pid_file, "%d\n", getpid() );
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_trunc( *file, 0 );
+        if( rv != APR_SUCCESS ) {
+            ERROR( "Could not truncate pid file [%s].", pfile_name );
+            apr_file_close( *file );
         }
+    }
 
+    if( rv == APR_SUCCESS ) {
+        apr_file_printf( *file, "%d\n", getpid() );
+    }
+    else {
+        *file = NULL;
     }
 
     return rv;
@@ -105,5 +159,13 @@ apr_status_t unlock_pid_file()
         _pid_file = NULL;
     }
 
+    if( _service_pid_files != NULL ) {
+        while( _service_pid_files->nelts > 0 ) {
+            pid_file_t *pf = apr_array_pop( _service_pid_files );
+            rv = apr_file_remove( pf->name, _mp ) || rv;
+            rv = apr_file_close( pf->file ) || rv;
+        }
+    }
+
     return rv;
 }
@@ -39,6 +39,8 @@
 #include <apr_general.h>
 
 apr_status_t lock_pid_file();
+apr_status_t lock_service_pid_file( const char *pfile_name );
 apr_status_t unlock_pid_file();
+apr_status_t release_pid_file();
 
 #endif
@@ -34,18 +34,30 @@
  *************************************************************************/
 
 #include <stdio.h>
+#include <unistd.h>
+#include <pwd.h>
 
 #include <apr_file_io.h>
 #include <apr_strings.h>
+#include <apr_env.h>
 #include <apr_fnmatch.h>
 
 #include "runtime.h"
 #include "property.h"
+#include "maven.h"
+#include "dirscan.h"
+#include "statbatch.h"
 
 static apr_status_t
 parse_line( char *line,
             apr_hash_t *rprops );
 
+static apr_status_t
+expand_recursive_prop( const char *name,
+                       apr_hash_t *rprops,
+                       apr_hash_t *active,
+                       apr_array_header_t *chain );
+
 apr_hash_t *_props = NULL;
 
 #define ST_BEFORE_NAME   0
@@ -103,6 +115,26 @@ get_property_value( const char *name,
     return rv;
 }
 
+/**
+ * Set value from the boolean property name, if set, failing with
+ * code for anything but true or false.
+ */
+apr_status_t
+get_boolean( const char *name, apr_status_t code, int *value )
+{
+    const char *val = NULL;
+    apr_status_t rv = get_property_value( name, 0, 0, &val );
+    if( ( rv != APR_SUCCESS ) || ( val == NULL ) ) return rv;
+
+    if( strcmp( val, "true" ) == 0 ) *value = 1;
+    else if( strcmp( val, "false" ) == 0 ) *value = 0;
+    else {
+        rv = code;
+        ERROR( "[%d]: Invalid %s [%s] (true or false).", rv, name, val );
+    }
+    return rv;
+}
+
 void
 set_property_array( const char *name,
                     apr_array_header_t *vals )
@@ -111,6 +143,13 @@ set_property_array( const char *name,
     DEBUG( "Set %s = %s", name, apr_array_pstrcat( _mp, vals, ' ' ) );
 }
 
+void
+clear_property( const char *name )
+{
+    apr_hash_set( _props, name, strlen( name ) + 1, NULL );
+    DEBUG( "Cleared %s", name );
+}
+
 apr_status_t
 set_property_value( const char *name,
                     const char * value )
@@ -122,6 +161,86 @@ set_property_value( const char *name,
     return rv;
 }
 
+/**
+ * Copy the current properties and the delayed (:=) rprops, such that
+ * further parsing does not alter the copies.
+ */
+void
+copy_properties( apr_hash_t *rprops,
+                 apr_hash_t **props_copy,
+                 apr_hash_t **rprops_copy )
+{
+    *props_copy = apr_hash_make( _mp );
+    *rprops_copy = apr_hash_make( _mp );
+
+    const char *name = NULL;
+    void *value = NULL;
+    apr_hash_index_t *p;
+    for( p = apr_hash_first( _mp, _props ); p; p = apr_hash_next( p ) ) {
+        apr_hash_this( p, (const void **) &name, NULL, &value );
+        apr_array_header_t *vals = value;
+        apr_array_header_t *cvals =
+            apr_array_make( _mp, vals->nelts + 1, sizeof( const char* ) );
+        apr_array_cat( cvals, vals );
+        apr_hash_set( *props_copy, name, strlen( name ) + 1, cvals );
+    }
+
+    // Delayed values are strings, replaced rather than modified.
+    for( p = apr_hash_first( _mp, rprops ); p; p = apr_hash_next( p ) ) {
+        apr_hash_this( p, (const void **) &name, NULL, &value );
+        apr_hash_set( *rprops_copy, name, strlen( name ) + 1, value );
+    }
+}
+
+apr_status_t
+set_user_prop()
+{
+    struct passwd *pentry = getpwuid( getuid() );
+    return set_property_value( "hashdot.user.home", pentry->pw_dir );
+}
+
+apr_status_t
+set_script_props( const char *script )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    char *absolute_script = NULL;
+    apr_filepath_merge( &absolute_script, NULL, script, 0, _mp );
+
+    rv = set_property_value( "hashdot.script", absolute_script );
+
+    char *lpath = strrchr( absolute_script, '/' );
+    char *dir = ( lpath == NULL ) ? "." :
+        apr_pstrndup( _mp, absolute_script, lpath - absolute_script );
+
+    rv = set_property_value( "hashdot.script.dir", dir );
+
+    return rv;
+}
+
+apr_status_t
+set_hashdot_env()
+{
+    static const char *HASHDOT_ENV_PRE = "hashdot.env.";
+    int plen = strlen( HASHDOT_ENV_PRE );
+    apr_status_t rv = APR_SUCCESS;
+
+    apr_array_header_t *vals;
+    const char *name = NULL;
+    apr_hash_index_t *p;
+    for( p = apr_hash_first( _mp, _props ); p && (rv == APR_SUCCESS);
+         p = apr_hash_next( p ) ) {
+
+        apr_hash_this( p, (const void **) &name, NULL, (void **) &vals );
+        int nlen = strlen( name );
+        if( ( nlen > plen ) && strncmp( HASHDOT_ENV_PRE, name, plen ) == 0 ) {
+            const char *val = apr_array_pstrcat( _mp, vals, ' ' );
+            rv = apr_env_set( name + plen, val, _mp );
+        }
+    }
+    return rv;
+}
+
 apr_status_t
 glob_values( apr_array_header_t *values,
              apr_array_header_t **tvalues )
@@ -130,16 +249,40 @@ glob_values( apr_array_header_t *values,
     int i;
     *tvalues = apr_array_make( _mp, 16, sizeof( const char* ) );
 
-    for( i = 0; i < values->nelts; i++ ) {
-        const char *val = ((const char **) values->elts )[i];
+    // Replace any mvn: coordinates with resolved jar paths.
+    rv = resolve_maven_values( values, &values );
+
+    apr_array_header_t *excludes =
+        apr_array_make( _mp, 4, sizeof( const char* ) );
+
+    // Stat all literal values up front, together.
+    const char **paths = NULL;
+    stat_result_t *stats = NULL;
+    int nstats = 0;
+    if( rv == APR_SUCCESS ) {
+        paths = apr_palloc( _mp, ( values->nelts + 1 ) *
+                            sizeof( const char* ) );
+        stats = apr_palloc( _mp, ( values->nelts + 1 ) *
+                            sizeof( stat_result_t ) );
+        for( i = 0; i < values->nelts; i++ ) {
+            const char *val = ((const char **) values->elts )[i];
+            if( ( val[0] != '!' ) && !dirscan_test( val ) ) {
+                paths[ nstats++ ] = val;
+            }
+        }
+        rv = stat_batch( paths, nstats, stats );
+        nstats = 0;
+    }
 
-        if( apr_fnmatch_test( val ) ) {
-            char *lpath = strrchr( val, '/' );
-            char *path = ( lpath == NULL ) ?
-                "" : apr_pstrndup( _mp, val, lpath - val + 1 );
+    for( i = 0; ( i < values->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+        const char *val = ((const char **) values->elts )[i];
 
+        if( val[0] == '!' ) {
+            *( (const char **) apr_array_push( excludes ) ) = val + 1;
+        }
+        else if( dirscan_test( val ) ) {
             apr_array_header_t *globs;
-            rv = apr_match_glob( val, &globs, _mp );
+            rv = dirscan_glob( val, &globs );
             if( rv != APR_SUCCESS ) {
                 print_error( rv, val );
                 rv = 2;
@@ -150,24 +293,19 @@ glob_values( apr_array_header_t *values,
                 ERROR( "[%d]: %s not found\n", rv, val );
                 break;
             }
-            int j;
-            for( j = 0; j < globs->nelts; j++ ) {
-                const char *g = ((const char **) globs->elts )[j];
-                *( (const char **) apr_array_push( *tvalues ) ) =
-                    apr_pstrcat( _mp, path, g, NULL );
-            }
+            apr_array_cat( *tvalues, globs );
         }
         else {
-            apr_finfo_t info;
-            rv = apr_stat( &info, val, APR_FINFO_TYPE, _mp );
+            stat_result_t *info = &stats[ nstats++ ];
+            rv = info->rv;
             if( rv != APR_SUCCESS ) {
                 print_error( rv, val );
                 rv = 2;
                 break;
             }
-            if( ( info.filetype != APR_DIR ) && ( info.filetype != APR_REG ) ) {
+            if( ( info->filetype != APR_DIR ) && ( info->filetype != APR_REG ) ) {
                 ERROR( "%s not a file or directory [%d]\n",
-                       val, (int) info.filetype );
+                       val, (int) info->filetype );
                 rv = 9;
                 break;
             }
@@ -175,6 +313,26 @@ glob_values( apr_array_header_t *values,
         }
     }
 
+    // Drop any values matching a !exclusion, preserving order.
+    if( ( rv == APR_SUCCESS ) && ( excludes->nelts > 0 ) ) {
+        int j, k, n = 0;
+        for( j = 0; j < (*tvalues)->nelts; j++ ) {
+            const char *val = ((const char **) (*tvalues)->elts )[j];
+            int excluded = 0;
+            for( k = 0; ( k < excludes->nelts ) && !excluded; k++ ) {
+                excluded = dirscan_match(
+                    ((const char **) excludes->elts )[k], val );
+            }
+            if( excluded ) {
+                DEBUG( "Excluded %s", val );
+            }
+            else {
+                ((const char **) (*tvalues)->elts )[n++] = val;
+            }
+        }
+        (*tvalues)->nelts = n;
+    }
+
     return rv;
 }
 
@@ -288,6 +446,17 @@ parse_hashdot_header( const char *fname,
     return rv;
 }
 
+/**
+ * Parse a single property expression, as in a profile or after '#.'
+ * in a script header.
+ */
+apr_status_t
+parse_property_line( const char *line,
+                     apr_hash_t *rprops )
+{
+    return parse_line( apr_pstrdup( _mp, line ), rprops );
+}
+
 static apr_status_t
 parse_line( char *line,
             apr_hash_t *rprops )
@@ -337,11 +506,21 @@ parse_line( char *line,
         case ST_AFTER_NAME:
             if( IS_WS( *p ) ) p++;
             else if( *p == '=' ) {
+                // Supersedes any prior delayed (:=) value.
+                apr_hash_set( rprops, name, strlen( name ) + 1, NULL );
                 values = apr_array_make( _mp, 16, sizeof( const char* ) );
                 state = ST_VALUES;
                 p++;
             }
             else if( ( *p == '+' ) && ( *(++p) == '=' ) ) {
+                // Append to a prior delayed (:=) value, as delayed.
+                const char *rvalue =
+                    apr_hash_get( rprops, name, strlen( name ) + 1 );
+                if( rvalue != NULL ) {
+                    apr_hash_set( rprops, name, strlen( name ) + 1,
+                                  apr_pstrcat( _mp, rvalue, " ", ++p, NULL ) );
+                    return rv;
+                }
                 // Append to old value, but only if not
                 // "hashdot.profile" in which case it will be appended
                 // (for both += and =) below.
@@ -509,23 +688,103 @@ parse_line( char *line,
     return rv;
 }
 
+/**
+ * Expand all delayed (:=) properties. Each is expanded after any
+ * delayed properties it references, in depth first order, thus
+ * independent of hash order. Each is expanded only once.
+ */
 apr_status_t
 expand_recursive_props( apr_hash_t *rprops )
 {
     apr_status_t rv = APR_SUCCESS;
 
+    // Copy names first, since expansion removes entries from rprops.
+    apr_array_header_t *names =
+        apr_array_make( _mp, apr_hash_count( rprops ), sizeof( const char* ) );
+
     const char *name = NULL;
-    const char *value = NULL;
     apr_hash_index_t *p;
     for( p = apr_hash_first( _mp, rprops ); p; p = apr_hash_next( p ) ) {
+        apr_hash_this( p, (const void **) &name, NULL, NULL );
+        *(const char **) apr_array_push( names ) = name;
+    }
 
-        apr_hash_this( p, (const void **) &name, NULL, (void **) &value );
+    apr_hash_t *active = apr_hash_make( _mp );
+    apr_array_header_t *chain =
+        apr_array_make( _mp, 8, sizeof( const char* ) );
+
+    int i;
+    for( i = 0; ( i < names->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+        name = ((const char **) names->elts )[i];
+        rv = expand_recursive_prop( name, rprops, active, chain );
+    }
 
+    return rv;
+}
+
+static apr_status_t
+expand_recursive_prop( const char *name,
+                       apr_hash_t *rprops,
+                       apr_hash_t *active,
+                       apr_array_header_t *chain )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_size_t nlen = strlen( name ) + 1;
+
+    const char *value = apr_hash_get( rprops, name, nlen );
+
+    // Not delayed, or already expanded.
+    if( value == NULL ) return rv;
+
+    *(const char **) apr_array_push( chain ) = name;
+
+    if( apr_hash_get( active, name, nlen ) != NULL ) {
+        char *path = apr_pstrdup( _mp, name );
+        int i;
+        for( i = chain->nelts - 1; --i >= 0; ) {
+            path = apr_pstrcat( _mp, ((const char **) chain->elts )[i],
+                                " -> ", path, NULL );
+            if( strcmp( ((const char **) chain->elts )[i], name ) == 0 ) break;
+        }
+        ERROR( "Circular property reference: %s", path );
+        return 27;
+    }
+
+    apr_hash_set( active, name, nlen, name );
+
+    // First expand any delayed properties referenced by ${ref}.
+    int quoted = 0;
+    const char *c = value;
+    while( ( *c != '\0' ) && ( rv == APR_SUCCESS ) ) {
+        if( quoted && ( *c == '\\' ) && ( c[1] != '\0' ) ) {
+            c += 2;
+        }
+        else if( *c == '"' ) {
+            quoted = !quoted;
+            c++;
+        }
+        else if( ( c[0] == '$' ) && ( c[1] == '{' ) ) {
+            const char *e = strchr( c + 2, '}' );
+            if( e == NULL ) break; // Reported by parse_line
+            char *ref = apr_pstrndup( _mp, c + 2, e - c - 2 );
+            // A self reference is to the prior (non-delayed) value.
+            if( strcmp( ref, name ) != 0 ) {
+                rv = expand_recursive_prop( ref, rprops, active, chain );
+            }
+            c = e + 1;
+        }
+        else c++;
+    }
+
+    if( rv == APR_SUCCESS ) {
+        DEBUG( "Expanding delayed property %s", name );
         char *line = apr_psprintf( _mp, "%s=%s", name, value );
         rv = parse_line( line, rprops );
-
-        if( rv != APR_SUCCESS ) break;
     }
 
+    apr_hash_set( rprops, name, nlen, NULL );
+    apr_hash_set( active, name, nlen, NULL );
+    apr_array_pop( chain );
+
     return rv;
 }
@@ -51,6 +51,10 @@ apr_status_t
 parse_hashdot_header( const char *fname,
                       apr_hash_t *rprops );
 
+apr_status_t
+parse_property_line( const char *line,
+                     apr_hash_t *rprops );
+
 apr_status_t
 glob_values( apr_array_header_t *values,
              apr_array_header_t **tvalues );
@@ -64,14 +68,36 @@ get_property_value( const char *name,
                     int required,
                     const char **value );
 
+apr_status_t
+get_boolean( const char *name,
+             apr_status_t code,
+             int *value );
+
 void
 set_property_array( const char *name,
                     apr_array_header_t *vals );
 
+void
+clear_property( const char *name );
+
 apr_status_t
 set_property_value( const char *name,
                     const char *value );
 
+void
+copy_properties( apr_hash_t *rprops,
+                 apr_hash_t **props_copy,
+                 apr_hash_t **rprops_copy );
+
+apr_status_t
+set_user_prop();
+
+apr_status_t
+set_script_props( const char *script );
+
+apr_status_t
+set_hashdot_env();
+
 extern apr_hash_t *_props;
 
 #endif
@@ -34,19 +34,28 @@
  *************************************************************************/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
 
 #include <apr_general.h>
 #include <apr_strings.h>
 #include <apr_lib.h>
 
 #include "runtime.h"
+#include "property.h"
 
 apr_pool_t *_mp = NULL;
 
 int _debug = 0;
 
+apr_int64_t _launch_ns = 0;
+
 apr_status_t rt_initialize()
 {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    _launch_ns = (apr_int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+
     apr_status_t rv = apr_initialize();
     if( rv == APR_SUCCESS ) {
         rv = apr_pool_create( &_mp, NULL );
@@ -69,3 +78,49 @@ void print_error( apr_status_t rv, const char * info )
     apr_strerror( rv, errbuf, sizeof(errbuf) );
     ERROR( "[%d]: %s: %s", rv, errbuf, info );
 }
+
+/**
+ * 64 bit FNV-1a hash of str, as used for cache file names.
+ */
+apr_uint64_t hash_string( const char *str )
+{
+    apr_uint64_t hash = 14695981039346656037ULL;
+    const char *c;
+    for( c = str; *c != '\0'; c++ ) {
+        hash = ( hash ^ (unsigned char) *c ) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * Seconds on CLOCK_MONOTONIC.
+ */
+double monotonic()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read property name, if set, as a non-negative number of seconds into
+ * secs. Returns code for an invalid value.
+ */
+apr_status_t read_seconds( const char *name,
+                           apr_status_t code,
+                           double *secs )
+{
+    const char *value = NULL;
+    apr_status_t rv = get_property_value( name, 0, 0, &value );
+
+    if( ( rv == APR_SUCCESS ) && ( value != NULL ) ) {
+        char *end = NULL;
+        double v = strtod( value, &end );
+        if( ( end == value ) || ( *end != '\0' ) || ( v < 0 ) ) {
+            rv = code;
+            ERROR( "[%d]: Invalid %s [%s] (seconds).", rv, name, value );
+        }
+        else *secs = v;
+    }
+    return rv;
+}
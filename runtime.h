@@ -64,7 +64,18 @@ void rt_shutdown();
 
 void print_error( apr_status_t rv, const char * info );
 
+apr_uint64_t hash_string( const char *str );
+
+double monotonic();
+
+apr_status_t read_seconds( const char *name,
+                           apr_status_t code,
+                           double *secs );
+
 extern apr_pool_t *_mp;
 extern int _debug;
 
+// CLOCK_MONOTONIC at rt_initialize, nanoseconds
+extern apr_int64_t _launch_ns;
+
 #endif
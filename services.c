@@ -0,0 +1,647 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_thread_proc.h>
+#include <apr_atomic.h>
+
+#include <jni.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "daemon.h"
+#include "pidfile.h"
+#include "jvm.h"
+#include "classgen.h"
+#include "history.h"
+#include "jfr.h"
+#include "services.h"
+
+typedef struct {
+    const char *name;
+    const char *main;
+    apr_array_header_t *args;
+    apr_array_header_t *class_path;
+    const char *status_fname;
+    apr_file_t *log;
+
+    JavaVM *vm;
+    jobject group;
+    jobject loader;
+    apr_status_t status;
+} service_t;
+
+static apr_array_header_t *_services = NULL;
+
+// Services which have reached their main method
+static volatile apr_uint32_t _running = 0;
+
+static apr_file_t *_std_files[2] = { NULL, NULL };
+static jobject _streams[2] = { NULL, NULL };
+
+static jclass _thread_cls = NULL;
+static jmethodID _current_thread = NULL;
+static jmethodID _get_thread_group = NULL;
+static jmethodID _get_parent = NULL;
+
+static apr_status_t
+read_service( const char *name, service_t **svc );
+
+static const char *
+service_property_name( service_t *svc, const char *suffix );
+
+static apr_status_t
+create_service_loader( JNIEnv *env, service_t *svc );
+
+static apr_status_t
+init_thread_methods( JNIEnv *env );
+
+static void * APR_THREAD_FUNC
+service_thread( apr_thread_t *thread, void *data );
+
+static void
+write_service_status( service_t *svc, const char *status );
+
+static service_t *
+current_service( JNIEnv *env );
+
+static void
+service_output( JNIEnv *env, jobject stream, const char *buf, apr_size_t len );
+
+static void JNICALL
+service_write_byte( JNIEnv *env, jobject stream, jint b );
+
+static void JNICALL
+service_write_bytes( JNIEnv *env, jobject stream,
+                     jbyteArray bytes, jint off, jint len );
+
+static void JNICALL
+service_flush( JNIEnv *env, jobject stream );
+
+/**
+ * Host each service named in hashdot.services in this one JVM, each
+ * started on its own thread, in its own thread group, and with its
+ * own class loader.
+ */
+apr_status_t run_services()
+{
+    static JNINativeMethod METHODS[] = {
+        { "write", "(I)V",    (void *) &service_write_byte },
+        { "write", "([BII)V", (void *) &service_write_bytes },
+        { "flush", "()V",     (void *) &service_flush }
+    };
+
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    apr_array_header_t *names = get_property_array( "hashdot.services" );
+
+    _services = apr_array_make( _mp, names->nelts, sizeof( service_t * ) );
+
+    for( i = 0; ( i < names->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+        service_t *svc = NULL;
+        rv = read_service( ((const char **) names->elts )[i], &svc );
+        if( rv == APR_SUCCESS ) {
+            *(service_t **) apr_array_push( _services ) = svc;
+        }
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open_stdout( &_std_files[0], _mp );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = apr_file_open_stderr( &_std_files[1], _mp );
+    }
+
+    JavaVM * vm = NULL;
+    JNIEnv * env = NULL;
+
+    if( rv == APR_SUCCESS ) {
+        rv = create_jvm( &vm, &env );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = install_hup_handler();
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = init_thread_methods( env );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        rv = replace_system_streams( env, "hashdot/ServiceOutput",
+                                     METHODS, _streams );
+    }
+
+    jclass group_cls = NULL;
+    jmethodID group_init = NULL;
+    if( rv == APR_SUCCESS ) {
+        group_cls = (*env)->FindClass( env, "java/lang/ThreadGroup" );
+        if( group_cls ) {
+            group_init = (*env)->GetMethodID( env, group_cls, "<init>",
+                                              "(Ljava/lang/String;)V" );
+        }
+        if( !group_init ) {
+            (*env)->ExceptionDescribe( env );
+            rv = 25;
+        }
+    }
+
+    for( i = 0; ( i < _services->nelts ) && ( rv == APR_SUCCESS ); i++ ) {
+        service_t *svc = ((service_t **) _services->elts )[i];
+        svc->vm = vm;
+
+        jstring name = (*env)->NewStringUTF( env, svc->name );
+        jobject group = NULL;
+        if( name ) {
+            group = (*env)->NewObject( env, group_cls, group_init, name );
+            (*env)->DeleteLocalRef( env, name );
+        }
+        if( group ) {
+            svc->group = (*env)->NewGlobalRef( env, group );
+            (*env)->DeleteLocalRef( env, group );
+        }
+        else {
+            (*env)->ExceptionDescribe( env );
+            rv = 25;
+        }
+
+        if( rv == APR_SUCCESS ) {
+            rv = create_service_loader( env, svc );
+        }
+    }
+
+    if( rv == APR_SUCCESS ) {
+        int count = _services->nelts;
+        apr_thread_t *threads[ count ];
+        int started = 0;
+        for( i = 0; i < count; i++ ) {
+            service_t *svc = ((service_t **) _services->elts )[i];
+            write_service_status( svc, "starting" );
+            rv = apr_thread_create( &threads[i], NULL, service_thread,
+                                    svc, _mp );
+            if( rv != APR_SUCCESS ) {
+                print_error( rv, svc->name );
+                break;
+            }
+            ++started;
+        }
+        for( i = 0; i < started; i++ ) {
+            apr_status_t trv;
+            apr_thread_join( &trv, threads[i] );
+        }
+    }
+
+    if( vm != NULL ) {
+        // Waits for all remaining non-daemon service threads. The
+        // exit hook doesn't run on DestroyJavaVM.
+        (*vm)->DestroyJavaVM(vm);
+        record_run();
+        jfr_exit();
+    }
+
+    if( rv == APR_SUCCESS ) {
+        int failed = 0;
+        for( i = 0; i < _services->nelts; i++ ) {
+            service_t *svc = ((service_t **) _services->elts )[i];
+            if( svc->status == APR_SUCCESS ) {
+                write_service_status( svc, "stopped" );
+            }
+            else {
+                ++failed;
+            }
+        }
+        if( failed > 0 ) {
+            WARN( "%d of %d services failed.", failed, _services->nelts );
+            rv = 31;
+        }
+    }
+
+    return rv;
+}
+
+static apr_status_t
+read_service( const char *name, service_t **svc )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    *svc = apr_pcalloc( _mp, sizeof( service_t ) );
+    (*svc)->name = name;
+
+    rv = get_property_value( service_property_name( *svc, "main" ),
+                             0, 1, &(*svc)->main );
+
+    if( rv == APR_SUCCESS ) {
+        (*svc)->args =
+            get_property_array( service_property_name( *svc, "args" ) );
+        (*svc)->class_path =
+            get_property_array( service_property_name( *svc, "class_path" ) );
+        rv = get_property_value( service_property_name( *svc, "status_file" ),
+                                 0, 0, &(*svc)->status_fname );
+    }
+
+    const char *fname = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( service_property_name( *svc, "pid_file" ),
+                                 0, 0, &fname );
+    }
+    if( ( rv == APR_SUCCESS ) && ( fname != NULL ) ) {
+        rv = lock_service_pid_file( fname );
+    }
+
+    fname = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( service_property_name( *svc,
+                                                        "io_redirect.file" ),
+                                 '/', 0, &fname );
+    }
+    if( ( rv == APR_SUCCESS ) && ( fname != NULL ) ) {
+        DEBUG( "Redirecting service %s output to %s", name, fname );
+        rv = apr_file_open( &(*svc)->log, fname,
+                            ( APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                              APR_FOPEN_APPEND ),
+                            APR_OS_DEFAULT, _mp );
+        if( rv != APR_SUCCESS ) {
+            ERROR( "Could not open service log file [%s].", fname );
+        }
+    }
+
+    return rv;
+}
+
+static const char *
+service_property_name( service_t *svc, const char *suffix )
+{
+    return apr_psprintf( _mp, "hashdot.service.%s.%s", svc->name, suffix );
+}
+
+/**
+ * With a service class_path, create a URLClassLoader over it with the
+ * system class loader's parent as parent, isolating the service from
+ * the host java.class.path and other services. Otherwise use the
+ * system class loader.
+ */
+static apr_status_t
+create_service_loader( JNIEnv *env, service_t *svc )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    jclass cl_cls = (*env)->FindClass( env, "java/lang/ClassLoader" );
+    jmethodID get_system = NULL;
+    if( cl_cls ) {
+        get_system = (*env)->GetStaticMethodID( env, cl_cls,
+                                                "getSystemClassLoader",
+                                                "()Ljava/lang/ClassLoader;" );
+    }
+    jobject loader = NULL;
+    if( get_system ) {
+        loader = (*env)->CallStaticObjectMethod( env, cl_cls, get_system );
+    }
+    if( !loader ) rv = 26;
+
+    apr_array_header_t *paths = NULL;
+    if( ( rv == APR_SUCCESS ) && ( svc->class_path != NULL ) ) {
+        rv = glob_values( svc->class_path, &paths );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( paths != NULL ) ) {
+        jclass file_cls = (*env)->FindClass( env, "java/io/File" );
+        jclass uri_cls  = (*env)->FindClass( env, "java/net/URI" );
+        jclass url_cls  = (*env)->FindClass( env, "java/net/URL" );
+        jclass ucl_cls  = (*env)->FindClass( env, "java/net/URLClassLoader" );
+        jmethodID file_init = NULL, to_uri = NULL, to_url = NULL;
+        jmethodID ucl_init = NULL, get_parent = NULL;
+        if( file_cls && uri_cls && url_cls && ucl_cls ) {
+            file_init = (*env)->GetMethodID( env, file_cls, "<init>",
+                                             "(Ljava/lang/String;)V" );
+            to_uri = (*env)->GetMethodID( env, file_cls, "toURI",
+                                          "()Ljava/net/URI;" );
+            to_url = (*env)->GetMethodID( env, uri_cls, "toURL",
+                                          "()Ljava/net/URL;" );
+            ucl_init = (*env)->GetMethodID( env, ucl_cls, "<init>",
+                                 "([Ljava/net/URL;Ljava/lang/ClassLoader;)V" );
+            get_parent = (*env)->GetMethodID( env, cl_cls, "getParent",
+                                              "()Ljava/lang/ClassLoader;" );
+        }
+        if( !file_init || !to_uri || !to_url || !ucl_init || !get_parent ) {
+            rv = 26;
+        }
+
+        jobjectArray urls = NULL;
+        if( rv == APR_SUCCESS ) {
+            urls = (*env)->NewObjectArray( env, paths->nelts, url_cls, NULL );
+            if( !urls ) rv = 26;
+        }
+
+        int i;
+        for( i = 0; ( rv == APR_SUCCESS ) && ( i < paths->nelts ); i++ ) {
+            const char *path = ((const char **) paths->elts )[i];
+            DEBUG( "Service %s class path: %s", svc->name, path );
+            jstring jpath = (*env)->NewStringUTF( env, path );
+            jobject file = NULL, uri = NULL, url = NULL;
+            if( jpath ) file = (*env)->NewObject( env, file_cls, file_init, jpath );
+            if( file ) uri = (*env)->CallObjectMethod( env, file, to_uri );
+            if( uri ) url = (*env)->CallObjectMethod( env, uri, to_url );
+            if( url ) {
+                (*env)->SetObjectArrayElement( env, urls, i, url );
+            }
+            else {
+                rv = 26;
+            }
+            if( jpath ) (*env)->DeleteLocalRef( env, jpath );
+            if( file ) (*env)->DeleteLocalRef( env, file );
+            if( uri ) (*env)->DeleteLocalRef( env, uri );
+            if( url ) (*env)->DeleteLocalRef( env, url );
+        }
+
+        jobject parent = NULL;
+        if( rv == APR_SUCCESS ) {
+            parent = (*env)->CallObjectMethod( env, loader, get_parent );
+            if( (*env)->ExceptionCheck( env ) ) rv = 26;
+        }
+        if( rv == APR_SUCCESS ) {
+            (*env)->DeleteLocalRef( env, loader );
+            loader = (*env)->NewObject( env, ucl_cls, ucl_init, urls, parent );
+            if( !loader ) rv = 26;
+        }
+    }
+
+    if( rv == APR_SUCCESS ) {
+        svc->loader = (*env)->NewGlobalRef( env, loader );
+    }
+    else if( rv == 26 ) {
+        (*env)->ExceptionDescribe( env );
+        ERROR( "Could not create class loader for service %s", svc->name );
+    }
+
+    return rv;
+}
+
+static apr_status_t
+init_thread_methods( JNIEnv *env )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    jclass cls = (*env)->FindClass( env, "java/lang/Thread" );
+    jclass group_cls = (*env)->FindClass( env, "java/lang/ThreadGroup" );
+    if( cls && group_cls ) {
+        _thread_cls = (*env)->NewGlobalRef( env, cls );
+        _current_thread = (*env)->GetStaticMethodID( env, cls, "currentThread",
+                                                     "()Ljava/lang/Thread;" );
+        _get_thread_group = (*env)->GetMethodID( env, cls, "getThreadGroup",
+                                                 "()Ljava/lang/ThreadGroup;" );
+        _get_parent = (*env)->GetMethodID( env, group_cls, "getParent",
+                                           "()Ljava/lang/ThreadGroup;" );
+    }
+
+    if( !_current_thread || !_get_thread_group || !_get_parent ) {
+        (*env)->ExceptionDescribe( env );
+        rv = 25;
+    }
+
+    return rv;
+}
+
+static void * APR_THREAD_FUNC
+service_thread( apr_thread_t *thread, void *data )
+{
+    service_t *svc = data;
+    JNIEnv *env = NULL;
+    apr_status_t rv = APR_SUCCESS;
+
+    JavaVMAttachArgs attach_args;
+    attach_args.version = JNI_VERSION_1_2;
+    attach_args.name = (char *) svc->name;
+    attach_args.group = svc->group;
+
+    if( (*svc->vm)->AttachCurrentThread( svc->vm, (void **) &env,
+                                         &attach_args ) != JNI_OK ) {
+        ERROR( "Service %s could not attach to JVM", svc->name );
+        rv = 25;
+        env = NULL;
+    }
+
+    jobject thread_obj = NULL;
+    if( rv == APR_SUCCESS ) {
+        thread_obj = (*env)->CallStaticObjectMethod( env, _thread_cls,
+                                                     _current_thread );
+        jmethodID set_loader =
+            (*env)->GetMethodID( env, _thread_cls, "setContextClassLoader",
+                                 "(Ljava/lang/ClassLoader;)V" );
+        if( thread_obj && set_loader ) {
+            (*env)->CallVoidMethod( env, thread_obj, set_loader, svc->loader );
+        }
+        if( (*env)->ExceptionCheck( env ) || !thread_obj || !set_loader ) {
+            (*env)->ExceptionDescribe( env );
+            rv = 25;
+        }
+    }
+
+    jclass cls = NULL;
+    if( rv == APR_SUCCESS ) {
+        jclass cl_cls = (*env)->FindClass( env, "java/lang/ClassLoader" );
+        jmethodID load_class = NULL;
+        if( cl_cls ) {
+            load_class =
+                (*env)->GetMethodID( env, cl_cls, "loadClass",
+                                     "(Ljava/lang/String;)Ljava/lang/Class;" );
+        }
+        jstring jname = (*env)->NewStringUTF( env, svc->main );
+        if( load_class && jname ) {
+            cls = (*env)->CallObjectMethod( env, svc->loader, load_class,
+                                            jname );
+        }
+        if( !cls ) {
+            (*env)->ExceptionDescribe( env );
+            ERROR( "Service %s main class %s not found", svc->name, svc->main );
+            rv = 3;
+        }
+    }
+
+    jmethodID main_method = NULL;
+    if( rv == APR_SUCCESS ) {
+        main_method = (*env)->GetStaticMethodID( env, cls, "main",
+                                                 "([Ljava/lang/String;)V" );
+        if( !main_method ) {
+            (*env)->ExceptionDescribe(env);
+            rv = 4;
+        }
+    }
+
+    jobjectArray args = NULL;
+    if( rv == APR_SUCCESS ) {
+        rv = new_string_array( env, svc->args, 0, NULL, &args );
+    }
+
+    if( rv == APR_SUCCESS ) {
+        DEBUG( "Starting service %s: %s", svc->name, svc->main );
+        write_service_status( svc, "running" );
+        // Ready once the last service is about to run.
+        if( apr_atomic_inc32( &_running ) + 1 == _services->nelts ) {
+            main_ready();
+        }
+        (*env)->CallStaticVoidMethod( env, cls, main_method, args );
+        DEBUG( "Service %s returned from main.", svc->name );
+        if( (*env)->ExceptionCheck( env ) ) {
+            (*env)->ExceptionDescribe( env );
+            rv = 1;
+        }
+    }
+
+    if( rv != APR_SUCCESS ) {
+        write_service_status( svc, "failed" );
+    }
+    svc->status = rv;
+
+    if( env != NULL ) {
+        (*svc->vm)->DetachCurrentThread( svc->vm );
+    }
+
+    apr_thread_exit( thread, rv );
+    return NULL;
+}
+
+static void
+write_service_status( service_t *svc, const char *status )
+{
+    DEBUG( "Service %s: %s", svc->name, status );
+
+    if( svc->status_fname != NULL ) {
+        apr_pool_t *pool = NULL;
+        apr_file_t *out = NULL;
+        apr_status_t rv = apr_pool_create( &pool, _mp );
+        if( rv == APR_SUCCESS ) {
+            rv = apr_file_open( &out, svc->status_fname,
+                                ( APR_FOPEN_WRITE | APR_FOPEN_CREATE |
+                                  APR_FOPEN_TRUNCATE ),
+                                APR_OS_DEFAULT, pool );
+        }
+        if( rv == APR_SUCCESS ) {
+            apr_file_printf( out, "%s\n", status );
+            apr_file_close( out );
+        }
+        else {
+            print_error( rv, svc->status_fname );
+        }
+        if( pool != NULL ) apr_pool_destroy( pool );
+    }
+}
+
+/**
+ * Find the service of the current thread by walking its thread group
+ * ancestry, so that threads started by a service are included.
+ */
+static service_t *
+current_service( JNIEnv *env )
+{
+    service_t *found = NULL;
+
+    jobject thread = (*env)->CallStaticObjectMethod( env, _thread_cls,
+                                                     _current_thread );
+    jobject group = NULL;
+    if( thread ) {
+        group = (*env)->CallObjectMethod( env, thread, _get_thread_group );
+        (*env)->DeleteLocalRef( env, thread );
+    }
+
+    while( group && !found ) {
+        int i;
+        for( i = 0; i < _services->nelts; i++ ) {
+            service_t *svc = ((service_t **) _services->elts )[i];
+            if( (*env)->IsSameObject( env, group, svc->group ) ) {
+                found = svc;
+                break;
+            }
+        }
+        jobject parent = NULL;
+        if( !found ) {
+            parent = (*env)->CallObjectMethod( env, group, _get_parent );
+        }
+        (*env)->DeleteLocalRef( env, group );
+        group = parent;
+    }
+
+    if( (*env)->ExceptionCheck( env ) ) {
+        (*env)->ExceptionClear( env );
+    }
+
+    return found;
+}
+
+static void
+service_output( JNIEnv *env, jobject stream, const char *buf, apr_size_t len )
+{
+    int s = ( (*env)->IsSameObject( env, stream, _streams[1] ) ) ? 1 : 0;
+
+    service_t *svc = current_service( env );
+
+    if( ( svc != NULL ) && ( svc->log != NULL ) ) {
+        apr_file_write_full( svc->log, buf, len, NULL );
+    }
+    else {
+        apr_file_write_full( _std_files[s], buf, len, NULL );
+    }
+}
+
+static void JNICALL
+service_write_byte( JNIEnv *env, jobject stream, jint b )
+{
+    char c = (char) b;
+    service_output( env, stream, &c, 1 );
+}
+
+static void JNICALL
+service_write_bytes( JNIEnv *env, jobject stream,
+                     jbyteArray bytes, jint off, jint len )
+{
+    char buf[4096];
+    while( len > 0 ) {
+        jint chunk = ( len < sizeof( buf ) ) ? len : sizeof( buf );
+        (*env)->GetByteArrayRegion( env, bytes, off, chunk, (jbyte *) buf );
+        if( (*env)->ExceptionCheck( env ) ) break;
+        service_output( env, stream, buf, chunk );
+        off += chunk;
+        len -= chunk;
+    }
+}
+
+static void JNICALL
+service_flush( JNIEnv *env, jobject stream )
+{
+    // Output is unbuffered: nothing to flush.
+}
@@ -0,0 +1,681 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Startup profiler, a JVMTI agent loaded with -agentpath when
+ * hashdot.profile.startup is set (see jvm.c). Records the load and
+ * prepare time of each class, the time in each static initializer
+ * (via a breakpoint at <clinit> entry and its frame pop, so only
+ * initializers are slowed) and when main is entered. Profiling ends
+ * a window of time after main is entered, or at VM death, and writes
+ * <out>.txt (a sorted report) and <out>.folded (flame graph stacks in
+ * microseconds). Depends only on libc.
+ *
+ * Options: t0=<launch time, CLOCK_MONOTONIC ns>,window=<seconds>,
+ *          main=<main class>,out=<output prefix>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <jni.h>
+#include <jvmti.h>
+
+#include "agent_util.h"
+
+// Maximum nesting of static initializers tracked per thread
+#define MAX_DEPTH 64
+
+// Static initializers listed in the report
+#define TOP_CLINITS 50
+
+typedef struct {
+    char *name;             // Java class name
+    jweak cls;
+    jlong load_ns;          // ClassLoad, relative to t0
+    jlong prepare_ns;       // ClassPrepare
+    jlong clinit_ns;        // Static initializer, total and self
+    jlong clinit_self_ns;
+    const char *source;     // Resolved at report time
+} class_rec_t;
+
+typedef struct {
+    long rec;               // class_rec_t index
+    jmethodID method;
+    jlong start_ns;
+    jlong child_ns;
+} frame_t;
+
+typedef struct {
+    char *stack;
+    jlong self_ns;
+} folded_t;
+
+static jvmtiEnv *_jvmti = NULL;
+static jrawMonitorID _lock = NULL;
+
+static jlong _t0 = 0;
+static jlong _agent_ns = 0;
+static jlong _vm_init_ns = -1;
+static jlong _main_ns = -1;
+static jlong _window_ns = 0;
+static jlong _deadline = -1;
+static int _done = 0;
+
+static char *_main_class = NULL;     // As a signature, Lfoo/Bar;
+static char *_out = NULL;
+static jmethodID _main_method = NULL;
+
+static class_rec_t *_recs = NULL;
+static long _nrecs = 0;
+static long _max_recs = 0;
+
+static table_t _clinits = { NULL, 0, 0 };   // jmethodID -> rec
+static table_t _loads = { NULL, 0, 0 };     // name -> load_ns slot
+static jlong *_load_times = NULL;
+static long _nloads = 0;
+
+static folded_t *_folded = NULL;
+static long _nfolded = 0;
+static table_t _folded_index = { NULL, 0, 0 };  // stack -> folded
+
+static __thread frame_t _stack[ MAX_DEPTH ];
+static __thread int _depth = 0;
+
+static jlong
+monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (jlong) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Time since launch
+static jlong
+now_ns()
+{
+    return monotonic_ns() - _t0;
+}
+
+// Convert a class signature (Lfoo/Bar;) to a java name (foo.Bar).
+static char *
+class_name( const char *sig )
+{
+    size_t len = strlen( sig );
+    char *name;
+    if( ( len > 2 ) && ( sig[0] == 'L' ) && ( sig[len - 1] == ';' ) ) {
+        name = strndup( sig + 1, len - 2 );
+    }
+    else {
+        name = strdup( sig );
+    }
+    char *c;
+    for( c = name; *c != '\0'; c++ ) {
+        if( *c == '/' ) *c = '.';
+    }
+    return name;
+}
+
+static void finish( jvmtiEnv *jvmti, JNIEnv *jni );
+
+static void
+check_deadline( jvmtiEnv *jvmti, JNIEnv *jni )
+{
+    if( ( _deadline >= 0 ) && !_done && ( now_ns() > _deadline ) ) {
+        finish( jvmti, jni );
+    }
+}
+
+static void JNICALL
+on_vm_init( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread )
+{
+    _vm_init_ns = now_ns();
+}
+
+static void JNICALL
+on_class_load( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread, jclass klass )
+{
+    jlong t = now_ns();
+    char *sig = NULL;
+    if( (*jvmti)->GetClassSignature( jvmti, klass, &sig, NULL ) !=
+        JVMTI_ERROR_NONE ) return;
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    if( !_done ) {
+        if( ( _nloads % 1024 ) == 0 ) {
+            _load_times = realloc( _load_times,
+                                   ( _nloads + 1024 ) * sizeof( jlong ) );
+        }
+        _load_times[ _nloads ] = t;
+        table_put( &_loads, strdup( sig ), 1, _nloads++ );
+    }
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) sig );
+}
+
+static void JNICALL
+on_class_prepare( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread,
+                  jclass klass )
+{
+    jlong t = now_ns();
+    char *sig = NULL;
+    if( (*jvmti)->GetClassSignature( jvmti, klass, &sig, NULL ) !=
+        JVMTI_ERROR_NONE ) return;
+
+    jint count = 0;
+    jmethodID *methods = NULL;
+    if( (*jvmti)->GetClassMethods( jvmti, klass, &count, &methods ) !=
+        JVMTI_ERROR_NONE ) {
+        count = 0;
+    }
+    int is_main = ( _main_class != NULL ) &&
+        ( strcmp( sig, _main_class ) == 0 );
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    long rec = -1;
+    if( !_done ) {
+        if( _nrecs == _max_recs ) {
+            _max_recs = ( _max_recs == 0 ) ? 4096 : _max_recs * 2;
+            _recs = realloc( _recs, _max_recs * sizeof( class_rec_t ) );
+        }
+        rec = _nrecs++;
+        class_rec_t *r = &_recs[rec];
+        memset( r, 0, sizeof( *r ) );
+        r->name = class_name( sig );
+        r->cls = ( jni != NULL ) ? (*jni)->NewWeakGlobalRef( jni, klass ) : NULL;
+        long load = table_get( &_loads, sig, 1 );
+        r->load_ns = ( load >= 0 ) ? _load_times[ load ] : t;
+        r->prepare_ns = t;
+    }
+
+    jint i;
+    for( i = 0; ( i < count ) && ( rec >= 0 ); i++ ) {
+        char *name = NULL;
+        char *msig = NULL;
+        if( (*jvmti)->GetMethodName( jvmti, methods[i], &name, &msig,
+                                     NULL ) != JVMTI_ERROR_NONE ) continue;
+        if( strcmp( name, "<clinit>" ) == 0 ) {
+            if( (*jvmti)->SetBreakpoint( jvmti, methods[i], 0 ) ==
+                JVMTI_ERROR_NONE ) {
+                table_put( &_clinits, methods[i], 0, rec );
+            }
+        }
+        else if( is_main && ( strcmp( name, "main" ) == 0 ) &&
+                 ( strcmp( msig, "([Ljava/lang/String;)V" ) == 0 ) ) {
+            if( (*jvmti)->SetBreakpoint( jvmti, methods[i], 0 ) ==
+                JVMTI_ERROR_NONE ) {
+                _main_method = methods[i];
+            }
+        }
+        (*jvmti)->Deallocate( jvmti, (unsigned char *) name );
+        (*jvmti)->Deallocate( jvmti, (unsigned char *) msig );
+    }
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) methods );
+    (*jvmti)->Deallocate( jvmti, (unsigned char *) sig );
+
+    check_deadline( jvmti, jni );
+}
+
+static void JNICALL
+on_breakpoint( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread,
+               jmethodID method, jlocation location )
+{
+    jlong t = now_ns();
+
+    (*jvmti)->ClearBreakpoint( jvmti, method, 0 );
+
+    if( method == _main_method ) {
+        (*jvmti)->RawMonitorEnter( jvmti, _lock );
+        if( _main_ns < 0 ) {
+            _main_ns = t;
+            if( _window_ns > 0 ) _deadline = t + _window_ns;
+        }
+        (*jvmti)->RawMonitorExit( jvmti, _lock );
+        return;
+    }
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    long rec = _done ? -1 : table_get( &_clinits, method, 0 );
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+
+    if( ( rec >= 0 ) && ( _depth < MAX_DEPTH ) &&
+        ( (*jvmti)->NotifyFramePop( jvmti, thread, 0 ) == JVMTI_ERROR_NONE ) ) {
+        frame_t *f = &_stack[ _depth++ ];
+        f->rec = rec;
+        f->method = method;
+        f->start_ns = now_ns();
+        f->child_ns = 0;
+    }
+}
+
+static void JNICALL
+on_frame_pop( jvmtiEnv *jvmti, JNIEnv *jni, jthread thread,
+              jmethodID method, jboolean by_exception )
+{
+    if( ( _depth == 0 ) || ( _stack[ _depth - 1 ].method != method ) ) {
+        return;
+    }
+
+    jlong t = now_ns();
+    frame_t *f = &_stack[ --_depth ];
+    jlong total = t - f->start_ns;
+    jlong self = total - f->child_ns;
+    if( _depth > 0 ) _stack[ _depth - 1 ].child_ns += total;
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    if( !_done ) {
+        _recs[ f->rec ].clinit_ns += total;
+        _recs[ f->rec ].clinit_self_ns += self;
+
+        // Folded stack: phase;outer;...;this
+        size_t len = 16;
+        int d;
+        for( d = 0; d <= _depth; d++ ) {
+            len += strlen( _recs[ _stack[d].rec ].name ) + 10;
+        }
+        char *stack = malloc( len );
+        strcpy( stack, ( ( _main_ns >= 0 ) && ( f->start_ns > _main_ns ) ) ?
+                "main" : "startup" );
+        for( d = 0; d <= _depth; d++ ) {
+            strcat( stack, ";" );
+            strcat( stack, _recs[ _stack[d].rec ].name );
+            strcat( stack, ".<clinit>" );
+        }
+        long fi = table_get( &_folded_index, stack, 1 );
+        if( fi >= 0 ) {
+            _folded[fi].self_ns += self;
+            free( stack );
+        }
+        else {
+            if( ( _nfolded % 1024 ) == 0 ) {
+                _folded = realloc( _folded,
+                                   ( _nfolded + 1024 ) * sizeof( folded_t ) );
+            }
+            _folded[ _nfolded ].stack = stack;
+            _folded[ _nfolded ].self_ns = self;
+            table_put( &_folded_index, stack, 1, _nfolded++ );
+        }
+    }
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+
+    check_deadline( jvmti, jni );
+}
+
+static void JNICALL
+on_vm_death( jvmtiEnv *jvmti, JNIEnv *jni )
+{
+    finish( jvmti, jni );
+}
+
+// The code source location of cls, or "boot" if none.
+static const char *
+class_source( JNIEnv *jni, jclass cls )
+{
+    static jmethodID get_pd = NULL, get_cs = NULL, get_loc = NULL,
+        to_string = NULL;
+    static jobject *pds = NULL;
+    static const char **sources = NULL;
+    static int npds = 0;
+
+    if( ( jni == NULL ) || ( cls == NULL ) ) return "?";
+
+    if( get_pd == NULL ) {
+        jclass c = (*jni)->FindClass( jni, "java/lang/Class" );
+        if( c ) get_pd = (*jni)->GetMethodID(
+            jni, c, "getProtectionDomain", "()Ljava/security/ProtectionDomain;" );
+        c = (*jni)->FindClass( jni, "java/security/ProtectionDomain" );
+        if( c ) get_cs = (*jni)->GetMethodID(
+            jni, c, "getCodeSource", "()Ljava/security/CodeSource;" );
+        c = (*jni)->FindClass( jni, "java/security/CodeSource" );
+        if( c ) get_loc = (*jni)->GetMethodID(
+            jni, c, "getLocation", "()Ljava/net/URL;" );
+        c = (*jni)->FindClass( jni, "java/lang/Object" );
+        if( c ) to_string = (*jni)->GetMethodID(
+            jni, c, "toString", "()Ljava/lang/String;" );
+        (*jni)->ExceptionClear( jni );
+        if( !get_pd || !get_cs || !get_loc || !to_string ) get_pd = NULL;
+    }
+    if( get_pd == NULL ) return "?";
+
+    const char *source = "boot";
+    jobject pd = (*jni)->CallObjectMethod( jni, cls, get_pd );
+    if( (*jni)->ExceptionCheck( jni ) ) {
+        (*jni)->ExceptionClear( jni );
+        return "?";
+    }
+    if( pd == NULL ) return source;
+
+    int i;
+    for( i = 0; i < npds; i++ ) {
+        if( (*jni)->IsSameObject( jni, pds[i], pd ) ) {
+            (*jni)->DeleteLocalRef( jni, pd );
+            return sources[i];
+        }
+    }
+
+    jobject cs = (*jni)->CallObjectMethod( jni, pd, get_cs );
+    jobject loc = NULL;
+    if( cs != NULL ) loc = (*jni)->CallObjectMethod( jni, cs, get_loc );
+    if( loc != NULL ) {
+        jstring str = (*jni)->CallObjectMethod( jni, loc, to_string );
+        if( str != NULL ) {
+            const char *chars = (*jni)->GetStringUTFChars( jni, str, NULL );
+            if( chars != NULL ) {
+                source = strdup( chars );
+                (*jni)->ReleaseStringUTFChars( jni, str, chars );
+            }
+            (*jni)->DeleteLocalRef( jni, str );
+        }
+        (*jni)->DeleteLocalRef( jni, loc );
+    }
+    if( cs != NULL ) (*jni)->DeleteLocalRef( jni, cs );
+    (*jni)->ExceptionClear( jni );
+
+    if( ( npds % 64 ) == 0 ) {
+        pds = realloc( pds, ( npds + 64 ) * sizeof( jobject ) );
+        sources = realloc( sources, ( npds + 64 ) * sizeof( const char * ) );
+    }
+    pds[ npds ] = (*jni)->NewGlobalRef( jni, pd );
+    sources[ npds++ ] = source;
+    (*jni)->DeleteLocalRef( jni, pd );
+
+    return source;
+}
+
+static int
+compare_self( const void *a, const void *b )
+{
+    jlong x = (*(class_rec_t * const *) a)->clinit_self_ns;
+    jlong y = (*(class_rec_t * const *) b)->clinit_self_ns;
+    return ( x < y ) ? 1 : ( ( x > y ) ? -1 : 0 );
+}
+
+typedef struct {
+    const char *source;
+    long classes;
+    jlong clinit_ns;
+} source_sum_t;
+
+static int
+compare_source( const void *a, const void *b )
+{
+    const source_sum_t *x = a;
+    const source_sum_t *y = b;
+    if( x->clinit_ns != y->clinit_ns ) {
+        return ( x->clinit_ns < y->clinit_ns ) ? 1 : -1;
+    }
+    return ( x->classes < y->classes ) ? 1 : ( x->classes > y->classes ) ? -1 : 0;
+}
+
+#define MS( ns ) ( (double) ( ns ) / 1000000.0 )
+
+static void
+write_report( JNIEnv *jni, jlong end_ns )
+{
+    long i;
+
+    for( i = 0; i < _nrecs; i++ ) {
+        class_rec_t *r = &_recs[i];
+        jobject cls = NULL;
+        if( ( jni != NULL ) && ( r->cls != NULL ) ) {
+            cls = (*jni)->NewLocalRef( jni, r->cls );
+        }
+        r->source = ( cls != NULL ) ? class_source( jni, cls ) : "?";
+        if( cls != NULL ) (*jni)->DeleteLocalRef( jni, cls );
+    }
+
+    char *fname = malloc( strlen( _out ) + 8 );
+    sprintf( fname, "%s.txt", _out );
+    FILE *out = fopen( fname, "w" );
+    if( out == NULL ) {
+        fprintf( stderr, "HASHDOT WARN: Could not write %s\n", fname );
+        free( fname );
+        return;
+    }
+
+    long before_main = 0;
+    jlong clinit_total = 0;
+    for( i = 0; i < _nrecs; i++ ) {
+        if( ( _main_ns < 0 ) || ( _recs[i].load_ns < _main_ns ) ) before_main++;
+        clinit_total += _recs[i].clinit_self_ns;
+    }
+
+    fprintf( out, "# hashdot startup profile (ms from launch)\n\n" );
+    fprintf( out, "%10.1f  JVM create (agent loaded)\n", MS( _agent_ns ) );
+    if( _vm_init_ns >= 0 ) {
+        fprintf( out, "%10.1f  VM initialized\n", MS( _vm_init_ns ) );
+    }
+    if( _main_ns >= 0 ) {
+        fprintf( out, "%10.1f  main entered\n", MS( _main_ns ) );
+    }
+    else {
+        fprintf( out, "%10s  main not entered\n", "-" );
+    }
+    fprintf( out, "%10.1f  end of profile\n\n", MS( end_ns ) );
+    fprintf( out, "%ld classes loaded (%ld before main), "
+             "%.1f ms in static initializers\n",
+             _nrecs, before_main, MS( clinit_total ) );
+
+    // By source
+    source_sum_t *sums = calloc( _nrecs + 1, sizeof( source_sum_t ) );
+    long nsums = 0;
+    table_t index = { NULL, 0, 0 };
+    for( i = 0; i < _nrecs; i++ ) {
+        long s = table_get( &index, _recs[i].source, 1 );
+        if( s < 0 ) {
+            s = nsums++;
+            sums[s].source = _recs[i].source;
+            table_put( &index, _recs[i].source, 1, s );
+        }
+        sums[s].classes++;
+        sums[s].clinit_ns += _recs[i].clinit_self_ns;
+    }
+    qsort( sums, nsums, sizeof( source_sum_t ), compare_source );
+
+    fprintf( out, "\n# Sources, by static initializer time\n" );
+    fprintf( out, "%8s %10s  %s\n", "classes", "clinit ms", "source" );
+    for( i = 0; i < nsums; i++ ) {
+        fprintf( out, "%8ld %10.2f  %s\n",
+                 sums[i].classes, MS( sums[i].clinit_ns ), sums[i].source );
+    }
+
+    // Top static initializers
+    class_rec_t **by_self = malloc( ( _nrecs + 1 ) * sizeof( class_rec_t * ) );
+    for( i = 0; i < _nrecs; i++ ) by_self[i] = &_recs[i];
+    qsort( by_self, _nrecs, sizeof( class_rec_t * ), compare_self );
+
+    fprintf( out, "\n# Static initializers, by self time (top %d)\n",
+             TOP_CLINITS );
+    fprintf( out, "%10s %10s %10s  %s\n", "self ms", "total ms", "at ms",
+             "class (source)" );
+    for( i = 0; ( i < _nrecs ) && ( i < TOP_CLINITS ); i++ ) {
+        class_rec_t *r = by_self[i];
+        if( r->clinit_ns == 0 ) break;
+        fprintf( out, "%10.2f %10.2f %10.1f  %s (%s)\n",
+                 MS( r->clinit_self_ns ), MS( r->clinit_ns ),
+                 MS( r->prepare_ns ), r->name, r->source );
+    }
+
+    fprintf( out, "\n# Classes, in load order\n" );
+    fprintf( out, "%10s %10s %10s  %s\n", "at ms", "load ms", "clinit ms",
+             "class (source)" );
+    for( i = 0; i < _nrecs; i++ ) {
+        class_rec_t *r = &_recs[i];
+        fprintf( out, "%10.1f %10.2f %10.2f  %s (%s)\n",
+                 MS( r->load_ns ), MS( r->prepare_ns - r->load_ns ),
+                 MS( r->clinit_ns ), r->name, r->source );
+    }
+    fclose( out );
+
+    // Flame graph stacks, microseconds
+    sprintf( fname, "%s.folded", _out );
+    out = fopen( fname, "w" );
+    if( out != NULL ) {
+        fprintf( out, "launcher %lld\n", (long long) ( _agent_ns / 1000 ) );
+        if( _vm_init_ns >= 0 ) {
+            fprintf( out, "vm_init %lld\n",
+                     (long long) ( ( _vm_init_ns - _agent_ns ) / 1000 ) );
+        }
+        for( i = 0; i < _nfolded; i++ ) {
+            if( _folded[i].self_ns >= 1000 ) {
+                fprintf( out, "%s %lld\n", _folded[i].stack,
+                         (long long) ( _folded[i].self_ns / 1000 ) );
+            }
+        }
+        fclose( out );
+    }
+    else {
+        fprintf( stderr, "HASHDOT WARN: Could not write %s\n", fname );
+    }
+
+    fprintf( stderr, "HASHDOT: Startup profile written to %s.txt\n", _out );
+
+    free( index.entries );
+    free( by_self );
+    free( sums );
+    free( fname );
+}
+
+// End profiling (once): stop events and write the report.
+static void
+finish( jvmtiEnv *jvmti, JNIEnv *jni )
+{
+    jlong t = now_ns();
+
+    (*jvmti)->RawMonitorEnter( jvmti, _lock );
+    int done = _done;
+    _done = 1;
+    (*jvmti)->RawMonitorExit( jvmti, _lock );
+    if( done ) return;
+
+    (*jvmti)->SetEventNotificationMode( jvmti, JVMTI_DISABLE,
+                                        JVMTI_EVENT_CLASS_LOAD, NULL );
+    (*jvmti)->SetEventNotificationMode( jvmti, JVMTI_DISABLE,
+                                        JVMTI_EVENT_CLASS_PREPARE, NULL );
+
+    // Remove any breakpoints not yet hit.
+    long i;
+    for( i = 0; i < _clinits.size; i++ ) {
+        if( _clinits.entries[i].key != NULL ) {
+            (*jvmti)->ClearBreakpoint( jvmti,
+                                       (jmethodID) _clinits.entries[i].key, 0 );
+        }
+    }
+    if( ( _main_method != NULL ) && ( _main_ns < 0 ) ) {
+        (*jvmti)->ClearBreakpoint( jvmti, _main_method, 0 );
+    }
+
+    write_report( jni, t );
+}
+
+AGENT_EXPORT JNIEXPORT jint JNICALL
+Agent_OnLoad( JavaVM *vm, char *options, void *reserved )
+{
+    const char *val;
+
+    val = option( options, "t0" );
+    _t0 = ( val != NULL ) ? atoll( val ) : monotonic_ns();
+    _agent_ns = now_ns();
+
+    if( ( val = option( options, "window" ) ) != NULL ) {
+        _window_ns = (jlong) ( atof( val ) * 1000000000.0 );
+    }
+
+    if( ( val = option( options, "main" ) ) != NULL ) {
+        const char *end = strchr( val, ',' );
+        size_t len = ( end != NULL ) ? (size_t) ( end - val ) : strlen( val );
+        _main_class = malloc( len + 3 );
+        size_t i;
+        _main_class[0] = 'L';
+        for( i = 0; i < len; i++ ) {
+            _main_class[ i + 1 ] = ( val[i] == '.' ) ? '/' : val[i];
+        }
+        _main_class[ len + 1 ] = ';';
+        _main_class[ len + 2 ] = '\0';
+    }
+
+    val = option( options, "out" );
+    _out = strdup( ( val != NULL ) ? val : "hashdot-startup" );
+
+    if( (*vm)->GetEnv( vm, (void **) &_jvmti, JVMTI_VERSION_1_0 ) != JNI_OK ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI unavailable, "
+                 "startup not profiled.\n" );
+        return JNI_OK;
+    }
+    jvmtiEnv *jvmti = _jvmti;
+
+    jvmtiCapabilities caps;
+    memset( &caps, 0, sizeof( caps ) );
+    caps.can_generate_breakpoint_events = 1;
+    caps.can_generate_frame_pop_events = 1;
+
+    jvmtiEventCallbacks callbacks;
+    memset( &callbacks, 0, sizeof( callbacks ) );
+    callbacks.VMInit       = &on_vm_init;
+    callbacks.VMDeath      = &on_vm_death;
+    callbacks.ClassLoad    = &on_class_load;
+    callbacks.ClassPrepare = &on_class_prepare;
+    callbacks.Breakpoint   = &on_breakpoint;
+    callbacks.FramePop     = &on_frame_pop;
+
+    static const jvmtiEvent events[] = {
+        JVMTI_EVENT_VM_INIT, JVMTI_EVENT_VM_DEATH, JVMTI_EVENT_CLASS_LOAD,
+        JVMTI_EVENT_CLASS_PREPARE, JVMTI_EVENT_BREAKPOINT,
+        JVMTI_EVENT_FRAME_POP };
+
+    int failed =
+        ( (*jvmti)->CreateRawMonitor( jvmti, "hashdot_startup", &_lock ) !=
+          JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->AddCapabilities( jvmti, &caps ) != JVMTI_ERROR_NONE ) ||
+        ( (*jvmti)->SetEventCallbacks( jvmti, &callbacks,
+                                       sizeof( callbacks ) ) != JVMTI_ERROR_NONE );
+    int i;
+    for( i = 0; !failed && ( i < sizeof( events ) / sizeof( events[0] ) ); i++ ) {
+        failed = ( (*jvmti)->SetEventNotificationMode(
+                       jvmti, JVMTI_ENABLE, events[i], NULL ) != JVMTI_ERROR_NONE );
+    }
+
+    if( failed ) {
+        fprintf( stderr, "HASHDOT WARN: JVMTI events unavailable, "
+                 "startup not profiled.\n" );
+    }
+
+    return JNI_OK;
+}
@@ -0,0 +1,311 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <apr_thread_proc.h>
+
+#if defined(__linux__) && defined(STATX_TYPE) && defined(SYS_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "runtime.h"
+#include "statbatch.h"
+
+// Smaller batches are checked sequentially.
+#define BATCH_MIN 4
+
+// Limit of entries in flight on the ring.
+#define RING_MAX 4096
+
+// Fallback threads, which mostly wait on the file system, so are not
+// limited to the number of CPUs.
+#define STAT_THREADS 16
+
+// Fallback paths per thread, at minimum.
+#define PATHS_PER_THREAD 8
+
+typedef struct {
+    const char **paths;
+    stat_result_t *results;
+    int start;
+    int count;
+    int stride;
+} stat_worker_t;
+
+static apr_filetype_e
+mode_filetype( mode_t mode )
+{
+    if( S_ISREG( mode ) )  return APR_REG;
+    if( S_ISDIR( mode ) )  return APR_DIR;
+    if( S_ISCHR( mode ) )  return APR_CHR;
+    if( S_ISBLK( mode ) )  return APR_BLK;
+    if( S_ISFIFO( mode ) ) return APR_PIPE;
+    if( S_ISLNK( mode ) )  return APR_LNK;
+    if( S_ISSOCK( mode ) ) return APR_SOCK;
+    return APR_UNKFILE;
+}
+
+static void
+stat_one( const char *path, stat_result_t *result )
+{
+    struct stat st;
+    if( stat( path, &st ) == 0 ) {
+        result->rv = APR_SUCCESS;
+        result->filetype = mode_filetype( st.st_mode );
+    }
+    else {
+        result->rv = APR_FROM_OS_ERROR( errno );
+        result->filetype = APR_NOFILE;
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * Submit a statx for every path on an io_uring, so that all lookups
+ * are in flight together, and gather the results. Returns non-zero if
+ * io_uring or its statx operation is not available.
+ */
+static int
+stat_ring( const char **paths, int count, stat_result_t *results )
+{
+    struct io_uring_params p;
+    memset( &p, 0, sizeof( p ) );
+
+    unsigned entries = ( count < RING_MAX ) ? count : RING_MAX;
+    int fd = (int) syscall( SYS_io_uring_setup, entries, &p );
+    if( fd < 0 ) return 1;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+    size_t cq_size = p.cq_off.cqes +
+        p.cq_entries * sizeof( struct io_uring_cqe );
+    if( p.features & IORING_FEAT_SINGLE_MMAP ) {
+        if( cq_size > sq_size ) sq_size = cq_size;
+        cq_size = sq_size;
+    }
+    size_t sqes_size = p.sq_entries * sizeof( struct io_uring_sqe );
+
+    char *sq = mmap( NULL, sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING );
+    char *cq = sq;
+    if( ( sq != MAP_FAILED ) && !( p.features & IORING_FEAT_SINGLE_MMAP ) ) {
+        cq = mmap( NULL, cq_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING );
+    }
+    struct io_uring_sqe *sqes =
+        mmap( NULL, sqes_size, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES );
+
+    int failed = ( sq == MAP_FAILED ) || ( cq == MAP_FAILED ) ||
+        ( sqes == MAP_FAILED );
+
+    struct statx *stx = NULL;
+    if( !failed ) {
+        stx = calloc( entries, sizeof( struct statx ) );
+        failed = ( stx == NULL );
+    }
+
+    unsigned *sq_tail  = (unsigned *) ( sq + p.sq_off.tail );
+    unsigned  sq_mask  = failed ? 0 : *(unsigned *) ( sq + p.sq_off.ring_mask );
+    unsigned *sq_array = (unsigned *) ( sq + p.sq_off.array );
+    unsigned *cq_head  = (unsigned *) ( cq + p.cq_off.head );
+    unsigned *cq_tail  = (unsigned *) ( cq + p.cq_off.tail );
+    unsigned  cq_mask  = failed ? 0 : *(unsigned *) ( cq + p.cq_off.ring_mask );
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *) ( cq + p.cq_off.cqes );
+
+    // Each chunk of up to entries paths is one submit and wait.
+    int done = 0;
+    while( !failed && ( done < count ) ) {
+        int n = count - done;
+        if( n > (int) p.sq_entries ) n = p.sq_entries;
+
+        unsigned tail = *sq_tail;
+        int i;
+        for( i = 0; i < n; i++ ) {
+            unsigned idx = ( tail + i ) & sq_mask;
+            struct io_uring_sqe *sqe = &sqes[idx];
+            memset( sqe, 0, sizeof( *sqe ) );
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (unsigned long) paths[ done + i ];
+            sqe->len = STATX_TYPE;
+            sqe->off = (unsigned long) &stx[i];
+            sqe->user_data = i;
+            sq_array[idx] = idx;
+        }
+        __atomic_store_n( sq_tail, tail + n, __ATOMIC_RELEASE );
+
+        int submitted = 0;
+        while( !failed && ( submitted < n ) ) {
+            int rc = (int) syscall( SYS_io_uring_enter, fd, n - submitted,
+                                    n - submitted, IORING_ENTER_GETEVENTS,
+                                    NULL, 0 );
+            if( rc > 0 ) submitted += rc;
+            else if( ( rc < 0 ) && ( errno != EINTR ) ) failed = 1;
+        }
+
+        int reaped = 0;
+        while( !failed && ( reaped < n ) ) {
+            unsigned head = *cq_head;
+            unsigned ctail = __atomic_load_n( cq_tail, __ATOMIC_ACQUIRE );
+            for( ; ( head != ctail ) && !failed; head++, reaped++ ) {
+                struct io_uring_cqe *cqe = &cqes[ head & cq_mask ];
+                int j = (int) cqe->user_data;
+                stat_result_t *result = &results[ done + j ];
+                if( cqe->res == 0 ) {
+                    result->rv = APR_SUCCESS;
+                    result->filetype = mode_filetype( stx[j].stx_mode );
+                }
+                else if( cqe->res == -EINVAL ) {
+                    // Kernel without IORING_OP_STATX
+                    failed = 1;
+                }
+                else {
+                    result->rv = APR_FROM_OS_ERROR( -cqe->res );
+                    result->filetype = APR_NOFILE;
+                }
+            }
+            __atomic_store_n( cq_head, head, __ATOMIC_RELEASE );
+
+            if( !failed && ( reaped < n ) ) {
+                int rc = (int) syscall( SYS_io_uring_enter, fd, 0, n - reaped,
+                                        IORING_ENTER_GETEVENTS, NULL, 0 );
+                if( ( rc < 0 ) && ( errno != EINTR ) ) failed = 1;
+            }
+        }
+        done += n;
+    }
+
+    free( stx );
+    if( sqes != MAP_FAILED ) munmap( sqes, sqes_size );
+    if( ( cq != MAP_FAILED ) && ( cq != sq ) ) munmap( cq, cq_size );
+    if( sq != MAP_FAILED ) munmap( sq, sq_size );
+    close( fd );
+
+    return failed;
+}
+
+#endif
+
+static void * APR_THREAD_FUNC
+stat_thread( apr_thread_t *thread, void *data )
+{
+    stat_worker_t *w = data;
+    int i;
+    for( i = w->start; i < w->count; i += w->stride ) {
+        stat_one( w->paths[i], &w->results[i] );
+    }
+    return NULL;
+}
+
+/**
+ * Stat each of count paths (following links) into results, with the
+ * lookups overlapped: on an io_uring where available, otherwise on
+ * several threads. Per path failures are returned in results.
+ */
+apr_status_t stat_batch( const char **paths, int count,
+                         stat_result_t *results )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    if( count < BATCH_MIN ) {
+        for( i = 0; i < count; i++ ) stat_one( paths[i], &results[i] );
+        return rv;
+    }
+
+#ifdef HAVE_IO_URING
+    if( stat_ring( paths, count, results ) == 0 ) {
+        DEBUG( "Checked %d class path entries on io_uring", count );
+        return rv;
+    }
+#endif
+
+    int threads = count / PATHS_PER_THREAD;
+    if( threads > STAT_THREADS ) threads = STAT_THREADS;
+    if( threads < 1 ) threads = 1;
+
+    stat_worker_t workers[ threads ];
+    apr_thread_t *tids[ threads ];
+    int started = 0;
+
+    for( i = 0; i < threads; i++ ) {
+        workers[i].paths = paths;
+        workers[i].results = results;
+        workers[i].start = i;
+        workers[i].count = count;
+        workers[i].stride = threads;
+    }
+
+    // This thread takes the first share.
+    for( i = 1; i < threads; i++ ) {
+        if( apr_thread_create( &tids[i - 1], NULL, stat_thread,
+                               &workers[i], _mp ) != APR_SUCCESS ) break;
+        ++started;
+    }
+
+    // Any share without a thread is also taken here.
+    for( i = 0; i < threads; i++ ) {
+        if( ( i == 0 ) || ( i > started ) ) {
+            stat_thread( NULL, &workers[i] );
+        }
+    }
+
+    for( i = 0; i < started; i++ ) {
+        apr_status_t trv;
+        apr_thread_join( &trv, tids[i] );
+    }
+
+    DEBUG( "Checked %d class path entries on %d threads",
+           count, started + 1 );
+
+    return rv;
+}
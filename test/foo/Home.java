@@ -0,0 +1,8 @@
+package foo;
+public class Home
+{
+    public static void main( String[] args )
+    {
+        System.out.println( System.getProperty( "java.home" ) );
+    }
+}
@@ -0,0 +1,45 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+require 'fileutils'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestAot < Test::Unit::TestCase
+  include FileUtils
+
+  CACHE = File.join( TEST_DIR, "aot_cache" )
+  MARKER = "#{CACHE}/aot-????????????????/hashdot.aot"
+
+  def setup
+    rm_rf CACHE
+  end
+
+  def test_compiled
+    # The first run is from source, while the script is compiled.
+    assert( !run_aot.start_with?( canonical( CACHE ) ) )
+
+    120.times do
+      break unless Dir[ MARKER ].empty? && Dir[ "#{CACHE}/*.failed" ].empty?
+      sleep 1
+    end
+    log = Dir[ "#{CACHE}/*.log" ].map { |l| File.read( l ) }.join
+    assert_equal( 1, Dir[ MARKER ].size, log )
+    assert( File.exist?( File.join( File.dirname( Dir[ MARKER ].first ),
+                                    "aot.class" ) ) )
+
+    assert_equal( canonical( File.dirname( Dir[ MARKER ].first ) ), run_aot )
+  end
+
+  def run_aot
+    out = `#{TEST_DIR}/aot`.strip
+    assert( $?.success?, "aot: returned status #{$?}" )
+    out.empty? ? out : canonical( out )
+  end
+
+  def canonical( path )
+    Java::java.io.File.new( path ).canonical_path
+  end
+
+end
@@ -0,0 +1,14 @@
+#!./jruby
+#-*- ruby -*-
+#. hashdot.batch.threads = 2
+#. hashdot.batch.status = ./test/test_batch.status
+
+# Run via: ./jruby --batch test/test_batch.jobs
+
+job = ARGV[0]
+raise "Unexpected job argument: #{job.inspect}" unless job =~ /^job\d+$/
+
+threads = Java::java.lang.System.get_property( 'hashdot.batch.threads' )
+raise "hashdot.batch.threads = #{threads}" unless threads == '2'
+
+puts "#{job}: #{Java::java.lang.Thread.current_thread.name}"
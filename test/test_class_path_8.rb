@@ -0,0 +1,43 @@
+#!./jruby
+#. hashdot.profile += jruby-shortlived
+#. java.class.path += ./test/foo*.jar
+#. java.class.path += ./test/maven/**/util/*/*.jar
+#. java.class.path += ./test/maven/repository/org/ex/{lib2,lib*,common}/*/*.jar
+#. java.class.path += !**/common-1.0.jar
+#. java.class.path += !./test/*/repository/**/util-2.5.jar
+#. java.class.path += ${hashdot.script.dir}/maven/repository/org/ex/{deep,opt}/*/*.jar
+#. java.class.path += !**/opt-*.jar
+
+require 'test/unit'
+
+class TestClassPathGlobs < Test::Unit::TestCase
+
+  EX = './test/maven/repository/org/ex'
+
+  def test_order
+    # Sorted within each pattern and alternative, alternatives in the
+    # order given, lib2 only once, excluded jars dropped.
+    assert_equal( [ './test/foobar.jar',
+                    "#{EX}/util/3.0/util-3.0.jar",
+                    "#{EX}/lib2/1.0/lib2-1.0.jar",
+                    "#{EX}/lib/2.0/lib-2.0.jar",
+                    "#{EX}/common/1.5/common-1.5.jar" ],
+                  class_path.grep( %r{^\./test/} ) )
+  end
+
+  def test_absolute
+    # A leading ** exclusion also applies to absolute paths.
+    dir = File.dirname( File.expand_path( __FILE__ ) )
+    assert_equal( [ "#{dir}/maven/repository/org/ex/deep/1.0/deep-1.0.jar" ],
+                  class_path.grep( %r{^/.*/org/ex/} ) )
+  end
+
+  def test_class
+    assert_equal( 'PASS: Bar loaded', Java::foo.Bar.new.to_s )
+  end
+
+  def class_path
+    Java::java.lang.System.getProperty( 'java.class.path' ).split( ':' )
+  end
+
+end
@@ -0,0 +1,73 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+require 'fileutils'
+require 'socket'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestControl < Test::Unit::TestCase
+  include FileUtils
+
+  RUN = File.join( TEST_DIR, "control_run" )
+  SOCKET = File.expand_path( "#{RUN}.pid.ctl" )
+
+  def setup
+    teardown
+    cp( File.join( TEST_DIR, "control" ), RUN )
+    chmod( 0755, RUN )
+  end
+
+  def teardown
+    rm_f [ RUN, "#{RUN}.done", "#{RUN}.props", "#{RUN}.pid", SOCKET ]
+  end
+
+  def test_reload
+    runner = Thread.new { system( RUN ) }
+    100.times { break if File.exist?( SOCKET ); sleep 0.1 }
+
+    status = command( 'status' )
+    assert_equal( 'ok', status.last )
+    assert( status.include?( 'reloads 0' ), status.inspect )
+
+    edit_header do |h|
+      h.sub!( 'control.test.a = one', 'control.test.a = uno' )
+      h.sub!( "#. control.test.b = two\n", '' )
+      h.sub!( "hashdot.test.r = 1\n",
+              "hashdot.test.r = 2\n#. control.test.c = three\n" )
+    end
+
+    reload = command( 'reload' )
+    assert_equal( 'ok restart required for 1 changes', reload.pop )
+    assert_equal( [ 'clear control.test.b',
+                    'restart hashdot.test.r=2',
+                    'set control.test.a=uno',
+                    'set control.test.c=three' ], reload.sort )
+
+    assert_equal( [ 'error no hashdot.io_redirect.file' ],
+                  command( 'reopen-logs' ) )
+    assert( command( 'status' ).include?( 'reloads 1' ) )
+
+    touch( "#{RUN}.done" )
+    assert( runner.value, "control_run: returned status #{$?}" )
+    assert_equal( [ 'control.test.a=uno',
+                    'control.test.b=',
+                    'control.test.c=three' ],
+                  File.read( "#{RUN}.props" ).split( "\n" ) )
+  end
+
+  def edit_header
+    header = File.read( RUN )
+    yield header
+    File.open( RUN, 'w' ) { |f| f.write( header ) }
+  end
+
+  def command( cmd )
+    UNIXSocket.open( SOCKET ) do |s|
+      s.puts( cmd )
+      s.read.split( "\n" )
+    end
+  end
+
+end
@@ -0,0 +1,120 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+/**
+ * Test of the libhashdot embedding API (hashdot.h): resolves a profile
+ * and property lines, checks the options and properties, then creates
+ * the JVM and calls main of test/foo/Home. Run from the source
+ * directory.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "hashdot.h"
+
+static int _failures = 0;
+
+static void
+check( int passed, const char *what )
+{
+    if( !passed ) {
+        fprintf( stderr, "FAIL: %s\n", what );
+        _failures++;
+    }
+}
+
+static int
+has_option( const hashdot_options_t *options, const char *option )
+{
+    int i;
+    for( i = 0; i < hashdot_option_count( options ); i++ ) {
+        if( strcmp( hashdot_option( options, i ), option ) == 0 ) return 1;
+    }
+    return 0;
+}
+
+int main( int argc, const char *argv[] )
+{
+    const char *profiles[] = { "shortlived", NULL };
+    const char *props[] = { "hashdot.main = foo.Home",
+                            "java.class.path = test",
+                            "hashdot.vm.options += -Xss512k",
+                            "embed.test = one two",
+                            "embed.name = one",
+                            "embed.ref = ${embed.name}.two",
+                            NULL };
+
+    int rv = hashdot_initialize();
+    hashdot_options_t *options = NULL;
+    if( rv == 0 ) rv = hashdot_resolve( profiles, NULL, props, &options );
+    if( rv != 0 ) {
+        fprintf( stderr, "FAIL: resolve [%d]\n", rv );
+        return 1;
+    }
+
+    check( has_option( options, "-Xss512k" ), "-Xss512k option" );
+    check( has_option( options, "-Dembed.test=one two" ),
+           "-Dembed.test option" );
+    check( has_option( options, "-Dhashdot.main=foo.Home" ),
+           "-Dhashdot.main option" );
+    check( hashdot_option( options, hashdot_option_count( options ) ) == NULL,
+           "option past the end" );
+
+    const char *val = hashdot_property( options, "embed.ref" );
+    check( ( val != NULL ) && ( strcmp( val, "one.two" ) == 0 ),
+           "embed.ref property" );
+    val = hashdot_property( options, "hashdot.vm.startup" );
+    check( ( val != NULL ) && ( strcmp( val, "fast" ) == 0 ),
+           "hashdot.vm.startup from shortlived" );
+    check( hashdot_property( options, "embed.none" ) == NULL,
+           "unset property" );
+
+    JavaVM *vm = NULL;
+    JNIEnv *env = NULL;
+    rv = hashdot_create_vm( options, &vm, &env );
+    check( rv == 0, "create JVM" );
+    if( rv == 0 ) {
+        check( hashdot_call_main( env, argc - 1, argv + 1 ) == 0,
+               "call foo.Home main" );
+        (*vm)->DestroyJavaVM( vm );
+    }
+
+    hashdot_terminate();
+
+    if( _failures > 0 ) return 1;
+    printf( "PASS: test_embed\n" );
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!./hashdot
+#. hashdot.profile = longlived jruby
+#. hashdot.gc.goal = throughput
+#. hashdot.gc.pause_target_ms = 200
+
+require 'test/unit'
+
+# The longlived profile leaves collector selection to the JVM
+# ergonomics, so these options can only come from hashdot.gc.goal.
+class TestGcGoal < Test::Unit::TestCase
+
+  def test_throughput_options
+    args = input_arguments
+    assert( args.include?( collector_option ), args.inspect )
+    assert( args.include?( '-XX:MaxGCPauseMillis=200' ), args.inspect )
+    assert( args.include?( '-Xms500m' ), args.inspect )
+  end
+
+  def test_collector
+    names = Java::java.lang.management.ManagementFactory.
+      garbage_collector_mx_beans.map { |b| b.name }
+    expected = if serial?
+                 [ 'Copy', 'MarkSweepCompact' ]
+               else
+                 [ 'PS MarkSweep', 'PS Scavenge' ]
+               end
+    assert_equal( expected, names.sort )
+  end
+
+  # With a single CPU the throughput goal selects the serial collector.
+  def serial?
+    Java::java.lang.Runtime.runtime.available_processors == 1
+  end
+
+  def collector_option
+    serial? ? '-XX:+UseSerialGC' : '-XX:+UseParallelGC'
+  end
+
+  def input_arguments
+    Java::java.lang.management.ManagementFactory.
+      runtime_mx_bean.input_arguments.to_a
+  end
+
+end
@@ -0,0 +1,57 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+#. hashdot.jfr = continuous
+#. hashdot.jfr.dir = ${hashdot.script.dir}/jfr
+#. hashdot.jfr.max_age = 10m
+
+require 'test/unit'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestJfr < Test::Unit::TestCase
+
+  JFR_DIR = File.join( TEST_DIR, "jfr" )
+
+  def test_options
+    return if skip?
+    args = runtime.input_arguments.to_a.grep( /^-XX:StartFlightRecording/ )
+    assert_equal( 1, args.size )
+    assert_match( /^-XX:StartFlightRecording=name=hashdot,/, args.first )
+    assert_match( /,maxage=10m,/, args.first )
+    assert_match( %r{,filename=.*/test_jfr\.rb-\d{8}-\d{6}-#{pid}\.jfr$},
+                  args.first )
+  end
+
+  def test_recording
+    return if skip?
+    names = Java::jdk.jfr.FlightRecorder.flight_recorder.recordings.
+      map { |r| r.name }
+    assert( names.include?( 'hashdot' ), names.inspect )
+  end
+
+  def test_repository
+    return if skip?
+    repos = Dir[ "#{JFR_DIR}/test_jfr.rb-*-#{pid}.repo" ]
+    assert_equal( 1, repos.size )
+    assert( File.directory?( repos.first ) )
+  end
+
+  def skip?
+    v = Java::java.lang.System.getProperty( 'java.specification.version' )
+    v = v.split( '.' )
+    if ( ( v[0] == '1' ) ? v[1].to_i : v[0].to_i ) < 11
+      puts( "SKIP: hashdot.jfr needs JDK 11+" )
+      return true
+    end
+    false
+  end
+
+  def pid
+    runtime.name.split( '@' ).first
+  end
+
+  def runtime
+    Java::java.lang.management.ManagementFactory.runtime_mx_bean
+  end
+
+end
@@ -0,0 +1,55 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+require 'fileutils'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestJlink < Test::Unit::TestCase
+  include FileUtils
+
+  CACHE = File.join( TEST_DIR, "jlink_cache" )
+  MARKER = "#{CACHE}/????????????????/hashdot.jlink"
+
+  def setup
+    rm_rf CACHE
+  end
+
+  def test_image
+    if java_version < 11
+      puts( "SKIP: hashdot.vm.jlink needs JDK 11+" )
+      return
+    end
+
+    # The first launch uses the JDK, while the image is built.
+    assert( !launch_home.start_with?( canonical( CACHE ) ) )
+
+    60.times do
+      break unless Dir[ MARKER ].empty? && Dir[ "#{CACHE}/*.failed" ].empty?
+      sleep 1
+    end
+    log = Dir[ "#{CACHE}/*.log" ].map { |l| File.read( l ) }.join
+    assert_equal( 1, Dir[ MARKER ].size, log )
+
+    assert_equal( canonical( File.dirname( Dir[ MARKER ].first ) ),
+                  launch_home )
+  end
+
+  def launch_home
+    home = `#{TEST_DIR}/jlink`.strip
+    assert( $?.success?, "jlink: returned status #{$?}" )
+    canonical( home )
+  end
+
+  def canonical( path )
+    Java::java.io.File.new( path ).canonical_path
+  end
+
+  def java_version
+    v = Java::java.lang.System.getProperty( 'java.specification.version' )
+    v = v.split( '.' )
+    ( v[0] == '1' ) ? v[1].to_i : v[0].to_i
+  end
+
+end
@@ -0,0 +1,22 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+#
+## Hold the one slot of the group while running, for test_slot_held.
+#. hashdot.launch.max_concurrent = 1
+#. hashdot.launch.group = hashdot-test
+#. hashdot.launch.scope = alive
+
+require 'test/unit'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestLaunch < Test::Unit::TestCase
+
+  def test_slot_held
+    out = `#{TEST_DIR}/launch_wait 2>&1`
+    assert_equal( 42, $?.exitstatus, out )
+    assert_match( /No hashdot launch slot of hashdot-test free/, out )
+    assert_no_match( /hello from launch_wait/, out )
+  end
+
+end
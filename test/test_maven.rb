@@ -0,0 +1,66 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+#
+## Resolve a coordinate against the test/maven/repository fixture:
+## app -> parent (property, dependency management, imported bom)
+##     -> lib -> util (managed by the bom), deep (runtime)
+##     -> util (version from the bom)
+##     -> lib2 (version range) -> bad (excluded), common 1.0 (further)
+##     -> opt (optional), junit (test scope)
+#. hashdot.maven.repository = ${hashdot.script.dir}/maven/repository
+#. hashdot.maven.index = ${hashdot.script.dir}/maven/index
+#. java.class.path += mvn:org.ex:app:1.5
+
+require 'test/unit'
+
+class TestMaven < Test::Unit::TestCase
+
+  REPO = File.join( File.dirname( File.expand_path( __FILE__ ) ),
+                    'maven', 'repository' )
+
+  EXPECTED = %w[ org/ex/app/1.5/app-1.5.jar
+                 org/ex/common/1.5/common-1.5.jar
+                 org/ex/lib/2.0/lib-2.0.jar
+                 org/ex/util/3.0/util-3.0.jar
+                 org/ex/lib2/1.0/lib2-1.0.jar
+                 org/ex/deep/1.0/deep-1.0.jar ]
+
+  def test_resolved_order
+    assert_equal( EXPECTED.map { |j| File.join( REPO, j ) }, maven_jars )
+  end
+
+  def test_nearest_wins
+    assert( maven_jars.grep( /common-1\.0/ ).empty? )
+    assert( maven_jars.grep( /util-2\.5/ ).empty? )
+  end
+
+  def test_excluded
+    %w[ bad opt junit ].each do |a|
+      assert( maven_jars.grep( %r{/#{a}-} ).empty?, a )
+    end
+  end
+
+  def test_index
+    idx = Dir[ File.join( property( "hashdot.maven.index" ), "*.idx" ) ]
+    assert_equal( 1, idx.length )
+    lines = IO.readlines( idx.first ).map { |l| l.chomp }
+    assert( lines.include?( "C mvn:org.ex:app:1.5" ) )
+    poms = lines.grep( /^P / ).map { |l| l.split( ' ', 3 ) }
+    assert( poms.any? { |p| p[2] =~ /bom-1\.0\.pom$/ } )
+    poms.each do |_, mtime, path|
+      assert_equal( ( File.mtime( path ).to_r * 1_000_000 ).to_i,
+                    mtime.to_i, path )
+    end
+  end
+
+  def maven_jars
+    property( "java.class.path" ).split( ':' ).select do |p|
+      p.index( REPO ) == 0
+    end
+  end
+
+  def property( name )
+    Java::java.lang.System.getProperty( name )
+  end
+
+end
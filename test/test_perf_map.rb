@@ -0,0 +1,35 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+#. hashdot.perf_map = true
+#. hashdot.perf_map.agent = ./libhashdot_perf.so
+#. hashdot.perf_map.unfold = true
+
+require 'test/unit'
+
+class TestPerfMap < Test::Unit::TestCase
+
+  def test_map
+    map = "/tmp/perf-#{pid}.map"
+    assert( File.exist?( map ), map )
+
+    lines = File.read( map ).split( "\n" )
+    assert( lines.size > 0 )
+    lines.each { |l| assert_match( /^[0-9a-f]+ [0-9a-f]+ \S/, l ) }
+  end
+
+  def test_unfold_options
+    args = runtime.input_arguments.to_a
+    assert( args.include?( '-XX:+DebugNonSafepoints' ), args.inspect )
+    assert( args.grep( /^-agentpath:.*libhashdot_perf\.so=unfold=1,/ ).size == 1,
+            args.inspect )
+  end
+
+  def pid
+    runtime.name.split( '@' ).first
+  end
+
+  def runtime
+    Java::java.lang.management.ManagementFactory.runtime_mx_bean
+  end
+
+end
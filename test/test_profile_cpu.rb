@@ -0,0 +1,30 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+require 'fileutils'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestProfileCpu < Test::Unit::TestCase
+  include FileUtils
+
+  OUT = File.join( TEST_DIR, "profile_cpu.folded" )
+
+  def setup
+    rm_f OUT
+  end
+
+  def test_profile
+    # The profile is written at JVM exit.
+    err = `#{TEST_DIR}/profile_cpu 2>&1`
+    assert( $?.success?, "profile_cpu: returned status #{$?}: #{err}" )
+    assert_match( /CPU profile written to \S*profile_cpu\.folded \([1-9]/,
+                  err )
+
+    stacks = File.read( OUT ).split( "\n" )
+    stacks.each { |l| assert_match( /^\S.* [1-9]\d*$/, l ) }
+    assert( stacks.grep( /org\.jruby\./ ).size > 0, stacks.first )
+  end
+
+end
@@ -0,0 +1,33 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+require 'fileutils'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestProfileStartup < Test::Unit::TestCase
+  include FileUtils
+
+  OUT = File.join( TEST_DIR, "profile_startup" )
+
+  def setup
+    rm_f [ "#{OUT}.txt", "#{OUT}.folded" ]
+  end
+
+  def test_report
+    # With window 0, the report is written at JVM exit.
+    assert( system( "#{TEST_DIR}/profile_startup" ),
+            "profile_startup: returned status #{$?}" )
+
+    report = File.read( "#{OUT}.txt" )
+    assert_match( /^# hashdot startup profile/, report )
+    assert_match( /main entered$/, report )
+    assert_match( /^# Classes, in load order$/, report )
+
+    folded = File.read( "#{OUT}.folded" ).split( "\n" )
+    assert( folded.grep( /^launcher \d+$/ ).size == 1, folded.first )
+    folded.each { |l| assert_match( /^\S.* \d+$/, l ) }
+  end
+
+end
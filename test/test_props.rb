@@ -37,8 +37,13 @@
 #. java.class.path += test/test_prop*.rb
 #
 ## recursive/delayed (:=) prop test
+#. rchain := ${rprop} third
 #. rprop := first ${cprop}
 #. cprop = second
+#. rappend := ${cprop}
+#. rappend += ${rchain}
+#. rover := ${cprop}
+#. rover = override
 
 require 'test/unit'
 
@@ -80,6 +85,12 @@ class TestProperties < Test::Unit::TestCase
     assert_prop( "rprop", "first second" )
   end
 
+  def test_recursive_prop_order
+    assert_prop( "rchain", "first second third" )
+    assert_prop( "rappend", "second first second third" )
+    assert_prop( "rover", "override" )
+  end
+
   def test_hashdot_script
     assert_prop( "hashdot.script", File.expand_path( __FILE__) )
     assert_prop( "hashdot.script.dir",
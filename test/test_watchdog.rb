@@ -0,0 +1,19 @@
+#!./hashdot
+#. hashdot.profile = jruby-shortlived
+
+require 'test/unit'
+
+TEST_DIR = File.dirname( __FILE__ )
+
+class TestWatchdog < Test::Unit::TestCase
+
+  def test_stall_exit
+    out = `#{TEST_DIR}/watchdog 2>&1`
+    assert_equal( 39, $?.exitstatus, out )
+    assert_match( /JVM stalled [\d.]+s \(.*\); thread dump 1 of 1\./, out )
+    assert_match( /^Full thread dump/, out )
+    assert_match( /JVM stalled [\d.]+s \(.*\); exiting \[39\]\./, out )
+    assert_no_match( /did not exit/, out )
+  end
+
+end
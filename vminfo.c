@@ -0,0 +1,476 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "vminfo.h"
+
+typedef struct {
+    const char *option;
+    int impl;
+    int min_version;  // 0: any known version
+    int max_version;  // 0: no maximum
+} startup_option_t;
+
+// hashdot.vm.startup = fast: Reduced JIT, single threaded GC, class
+// data sharing, a small code cache and no perf data (jstat) file.
+static const startup_option_t FAST_OPTIONS[] = {
+    { "-XX:TieredStopAtLevel=1",        VM_IMPL_HOTSPOT, 8, 0 },
+    { "-XX:+UseSerialGC",               VM_IMPL_HOTSPOT, 0, 0 },
+    { "-Xshare:auto",                   VM_IMPL_HOTSPOT, 0, 0 },
+    { "-XX:ReservedCodeCacheSize=32m",  VM_IMPL_HOTSPOT, 0, 0 },
+    { "-XX:-UsePerfData",               VM_IMPL_HOTSPOT, 0, 0 },
+    { "-Xquickstart",                   VM_IMPL_J9,      0, 0 },
+    { NULL, 0, 0, 0 }
+};
+
+static apr_status_t read_release( const char *fname, vm_info_t *info );
+
+static const char *find_release_file();
+
+static int parse_version( const char *value );
+
+static int selects_gc( apr_array_header_t *options );
+
+static apr_int64_t max_heap( apr_array_header_t *options );
+
+static void available_cpus( int *cpus, int *online );
+
+/**
+ * Return version and implementation of the JVM at hashdot.vm.home
+ * (or found above hashdot.vm.lib), from its release file. Read once
+ * per process.
+ */
+apr_status_t get_vm_info( const vm_info_t **info )
+{
+    static vm_info_t vm_info;
+    static int loaded = 0;
+
+    apr_status_t rv = APR_SUCCESS;
+
+    if( !loaded ) {
+        vm_info.version = 0;
+        vm_info.impl = VM_IMPL_UNKNOWN;
+
+        const char *fname = find_release_file();
+        if( fname != NULL ) {
+            rv = read_release( fname, &vm_info );
+        }
+        else {
+            DEBUG( "No JDK release file found." );
+        }
+
+        if( ( rv == APR_SUCCESS ) && ( vm_info.version > 0 ) ) {
+            set_property_value( "hashdot.vm.version",
+                                apr_psprintf( _mp, "%d", vm_info.version ) );
+        }
+        loaded = 1;
+    }
+
+    *info = &vm_info;
+    return rv;
+}
+
+/**
+ * Prepend the options of any hashdot.vm.startup preset which are
+ * supported by the detected JVM to options (hashdot.vm.options), so
+ * that any explicit options take precedence on compaction. Options of
+ * an unknown JVM version or implementation are never added, as these
+ * could fail JVM creation.
+ */
+apr_status_t add_startup_options( apr_array_header_t **options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *preset = NULL;
+    rv = get_property_value( "hashdot.vm.startup", 0, 0, &preset );
+
+    if( ( rv != APR_SUCCESS ) || ( preset == NULL ) ||
+        ( strcmp( preset, "default" ) == 0 ) ) {
+        return rv;
+    }
+
+    if( strcmp( preset, "fast" ) != 0 ) {
+        ERROR( "Unknown hashdot.vm.startup preset [%s] (fast|default).",
+               preset );
+        return 1;
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( info->version == 0 ) || ( info->impl == VM_IMPL_UNKNOWN ) ) {
+        DEBUG( "Unknown JVM version, no hashdot.vm.startup options." );
+        return rv;
+    }
+
+    int gc_selected = ( *options != NULL ) && selects_gc( *options );
+
+    apr_array_header_t *vals = apr_array_make( _mp, 16, sizeof( const char* ) );
+    const startup_option_t *o;
+    for( o = FAST_OPTIONS; o->option != NULL; o++ ) {
+        if( ( o->impl == info->impl ) &&
+            ( info->version >= o->min_version ) &&
+            ( ( o->max_version == 0 ) || ( info->version <= o->max_version ) ) ) {
+
+            // Conflicting collector choices fail JVM creation.
+            if( gc_selected && ( strcmp( o->option, "-XX:+UseSerialGC" ) == 0 ) ) {
+                continue;
+            }
+            DEBUG( "Startup option (%s): %s", preset, o->option );
+            *(const char **) apr_array_push( vals ) = o->option;
+        }
+    }
+
+    if( *options != NULL ) apr_array_cat( vals, *options );
+    *options = vals;
+
+    return rv;
+}
+
+/**
+ * Prepend options for a hashdot.gc.goal (latency, throughput or
+ * footprint) and hashdot.gc.pause_target_ms to options, so that any
+ * explicit options still take precedence on compaction. The collector
+ * is chosen from those of the detected HotSpot version, the -Xmx heap
+ * and the available CPUs. No collector is chosen if options already
+ * select one.
+ */
+apr_status_t add_gc_options( apr_array_header_t **options )
+{
+    apr_status_t rv = APR_SUCCESS;
+
+    const char *goal = NULL;
+    const char *target_value = NULL;
+
+    rv = get_property_value( "hashdot.gc.goal", 0, 0, &goal );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.gc.pause_target_ms", 0, 0,
+                                 &target_value );
+    }
+    if( ( rv != APR_SUCCESS ) ||
+        ( ( goal == NULL ) && ( target_value == NULL ) ) ) return rv;
+
+    // A pause target alone implies the latency goal.
+    if( goal == NULL ) goal = "latency";
+
+    if( ( strcmp( goal, "latency" ) != 0 ) &&
+        ( strcmp( goal, "throughput" ) != 0 ) &&
+        ( strcmp( goal, "footprint" ) != 0 ) ) {
+        rv = 44;
+        ERROR( "[%d]: Invalid hashdot.gc.goal [%s]"
+               " (latency, throughput or footprint).", rv, goal );
+        return rv;
+    }
+
+    long target = 0;
+    if( target_value != NULL ) {
+        char *end = NULL;
+        target = strtol( target_value, &end, 10 );
+        if( ( end == target_value ) || ( *end != '\0' ) || ( target < 1 ) ) {
+            rv = 44;
+            ERROR( "[%d]: Invalid hashdot.gc.pause_target_ms [%s].",
+                   rv, target_value );
+            return rv;
+        }
+    }
+
+    const vm_info_t *info = NULL;
+    rv = get_vm_info( &info );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( info->version == 0 ) || ( info->impl != VM_IMPL_HOTSPOT ) ) {
+        DEBUG( "Not a known HotSpot JVM, no hashdot.gc options." );
+        return rv;
+    }
+
+    int gc_selected = ( *options != NULL ) && selects_gc( *options );
+    apr_int64_t heap = ( *options != NULL ) ? max_heap( *options ) : 0;
+    int cpus = 0;
+    int online = 0;
+    available_cpus( &cpus, &online );
+
+    const char *gc = NULL;
+    apr_array_header_t *vals = apr_array_make( _mp, 8, sizeof( const char* ) );
+
+    if( strcmp( goal, "footprint" ) == 0 ) {
+        gc = "-XX:+UseSerialGC";
+        // Return free heap to the OS promptly
+        *(const char **) apr_array_push( vals ) = "-XX:MinHeapFreeRatio=10";
+        *(const char **) apr_array_push( vals ) = "-XX:MaxHeapFreeRatio=30";
+    }
+    else if( strcmp( goal, "throughput" ) == 0 ) {
+        gc = ( cpus == 1 ) ? "-XX:+UseSerialGC" : "-XX:+UseParallelGC";
+        if( target > 0 ) {
+            *(const char **) apr_array_push( vals ) =
+                apr_psprintf( _mp, "-XX:MaxGCPauseMillis=%ld", target );
+        }
+    }
+    else if( cpus == 1 ) {
+        // No CPU for concurrent collection; serial pauses are shortest.
+        gc = "-XX:+UseSerialGC";
+    }
+    else if( ( target > 0 ) && ( target <= 10 ) && ( info->version >= 15 ) ) {
+        gc = "-XX:+UseZGC";
+        if( ( info->version >= 21 ) && ( info->version < 23 ) &&
+            !gc_selected ) {
+            *(const char **) apr_array_push( vals ) = "-XX:+ZGenerational";
+        }
+    }
+    else {
+        gc = "-XX:+UseG1GC";
+        if( target > 0 ) {
+            *(const char **) apr_array_push( vals ) =
+                apr_psprintf( _mp, "-XX:MaxGCPauseMillis=%ld", target );
+        }
+        // Larger regions than the default (heap / 2048) for fewer
+        // humongous objects, from 1 to 32MB.
+        if( ( heap >= 2048LL << 20 ) && !gc_selected ) {
+            apr_int64_t region = 1 << 20;
+            while( ( region < ( 32 << 20 ) ) && ( region * 2 <= heap / 1024 ) ) {
+                region *= 2;
+            }
+            *(const char **) apr_array_push( vals ) =
+                apr_psprintf( _mp, "-XX:G1HeapRegionSize=%dm",
+                              (int) ( region >> 20 ) );
+        }
+    }
+
+    // A fixed heap avoids resizing pauses and full collections.
+    if( ( heap >= ( 1 << 20 ) ) && ( strcmp( goal, "footprint" ) != 0 ) ) {
+        *(const char **) apr_array_push( vals ) =
+            apr_psprintf( _mp, "-Xms%ldm", (long) ( heap >> 20 ) );
+    }
+
+    // The JVM's own thread counts, but of the CPUs this process may
+    // run on, where affinity restricts these (i.e. hashdot.workers
+    // placement); older JDK 8 builds count all online CPUs.
+    if( ( cpus > 1 ) && ( cpus < online ) &&
+        ( strcmp( gc, "-XX:+UseSerialGC" ) != 0 ) ) {
+        int parallel = ( cpus <= 8 ) ? cpus : 8 + ( cpus - 8 ) * 5 / 8;
+        *(const char **) apr_array_push( vals ) =
+            apr_psprintf( _mp, "-XX:ParallelGCThreads=%d", parallel );
+        if( strcmp( gc, "-XX:+UseParallelGC" ) != 0 ) {
+            int conc = ( parallel + 2 ) / 4;
+            *(const char **) apr_array_push( vals ) =
+                apr_psprintf( _mp, "-XX:ConcGCThreads=%d",
+                              ( conc > 0 ) ? conc : 1 );
+        }
+    }
+
+    if( gc_selected ) {
+        DEBUG( "GC selected by options, not %s.", gc );
+    }
+    else {
+        *(const char **) apr_array_push( vals ) = gc;
+    }
+
+    int i;
+    for( i = 0; i < vals->nelts; i++ ) {
+        DEBUG( "GC option (%s): %s", goal, ((const char **) vals->elts )[i] );
+    }
+
+    if( *options != NULL ) apr_array_cat( vals, *options );
+    *options = vals;
+
+    return rv;
+}
+
+static const char *find_release_file()
+{
+    apr_finfo_t finfo;
+    const char *home = NULL;
+
+    get_property_value( "hashdot.vm.home", 0, 0, &home );
+    if( home != NULL ) {
+        const char *fname = apr_pstrcat( _mp, home, "/release", NULL );
+        if( apr_stat( &finfo, fname, APR_FINFO_TYPE, _mp ) == APR_SUCCESS ) {
+            return fname;
+        }
+    }
+
+    // Otherwise search up from hashdot.vm.lib, i.e.:
+    // <home>/jre/lib/<arch>/server/libjvm.so or <home>/lib/server/libjvm.so
+    const char *lib = NULL;
+    get_property_value( "hashdot.vm.lib", 0, 0, &lib );
+    if( lib != NULL ) {
+        char *dir = apr_pstrdup( _mp, lib );
+        int i;
+        for( i = 0; i < 5; i++ ) {
+            char *s = strrchr( dir, '/' );
+            if( ( s == NULL ) || ( s == dir ) ) break;
+            *s = '\0';
+            const char *fname = apr_pstrcat( _mp, dir, "/release", NULL );
+            if( apr_stat( &finfo, fname, APR_FINFO_TYPE, _mp ) == APR_SUCCESS ) {
+                return fname;
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Read JAVA_VERSION, JVM_VARIANT and IMPLEMENTOR from a JDK release
+ * file of NAME="value" lines.
+ */
+static apr_status_t read_release( const char *fname, vm_info_t *info )
+{
+    apr_status_t rv = APR_SUCCESS;
+    apr_file_t *in = NULL;
+    char line[1024];
+
+    DEBUG( "Reading JDK release file [%s].", fname );
+
+    rv = apr_file_open( &in, fname, APR_FOPEN_READ, APR_OS_DEFAULT, _mp );
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, fname );
+        return rv;
+    }
+
+    info->impl = VM_IMPL_HOTSPOT;
+
+    while( apr_file_gets( line, sizeof( line ), in ) == APR_SUCCESS ) {
+        char *value = strchr( line, '=' );
+        if( value == NULL ) continue;
+        *value++ = '\0';
+
+        // Strip quotes and trailing newline.
+        if( *value == '"' ) value++;
+        char *end = value + strcspn( value, "\"\r\n" );
+        *end = '\0';
+
+        if( strcmp( line, "JAVA_VERSION" ) == 0 ) {
+            info->version = parse_version( value );
+        }
+        else if( ( strcmp( line, "JVM_VARIANT" ) == 0 ) ||
+                 ( strcmp( line, "IMPLEMENTOR" ) == 0 ) ) {
+            if( strstr( value, "J9" ) || strstr( value, "j9" ) ||
+                strstr( value, "IBM" ) ) {
+                info->impl = VM_IMPL_J9;
+            }
+        }
+    }
+
+    apr_file_close( in );
+
+    DEBUG( "JVM version: %d, implementation: %d", info->version, info->impl );
+
+    return rv;
+}
+
+/**
+ * Feature version of a JAVA_VERSION value: 1.8.0_292 is 8, 11.0.2 is
+ * 11, 21-ea is 21.
+ */
+static int parse_version( const char *value )
+{
+    int version = atoi( value );
+    if( ( version == 1 ) && ( strncmp( value, "1.", 2 ) == 0 ) ) {
+        version = atoi( value + 2 );
+    }
+    return version;
+}
+
+static int selects_gc( apr_array_header_t *options )
+{
+    int i;
+    for( i = 0; i < options->nelts; i++ ) {
+        const char *val = ((const char **) options->elts )[i];
+        int len = strlen( val );
+        if( ( strncmp( val, "-XX:+Use", 8 ) == 0 ) && ( len > 10 ) &&
+            ( strcmp( val + len - 2, "GC" ) == 0 ) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * The last -Xmx of options in bytes, or 0 if none.
+ */
+static apr_int64_t max_heap( apr_array_header_t *options )
+{
+    apr_int64_t heap = 0;
+    int i;
+    for( i = 0; i < options->nelts; i++ ) {
+        const char *val = ((const char **) options->elts )[i];
+        if( strncmp( val, "-Xmx", 4 ) == 0 ) {
+            static const char *UNITS = "kmgt";
+            char *end = NULL;
+            apr_int64_t size = strtoll( val + 4, &end, 10 );
+            const char *unit = ( *end != '\0' ) ?
+                strchr( UNITS, tolower( (unsigned char) *end ) ) : NULL;
+            if( unit != NULL ) {
+                size <<= 10 * ( unit - UNITS + 1 );
+                end++;
+            }
+            if( *end != '\0' ) size = 0;
+            heap = size;
+        }
+    }
+    return heap;
+}
+
+/**
+ * Count of CPUs this process may run on, and online on the host.
+ */
+static void available_cpus( int *cpus, int *online )
+{
+    *online = (int) sysconf( _SC_NPROCESSORS_ONLN );
+    *cpus = *online;
+#ifdef __linux__
+    cpu_set_t set;
+    if( sched_getaffinity( 0, sizeof( set ), &set ) == 0 ) {
+        *cpus = CPU_COUNT( &set );
+    }
+#endif
+}
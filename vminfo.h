@@ -0,0 +1,57 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifndef _VMINFO_H
+#define _VMINFO_H
+
+#include <apr_general.h>
+#include <apr_tables.h>
+
+#define VM_IMPL_UNKNOWN 0
+#define VM_IMPL_HOTSPOT 1
+#define VM_IMPL_J9      2
+
+typedef struct {
+    int version;   // Feature (major) version, i.e. 8, 11, 17; 0: unknown
+    int impl;      // VM_IMPL_*
+} vm_info_t;
+
+apr_status_t get_vm_info( const vm_info_t **info );
+
+apr_status_t add_startup_options( apr_array_header_t **options );
+
+apr_status_t add_gc_options( apr_array_header_t **options );
+
+#endif
@@ -0,0 +1,311 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <limits.h>
+
+#include <apr_strings.h>
+#include <apr_thread_proc.h>
+
+#include <jni.h>
+
+#include "runtime.h"
+#include "watchdog.h"
+#include "property.h"
+#include "classgen.h"
+#include "perfdata.h"
+#include "jfr.h"
+
+// Exit status when terminating a stalled JVM (hashdot.watchdog.exit)
+#define STALL_EXIT 39
+
+typedef enum { SOURCE_PERFDATA, SOURCE_HEARTBEAT } source_t;
+
+// Stall threshold in seconds, or 0 when disabled
+static double _timeout = 0;
+
+static source_t _source = SOURCE_PERFDATA;
+static int _max_dumps = 3;
+static double _dump_interval = 5;
+static int _exit_on_stall = 0;
+
+// Incremented by hashdot.Watchdog.heartbeat()
+static volatile unsigned long _beats = 0;
+
+// Own perf data counters with SOURCE_PERFDATA
+static perfdata_t _pd;
+static const volatile long long *_safepoints = NULL;
+static const volatile long long *_safepoint_time = NULL;
+
+static void * APR_THREAD_FUNC
+watchdog_thread( apr_thread_t *thread, void *data );
+
+static void JNICALL
+watchdog_heartbeat( JNIEnv *env, jclass cls );
+
+/**
+ * Read the hashdot.watchdog properties and, when enabled, add any JVM
+ * options needed: -XX:+UsePerfData (overriding hashdot.vm.startup =
+ * fast) for the perfdata source, with a safepoint timeout of the same
+ * threshold, so the JVM reports the threads not reaching the stalled
+ * safepoint, and a VM output log file for thread dumps with
+ * hashdot.watchdog.output.
+ */
+apr_status_t add_watchdog_options( apr_array_header_t *options )
+{
+    apr_status_t rv = read_seconds( "hashdot.watchdog", 38, &_timeout );
+    if( ( rv != APR_SUCCESS ) || ( _timeout == 0 ) ) return rv;
+
+    const char *source = NULL;
+    const char *dumps = NULL;
+    const char *out = NULL;
+
+    rv = get_property_value( "hashdot.watchdog.source", 0, 0, &source );
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.watchdog.dumps", 0, 0, &dumps );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_boolean( "hashdot.watchdog.exit", 38, &_exit_on_stall );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = get_property_value( "hashdot.watchdog.output", 0, 0, &out );
+    }
+    if( rv == APR_SUCCESS ) {
+        rv = read_seconds( "hashdot.watchdog.interval", 38, &_dump_interval );
+    }
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( ( source == NULL ) || ( strcmp( source, "perfdata" ) == 0 ) ) {
+        _source = SOURCE_PERFDATA;
+    }
+    else if( strcmp( source, "heartbeat" ) == 0 ) {
+        _source = SOURCE_HEARTBEAT;
+    }
+    else {
+        rv = 38;
+        ERROR( "[%d]: Invalid hashdot.watchdog.source [%s]"
+               " (perfdata or heartbeat).", rv, source );
+        return rv;
+    }
+
+    if( dumps != NULL ) {
+        char *end = NULL;
+        long count = strtol( dumps, &end, 10 );
+        if( ( end == dumps ) || ( *end != '\0' ) || ( count < 0 ) ||
+            ( count > INT_MAX ) ) {
+            rv = 38;
+            ERROR( "[%d]: Invalid hashdot.watchdog.dumps [%s].", rv, dumps );
+            return rv;
+        }
+        _max_dumps = (int) count;
+    }
+
+    if( _source == SOURCE_PERFDATA ) {
+        *(const char **) apr_array_push( options ) = "-XX:+UsePerfData";
+        // A SIGQUIT dump is itself served at a safepoint, so is deferred
+        // until the stalled one completes; these threads are the cause.
+        long delay = (long) ( _timeout * 1000 );
+        *(const char **) apr_array_push( options ) = "-XX:+SafepointTimeout";
+        *(const char **) apr_array_push( options ) =
+            apr_psprintf( _mp, "-XX:SafepointTimeoutDelay=%ld",
+                          ( delay > 0 ) ? delay : 1 );
+    }
+
+    if( out != NULL ) {
+        *(const char **) apr_array_push( options ) =
+            "-XX:+UnlockDiagnosticVMOptions";
+        *(const char **) apr_array_push( options ) = "-XX:+LogVMOutput";
+        *(const char **) apr_array_push( options ) =
+            apr_pstrcat( _mp, "-XX:LogFile=", out, NULL );
+    }
+
+    return rv;
+}
+
+/**
+ * Once the JVM is created, start the watchdog thread if enabled. With
+ * the heartbeat source this defines the hashdot.Watchdog class, with a
+ * static native heartbeat() method for the application to call. With
+ * the perfdata source, the JVM's own safepoint counters are read from
+ * its shared perf data. Either way nothing is added to the JVM's own
+ * work: the thread only samples a counter each poll.
+ */
+apr_status_t start_watchdog( JNIEnv *env )
+{
+    static JNINativeMethod METHODS[] = {
+        { "heartbeat", "()V", (void *) &watchdog_heartbeat }
+    };
+
+    apr_status_t rv = APR_SUCCESS;
+
+    if( _timeout == 0 ) return rv;
+
+    if( _source == SOURCE_HEARTBEAT ) {
+        jclass cls = NULL;
+        rv = define_native_class( env, "hashdot/Watchdog", "java/lang/Object",
+                                  METHODS, 1, 1, &cls );
+        if( rv != APR_SUCCESS ) return rv;
+    }
+    else {
+        char path[ PATH_MAX ];
+        if( ( perfdata_path( (int) getpid(), path, sizeof( path ) ) ==
+              PERFDATA_OK ) &&
+            ( perfdata_open( path, &_pd ) == PERFDATA_OK ) ) {
+            _safepoints = perfdata_long( &_pd, "sun.rt.safepoints" );
+            _safepoint_time = perfdata_long( &_pd, "sun.rt.safepointTime" );
+        }
+        if( ( _safepoints == NULL ) || ( _safepoint_time == NULL ) ) {
+            WARN( "No JVM perf data safepoint counters;"
+                  " hashdot.watchdog disabled." );
+            perfdata_close( &_pd );
+            return rv;
+        }
+    }
+
+    apr_thread_t *thread = NULL;
+    rv = apr_thread_create( &thread, NULL, watchdog_thread, NULL, _mp );
+    if( rv != APR_SUCCESS ) {
+        print_error( rv, "watchdog thread" );
+        return rv;
+    }
+
+    DEBUG( "Watchdog started (%s, %.1fs).",
+           ( _source == SOURCE_HEARTBEAT ) ? "heartbeat" : "perfdata",
+           _timeout );
+
+    return rv;
+}
+
+/**
+ * Sample the progress counter and whether a stall may be timed: with
+ * the heartbeat source after the first heartbeat, with the perfdata
+ * source while a safepoint has begun (count advanced) but not ended
+ * (total time unchanged).
+ */
+static void
+sample( unsigned long long *progress, int *armed )
+{
+    static long long ended_count = -1;
+    static long long last_time = -1;
+
+    if( _source == SOURCE_HEARTBEAT ) {
+        *progress = _beats;
+        *armed = ( *progress > 0 );
+    }
+    else {
+        long long count = *_safepoints;
+        long long time = *_safepoint_time;
+        if( ( time != last_time ) || ( ended_count < 0 ) ) {
+            last_time = time;
+            ended_count = count;
+        }
+        *progress = time;
+        *armed = ( count != ended_count );
+    }
+}
+
+static void * APR_THREAD_FUNC
+watchdog_thread( apr_thread_t *thread, void *data )
+{
+    const char *what = ( _source == SOURCE_HEARTBEAT ) ?
+        "no heartbeat" : "safepoint not completed";
+
+    double poll = _timeout / 4;
+    if( poll > 1.0 ) poll = 1.0;
+    if( poll < 0.01 ) poll = 0.01;
+
+    struct timespec ts;
+    ts.tv_sec = (time_t) poll;
+    ts.tv_nsec = (long) ( ( poll - ts.tv_sec ) * 1e9 );
+
+    unsigned long long last = 0;
+    int armed = 0;
+    sample( &last, &armed );
+    double since = monotonic();
+    double next_action = 0;
+    int dumps = 0;
+
+    for(;;) {
+        nanosleep( &ts, NULL );
+
+        unsigned long long progress = 0;
+        sample( &progress, &armed );
+        double now = monotonic();
+
+        if( ( progress != last ) || !armed ) {
+            if( dumps > 0 ) {
+                WARN( "JVM progressing again after %.1fs stall.",
+                      now - since );
+            }
+            last = progress;
+            since = now;
+            dumps = 0;
+            next_action = 0;
+            continue;
+        }
+
+        double stalled = now - since;
+        if( ( stalled < _timeout ) || ( now < next_action ) ) continue;
+
+        if( dumps < _max_dumps ) {
+            dumps++;
+            WARN( "JVM stalled %.1fs (%s); thread dump %d of %d.",
+                  stalled, what, dumps, _max_dumps );
+            fflush( stderr );
+            kill( getpid(), SIGQUIT );
+            next_action = now + _dump_interval;
+        }
+        else if( _exit_on_stall ) {
+            WARN( "JVM stalled %.1fs (%s); exiting [%d].",
+                  stalled, what, STALL_EXIT );
+            jfr_abort();
+            fflush( stderr );
+            _exit( STALL_EXIT );
+        }
+    }
+
+    return NULL;
+}
+
+static void JNICALL
+watchdog_heartbeat( JNIEnv *env, jclass cls )
+{
+    __atomic_add_fetch( &_beats, 1, __ATOMIC_RELAXED );
+}
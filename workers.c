@@ -0,0 +1,551 @@
+/**************************************************************************
+ * Copyright (C) 2008-2010 David Kellum
+ * This file is part of Hashdot.
+ *
+ * Hashdot is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3, or (at your option)
+ * any later version.
+ *
+ * Hashdot is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Hashdot. If not, see http://www.gnu.org/licenses/.
+ *
+ * Dynamically linking other modules to this executable is making a
+ * combined work based on this executable.  Thus, the terms and
+ * conditions of the GNU General Public License cover the whole
+ * combination.
+ *
+ * As a special exception, the Hashdot copyright holder gives you
+ * permission to dynamically link independent modules to this
+ * executable, regardless of the license terms of these independent
+ * modules, and to copy and distribute the combination under terms of
+ * your choice, provided that you also meet, for each linked
+ * independent module, the terms and conditions of the license of that
+ * module.  An independent module is a module which is not derived
+ * from or based from the source of Hashdot.  If you modify Hashdot,
+ * you may extend this exception to your version, but you are not
+ * obligated to do so.  If you do not wish to do so, delete this
+ * exception statement from your version.
+ *************************************************************************/
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <apr_strings.h>
+#include <apr_file_io.h>
+#include <apr_signal.h>
+#include <apr_time.h>
+
+#include "runtime.h"
+#include "property.h"
+#include "pidfile.h"
+#include "jvm.h"
+#include "workers.h"
+
+// Restart delay doubles from BACKOFF_MIN with each consecutive early
+// exit, up to BACKOFF_MAX. A worker up for STABLE_SECS resets it.
+#define BACKOFF_MIN 1
+#define BACKOFF_MAX 60
+#define STABLE_SECS 60
+
+// Most workers hashdot.workers may ask for
+#define MAX_WORKERS 1024
+
+// Preferred (not strict) node memory policy, from linux/mempolicy.h
+#define MPOL_PREFERRED 1
+
+typedef struct {
+    int index;
+    volatile pid_t pid;       // 0 when not running
+    apr_time_t started;
+    apr_time_t restart_at;    // Time of next start, when not running
+    int failures;             // Consecutive early exits
+    apr_array_header_t *cpus; // CPU numbers (int) or NULL for any
+    int node;                 // Preferred NUMA node or -1
+    const char *pid_fname;    // Worker pid file or NULL
+} worker_t;
+
+static worker_t *_workers = NULL;
+static int _worker_count = 0;
+
+static volatile sig_atomic_t _stopping = 0;
+
+// Signals forwarded from the supervisor to all running workers.
+static const int FORWARD_SIGNALS[] = {
+    SIGTERM, SIGINT, SIGHUP, SIGQUIT, SIGUSR1, SIGUSR2, 0 };
+
+static apr_status_t
+resolve_workers( apr_array_header_t *cpus );
+
+static apr_array_header_t *
+available_cpus();
+
+static apr_array_header_t *
+read_cpu_list( const char *fname, apr_array_header_t *filter );
+
+static void
+assign_cpus( worker_t **members, int count, apr_array_header_t *cpus );
+
+static apr_status_t
+start_worker( worker_t *w, int argc, const char *argv[], int *is_child );
+
+static apr_status_t
+init_worker( worker_t *w );
+
+static void
+reap_workers();
+
+static void
+forward_signal( int signo );
+
+static void
+child_signal( int signo );
+
+apr_status_t run_workers( int argc, const char *argv[] )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    rv = resolve_workers( available_cpus() );
+    if( rv != APR_SUCCESS ) return rv;
+
+    for( i = 0; FORWARD_SIGNALS[i] != 0; ++i ) {
+        apr_signal( FORWARD_SIGNALS[i], &forward_signal );
+    }
+    apr_signal( SIGCHLD, &child_signal );
+
+    int is_child = 0;
+    for( i = 0; ( i < _worker_count ) && !_stopping; ++i ) {
+        rv = start_worker( &_workers[i], argc, argv, &is_child );
+        if( is_child || ( rv != APR_SUCCESS ) ) break;
+    }
+    if( is_child ) return rv;
+
+    if( rv != APR_SUCCESS ) {
+        _stopping = 1;
+        forward_signal( SIGTERM );
+    }
+
+    while( 1 ) {
+        reap_workers();
+
+        int running = 0;
+        apr_time_t now = apr_time_now();
+        apr_time_t next = now + apr_time_from_sec( 1 );
+
+        for( i = 0; i < _worker_count; ++i ) {
+            worker_t *w = &_workers[i];
+            if( ( w->pid == 0 ) && !_stopping && ( w->restart_at <= now ) ) {
+                apr_status_t srv = start_worker( w, argc, argv, &is_child );
+                if( is_child ) return srv;
+                if( srv != APR_SUCCESS ) {
+                    w->restart_at = now + apr_time_from_sec( BACKOFF_MAX );
+                }
+            }
+            if( w->pid != 0 ) {
+                ++running;
+            }
+            else if( !_stopping && ( w->restart_at < next ) ) {
+                next = w->restart_at;
+            }
+        }
+
+        if( _stopping && ( running == 0 ) ) break;
+
+        // Sleep until the next restart is due; SIGCHLD or a forwarded
+        // signal interrupts this early.
+        if( next > now ) {
+            apr_interval_time_t wait = next - now;
+            struct timespec ts;
+            ts.tv_sec  = (time_t) apr_time_sec( wait );
+            ts.tv_nsec = (long) ( apr_time_usec( wait ) * 1000 );
+            nanosleep( &ts, NULL );
+        }
+    }
+
+    DEBUG( "All workers stopped." );
+
+    return rv;
+}
+
+static apr_status_t
+resolve_workers( apr_array_header_t *cpus )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    const char *val = NULL;
+    rv = get_property_value( "hashdot.workers", 0, 1, &val );
+    if( rv != APR_SUCCESS ) return rv;
+
+    if( strcmp( val, "auto" ) == 0 ) {
+        _worker_count = ( cpus != NULL ) ? cpus->nelts :
+            (int) sysconf( _SC_NPROCESSORS_ONLN );
+    }
+    else {
+        char *end = NULL;
+        long count = strtol( val, &end, 10 );
+        _worker_count = ( ( end != val ) && ( *end == '\0' ) &&
+                          ( count <= MAX_WORKERS ) ) ? (int) count : 0;
+    }
+    if( _worker_count < 1 ) {
+        rv = 33;
+        ERROR( "[%d]: Invalid hashdot.workers [%s] (1-%d or auto).",
+               rv, val, MAX_WORKERS );
+        return rv;
+    }
+
+    const char *pfile_name = NULL;
+    rv = get_property_value( "hashdot.pid_file", 0, 0, &pfile_name );
+    if( rv != APR_SUCCESS ) return rv;
+
+    _workers = apr_pcalloc( _mp, _worker_count * sizeof( worker_t ) );
+    for( i = 0; i < _worker_count; ++i ) {
+        _workers[i].index = i;
+        _workers[i].node = -1;
+        if( pfile_name != NULL ) {
+            _workers[i].pid_fname = apr_psprintf( _mp, "%s.%d",
+                                                  pfile_name, i );
+        }
+    }
+
+    const char *flag = NULL;
+    rv = get_property_value( "hashdot.workers.affinity", 0, 0, &flag );
+    if( rv != APR_SUCCESS ) return rv;
+    if( ( flag != NULL ) && ( strcmp( flag, "false" ) == 0 ) ) {
+        return rv;
+    }
+    if( cpus == NULL ) {
+        DEBUG( "CPU affinity not supported, workers not placed." );
+        return rv;
+    }
+
+    flag = NULL;
+    rv = get_property_value( "hashdot.workers.numa", 0, 0, &flag );
+    if( rv != APR_SUCCESS ) return rv;
+
+    worker_t **members = apr_palloc( _mp,
+                                     _worker_count * sizeof( worker_t * ) );
+
+    apr_array_header_t *nodes = NULL;
+    if( ( flag != NULL ) && ( strcmp( flag, "true" ) == 0 ) ) {
+        nodes = read_cpu_list( "/sys/devices/system/node/online", NULL );
+        if( nodes == NULL ) {
+            WARN( "No NUMA nodes found, ignoring hashdot.workers.numa." );
+        }
+    }
+
+    if( nodes != NULL ) {
+        // Skip nodes with none of our CPUs, then deal the workers to
+        // nodes round robin and split each node's CPUs among its own.
+        apr_array_header_t *node_cpus =
+            apr_array_make( _mp, nodes->nelts,
+                            sizeof( apr_array_header_t * ) );
+        apr_array_header_t *node_ids =
+            apr_array_make( _mp, nodes->nelts, sizeof( int ) );
+
+        for( i = 0; i < nodes->nelts; ++i ) {
+            int node = ((int *) nodes->elts)[i];
+            apr_array_header_t *ncpus =
+                read_cpu_list( apr_psprintf( _mp,
+                    "/sys/devices/system/node/node%d/cpulist", node ),
+                               cpus );
+            if( ( ncpus != NULL ) && ( ncpus->nelts > 0 ) ) {
+                *(apr_array_header_t **) apr_array_push( node_cpus ) = ncpus;
+                *(int *) apr_array_push( node_ids ) = node;
+            }
+        }
+
+        int n;
+        for( n = 0; n < node_ids->nelts; ++n ) {
+            int count = 0;
+            for( i = n; i < _worker_count; i += node_ids->nelts ) {
+                _workers[i].node = ((int *) node_ids->elts)[n];
+                members[count++] = &_workers[i];
+            }
+            assign_cpus( members, count,
+                         ((apr_array_header_t **) node_cpus->elts)[n] );
+        }
+    }
+    else {
+        for( i = 0; i < _worker_count; ++i ) members[i] = &_workers[i];
+        assign_cpus( members, _worker_count, cpus );
+    }
+
+    return rv;
+}
+
+// Split cpus into contiguous, disjoint sets, one per member worker.
+// With fewer CPUs than workers, CPUs are shared round robin.
+static void
+assign_cpus( worker_t **members, int count, apr_array_header_t *cpus )
+{
+    int i, c;
+    int ncpus = cpus->nelts;
+
+    if( ( count > ncpus ) && ( count > 0 ) ) {
+        DEBUG( "More workers (%d) than CPUs (%d), sharing CPUs.",
+               count, ncpus );
+    }
+
+    for( i = 0; i < count; ++i ) {
+        int first = i * ncpus / count;
+        int last  = ( i + 1 ) * ncpus / count;
+        if( last <= first ) {
+            first = i % ncpus;
+            last = first + 1;
+        }
+        members[i]->cpus = apr_array_make( _mp, last - first, sizeof( int ) );
+        for( c = first; c < last; ++c ) {
+            *(int *) apr_array_push( members[i]->cpus ) =
+                ((int *) cpus->elts)[c];
+        }
+    }
+}
+
+// Return the CPUs this process may run on, or NULL if unknown.
+static apr_array_header_t *
+available_cpus()
+{
+#ifdef __linux__
+    cpu_set_t set;
+    if( sched_getaffinity( 0, sizeof( set ), &set ) == 0 ) {
+        apr_array_header_t *cpus =
+            apr_array_make( _mp, CPU_COUNT( &set ), sizeof( int ) );
+        int cpu;
+        for( cpu = 0; cpu < CPU_SETSIZE; ++cpu ) {
+            if( CPU_ISSET( cpu, &set ) ) {
+                *(int *) apr_array_push( cpus ) = cpu;
+            }
+        }
+        return cpus;
+    }
+#endif
+    return NULL;
+}
+
+// Read a kernel list file such as "0-3,8-11", returning its members
+// that are also in filter (if not NULL), or NULL if unreadable.
+static apr_array_header_t *
+read_cpu_list( const char *fname, apr_array_header_t *filter )
+{
+    apr_file_t *in = NULL;
+    char line[4096];
+
+    if( apr_file_open( &in, fname, APR_READ, APR_OS_DEFAULT, _mp )
+        != APR_SUCCESS ) {
+        return NULL;
+    }
+    apr_status_t rv = apr_file_gets( line, sizeof( line ), in );
+    apr_file_close( in );
+    if( rv != APR_SUCCESS ) return NULL;
+
+    apr_array_header_t *list = apr_array_make( _mp, 16, sizeof( int ) );
+    char *last = NULL;
+    char *range = apr_strtok( line, ",\n", &last );
+    while( range != NULL ) {
+        int lo = atoi( range );
+        int hi = lo;
+        char *dash = strchr( range, '-' );
+        if( dash != NULL ) hi = atoi( dash + 1 );
+
+        int n, f;
+        for( n = lo; n <= hi; ++n ) {
+            int keep = ( filter == NULL );
+            for( f = 0; !keep && ( f < filter->nelts ); ++f ) {
+                keep = ( ((int *) filter->elts)[f] == n );
+            }
+            if( keep ) *(int *) apr_array_push( list ) = n;
+        }
+        range = apr_strtok( NULL, ",\n", &last );
+    }
+
+    return list;
+}
+
+static apr_status_t
+start_worker( worker_t *w, int argc, const char *argv[], int *is_child )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    // Hold signals until the child has reset its handlers.
+    sigset_t all, old;
+    sigfillset( &all );
+    sigprocmask( SIG_BLOCK, &all, &old );
+
+    // Flush so buffered output isn't duplicated in the child
+    fflush( stdout );
+    fflush( stderr );
+
+    pid_t pid = fork();
+    if( pid < 0 ) {
+        rv = APR_FROM_OS_ERROR( errno );
+        ERROR( "Could not fork worker %d.", w->index );
+    }
+    else if( pid == 0 ) {
+        *is_child = 1;
+        for( i = 0; FORWARD_SIGNALS[i] != 0; ++i ) {
+            apr_signal( FORWARD_SIGNALS[i], SIG_DFL );
+        }
+        apr_signal( SIGCHLD, SIG_DFL );
+        sigprocmask( SIG_SETMASK, &old, NULL );
+
+        rv = init_worker( w );
+        if( rv == APR_SUCCESS ) {
+            rv = init_jvm( argc, argv );
+        }
+        return rv;
+    }
+    else {
+        w->pid = pid;
+        w->started = apr_time_now();
+        DEBUG( "Started worker %d as pid %d.", w->index, (int) pid );
+    }
+
+    sigprocmask( SIG_SETMASK, &old, NULL );
+
+    return rv;
+}
+
+// In the forked child: set worker properties, pid file and placement.
+static apr_status_t
+init_worker( worker_t *w )
+{
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+
+    set_property_value( "hashdot.worker.index",
+                        apr_psprintf( _mp, "%d", w->index ) );
+
+    // The supervisor keeps its own pid file lock. Each worker gets
+    // hashdot.pid_file suffixed with its index.
+    if( w->pid_fname != NULL ) {
+        release_pid_file();
+        set_property_value( "hashdot.pid_file", w->pid_fname );
+        rv = lock_pid_file();
+    }
+
+#ifdef __linux__
+    if( ( rv == APR_SUCCESS ) && ( w->cpus != NULL ) ) {
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        for( i = 0; i < w->cpus->nelts; ++i ) {
+            CPU_SET( ((int *) w->cpus->elts)[i], &set );
+        }
+        if( sched_setaffinity( 0, sizeof( set ), &set ) != 0 ) {
+            WARN( "Could not set CPU affinity of worker %d.", w->index );
+        }
+        DEBUG( "Worker %d on %d CPU(s) from %d, node %d.", w->index,
+               w->cpus->nelts, ((int *) w->cpus->elts)[0], w->node );
+    }
+
+    if( ( rv == APR_SUCCESS ) && ( w->node >= 0 ) ) {
+        unsigned long mask[16];
+        memset( mask, 0, sizeof( mask ) );
+        int bits = 8 * sizeof( mask[0] );
+        if( w->node < (int) ( 16 * bits ) ) {
+            mask[ w->node / bits ] = 1UL << ( w->node % bits );
+            if( syscall( SYS_set_mempolicy, MPOL_PREFERRED, mask,
+                         (unsigned long) ( 16 * bits ) ) != 0 ) {
+                WARN( "Could not prefer NUMA node %d for worker %d.",
+                      w->node, w->index );
+            }
+        }
+    }
+#endif
+
+    return rv;
+}
+
+// Collect exited workers and schedule their restart.
+static void
+reap_workers()
+{
+    int status = 0;
+    pid_t pid;
+
+    while( ( pid = waitpid( -1, &status, WNOHANG ) ) > 0 ) {
+        int i;
+        for( i = 0; i < _worker_count; ++i ) {
+            worker_t *w = &_workers[i];
+            if( w->pid != pid ) continue;
+
+            w->pid = 0;
+            apr_time_t now = apr_time_now();
+
+            // Left behind if the worker was killed.
+            if( w->pid_fname != NULL ) {
+                apr_file_remove( w->pid_fname, _mp );
+            }
+
+            if( WIFSIGNALED( status ) ) {
+                if( !_stopping ) {
+                    WARN( "Worker %d (pid %d) killed by signal %d.",
+                          w->index, (int) pid, WTERMSIG( status ) );
+                }
+            }
+            else if( !_stopping ) {
+                WARN( "Worker %d (pid %d) exited with status %d.",
+                      w->index, (int) pid, WEXITSTATUS( status ) );
+            }
+
+            if( ( now - w->started ) >= apr_time_from_sec( STABLE_SECS ) ) {
+                w->failures = 0;
+            }
+            int delay = BACKOFF_MIN;
+            int f;
+            for( f = 0; ( f < w->failures ) && ( delay < BACKOFF_MAX ); ++f ) {
+                delay *= 2;
+            }
+            if( delay > BACKOFF_MAX ) delay = BACKOFF_MAX;
+            ++w->failures;
+
+            w->restart_at = now + apr_time_from_sec( delay );
+            if( !_stopping ) {
+                DEBUG( "Restarting worker %d in %ds.", w->index, delay );
+            }
+        }
+    }
+}
+
+static void
+forward_signal( int signo )
+{
+    int i;
+
+    if( ( signo == SIGTERM ) || ( signo == SIGINT ) ) {
+        _stopping = 1;
+    }
+
+    for( i = 0; i < _worker_count; ++i ) {
+        pid_t pid = _workers[i].pid;
+        if( pid > 0 ) kill( pid, signo );
+    }
+}
+
+static void
+child_signal( int signo )
+{
+    // Only to interrupt the supervisor's sleep.
+}